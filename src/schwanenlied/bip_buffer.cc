@@ -244,4 +244,24 @@ void BipBuffer::linearize() {
   b_size_ = 0;
 }
 
+void BipBuffer::resize(const size_t sz) {
+  SL_ASSERT(reserve_offset_ == 0);
+  SL_ASSERT(reserve_size_ == 0);
+  SL_ASSERT(sz >= size());
+
+  if (sz == buffer_size_)
+    return;
+
+  ::std::unique_ptr<uint8_t[]> buffer(new uint8_t[sz]);
+  ::std::memset(buffer.get(), 0, sz);
+  const size_t data_size = size();
+  copy(buffer.get(), data_size);
+
+  buffer_.swap(buffer);
+  buffer_size_ = sz;
+  a_offset_ = 0;
+  a_size_ = data_size;
+  b_size_ = 0;
+}
+
 } // namespace schwanenlied
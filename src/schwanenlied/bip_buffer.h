@@ -49,7 +49,8 @@ namespace schwanenlied {
  * - The Bi-partite nature of the buffer can entirely be ignored if
  *   push_back(), pop_front(), and copy() are used exclusively (peek(),
  *   reserve() and commit() require understanding of how a Bip-Buffer works).
- * - The backing store is allocated at object construction time
+ * - The backing store is allocated at object construction time, and is only
+ *   reallocated by resize()
  */
 class BipBuffer {
  public:
@@ -172,6 +173,19 @@ class BipBuffer {
    * @todo Avoid using a temporary buffer
    */
   void linearize();
+
+  /**
+   * Change the capacity of the backing store
+   *
+   * The data is copied to a new backing store (linearized), so this
+   * invalidates any pointers previously returned from peek() or reserve().
+   *
+   * @warning This routine will cause an assertion if it is called with a
+   * reservation pending, or if the data does not fit in the new capacity.
+   *
+   * @param[in] sz The new size of the BipBuffer
+   */
+  void resize(const size_t sz);
   /** @} */
 
  private:
@@ -180,7 +194,7 @@ class BipBuffer {
   void operator=(const BipBuffer&) = delete;
 
   ::std::unique_ptr<uint8_t[]> buffer_; /**< The backing store */
-  const size_t buffer_size_;            /**< Size of the backing store */
+  size_t buffer_size_;                  /**< Size of the backing store */
 
   size_t a_offset_;       /**< Offset of the "A" buffer */
   size_t a_size_;         /**< Size of the "A" buffer */
@@ -191,4 +191,45 @@ TEST_F(BipBufferTest, LinearizeTest) {
   ASSERT_EQ(0, ::std::memcmp(test_data_.data(), ptr + 1000, 24));
 }
 
+// Test growing and shrinking the backing store
+TEST_F(BipBufferTest, ResizeTest) {
+  BipBuffer buf(kTestBufferSz);
+
+  // Make the buffer look like | B | Blank space | A | Blank space |
+  size_t sz = buf.push_back(test_data_.data(), 1000);
+  ASSERT_EQ(1000, sz);
+  buf.pop_front(900);
+  sz = buf.push_back(test_data_.data() + 1000, 24);
+  ASSERT_EQ(24, sz);
+  sz = buf.push_back(test_data_.data(), 64);
+  ASSERT_EQ(64, sz);
+  const uint8_t* ptr = buf.peek(sz);
+  ASSERT_EQ(100, sz);
+
+  // Grow, which linearizes the contents
+  buf.resize(2 * kTestBufferSz);
+  ASSERT_TRUE(2 * kTestBufferSz == buf.max_size());
+  ASSERT_EQ(188, buf.size());
+  ptr = buf.peek(sz);
+  ASSERT_EQ(188, sz);
+  ASSERT_EQ(0, ::std::memcmp(test_data_.data() + 900, ptr, 124));
+  ASSERT_EQ(0, ::std::memcmp(test_data_.data(), ptr + 124, 64));
+
+  // The new space is usable
+  sz = buf.push_back(test_data_.data(), kTestBufferSz);
+  ASSERT_TRUE(kTestBufferSz == sz);
+  buf.pop_front(188 + 1000);
+  ASSERT_EQ(24, buf.size());
+
+  // Shrink down to a size that still holds the data
+  buf.resize(64);
+  ASSERT_EQ(64, buf.max_size());
+  ptr = buf.peek(sz);
+  ASSERT_EQ(24, sz);
+  ASSERT_EQ(0, ::std::memcmp(test_data_.data() + 1000, ptr, 24));
+  sz = buf.push_back(test_data_.data(), 64);
+  ASSERT_EQ(40, sz);
+  ASSERT_EQ(0, buf.max_size() - buf.size());
+}
+
 } // namespace schwanenlied
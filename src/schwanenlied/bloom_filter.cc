@@ -33,24 +33,39 @@
 
 #include <cmath>
 #include <cstring>
+#include <utility>
 
 #include <alloca.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "schwanenlied/bloom_filter.h"
+#include "schwanenlied/crypto/utils.h"
 
 namespace schwanenlied {
 
 static const double ln_2 = 0.69314718055994529;     // ln(2)
 static const double ln_2_sq = 0.48045301391820139;  // ln(2) ^ 2
 
+const uint8_t BloomFilter::kStateMagic[8] = {
+  'S', 'L', 'B', 'L', 'O', 'O', 'M', '1'
+};
+
 BloomFilter::BloomFilter(crypto::Random& rng,
                          const size_t m_ln2,
                          const double p) :
     hash_(rng),
     nr_hashes_(0),
-    nr_entries_(0),
     nr_entries_max_(0),
-    hash_mask_(0) {
+    hash_mask_(0),
+    m_ln2_(m_ln2),
+    cache_len_(0),
+    header_(nullptr),
+    active_1_(nullptr),
+    active_2_(nullptr),
+    map_(nullptr) {
   SL_ASSERT(m_ln2 <= kMaxMLn2);
 
   // Derive the number of entries and number of hashes
@@ -61,9 +76,23 @@ BloomFilter::BloomFilter(crypto::Random& rng,
     nr_hashes_ = 2; // Use at least 2 hashes
   SL_ASSERT(nr_hashes_ <= kMaxNrHashes);
   hash_mask_ = m - 1;
+  cache_len_ = m >> 3;
+
+  // Allocate and initialize the state region
+  const size_t len = sizeof(StateHeader) + 2 * cache_len_;
+  storage_.resize((len + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+  set_state(reinterpret_cast<uint8_t*>(&storage_[0]));
+  ::std::memcpy(header_->magic_, kStateMagic, sizeof(kStateMagic));
+  header_->m_ln2_ = static_cast<uint32_t>(m_ln2_);
+  header_->nr_hashes_ = static_cast<uint32_t>(nr_hashes_);
+  ::std::memcpy(header_->key_, hash_.key().data(), sizeof(header_->key_));
+}
 
-  active_1_.resize(m >> 3);
-  active_2_.resize(m >> 3);
+BloomFilter::~BloomFilter() {
+  if (map_ != nullptr)
+    ::munmap(map_, sizeof(StateHeader) + 2 * cache_len_);
+  else
+    crypto::memwipe(header_->key_, sizeof(header_->key_));
 }
 
 bool BloomFilter::test(const void* buf,
@@ -82,7 +111,7 @@ bool BloomFilter::test(const void* buf,
      * A2Buffering semantics.
      */
     add_cache_active_1(hashes);
-    if (++nr_entries_ > nr_entries_max_)
+    if (++header_->nr_entries_ > nr_entries_max_)
       flip_cache(hashes);
     return true;
   }
@@ -113,12 +142,96 @@ bool BloomFilter::test_and_set(const void* buf,
   add_cache_active_1(hashes);
 
   // if active1 is full then
-  if (++nr_entries_ > nr_entries_max_)
+  if (++header_->nr_entries_ > nr_entries_max_)
     flip_cache(hashes);
 
   return ret;
 }
 
+void BloomFilter::export_state(crypto::SecureBuffer& state) const {
+  const uint64_t nr_entries = header_->nr_entries_;
+
+  state = hash_.key();
+  state.append(reinterpret_cast<const uint8_t*>(&nr_entries),
+               sizeof(nr_entries));
+  state.append(active_1_, cache_len_);
+  state.append(active_2_, cache_len_);
+}
+
+bool BloomFilter::import_state(const uint8_t* state,
+                               const size_t len) {
+  const size_t hdr_len = crypto::SipHash::kKeyLength + sizeof(uint64_t);
+  if (len != hdr_len + 2 * cache_len_)
+    return false;
+
+  uint64_t nr_entries;
+  ::std::memcpy(&nr_entries, state + crypto::SipHash::kKeyLength,
+                sizeof(nr_entries));
+  if (nr_entries > nr_entries_max_)
+    return false;
+
+  hash_.set_key(state, crypto::SipHash::kKeyLength);
+  ::std::memcpy(header_->key_, state, sizeof(header_->key_));
+  header_->nr_entries_ = nr_entries;
+  state += hdr_len;
+  ::std::memcpy(active_1_, state, cache_len_);
+  ::std::memcpy(active_2_, state + cache_len_, cache_len_);
+
+  return true;
+}
+
+int BloomFilter::map_file(const char* path) {
+  const size_t len = sizeof(StateHeader) + 2 * cache_len_;
+
+  const int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return kErrorBadFD;
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size < 0) {
+    ::close(fd);
+    return kErrorBadFD;
+  }
+  const bool resized = static_cast<size_t>(st.st_size) != len;
+  if (resized && ::ftruncate(fd, len) != 0) {
+    ::close(fd);
+    return kErrorBadFD;
+  }
+  void* map = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED)
+    return kErrorBadFD;
+
+  // Adopt the file's state if it is from a compatible Bloom Filter
+  const StateHeader* hdr = static_cast<const StateHeader*>(map);
+  const bool compatible = !resized &&
+      ::std::memcmp(hdr->magic_, kStateMagic, sizeof(kStateMagic)) == 0 &&
+      hdr->m_ln2_ == m_ln2_ &&
+      hdr->nr_hashes_ == static_cast<uint32_t>(nr_hashes_) &&
+      hdr->nr_entries_ <= nr_entries_max_ &&
+      hdr->active_ <= 1;
+  if (!compatible)
+    ::std::memcpy(map, header_, len);
+
+  // Switch over to the mapping
+  if (map_ != nullptr)
+    ::munmap(map_, len);
+  else
+    crypto::memwipe(header_->key_, sizeof(header_->key_));
+  storage_.clear();
+  storage_.shrink_to_fit();
+  map_ = map;
+  set_state(static_cast<uint8_t*>(map));
+  if (compatible)
+    hash_.set_key(header_->key_, sizeof(header_->key_));
+
+  return kErrorOk;
+}
+
+void BloomFilter::sync() {
+  if (map_ != nullptr)
+    ::msync(map_, sizeof(StateHeader) + 2 * cache_len_, MS_SYNC);
+}
+
 const size_t BloomFilter::calculate_n(const size_t m_ln2,
                                       const double p) {
   SL_ASSERT(m_ln2 > 0);
@@ -174,7 +287,7 @@ const inline void BloomFilter::get_hashes(uint32_t* hashes,
     hashes[i] = hashes[0] + i * hashes[1];
 }
 
-const inline bool BloomFilter::test_cache(const std::vector<uint8_t>& cache,
+const inline bool BloomFilter::test_cache(const uint8_t* cache,
                                           const uint32_t* hashes) const {
   for (int i = 0; i < nr_hashes_; i++) {
     uint32_t idx = hashes[i] & hash_mask_;
@@ -193,14 +306,22 @@ inline void BloomFilter::add_cache_active_1(const uint32_t* hashes) {
 
 inline void BloomFilter::flip_cache(const uint32_t* hashes) {
   // flush active2
-  ::std::memset(&active_2_[0], 0, active_2_.size());
+  ::std::memset(active_2_, 0, cache_len_);
 
   // switch active1 and 2
-  active_1_.swap(active_2_);
+  ::std::swap(active_1_, active_2_);
+  header_->active_ ^= 1;
 
   // insert x into active1
   add_cache_active_1(hashes);
-  nr_entries_ = 1;
+  header_->nr_entries_ = 1;
+}
+
+void BloomFilter::set_state(uint8_t* state) {
+  header_ = reinterpret_cast<StateHeader*>(state);
+  uint8_t* caches = state + sizeof(StateHeader);
+  active_1_ = caches + header_->active_ * cache_len_;
+  active_2_ = caches + (header_->active_ ^ 1) * cache_len_;
 }
 
 } // namespace schwanenlied
@@ -65,6 +65,9 @@ namespace schwanenlied {
  *   Bloom Filter is constant time.  It does attempt to defend itself against
  *   people feeding crafted data by randomizing the SipHash-2-4 key per
  *   instance and by using a cryptographic PRF.
+ * - The state (SipHash-2-4 key, entry count and both caches) lives in a single
+ *   region that can optionally be a shared mapping of a file (map_file()), so
+ *   that replay protection survives a restart.
  */
 class BloomFilter {
  public:
@@ -90,11 +93,15 @@ class BloomFilter {
               const size_t m_ln2,
               const double p);
 
+  ~BloomFilter();
+
   /** @{ */
   /** Return the size of each cache in bytes. */
-  const size_t size() const { return active_1_.size(); }
+  const size_t size() const { return cache_len_; }
   /** Return the maximum number of entries per cache */
   const size_t nr_entries_max() const { return nr_entries_max_; }
+  /** Return if the Bloom Filter is backed by a file */
+  bool is_mapped() const { return map_ != nullptr; }
   /** @} */
 
   /** @{ */
@@ -127,6 +134,56 @@ class BloomFilter {
                     const size_t len);
   /** @} */
 
+  /** @{ */
+  /**
+   * Serialize the Bloom Filter (The SipHash key, and both caches)
+   *
+   * @param[out] state The SecureBuffer where the state will be stored
+   */
+  void export_state(crypto::SecureBuffer& state) const;
+
+  /**
+   * Restore the state of a Bloom Filter with the same size and false positive
+   * rate, serialized via export_state()
+   *
+   * @param[in] state A pointer to the state
+   * @param[in] len   The length of the state
+   *
+   * @returns true  - Success
+   * @returns false - The state was not produced by a compatible Bloom Filter
+   */
+  bool import_state(const uint8_t* state,
+                    const size_t len);
+
+  /**
+   * Back the Bloom Filter with a shared mapping of a file
+   *
+   * If the file holds the state of a Bloom Filter with the same size and
+   * false positive rate, that state is adopted, otherwise the file is
+   * (re)initialized with the current state.  Updates are not explicitly
+   * written back, so the contents survive the process exiting (or crashing)
+   * but not necessarily the host doing so (See sync()).
+   *
+   * @warning The file contains the SipHash-2-4 key, and must not be mapped by
+   * more than one Bloom Filter that is in active use at a time.
+   *
+   * @param[in] path The path to the file (Created with mode 0600 if needed)
+   *
+   * @returns kErrorOk    - Success
+   * @returns kErrorBadFD - The file could not be opened, resized or mapped
+   *                        (The Bloom Filter is left untouched)
+   */
+  int map_file(const char* path);
+
+  /**
+   * Synchronously write the state back to the backing file (if any)
+   *
+   * This is intended for orderly shutdown, and should not be called from the
+   * packet processing path.
+   */
+  void sync();
+  /** @} */
+
   /** @{ */
   /**
    * Calculate the number of entries that will fit in a Bloom Filter given size
@@ -191,7 +248,7 @@ class BloomFilter {
    * @returns true - The entry **may** be present
    * @returns false - The entry is **not** present
    */
-  const inline bool test_cache(const ::std::vector<uint8_t>& cache,
+  const inline bool test_cache(const uint8_t* cache,
                                const uint32_t* hashes) const;
 
   /**
@@ -209,13 +266,38 @@ class BloomFilter {
    */
   inline void flip_cache(const uint32_t* hashes);
 
+  /**
+   * Point header_, active_1_ and active_2_ into a state region.
+   *
+   * @param[in] state The state region (StateHeader followed by 2 caches)
+   */
+  void set_state(uint8_t* state);
+
+  /** The header at the start of the state region */
+  struct StateHeader {
+    uint8_t magic_[8];    /**< kStateMagic */
+    uint32_t m_ln2_;      /**< The size of each cache in bits as a power of 2 */
+    uint32_t nr_hashes_;  /**< The number of hash functions */
+    uint8_t key_[crypto::SipHash::kKeyLength];  /**< The SipHash-2-4 key */
+    uint64_t nr_entries_; /**< Number of entries currently in "Active 1" */
+    uint32_t active_;     /**< The index of the "Active 1" cache (0/1) */
+    uint32_t reserved_;   /**< Reserved (0) */
+  };
+
+  /** The magic at the start of the state region */
+  static const uint8_t kStateMagic[8];
+
   crypto::SipHash hash_;  /**< The crypto::SipHash instance */
   int nr_hashes_;         /**< Number of hash functions used to query ("k") */
-  size_t nr_entries_;     /**< Number of entries currently in active_1_ */
   size_t nr_entries_max_; /**< Maximum number of entries in each cache ("n") */
   uint32_t hash_mask_;    /**< Bitmask used to truncate the hash output */
-  ::std::vector<uint8_t> active_1_; /**< The "Active 1" cache */
-  ::std::vector<uint8_t> active_2_; /**< The "Active 2" cache */
+  size_t m_ln2_;          /**< The size of each cache in bits as a power of 2 */
+  size_t cache_len_;      /**< The size of each cache in bytes */
+  StateHeader* header_;   /**< The state header (Includes the entry count) */
+  uint8_t* active_1_;     /**< The "Active 1" cache */
+  uint8_t* active_2_;     /**< The "Active 2" cache */
+  ::std::vector<uint64_t> storage_; /**< The state region (If not mapped) */
+  void* map_;             /**< The state region (If mapped) */
 };
 
 } // namespace schwanenlied
@@ -27,8 +27,11 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cstdlib>
 #include <string>
 
+#include <unistd.h>
+
 #include "schwanenlied/bloom_filter.h"
 #include "schwanenlied/crypto/random.h"
 #include "gtest/gtest.h"
@@ -87,4 +90,72 @@ TEST_F(BloomFilterTest, SmokeTest) {
   ASSERT_TRUE(ret);
 }
 
+TEST_F(BloomFilterTest, ExportImport) {
+  crypto::Random rng;
+  BloomFilter bf(rng, 10, 0.01);
+  uint32_t buf[64];
+
+  for (size_t i = 0; i < 64; i++) {
+    buf[i] = rng.get_uint32();
+    bf.test_and_set(&buf[i], sizeof(uint32_t));
+  }
+
+  crypto::SecureBuffer state;
+  bf.export_state(state);
+
+  // A fresh filter (with a different key) knows about everything
+  BloomFilter bf2(rng, 10, 0.01);
+  ASSERT_TRUE(bf2.import_state(state.data(), state.size()));
+  for (size_t i = 0; i < 64; i++) {
+    ASSERT_TRUE(bf2.test(&buf[i], sizeof(uint32_t)));
+  }
+
+  // Filters of a different size are rejected
+  BloomFilter bf3(rng, 11, 0.01);
+  ASSERT_FALSE(bf3.import_state(state.data(), state.size()));
+  ASSERT_FALSE(bf2.import_state(state.data(), state.size() - 1));
+}
+
+TEST_F(BloomFilterTest, MapFile) {
+  crypto::Random rng;
+  uint32_t buf[212];
+  char path[] = "/tmp/bloom_filter_XXXXXX";
+  ::close(::mkstemp(path));
+
+  for (size_t i = 0; i < 212; i++)
+    buf[i] = rng.get_uint32();
+
+  // Fill a filter past a flip, with the first half in memory
+  {
+    BloomFilter bf(rng, 10, 0.01);
+    for (size_t i = 0; i < 106; i++)
+      bf.test_and_set(&buf[i], sizeof(uint32_t));
+    ASSERT_FALSE(bf.is_mapped());
+    ASSERT_EQ(kErrorBadFD, bf.map_file("/nonexistent/bloom_filter"));
+    ASSERT_EQ(kErrorOk, bf.map_file(path));
+    ASSERT_TRUE(bf.is_mapped());
+    for (size_t i = 106; i < 212; i++)
+      bf.test_and_set(&buf[i], sizeof(uint32_t));
+  }
+
+  // A new filter (with a different key) picks up where the old one left off
+  {
+    BloomFilter bf(rng, 10, 0.01);
+    ASSERT_EQ(kErrorOk, bf.map_file(path));
+    for (size_t i = 106; i < 212; i++)
+      ASSERT_TRUE(bf.test(&buf[i], sizeof(uint32_t)));
+    ASSERT_TRUE(bf.test(&buf[0], sizeof(uint32_t)));
+  }
+
+  // A filter of a different size starts over
+  {
+    BloomFilter bf(rng, 11, 0.01);
+    ASSERT_EQ(kErrorOk, bf.map_file(path));
+    for (size_t i = 0; i < 212; i++)
+      ASSERT_FALSE(bf.test(&buf[i], sizeof(uint32_t)));
+  }
+
+  ::unlink(path);
+}
+
 } // namespace schwanenlied
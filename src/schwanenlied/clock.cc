@@ -0,0 +1,99 @@
+/**
+ * @file    clock.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Clock/Timer source abstraction (IMPLEMENTATION)
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdlib>
+
+#include "schwanenlied/clock.h"
+#include "schwanenlied/timer.h"
+
+namespace schwanenlied {
+
+Clock& Clock::system() {
+  // Leaked on purpose, Timers may outlive static destruction
+  static SystemClock* clock = new SystemClock();
+  return *clock;
+}
+
+SystemClock::SystemClock(uv_loop_t* loop) :
+    loop_(loop) {
+  SL_ASSERT(loop_ != nullptr);
+}
+
+void* SystemClock::timer_create(Timer& timer) {
+  uv_timer_t* handle = reinterpret_cast<uv_timer_t*>(::std::calloc(1, sizeof(*handle)));
+  SL_ASSERT(handle != nullptr);
+
+  uv_timer_init(loop_, handle);
+  handle->data = &timer;
+
+  return handle;
+}
+
+void SystemClock::timer_destroy(void* handle) {
+  uv_handle_t* t_handle = reinterpret_cast<uv_handle_t*>(handle);
+
+  // Stop the timer if it is pending
+  if (uv_is_active(t_handle))
+    uv_timer_stop(reinterpret_cast<uv_timer_t*>(handle));
+
+  // Handle defered timer cleanup with a lambda
+  uv_close_cb close_cb = [](uv_handle_t* handle) {
+    free(handle);
+  };
+  uv_close(t_handle, close_cb);
+}
+
+bool SystemClock::timer_start(void* handle,
+                              const ::std::chrono::milliseconds& delta_t) {
+  // Gratuitous use of yet another lambda to call the timer callback
+  uv_timer_cb timer_cb = [](uv_timer_t* handle, int status) {
+    // Does status ever hold anything important?
+    reinterpret_cast<Timer*>(handle->data)->fire();
+  };
+  int ret = uv_timer_start(reinterpret_cast<uv_timer_t*>(handle), timer_cb,
+                           delta_t.count(), 0);
+
+  return (ret == 0);
+}
+
+void SystemClock::timer_stop(void* handle) {
+  if (uv_is_active(reinterpret_cast<uv_handle_t*>(handle)))
+    uv_timer_stop(reinterpret_cast<uv_timer_t*>(handle));
+}
+
+bool SystemClock::timer_is_active(const void* handle) const {
+  return (0 != uv_is_active(reinterpret_cast<const uv_handle_t*>(handle)));
+}
+
+} // namespace schwanenlied
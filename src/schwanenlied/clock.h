@@ -0,0 +1,202 @@
+/**
+ * @file    clock.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Clock/Timer source abstraction
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_CLOCK_H__
+#define SCHWANENLIED_CLOCK_H__
+
+#include <chrono>
+
+#include <uv.h>
+
+#include "schwanenlied/common.h"
+
+namespace schwanenlied {
+
+class Timer;
+
+/**
+ * A source of monotonic time and Timers
+ *
+ * Everything in the library that cares about the passage of time (cookie
+ * expiration, Timers etc) goes through a Clock, so that the application can
+ * substitute virtual time (Eg: SimClock) for the real thing.  The default is
+ * system(), which is ::std::chrono::steady_clock and the libuv default event
+ * loop.  Hot paths that read the time frequently should use a CachedClock.
+ *
+ * The time_point type is deliberately ::std::chrono::steady_clock's, so that
+ * existing deadlines do not need to change type.
+ */
+class Clock {
+ public:
+  /** A point in time */
+  typedef ::std::chrono::steady_clock::time_point time_point;
+  /** A span of time */
+  typedef ::std::chrono::steady_clock::duration duration;
+
+  virtual ~Clock() {}
+
+  /** Return the current time */
+  virtual time_point now() const = 0;
+
+  /** Return the process wide SystemClock instance */
+  static Clock& system();
+
+ protected:
+  Clock() = default;
+
+  // Timer backend, Timer calls these with the opaque handle from
+  // timer_create()
+  /** @{ */
+  /** Create the backend state for a Timer */
+  virtual void* timer_create(Timer& timer) = 0;
+  /** Destroy the backend state for a Timer */
+  virtual void timer_destroy(void* handle) = 0;
+  /** Schedule a Timer to fire after delta_t */
+  virtual bool timer_start(void* handle,
+                           const ::std::chrono::milliseconds& delta_t) = 0;
+  /** Cancel a scheduled Timer */
+  virtual void timer_stop(void* handle) = 0;
+  /** Return if a Timer is scheduled */
+  virtual bool timer_is_active(const void* handle) const = 0;
+  /** @} */
+
+ private:
+  Clock(const Clock&) = delete;
+  void operator=(const Clock&) = delete;
+
+  friend class Timer;
+  friend class CachedClock;
+};
+
+/**
+ * The real Clock
+ *
+ * Time is ::std::chrono::steady_clock, and Timers are run by a libuv event
+ * loop.
+ *
+ * @warning Like all libuv timers, Timers are relative to the loop's cached
+ * time, which is only refreshed when the loop runs.  Code that starts Timers
+ * after blocking outside of the loop should call uv_update_time() first.
+ */
+class SystemClock : public Clock {
+ public:
+  /**
+   * Construct a SystemClock
+   *
+   * @param[in] loop  The libuv event loop that runs the Timers
+   */
+  explicit SystemClock(uv_loop_t* loop = uv_default_loop());
+
+  /** Get the libuv event loop that runs the Timers */
+  uv_loop_t* loop() const { return loop_; }
+
+  time_point now() const override {
+    return ::std::chrono::steady_clock::now();
+  }
+
+ protected:
+  void* timer_create(Timer& timer) override;
+  void timer_destroy(void* handle) override;
+  bool timer_start(void* handle,
+                   const ::std::chrono::milliseconds& delta_t) override;
+  void timer_stop(void* handle) override;
+  bool timer_is_active(const void* handle) const override;
+
+ private:
+  uv_loop_t* loop_; /**< The event loop used for Timers */
+};
+
+/**
+ * A Clock that only reads the time when told to
+ *
+ * now() returns the time as of the last update(), which the application calls
+ * once per event loop iteration (Eg: From a uv_check_t/uv_prepare_t, or after
+ * each epoll_wait()/recvmmsg() batch).  Everything processed in between sees
+ * the same time, which saves repeated clock reads on the hot path, at the
+ * cost of the time being as stale as the longest iteration.
+ *
+ * Timers are passed through to the source Clock.
+ */
+class CachedClock : public Clock {
+ public:
+  /**
+   * Construct a CachedClock
+   *
+   * @param[in] source  The Clock that provides the time and Timers
+   */
+  explicit CachedClock(Clock& source) :
+      source_(source),
+      now_(source.now()) {}
+
+  time_point now() const override { return now_; }
+
+  /**
+   * Refresh the cached time from the source Clock
+   *
+   * @returns The new time
+   */
+  const time_point& update() {
+    now_ = source_.now();
+    return now_;
+  }
+
+  /** Get the source Clock */
+  Clock& source() const { return source_; }
+
+ protected:
+  void* timer_create(Timer& timer) override {
+    return source_.timer_create(timer);
+  }
+  void timer_destroy(void* handle) override {
+    source_.timer_destroy(handle);
+  }
+  bool timer_start(void* handle,
+                   const ::std::chrono::milliseconds& delta_t) override {
+    return source_.timer_start(handle, delta_t);
+  }
+  void timer_stop(void* handle) override {
+    source_.timer_stop(handle);
+  }
+  bool timer_is_active(const void* handle) const override {
+    return source_.timer_is_active(handle);
+  }
+
+ private:
+  Clock& source_;   /**< The source Clock */
+  time_point now_;  /**< The cached time */
+};
+
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_CLOCK_H__
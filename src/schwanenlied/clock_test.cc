@@ -0,0 +1,91 @@
+/*
+ * clock_test.cc: Clock tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "schwanenlied/clock.h"
+#include "schwanenlied/sim_clock.h"
+#include "schwanenlied/timer.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+
+class ClockTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {};
+  virtual void TearDown() {};
+};
+
+TEST_F(ClockTest, SystemClockLoop) {
+  uv_loop_t* loop = uv_loop_new();
+  ASSERT_NE(nullptr, loop);
+
+  // Timers run on the SystemClock's loop, not the default one
+  {
+    SystemClock clock(loop);
+    ASSERT_EQ(loop, clock.loop());
+    bool fired = false;
+    Timer t([&fired]() { fired = true; }, clock);
+    ASSERT_TRUE(t.start(::std::chrono::milliseconds(1)));
+    uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+    ASSERT_FALSE(fired);
+    uv_run(loop, UV_RUN_DEFAULT);
+    ASSERT_TRUE(fired);
+    ASSERT_FALSE(t.is_active());
+  }
+
+  // Let the deferred handle cleanup happen
+  uv_run(loop, UV_RUN_DEFAULT);
+  uv_loop_delete(loop);
+}
+
+TEST_F(ClockTest, CachedClock) {
+  SimClock source;
+  CachedClock clock(source);
+  ASSERT_EQ(&source, &clock.source());
+  const Clock::time_point start = clock.now();
+
+  // The time only changes on update()
+  source.schedule(::std::chrono::seconds(1), []() {});
+  source.run();
+  ASSERT_EQ(start, clock.now());
+  ASSERT_EQ(start + ::std::chrono::seconds(1), clock.update());
+  ASSERT_EQ(start + ::std::chrono::seconds(1), clock.now());
+
+  // Timers are passed through to the source
+  int fired = 0;
+  Timer t([&fired]() { fired++; }, clock);
+  ASSERT_TRUE(t.start(::std::chrono::milliseconds(10)));
+  ASSERT_TRUE(t.is_active());
+  ASSERT_EQ(1u, source.pending());
+  source.run();
+  ASSERT_EQ(1, fired);
+  ASSERT_FALSE(t.is_active());
+}
+
+} // namespace schwanenlied
@@ -111,6 +111,14 @@ class Blake2s {
    * continue to use the object.
    */
   void clear_key();
+
+  /**
+   * Return the key
+   *
+   * This exists so that keyed state can be handed off to another process
+   * (Eg: LodpEndpoint::export_state()), and should not be used otherwise.
+   */
+  const SecureBuffer& key() const { return key_; }
   /**@} */
 
   /** @{ */
@@ -46,9 +46,8 @@ namespace crypto {
  * a cryptographic PRNG.
  *
  * In theory this wrapper is unneccecary but this allows developers to switch
- * out the PRNG as needed.
- *
- * @todo This probably is better off as an abstract base class.
+ * out the PRNG as needed.  The generator methods are virtual so that test
+ * harnesses (Eg: lodp::LodpSimulator) can substitute a deterministic source.
  */
 class Random {
  public:
@@ -64,7 +63,7 @@ class Random {
   /**
    * Destroy the PRNG instance.
    */
-  ~Random();
+  virtual ~Random();
 
   /** @{ */
   /**
@@ -73,14 +72,14 @@ class Random {
    * @param[out] buf The buffer to fill
    * @param[in]  len The number of random bytes to generate
    */
-  void get_bytes(void* buf, const size_t len);
+  virtual void get_bytes(void* buf, const size_t len);
 
   /**
    * Generate a random 32 bit integer
    *
    * @return A random number between 0 and UINT_MAX inclusive
    */
-  uint32_t get_uint32();
+  virtual uint32_t get_uint32();
 
   /**
    * Generate a random 32 bit integer with an upper limit
@@ -88,7 +87,7 @@ class Random {
    * @param[in] max The upper limit
    * @return A random number between 0 and max
    */
-  uint32_t get_uint32_range(uint32_t max);
+  virtual uint32_t get_uint32_range(uint32_t max);
   /** @} */
 
  private:
@@ -0,0 +1,163 @@
+/**
+ * @file    secure_arena.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   mlock()ed Arena Allocator for Key Material (IMPLEMENTATION)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "schwanenlied/crypto/secure_arena.h"
+
+namespace schwanenlied {
+namespace crypto {
+
+const size_t SecureArena::kSmallSlotSize;
+const size_t SecureArena::kLargeSlotSize;
+const size_t SecureArena::kDefaultSlotCount;
+
+SecureArena::SecureArena(const size_t nr_slots) :
+    region_(nullptr),
+    region_len_(0),
+    base_(nullptr),
+    len_(0),
+    large_base_(nullptr),
+    locked_(false),
+    nr_slots_(nr_slots),
+    nr_in_use_(0),
+    small_free_(nullptr),
+    large_free_(nullptr) {
+  SL_ASSERT(nr_slots > 0);
+
+  const size_t page_sz = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  const size_t small_len = nr_slots * kSmallSlotSize;
+  const size_t large_len = nr_slots * kLargeSlotSize;
+  len_ = (small_len + large_len + page_sz - 1) & ~(page_sz - 1);
+  region_len_ = len_ + 2 * page_sz;
+
+  void* p = ::mmap(nullptr, region_len_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+  if (p == MAP_FAILED) {
+    // Every allocation will fall back to the heap.
+    region_ = nullptr;
+    region_len_ = len_ = 0;
+    return;
+  }
+  region_ = static_cast<uint8_t*>(p);
+  base_ = region_ + page_sz;
+  large_base_ = base_ + small_len;
+
+  // Open up everything but the guard pages.
+  int ret = ::mprotect(base_, len_, PROT_READ | PROT_WRITE);
+  SL_ASSERT(ret == 0);
+  locked_ = (::mlock(base_, len_) == 0);
+#ifdef MADV_DONTDUMP
+  ::madvise(base_, len_, MADV_DONTDUMP);
+#endif
+
+  init_free_list(small_free_, base_, kSmallSlotSize);
+  init_free_list(large_free_, large_base_, kLargeSlotSize);
+}
+
+SecureArena::~SecureArena() {
+  SL_ASSERT(nr_in_use_ == 0);
+
+  if (region_ != nullptr) {
+    if (locked_)
+      ::munlock(base_, len_);
+    ::munmap(region_, region_len_);
+  }
+}
+
+SecureArena& SecureArena::global() {
+  static SecureArena* arena = new SecureArena(kDefaultSlotCount);
+  return *arena;
+}
+
+void* SecureArena::allocate(const size_t len) {
+  FreeSlot** head;
+  if (len <= kSmallSlotSize)
+    head = &small_free_;
+  else if (len <= kLargeSlotSize)
+    head = &large_free_;
+  else
+    return nullptr;
+
+  ::std::lock_guard<::std::mutex> guard(lock_);
+
+  // Small requests spill over into the large slots rather than the heap.
+  if (*head == nullptr && head == &small_free_)
+    head = &large_free_;
+  FreeSlot* slot = *head;
+  if (slot == nullptr)
+    return nullptr;
+  *head = slot->next_;
+  nr_in_use_++;
+
+  return slot;
+}
+
+bool SecureArena::deallocate(void* p) {
+  if (!owns(p))
+    return false;
+
+  uint8_t* ptr = static_cast<uint8_t*>(p);
+  FreeSlot* slot = reinterpret_cast<FreeSlot*>(ptr);
+
+  ::std::lock_guard<::std::mutex> guard(lock_);
+
+  FreeSlot** head = (ptr < large_base_) ? &small_free_ : &large_free_;
+  slot->next_ = *head;
+  *head = slot;
+  SL_ASSERT(nr_in_use_ > 0);
+  nr_in_use_--;
+
+  return true;
+}
+
+size_t SecureArena::in_use() const {
+  ::std::lock_guard<::std::mutex> guard(lock_);
+  return nr_in_use_;
+}
+
+void SecureArena::init_free_list(FreeSlot*& head,
+                                 uint8_t* base,
+                                 const size_t slot_size) {
+  // Build the list back to front so that allocations walk up the region.
+  head = nullptr;
+  for (size_t i = nr_slots_; i > 0; i--) {
+    FreeSlot* slot = reinterpret_cast<FreeSlot*>(base + (i - 1) * slot_size);
+    slot->next_ = head;
+    head = slot;
+  }
+}
+
+} // namespace crypto
+} // namespace schwanenlied
@@ -0,0 +1,164 @@
+/**
+ * @file    secure_arena.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   mlock()ed Arena Allocator for Key Material
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_CRYPTO_SECURE_ARENA_H__
+#define SCHWANENLIED_CRYPTO_SECURE_ARENA_H__
+
+#include <mutex>
+
+#include "schwanenlied/common.h"
+
+namespace schwanenlied {
+namespace crypto {
+
+/**
+ * A slab allocator over a mlock()ed, guard paged region
+ *
+ * Key material is small and fixed size, so instead of having each
+ * SecureBuffer be a separate trip to the heap, allocations that fit into one
+ * of the size classes (kSmallSlotSize/kLargeSlotSize) are served from a free
+ * list backed by a single mmap()ed region.  The region is mlock()ed so that
+ * the contents never get paged out, excluded from core dumps where supported,
+ * and bracketed by PROT_NONE guard pages.
+ *
+ * Allocations that are too large, or that happen when a size class is
+ * exhausted return nullptr, and the caller is expected to fall back to the
+ * regular heap.  Failure to mlock() the region (Eg: due to RLIMIT_MEMLOCK) is
+ * not fatal, and is reported via locked().
+ *
+ * @warning The arena does not wipe memory on deallocate(), that is the
+ * responsibility of the caller (SecureAllocator does this).
+ */
+class SecureArena {
+ public:
+  /**
+   * The size of the small slots in bytes
+   *
+   * SecureBuffer always allocates room for a terminator, so a 32 byte key
+   * needs 33 bytes.  The slot sizes are rounded up to 16 bytes to keep every
+   * slot suitably aligned.
+   */
+  static const size_t kSmallSlotSize = 48;
+  /** The size of the large slots in bytes (64 byte keys + terminator) */
+  static const size_t kLargeSlotSize = 80;
+  /** The default number of slots in each size class */
+  static const size_t kDefaultSlotCount = 512;
+
+  /**
+   * Construct a SecureArena
+   *
+   * @param[in] nr_slots  The number of slots in each size class
+   */
+  SecureArena(const size_t nr_slots);
+
+  ~SecureArena();
+
+  /**
+   * Return the process wide arena used by SecureAllocator
+   *
+   * The arena is created on first use with kDefaultSlotCount slots per size
+   * class, and is intentionally never destroyed so that static SecureBuffers
+   * can be released at any point during shutdown.
+   */
+  static SecureArena& global();
+
+  /** @{ */
+  /**
+   * Allocate memory from the arena
+   *
+   * @param[in] len The number of bytes to allocate
+   *
+   * @returns A pointer to the allocated memory, or nullptr if len does not
+   *          fit into a size class or the size class is exhausted
+   */
+  void* allocate(const size_t len);
+
+  /**
+   * Return memory to the arena
+   *
+   * @param[in] p   The pointer to release
+   *
+   * @returns true  - p was allocated by this arena and has been released
+   * @returns false - p was not allocated by this arena
+   */
+  bool deallocate(void* p);
+
+  /**
+   * Check if a pointer was allocated by this arena
+   *
+   * @param[in] p   The pointer to check
+   */
+  bool owns(const void* p) const {
+    const uint8_t* ptr = static_cast<const uint8_t*>(p);
+    return ptr >= base_ && ptr < base_ + len_;
+  }
+  /** @} */
+
+  /** @{ */
+  /** Return true iff the backing region is mlock()ed */
+  bool locked() const { return locked_; }
+  /** Return the number of slots currently allocated */
+  size_t in_use() const;
+  /** @} */
+
+ private:
+  SecureArena() = delete;
+  SecureArena(const SecureArena&) = delete;
+  void operator=(const SecureArena&) = delete;
+
+  /** A free slot, linked through the first bytes of the slot itself */
+  struct FreeSlot {
+    FreeSlot* next_;  /**< The next free slot */
+  };
+
+  void init_free_list(FreeSlot*& head,
+                      uint8_t* base,
+                      const size_t slot_size);
+
+  mutable ::std::mutex lock_; /**< Serializes access to the free lists */
+  uint8_t* region_;       /**< The mmap()ed region including guard pages */
+  size_t region_len_;     /**< The length of region_ */
+  uint8_t* base_;         /**< The start of the usable (slot) area */
+  size_t len_;            /**< The length of the usable area */
+  uint8_t* large_base_;   /**< The start of the large slots */
+  bool locked_;           /**< Is the usable area mlock()ed? */
+  const size_t nr_slots_; /**< The number of slots per size class */
+  size_t nr_in_use_;      /**< The number of allocated slots */
+  FreeSlot* small_free_;  /**< The small slot free list */
+  FreeSlot* large_free_;  /**< The large slot free list */
+};
+
+} // namespace crypto
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_CRYPTO_SECURE_ARENA_H__
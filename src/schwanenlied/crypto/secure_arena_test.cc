@@ -0,0 +1,99 @@
+/*
+ * secure_arena_test.cc: SecureArena tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+
+#include "schwanenlied/crypto/secure_arena.h"
+#include "schwanenlied/crypto/utils.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+namespace crypto {
+
+class SecureArenaTest : public ::testing::Test {
+  protected:
+   virtual void SetUp() {}
+   virtual void TearDown() {}
+};
+
+TEST_F(SecureArenaTest, SizeClasses) {
+  SecureArena arena(4);
+
+  // Too large for any size class
+  ASSERT_EQ(nullptr, arena.allocate(SecureArena::kLargeSlotSize + 1));
+
+  // Exhaust the small slots, then spill into the large ones
+  void* slots[8];
+  for (size_t i = 0; i < 8; i++) {
+    slots[i] = arena.allocate(SecureArena::kSmallSlotSize);
+    ASSERT_NE(nullptr, slots[i]);
+    ASSERT_TRUE(arena.owns(slots[i]));
+    ::std::memset(slots[i], 0xa5, SecureArena::kSmallSlotSize);
+  }
+  ASSERT_EQ(8u, arena.in_use());
+  ASSERT_EQ(nullptr, arena.allocate(1));
+
+  // Release, and allocate again (LIFO)
+  ASSERT_TRUE(arena.deallocate(slots[3]));
+  ASSERT_EQ(slots[3], arena.allocate(SecureArena::kSmallSlotSize));
+
+  // Foreign pointers are rejected
+  uint8_t buf[16];
+  ASSERT_FALSE(arena.owns(buf));
+  ASSERT_FALSE(arena.deallocate(buf));
+
+  for (size_t i = 0; i < 8; i++)
+    ASSERT_TRUE(arena.deallocate(slots[i]));
+  ASSERT_EQ(0u, arena.in_use());
+}
+
+TEST_F(SecureArenaTest, SecureBuffer) {
+  SecureArena& arena = SecureArena::global();
+  const size_t base = arena.in_use();
+
+  {
+    // Key sized buffers come from the arena, including the terminator
+    SecureBuffer key(32, 0xff);
+    ASSERT_TRUE(arena.owns(key.data()));
+    ASSERT_EQ(base + 1, arena.in_use());
+    SecureBuffer siv_key(64, 0xff);
+    ASSERT_TRUE(arena.owns(siv_key.data()));
+    ASSERT_EQ(base + 2, arena.in_use());
+
+    // Large buffers come from the heap
+    SecureBuffer big(4096, 0xff);
+    ASSERT_FALSE(arena.owns(big.data()));
+    ASSERT_EQ(base + 2, arena.in_use());
+  }
+
+  ASSERT_EQ(base, arena.in_use());
+}
+
+} // namespace crypto
+} // namespace schwanenlied
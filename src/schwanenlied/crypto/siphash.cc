@@ -50,6 +50,12 @@ SipHash::SipHash(Random& rng) :
   rng.get_bytes(&key_[0], key_.size());
 }
 
+void SipHash::set_key(const uint8_t* key,
+                      const size_t key_len) {
+  SL_ASSERT(key_len == kKeyLength);
+  key_.assign(key, key_len);
+}
+
 uint64_t SipHash::digest(const uint8_t* buf,
                          const size_t len) const {
   return ::siphash(key_.data(), buf, len);
@@ -73,6 +73,23 @@ class SipHash {
    */
   SipHash(Random& rng);
 
+  /** @{ */
+  /**
+   * Replace the key
+   *
+   * @warning Attempting to pass in an invalid key will cause the code to
+   * SL_ASSERT().
+   *
+   * @param[in] key      A pointer to the new key
+   * @param[in] key_len The length of the key
+   */
+  void set_key(const uint8_t* key,
+               const size_t key_len);
+
+  /** Return the key (For state hand off only, see Blake2s::key()) */
+  const SecureBuffer& key() const { return key_; }
+  /** @} */
+
   /** @{ */
   /**
    * One shot digest calculation
@@ -0,0 +1,308 @@
+/**
+ * @file    siv.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Generic SIV AEAD construction
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_CRYPTO_SIV_H__
+#define SCHWANENLIED_CRYPTO_SIV_H__
+
+#include <string>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/crypto/random.h"
+#include "schwanenlied/crypto/utils.h"
+
+namespace schwanenlied {
+namespace crypto {
+
+/**
+ * Generic SIV AEAD
+ *
+ * This provides [Synthetic Initialization Vector](http://www.cs.ucdavis.edu/~rogaway/papers/siv.pdf)
+ * Authenticated Encryption with Associated Data over an arbitrary keyed MAC
+ * and stream cipher.  Rogaway and Shrimpton's original paper specify SIV using
+ * AES-CMAC and AES-CTR, however the construct itself is generic.
+ *
+ * All of the sizes are compile time constants derived from the primitives,
+ * and the primitive calls are resolved statically, so each instantiation is
+ * as fast as a hand written construction.
+ *
+ * Mac must provide kKeyLength, kDigestLength, set_key(), clear_key(), init(),
+ * update() and final() with the same semantics as Blake2s (Including
+ * init() SL_ASSERT()ing if there is no key, which is the only check for
+ * using a instance before set_key()).  StreamCipher must provide kKeyLength,
+ * kIvLength, set_key(), clear_key() and encrypt(iv, in, out, len) with the
+ * same semantics as XChaCha.
+ *
+ * @tparam Mac          The keyed MAC used to derive the SIV
+ * @tparam StreamCipher The stream cipher keyed with the SIV as the IV
+ */
+template <class Mac, class StreamCipher>
+class SIV {
+ public:
+  /** The key length in bytes */
+  static const size_t kKeyLength = Mac::kKeyLength + StreamCipher::kKeyLength;
+  /** The Synthetic Initialization Vector length in bytes */
+  static const size_t kSIVLength = StreamCipher::kIvLength;
+  /** The random nonce length in bytes (16 bytes/128 bits) */
+  static const size_t kNonceLength = 16;
+
+  static_assert(kSIVLength <= Mac::kDigestLength,
+                "The MAC digest must be able to cover the stream cipher IV");
+
+  /**
+   * Construct a uninitialized SIV instance
+   *
+   * The application must call set_key() to actually use any of the functions.
+   *
+   * @param[in] rng   The Random instance to use when generating nonces
+   */
+  SIV(Random& rng) :
+      rng_(rng),
+      has_key_(false),
+      mac_(),
+      stream_() {
+    // Nothing to do
+  }
+
+  /**
+   * Construct a SIV instance given a key
+   *
+   * @warning Attempting to pass in an invalid key will cause the code to
+   * SL_ASSERT().
+   *
+   * @param[in] rng     The Random instance to use when generating nonces
+   * @param[in] key     A pointer to the key to associate with this instance
+   * @param[in] key_len The length of the key to use
+   */
+  SIV(Random& rng,
+      const uint8_t* key,
+      const size_t key_len) :
+      SIV(rng) {
+    set_key(key, key_len);
+  }
+
+  /** @{ */
+  /**
+   * Set the key
+   *
+   * @warning Attempting to pass in an invalid key will cause the code to
+   * SL_ASSERT().
+   *
+   * @param[in] key     A pointer to the key to associate with this instance
+   * @param[in] key_len The length of the key
+   */
+  void set_key(const uint8_t* key,
+               const size_t key_len) {
+    SL_ASSERT(key_len == kKeyLength);
+
+    // Feed the keys to the appropriate algorithms
+    mac_.set_key(key, Mac::kKeyLength);
+    stream_.set_key(key + Mac::kKeyLength, StreamCipher::kKeyLength);
+    has_key_ = true;
+  }
+
+  /**
+   * Clear the key
+   */
+  void clear_key() {
+    if (has_key_) {
+      mac_.clear_key();
+      stream_.clear_key();
+      has_key_ = false;
+    }
+  }
+
+  /**
+   * Return the key, in the form accepted by set_key()
+   *
+   * This is only intended for handing off state to another process.
+   *
+   * @param[out] key The SecureBuffer where the key will be stored
+   */
+  void get_key(SecureBuffer& key) const {
+    SL_ASSERT(has_key_);
+    key = mac_.key();
+    key.append(stream_.key());
+  }
+  /** @} */
+
+  /** @{ */
+  /**
+   * Encrypt a given buffer
+   *
+   *     Let H(t, x) be Mac with key t, and message x.
+   *
+   *     Let E(t,v,x) be StreamCipher with key t, IV v, and message x.
+   *
+   *     Let R(n) be n bytes of output from a cryptographically strong random
+   *     number generator seeded from a strong entropy source.
+   *
+   *     SIV-Encrypt(t, x) -> ciphertext
+   *
+   *         Nonce = R(kNonceLength)
+   *
+   *         SIV = H(leftmost(t, Mac::kKeyLength), Nonce | x)
+   *
+   *         CT = E(rightmost(t, StreamCipher::kKeyLength), SIV, x)
+   *
+   *         ciphertext = SIV | V | CT
+   *
+   * @param[in]  in  The std::string containing the plaintext
+   * @param[out] out The std::string where the ciphertext will be stored
+   */
+  void encrypt(const ::std::string& in,
+               ::std::string& out) {
+    out.resize(kSIVLength + kNonceLength + in.length());
+    encrypt(in, reinterpret_cast<uint8_t*>(&out[0]));
+  }
+
+  /**
+   * Encrypt a given buffer into caller provided storage
+   *
+   * This is identical to the std::string variant, except that the ciphertext
+   * is written to out, which allows multiple packets to be encrypted back to
+   * back into one contiguous buffer.
+   *
+   * @param[in]  in  The std::string containing the plaintext
+   * @param[out] out A pointer to where the ciphertext should be stored (Must
+   *                 not be nullptr, and be able to hold kSIVLength +
+   *                 kNonceLength + in.length() bytes)
+   */
+  void encrypt(const ::std::string& in,
+               uint8_t* out) {
+    bool ret = mac_.init(kSIVLength);
+
+    // Generate/MAC the Nonce
+    uint8_t* nonce = out + kSIVLength;
+    rng_.get_bytes(nonce, kNonceLength);
+    ret &= mac_.update(nonce, kNonceLength);
+
+    // MAC the plaintext, Generate the SIV
+    const uint8_t* in_ptr = reinterpret_cast<const uint8_t*>(in.data());
+    ret &= mac_.update(in_ptr, in.length());
+    uint8_t* siv = out;
+    ret &= mac_.final(siv, kSIVLength);
+
+    // Encrypt
+    stream_.encrypt(siv, in_ptr, out + kSIVLength + kNonceLength,
+                    in.length());
+
+    SL_ASSERT(ret);
+  }
+
+  /**
+   * Decrypt and authenticate a given buffer
+   *
+   *     Let H(t, x) be Mac with key t, and message x.
+   *
+   *     Let E(t,v,x) be StreamCipher with key t, IV v, and message x.
+   *
+   *     SIV-Decrypt(t, x) -> plaintext
+   *
+   *         SIV_Nonce = leftmost(x, kSivLength + kNonceLength)
+   *
+   *         SIV = leftmost(SIV_Nonce, kSivLength)
+   *
+   *         Nonce = rightmost(SIV_Nonce, kNonceLength)
+   *
+   *         PT = E(rightmost(t, StreamCipher::kKeyLength), SIV,
+   *         rightmost(x, X_LEN - (kSivLength + kNonceLength)))
+   *
+   *         SIV_Check = H(leftmost(t, Mac::kKeyLength), Nonce | PT)
+   *
+   *         if is_equal(SIV_Check, SIV)
+   *
+   *             plaintext = PT
+   *
+   *         else
+   *
+   *             return FAIL
+   *
+   * @param[in] in      A pointer to the ciphertext
+   * @param[in] in_len  The lenght of the ciphertext
+   * @param[out] out    The std::string where the plaintext will be stored
+   *
+   * @returns true - The plaintext was decrypted and authenticated
+   *                 successfully
+   * @returns false - The decryption failed
+   */
+  bool decrypt(const uint8_t* in,
+               const size_t in_len,
+               ::std::string& out) {
+    SL_ASSERT(in_len >= kSIVLength + kNonceLength);
+
+    out.resize(in_len - (kSIVLength + kNonceLength));
+    const size_t out_len = out.length();
+    uint8_t* out_ptr = reinterpret_cast<uint8_t*>(&out[0]);
+    bool ret = mac_.init(kSIVLength);
+
+    // MAC the Nonce
+    const uint8_t* nonce = in + kSIVLength;
+    ret &= mac_.update(nonce, kNonceLength);
+
+    // Decrypt the ciphertext
+    const uint8_t* siv = in;
+    stream_.encrypt(siv, in + kSIVLength + kNonceLength, out_ptr, out_len);
+    ret &= mac_.update(out_ptr, out_len);
+
+    // MAC the plaintext, compare the SIVs (Authenticate)
+    uint8_t auth_siv[kSIVLength];
+    ret &= mac_.final(auth_siv, sizeof(auth_siv));
+    SL_ASSERT(ret); // The MAC routines will only fail on implementation error.
+    ret &= (0 == memequals(auth_siv, siv, sizeof(auth_siv)));
+
+    return ret;
+  }
+  /**@} */
+
+ private:
+  SIV() = delete;
+  SIV(const SIV&) = delete;
+  void operator=(const SIV&) = delete;
+
+  Random& rng_;         /**< The Random instance used when generating nonces */
+  bool has_key_;        /**< Is a key currently set for this instance? */
+  Mac mac_;             /**< The MAC object used to generate SIVs */
+  StreamCipher stream_; /**< The cipher object used to encrypt/decrypt */
+};
+
+template <class Mac, class StreamCipher>
+const size_t SIV<Mac, StreamCipher>::kKeyLength;
+template <class Mac, class StreamCipher>
+const size_t SIV<Mac, StreamCipher>::kSIVLength;
+template <class Mac, class StreamCipher>
+const size_t SIV<Mac, StreamCipher>::kNonceLength;
+
+} // namespace crypto
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_CRYPTO_SIV_H__
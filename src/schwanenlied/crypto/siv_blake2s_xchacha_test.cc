@@ -106,5 +106,33 @@ TEST_F(SIVBlake2sXChaChaTest, InvalidData) {
   ASSERT_FALSE(ret);
 }
 
+TEST_F(SIVBlake2sXChaChaTest, FastProfile) {
+  static_assert(SIVBlake2sXChaCha12::kKeyLength ==
+                SIVBlake2sXChaCha::kKeyLength, "Key length mismatch");
+  static_assert(SIVBlake2sXChaCha12::kSIVLength ==
+                SIVBlake2sXChaCha::kSIVLength, "SIV length mismatch");
+
+  Random rng;
+  SIVBlake2sXChaCha12 siv(rng, test_key_.data(), test_key_.size());
+
+  ::std::string in(reinterpret_cast<char*>(test_data_.data()),
+                   test_data_.size());
+  ::std::string out;
+
+  // Round trip
+  siv.encrypt(in, out);
+  ASSERT_EQ(in.length() + SIVBlake2sXChaCha12::kSIVLength +
+            SIVBlake2sXChaCha12::kNonceLength, out.length());
+  ::std::string in_cmp;
+  ASSERT_TRUE(siv.decrypt(reinterpret_cast<const uint8_t*>(out.data()),
+                          out.length(), in_cmp));
+  ASSERT_EQ(in, in_cmp);
+
+  // The full round profile must reject the fast profile's ciphertext
+  SIVBlake2sXChaCha siv20(rng, test_key_.data(), test_key_.size());
+  ASSERT_FALSE(siv20.decrypt(reinterpret_cast<const uint8_t*>(out.data()),
+                             out.length(), in_cmp));
+}
+
 } // namespace crypto
 } // namespace schwanenlied
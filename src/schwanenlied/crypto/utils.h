@@ -38,6 +38,7 @@
 #include <string>
 
 #include "schwanenlied/common.h"
+#include "schwanenlied/crypto/secure_arena.h"
 
 namespace schwanenlied {
 namespace crypto {
@@ -66,6 +67,10 @@ int memequals(const void* s1,
 
 /**
  * A custom allocator that calls memwipe() on deallocate
+ *
+ * Allocations small enough to fit into the SecureArena size classes (key
+ * material) are served from the global mlock()ed arena, everything else comes
+ * from the heap.
  */
 template<typename T>
 class SecureAllocator: public ::std::allocator<T> {
@@ -83,9 +88,19 @@ class SecureAllocator: public ::std::allocator<T> {
   };
   /** @endcond */
 
-  void deallocate(T* p, ::std::size_t n) {
+  T* allocate(::std::size_t n, const void* = nullptr) {
+    void* p = SecureArena::global().allocate(sizeof(T) * n);
     if (p != nullptr)
+      return static_cast<T*>(p);
+    return ::std::allocator<T>::allocate(n);
+  }
+
+  void deallocate(T* p, ::std::size_t n) {
+    if (p != nullptr) {
       memwipe(p, sizeof(T) * n);
+      if (SecureArena::global().deallocate(p))
+        return;
+    }
     ::std::allocator<T>::deallocate(p, n);
   }
 };
@@ -40,62 +40,15 @@ namespace crypto {
 
 static ::std::once_flag self_test;
 
-XChaCha::XChaCha() :
-    has_key_(false),
-    key_(kKeyLength, 0) {
+void xchacha_self_test() {
   ::std::call_once(self_test, []() {
     int ret = ::chacha_check_validity();
     SL_ASSERT(ret);
   });
 }
 
-XChaCha::XChaCha(const uint8_t* key,
-                 const size_t key_len) :
-    XChaCha() {
-  SL_ASSERT(key_len == kKeyLength);
-  key_.assign(key, key_len);
-  has_key_ = true;
-}
-
-void XChaCha::set_key(const uint8_t* key,
-                      const size_t key_len) {
-  SL_ASSERT(key_len == kKeyLength);
-  key_.assign(key, key_len);
-  has_key_ = true;
-}
-
-void XChaCha::clear_key() {
-  if (has_key_) {
-    memwipe(&key_[0], key_.size());
-    has_key_ = false;
-  }
-}
-
-void XChaCha::encrypt(const uint8_t* iv,
-                      const ::std::string &in,
-                      uint8_t* out,
-                      const size_t len) const {
-  SL_ASSERT(has_key_);
-  SL_ASSERT(in.size() == len);
-  SL_ASSERT(out != 0);
-
-  ::xchacha(reinterpret_cast<const chacha_key*>(key_.data()),
-            reinterpret_cast<const chacha_iv24*>(iv),
-            reinterpret_cast<const uint8_t*>(in.data()), out, len, kRounds);
-}
-
-void XChaCha::encrypt(const uint8_t* iv,
-                      const uint8_t* in,
-                      uint8_t* out,
-                      const size_t len) const {
-  SL_ASSERT(has_key_);
-  SL_ASSERT(in != nullptr);
-  SL_ASSERT(out != nullptr);
-
-  ::xchacha(reinterpret_cast<const chacha_key*>(key_.data()),
-            reinterpret_cast<const chacha_iv24*>(iv), in, out, len,
-            kRounds);
-}
+template class BasicXChaCha<20>;
+template class BasicXChaCha<12>;
 
 } // namespace crypto
 } // namespace schwanenlied
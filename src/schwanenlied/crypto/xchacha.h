@@ -1,7 +1,7 @@
 /**
  * @file    xchacha.h
  * @author  Yawning Angel (yawning at schwanenlied dot me)
- * @brief   XChaCha/20 Stream Cipher
+ * @brief   XChaCha/20 (and reduced round variant) Stream Cipher
  */
 
 /*
@@ -44,33 +44,50 @@ namespace schwanenlied {
 namespace crypto {
 
 
+/** Run the underlying implementation's self test (once per process) */
+void xchacha_self_test();
+
 /**
- * The [XChaCha/20](http://cr.yp.to/snuffle/xsalsa-20110204.pdf) Stream Cipher
+ * The [XChaCha](http://cr.yp.to/snuffle/xsalsa-20110204.pdf) Stream Cipher
  *
- * This provides the XChaCha/20 stream cipher.  Internally it wraps the
+ * This provides the XChaCha stream cipher, with the number of rounds fixed at
+ * compile time.  Internally it wraps the
  * [implementation by Floodyberry](https://github.com/floodyberry/chacha-opt)
  * to make it easier to use from C++ code, and handles safe removal of key
  * material.
  *
+ * Applications should use the XChaCha (20 rounds) typedef, unless both peers
+ * have agreed to use the reduced round XChaCha12 profile.
+ *
  * @warning The first time any of the constructors are called, the underlying
  * implementation's self test is called, and the code will terminate on
  * failure.
+ *
+ * @tparam Rounds The number of rounds (Must be even)
  */
-class XChaCha {
+template <int Rounds>
+class BasicXChaCha {
  public:
+  static_assert(Rounds > 0 && Rounds % 2 == 0,
+                "XChaCha requires a positive even number of rounds");
+
   /** The key length in bytes */
   static const size_t kKeyLength = 32;
   /** The Initialization Vector length in bytes */
   static const size_t kIvLength = 24;
   /** The number of rounds */
-  static const int kRounds = 20;
+  static const int kRounds = Rounds;
 
   /**
    * Construct a uninitialized XChaCha instance
    *
    * The application must call set_key() to actually use any of the functions.
    */
-  XChaCha();
+  BasicXChaCha() :
+      has_key_(false),
+      key_(kKeyLength, 0) {
+    xchacha_self_test();
+  }
 
   /**
    * Construct a XChaCha instance given a key
@@ -81,8 +98,11 @@ class XChaCha {
    * @param[in] key      A pointer to the key to associate with this instance
    * @param[in] key_len The length of the key
    */
-  XChaCha(const uint8_t* key,
-          const size_t key_len);
+  BasicXChaCha(const uint8_t* key,
+               const size_t key_len) :
+      BasicXChaCha() {
+    set_key(key, key_len);
+  }
 
   /** @{ */
   /**
@@ -95,12 +115,24 @@ class XChaCha {
    * @param[in] key_len The length of the key
    */
   void set_key(const uint8_t* key,
-               const size_t key_len);
+               const size_t key_len) {
+    SL_ASSERT(key_len == kKeyLength);
+    key_.assign(key, key_len);
+    has_key_ = true;
+  }
 
   /**
    * Clear the key
    */
-  void clear_key();
+  void clear_key() {
+    if (has_key_) {
+      memwipe(&key_[0], key_.size());
+      has_key_ = false;
+    }
+  }
+
+  /** Return the key (For state hand off only, see Blake2s::key()) */
+  const SecureBuffer& key() const { return key_; }
   /** @} */
 
   /** @{ */
@@ -116,7 +148,10 @@ class XChaCha {
   void encrypt(const uint8_t* iv,
                const ::std::string &in,
                uint8_t* out,
-               const size_t len) const;
+               const size_t len) const {
+    SL_ASSERT(in.size() == len);
+    encrypt(iv, reinterpret_cast<const uint8_t*>(in.data()), out, len);
+  }
 
   /**
    * Encrypt/Decrypt a given buffer
@@ -129,17 +164,37 @@ class XChaCha {
   void encrypt(const uint8_t* iv,
                const uint8_t* in,
                uint8_t* out,
-               const size_t len) const;
+               const size_t len) const {
+    SL_ASSERT(has_key_);
+    SL_ASSERT(in != nullptr);
+    SL_ASSERT(out != nullptr);
+
+    ::xchacha(reinterpret_cast<const chacha_key*>(key_.data()),
+              reinterpret_cast<const chacha_iv24*>(iv), in, out, len,
+              kRounds);
+  }
   /** @} */
 
  private:
-  XChaCha(const XChaCha&) = delete;
-  void operator=(const XChaCha&) = delete;
+  BasicXChaCha(const BasicXChaCha&) = delete;
+  void operator=(const BasicXChaCha&) = delete;
 
   bool has_key_;      /**< Is a key currently set for this instance? */
   SecureBuffer key_;  /**< The key storage object */
 };
 
+template <int Rounds> const size_t BasicXChaCha<Rounds>::kKeyLength;
+template <int Rounds> const size_t BasicXChaCha<Rounds>::kIvLength;
+template <int Rounds> const int BasicXChaCha<Rounds>::kRounds;
+
+/** XChaCha/20, the default stream cipher */
+typedef BasicXChaCha<20> XChaCha;
+/** XChaCha/12, the reduced round fast profile */
+typedef BasicXChaCha<12> XChaCha12;
+
+extern template class BasicXChaCha<20>;
+extern template class BasicXChaCha<12>;
+
 } // namespace crypto
 } // namespace schwanenlied
 
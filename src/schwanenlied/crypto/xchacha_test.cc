@@ -87,5 +87,45 @@ TEST_F(XChaChaTest, XChaCha) {
   ASSERT_EQ(0, ::std::memcmp(out, buf.data(), buf_sz));
 }
 
+// Test the reduced round XChaCha/12 profile
+TEST_F(XChaChaTest, XChaCha12) {
+  ASSERT_EQ(12, XChaCha12::kRounds);
+
+  const size_t buf_sz = 4096;
+  uint8_t buf[buf_sz];
+  for (size_t i = 0; i < buf_sz; i++) {
+    buf[i] = static_cast<uint8_t>(i);
+  }
+
+  chacha_key_t key;
+  for (size_t i = 0; i < sizeof(key.b); i++) {
+    key.b[i] = static_cast<uint8_t>(i);
+  }
+  chacha_iv24_t iv;
+  for (size_t i = 0; i < sizeof(iv.b); i++) {
+    iv.b[i] = static_cast<uint8_t>(i);
+  }
+
+  // Call the raw implementation with 12 rounds
+  uint8_t cmp[buf_sz];
+  ::xchacha(&key, &iv, buf, cmp, buf_sz, 12);
+
+  // Call the class
+  uint8_t out[buf_sz];
+  XChaCha12 x(key.b, sizeof(key.b));
+  x.encrypt(iv.b, buf, out, buf_sz);
+  ASSERT_EQ(0, ::std::memcmp(out, cmp, buf_sz));
+
+  // The keystream must differ from the full round variant
+  uint8_t full[buf_sz];
+  XChaCha x20(key.b, sizeof(key.b));
+  x20.encrypt(iv.b, buf, full, buf_sz);
+  ASSERT_NE(0, ::std::memcmp(out, full, buf_sz));
+
+  // Decrypt
+  x.encrypt(iv.b, out, out, buf_sz);
+  ASSERT_EQ(0, ::std::memcmp(out, buf, buf_sz));
+}
+
 } // namespace crypto
 } // namespace schwanenlied
@@ -0,0 +1,240 @@
+/**
+ * @file    flight_recorder.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Binary event ring buffer (Flight Recorder) (IMPLEMENTATION)
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "schwanenlied/flight_recorder.h"
+
+namespace schwanenlied {
+
+static_assert(sizeof(FlightRecorder::Record) == 64,
+              "FlightRecorder::Record should be a cache line");
+static_assert(sizeof(FlightRecorder::DumpHeader) == 40,
+              "FlightRecorder::DumpHeader has padding");
+
+const size_t FlightRecorder::kNrArgs;
+const uint8_t FlightRecorder::kAddrNone;
+const uint8_t FlightRecorder::kAddrHash;
+const uint8_t FlightRecorder::kAddrIPv4;
+const uint8_t FlightRecorder::kAddrIPv6;
+const char FlightRecorder::kDumpMagic[8] = {
+  'S', 'L', 'F', 'R', 'E', 'C', '0', '1'
+};
+
+FlightRecorder::FlightRecorder(const size_t nr_records,
+                               const bool safe) :
+    safe_(safe),
+    mask_(0),
+    head_(0),
+    dump_fd_(-1) {
+  SL_ASSERT(nr_records > 0);
+
+  size_t sz = 1;
+  while (sz < nr_records)
+    sz <<= 1;
+  ring_.resize(sz);
+  mask_ = sz - 1;
+  ::std::memset(&ring_[0], 0, sz * sizeof(Record));
+}
+
+void FlightRecorder::snapshot(::std::vector<Record>& records) const {
+  const uint64_t n = head_ < ring_.size() ? head_ : ring_.size();
+  records.clear();
+  records.reserve(static_cast<size_t>(n));
+  for (uint64_t i = head_ - n; i < head_; i++)
+    records.push_back(ring_[i & mask_]);
+}
+
+void FlightRecorder::serialize(::std::string& out) const {
+  ::std::vector<Record> records;
+  snapshot(records);
+
+  DumpHeader header;
+  ::std::memcpy(header.magic_, kDumpMagic, sizeof(header.magic_));
+  header.record_size_ = sizeof(Record);
+  header.nr_records_ = static_cast<uint32_t>(records.size());
+  header.recorded_ = head_;
+  header.timestamp_ = LatencyHistogram::now();
+  header.realtime_ = ::std::chrono::duration_cast< ::std::chrono::nanoseconds>(
+      ::std::chrono::system_clock::now().time_since_epoch()).count();
+
+  out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (!records.empty())
+    out.append(reinterpret_cast<const char*>(&records[0]),
+               records.size() * sizeof(Record));
+}
+
+int FlightRecorder::dump(const int fd) const {
+  ::std::string out;
+  serialize(out);
+
+  const char* ptr = out.data();
+  size_t len = out.length();
+  while (len > 0) {
+    const ssize_t ret = ::write(fd, ptr, len);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return kErrorAgain;
+      return kErrorConnAborted;
+    }
+    ptr += ret;
+    len -= static_cast<size_t>(ret);
+  }
+
+  return kErrorOk;
+}
+
+int FlightRecorder::trigger() {
+  if (!armed())
+    return kErrorOk;
+
+  const int fd = dump_fd_;
+  dump_fd_ = -1;
+  return dump(fd);
+}
+
+int FlightRecorder::decode(const void* buf,
+                           const size_t len,
+                           DumpHeader& header,
+                           ::std::vector<Record>& records) {
+  records.clear();
+  if (buf == nullptr || len < sizeof(DumpHeader))
+    return kErrorInval;
+
+  const uint8_t* p = static_cast<const uint8_t*>(buf);
+  ::std::memcpy(&header, p, sizeof(header));
+  if (::std::memcmp(header.magic_, kDumpMagic, sizeof(header.magic_)) != 0)
+    return kErrorInval;
+  if (header.record_size_ != sizeof(Record))
+    return kErrorInval;
+  if (len - sizeof(header) !=
+      static_cast<size_t>(header.nr_records_) * sizeof(Record))
+    return kErrorInval;
+
+  records.resize(header.nr_records_);
+  if (!records.empty())
+    ::std::memcpy(&records[0], p + sizeof(header),
+                  records.size() * sizeof(Record));
+
+  return kErrorOk;
+}
+
+void FlightRecorder::render(const ::std::vector<Record>& records,
+                            const uint64_t reference,
+                            const EventNameFn name_fn,
+                            ::std::string& out) {
+  char addr[INET6_ADDRSTRLEN + 8];
+  char line[256];
+
+  for (const auto& r : records) {
+    switch (r.addr_type_) {
+    case kAddrHash: {
+      uint64_t hash;
+      ::std::memcpy(&hash, r.addr_, sizeof(hash));
+      ::std::snprintf(addr, sizeof(addr), "%016" PRIx64 ":%u", hash,
+                      r.port_);
+      break;
+    }
+    case kAddrIPv4:
+      ::inet_ntop(AF_INET, r.addr_, addr, sizeof(addr));
+      ::std::snprintf(addr + ::std::strlen(addr),
+                      sizeof(addr) - ::std::strlen(addr), ":%u", r.port_);
+      break;
+    case kAddrIPv6:
+      addr[0] = '[';
+      ::inet_ntop(AF_INET6, r.addr_, addr + 1, sizeof(addr) - 1);
+      ::std::snprintf(addr + ::std::strlen(addr),
+                      sizeof(addr) - ::std::strlen(addr), "]:%u", r.port_);
+      break;
+    default:
+      ::std::snprintf(addr, sizeof(addr), "-");
+    }
+
+    const char* name = name_fn != nullptr ? name_fn(r.event_) : nullptr;
+    char unknown[16];
+    if (name == nullptr) {
+      ::std::snprintf(unknown, sizeof(unknown), "event_%u", r.event_);
+      name = unknown;
+    }
+
+    // Records newer than the reference (clock skew etc) show up as -0
+    const uint64_t age = reference > r.timestamp_ ?
+        reference - r.timestamp_ : 0;
+    ::std::snprintf(line, sizeof(line),
+                    "-%" PRIu64 " %s session=%" PRIx64 " addr=%s "
+                    "args=%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                    age, name, r.session_, addr,
+                    r.args_[0], r.args_[1], r.args_[2]);
+    out += line;
+  }
+}
+
+void FlightRecorder::set_address(Record& r,
+                                 const IPAddress& addr) const {
+  const struct sockaddr* sa = addr.sockaddr();
+  if (sa->sa_family == AF_INET) {
+    const struct sockaddr_in* v4 =
+        reinterpret_cast<const struct sockaddr_in*>(sa);
+    r.port_ = ntohs(v4->sin_port);
+    if (!safe_) {
+      r.addr_type_ = kAddrIPv4;
+      ::std::memcpy(r.addr_, &v4->sin_addr, sizeof(v4->sin_addr));
+      return;
+    }
+  } else {
+    const struct sockaddr_in6* v6 =
+        reinterpret_cast<const struct sockaddr_in6*>(sa);
+    r.port_ = ntohs(v6->sin6_port);
+    if (!safe_) {
+      r.addr_type_ = kAddrIPv6;
+      ::std::memcpy(r.addr_, &v6->sin6_addr, sizeof(v6->sin6_addr));
+      return;
+    }
+  }
+
+  const uint64_t hash = addr.hash();
+  r.addr_type_ = kAddrHash;
+  ::std::memcpy(r.addr_, &hash, sizeof(hash));
+}
+
+} // namespace schwanenlied
@@ -0,0 +1,271 @@
+/**
+ * @file    flight_recorder.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Binary event ring buffer (Flight Recorder)
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_FLIGHT_RECORDER_H__
+#define SCHWANENLIED_FLIGHT_RECORDER_H__
+
+#include <string>
+#include <vector>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/ip_address.h"
+#include "schwanenlied/latency_histogram.h"
+
+namespace schwanenlied {
+
+/**
+ * A binary event ring buffer (Flight Recorder)
+ *
+ * Events are fixed size (one cache line) Records, that are written into a
+ * power of 2 sized ring without formatting, locking, or allocation, so that
+ * recording an event costs a handful of stores.  Once the ring is full the
+ * oldest Records are overwritten.  Decoding to text is only done on demand
+ * (render()) or offline from a dump (serialize()/dump() + decode()).
+ *
+ * IP addresses are either stored verbatim, or if the recorder is constructed
+ * with safe set, as IPAddress::hash() (which is keyed per-process), mirroring
+ * IPAddress::to_string().  The port is retained in both cases.
+ *
+ * A dump file descriptor can be armed, and the owner calls trigger() when
+ * something goes wrong to write the events leading up to the failure out.
+ * Triggering disarms the recorder, so a flood of errors results in a single
+ * dump.
+ *
+ * Event ids are opaque to the recorder, and are turned into names by the
+ * EventNameFn passed to render().
+ *
+ * @warning This is not thread safe, and is intended to be owned by whatever
+ * owns the code that records into it.
+ */
+class FlightRecorder {
+ public:
+  /** The number of event specific arguments in a Record */
+  static const size_t kNrArgs = 3;
+
+  /** @{ */
+  /** Record::addr_type_ - No address */
+  static const uint8_t kAddrNone = 0;
+  /** Record::addr_type_ - IPAddress::hash() (Host byte order) */
+  static const uint8_t kAddrHash = 1;
+  /** Record::addr_type_ - IPv4 address (network byte order) */
+  static const uint8_t kAddrIPv4 = 4;
+  /** Record::addr_type_ - IPv6 address (network byte order) */
+  static const uint8_t kAddrIPv6 = 6;
+  /** @} */
+
+  /** A recorded event */
+  struct Record {
+    uint64_t timestamp_;  /**< LatencyHistogram::now() at record time */
+    uint64_t session_;    /**< The session identifier (0 for none) */
+    uint16_t event_;      /**< The event id */
+    uint8_t addr_type_;   /**< The type of addr_ (kAddrNone etc) */
+    uint8_t reserved_;    /**< Reserved (0) */
+    uint16_t port_;       /**< The port (Host byte order) */
+    uint16_t reserved2_;  /**< Reserved (0) */
+    uint8_t addr_[16];    /**< The address */
+    uint64_t args_[kNrArgs];  /**< Event specific arguments */
+  };
+
+  /** The header written in front of the Records by serialize()/dump() */
+  struct DumpHeader {
+    uint8_t magic_[8];      /**< kDumpMagic */
+    uint32_t record_size_;  /**< sizeof(Record) */
+    uint32_t nr_records_;   /**< The number of Records that follow */
+    uint64_t recorded_;     /**< The total number of events ever recorded */
+    uint64_t timestamp_;    /**< LatencyHistogram::now() at dump time */
+    uint64_t realtime_;     /**< UNIX time in ns at dump time */
+  };
+
+  /** The magic at the start of a DumpHeader */
+  static const char kDumpMagic[8];
+
+  /** A function that turns an event id into a human readable name */
+  typedef const char* (*EventNameFn)(const uint16_t event);
+
+  /**
+   * Construct a FlightRecorder
+   *
+   * @param[in] nr_records  The number of Records to retain (Rounded up to a
+   *                        power of 2)
+   * @param[in] safe        Store IPAddress::hash() instead of the address
+   */
+  FlightRecorder(const size_t nr_records,
+                 const bool safe);
+
+  /** @{ */
+  /**
+   * Record an event
+   *
+   * @param[in] event   The event id
+   * @param[in] session The session identifier (0 for none)
+   * @param[in] addr    The peer address if any (May be nullptr)
+   * @param[in] arg0    Event specific argument
+   * @param[in] arg1    Event specific argument
+   * @param[in] arg2    Event specific argument
+   */
+  void record(const uint16_t event,
+              const uint64_t session,
+              const IPAddress* addr,
+              const uint64_t arg0 = 0,
+              const uint64_t arg1 = 0,
+              const uint64_t arg2 = 0) {
+    Record& r = ring_[head_++ & mask_];
+    r.timestamp_ = LatencyHistogram::now();
+    r.session_ = session;
+    r.event_ = event;
+    r.args_[0] = arg0;
+    r.args_[1] = arg1;
+    r.args_[2] = arg2;
+    if (addr == nullptr) {
+      r.addr_type_ = kAddrNone;
+      r.port_ = 0;
+    } else {
+      set_address(r, *addr);
+    }
+  }
+
+  /** Discard all of the Records */
+  void clear() { head_ = 0; }
+  /** @} */
+
+  /** @{ */
+  /** Return the number of Records retained */
+  size_t capacity() const { return ring_.size(); }
+  /** Return the total number of events ever recorded */
+  uint64_t recorded() const { return head_; }
+  /** Return if addresses are stored as IPAddress::hash() */
+  bool safe() const { return safe_; }
+
+  /**
+   * Copy out the retained Records, oldest first
+   *
+   * @param[out] records  The vector to store the Records in
+   */
+  void snapshot(::std::vector<Record>& records) const;
+  /** @} */
+
+  /** @{ */
+  /**
+   * Serialize a DumpHeader and the retained Records
+   *
+   * The dump is in host byte order, and is intended to be decoded on the same
+   * host (the timestamps are meaningless elsewhere anyway).
+   *
+   * @param[out] out  The string to append the dump to
+   */
+  void serialize(::std::string& out) const;
+
+  /**
+   * Serialize the retained Records, and write them to a file descriptor
+   *
+   * @param[in] fd  The file descriptor to write to
+   *
+   * @returns kErrorOk          - Success
+   * @returns kErrorAgain       - The descriptor is non-blocking and full
+   * @returns kErrorConnAborted - The write failed
+   */
+  int dump(const int fd) const;
+
+  /**
+   * Arm the dump on error trigger
+   *
+   * @param[in] fd  The file descriptor that trigger() dumps to (-1 disarms)
+   */
+  void arm(const int fd) { dump_fd_ = fd; }
+
+  /** Return if the dump on error trigger is armed */
+  bool armed() const { return dump_fd_ >= 0; }
+
+  /**
+   * Dump to the armed file descriptor (if any) and disarm
+   *
+   * @returns kErrorOk  - Success, or the trigger is not armed
+   * @returns (Other)   - See dump()
+   */
+  int trigger();
+  /** @} */
+
+  /** @{ */
+  /**
+   * Decode a dump produced by serialize()/dump()
+   *
+   * @param[in] buf       The dump
+   * @param[in] len       The length of the dump
+   * @param[out] header   The DumpHeader
+   * @param[out] records  The Records, oldest first
+   *
+   * @returns kErrorOk    - Success
+   * @returns kErrorInval - The dump is truncated or malformed
+   */
+  static int decode(const void* buf,
+                    const size_t len,
+                    DumpHeader& header,
+                    ::std::vector<Record>& records);
+
+  /**
+   * Render Records as text, one line per Record
+   *
+   * Timestamps are rendered as the number of ticks prior to reference (Eg:
+   * DumpHeader::timestamp_, or LatencyHistogram::now()).
+   *
+   * @param[in] records   The Records to render
+   * @param[in] reference The reference timestamp
+   * @param[in] name_fn   The EventNameFn used to name the events
+   * @param[out] out      The string to append the text to
+   */
+  static void render(const ::std::vector<Record>& records,
+                     const uint64_t reference,
+                     const EventNameFn name_fn,
+                     ::std::string& out);
+  /** @} */
+
+ private:
+  FlightRecorder() = delete;
+  FlightRecorder(const FlightRecorder&) = delete;
+  void operator=(const FlightRecorder&) = delete;
+
+  /** Fill in the address related fields of a Record */
+  void set_address(Record& r,
+                   const IPAddress& addr) const;
+
+  const bool safe_;             /**< Store IPAddress::hash() */
+  ::std::vector<Record> ring_;  /**< The Records */
+  size_t mask_;                 /**< ring_.size() - 1 */
+  uint64_t head_;               /**< The total number of events recorded */
+  int dump_fd_;                 /**< The dump on error file descriptor */
+};
+
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_FLIGHT_RECORDER_H__
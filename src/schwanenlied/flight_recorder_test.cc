@@ -0,0 +1,199 @@
+/*
+ * flight_recorder_test.cc: Flight Recorder tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <cstring>
+#include <array>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "schwanenlied/flight_recorder.h"
+#include "schwanenlied/crypto/siphash.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+
+class FlightRecorderTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    key_.fill(0x23);
+    ::std::memset(&v4addr_, 0, sizeof(v4addr_));
+    v4addr_.sin_family = AF_INET;
+    v4addr_.sin_port = htons(6969);
+    inet_pton(AF_INET, "192.0.2.1", &v4addr_.sin_addr);
+    ::std::memset(&v6addr_, 0, sizeof(v6addr_));
+    v6addr_.sin6_family = AF_INET6;
+    v6addr_.sin6_port = htons(2323);
+    inet_pton(AF_INET6, "2001:db8::1", &v6addr_.sin6_addr);
+  };
+  virtual void TearDown() {};
+
+  static const char* event_name(const uint16_t event) {
+    return event == 1 ? "one" : nullptr;
+  }
+
+  ::std::array<uint8_t, crypto::SipHash::kKeyLength> key_;
+  struct sockaddr_in v4addr_;
+  struct sockaddr_in6 v6addr_;
+};
+
+TEST_F(FlightRecorderTest, Ring) {
+  FlightRecorder fr(5, false);
+  ASSERT_EQ(8u, fr.capacity());
+  ASSERT_EQ(0u, fr.recorded());
+
+  ::std::vector<FlightRecorder::Record> records;
+  fr.snapshot(records);
+  ASSERT_TRUE(records.empty());
+
+  // Partially full
+  for (uint64_t i = 0; i < 3; i++)
+    fr.record(1, 0, nullptr, i);
+  fr.snapshot(records);
+  ASSERT_EQ(3u, records.size());
+  for (uint64_t i = 0; i < 3; i++)
+    ASSERT_EQ(i, records[i].args_[0]);
+
+  // Wrapped, oldest first
+  for (uint64_t i = 3; i < 20; i++)
+    fr.record(1, i, nullptr, i, i + 1, i + 2);
+  ASSERT_EQ(20u, fr.recorded());
+  fr.snapshot(records);
+  ASSERT_EQ(8u, records.size());
+  for (size_t i = 0; i < records.size(); i++) {
+    ASSERT_EQ(12u + i, records[i].session_);
+    ASSERT_EQ(12u + i, records[i].args_[0]);
+    ASSERT_EQ(14u + i, records[i].args_[2]);
+    ASSERT_EQ(FlightRecorder::kAddrNone, records[i].addr_type_);
+    if (i > 0) {
+      ASSERT_LE(records[i - 1].timestamp_, records[i].timestamp_);
+    }
+  }
+
+  fr.clear();
+  fr.snapshot(records);
+  ASSERT_TRUE(records.empty());
+}
+
+TEST_F(FlightRecorderTest, Addresses) {
+  crypto::SipHash hash(key_.data(), key_.size());
+  IPAddress v4(hash, reinterpret_cast<struct sockaddr*>(&v4addr_),
+               sizeof(v4addr_));
+  IPAddress v6(hash, reinterpret_cast<struct sockaddr*>(&v6addr_),
+               sizeof(v6addr_));
+  ::std::vector<FlightRecorder::Record> records;
+  ::std::string text;
+
+  FlightRecorder fr(4, false);
+  fr.record(1, 0, &v4);
+  fr.record(2, 0, &v6);
+  fr.snapshot(records);
+  ASSERT_EQ(FlightRecorder::kAddrIPv4, records[0].addr_type_);
+  ASSERT_EQ(6969, records[0].port_);
+  ASSERT_EQ(0, ::std::memcmp(&v4addr_.sin_addr, records[0].addr_, 4));
+  ASSERT_EQ(FlightRecorder::kAddrIPv6, records[1].addr_type_);
+  ASSERT_EQ(2323, records[1].port_);
+  FlightRecorder::render(records, records[1].timestamp_, event_name, text);
+  ASSERT_NE(::std::string::npos,
+            text.find(" one session=0 addr=192.0.2.1:6969 "));
+  ASSERT_NE(::std::string::npos,
+            text.find(" event_2 session=0 addr=[2001:db8::1]:2323 "));
+
+  // Safe recorders never store the address
+  FlightRecorder safe_fr(4, true);
+  ASSERT_TRUE(safe_fr.safe());
+  safe_fr.record(1, 0, &v4);
+  safe_fr.record(1, 0, &v6);
+  safe_fr.snapshot(records);
+  uint64_t h;
+  ASSERT_EQ(FlightRecorder::kAddrHash, records[0].addr_type_);
+  ASSERT_EQ(6969, records[0].port_);
+  ::std::memcpy(&h, records[0].addr_, sizeof(h));
+  ASSERT_EQ(v4.hash(), h);
+  ASSERT_EQ(FlightRecorder::kAddrHash, records[1].addr_type_);
+  ::std::memcpy(&h, records[1].addr_, sizeof(h));
+  ASSERT_EQ(v6.hash(), h);
+  text.clear();
+  FlightRecorder::render(records, records[1].timestamp_, event_name, text);
+  ASSERT_EQ(::std::string::npos, text.find("192.0.2.1"));
+  ASSERT_EQ(::std::string::npos, text.find("2001:db8"));
+}
+
+TEST_F(FlightRecorderTest, Dump) {
+  FlightRecorder fr(4, false);
+  for (uint64_t i = 0; i < 6; i++)
+    fr.record(1, 0, nullptr, i);
+
+  // Round trip
+  ::std::string dump;
+  fr.serialize(dump);
+  FlightRecorder::DumpHeader header;
+  ::std::vector<FlightRecorder::Record> records;
+  ASSERT_EQ(kErrorOk, FlightRecorder::decode(dump.data(), dump.size(), header,
+                                             records));
+  ASSERT_EQ(6u, header.recorded_);
+  ASSERT_EQ(4u, header.nr_records_);
+  ASSERT_EQ(4u, records.size());
+  ASSERT_EQ(2u, records[0].args_[0]);
+  ASSERT_LE(records[3].timestamp_, header.timestamp_);
+
+  // Truncated/corrupted dumps are rejected
+  ASSERT_EQ(kErrorInval, FlightRecorder::decode(dump.data(), dump.size() - 1,
+                                                header, records));
+  ASSERT_TRUE(records.empty());
+  dump[0] = 'X';
+  ASSERT_EQ(kErrorInval, FlightRecorder::decode(dump.data(), dump.size(),
+                                                header, records));
+
+  // The trigger only fires when armed, and only once
+  int fds[2];
+  ASSERT_EQ(0, ::pipe(fds));
+  ASSERT_EQ(kErrorOk, fr.trigger());
+  fr.arm(fds[1]);
+  ASSERT_TRUE(fr.armed());
+  ASSERT_EQ(kErrorOk, fr.trigger());
+  ASSERT_FALSE(fr.armed());
+  ASSERT_EQ(kErrorOk, fr.trigger());
+  ::close(fds[1]);
+
+  ::std::string piped;
+  char buf[512];
+  ssize_t len;
+  while ((len = ::read(fds[0], buf, sizeof(buf))) > 0)
+    piped.append(buf, len);
+  ::close(fds[0]);
+  ASSERT_EQ(dump.size(), piped.size());
+  ASSERT_EQ(kErrorOk, FlightRecorder::decode(piped.data(), piped.size(),
+                                             header, records));
+  ASSERT_EQ(4u, records.size());
+  ASSERT_EQ(5u, records[3].args_[0]);
+}
+
+} // namespace schwanenlied
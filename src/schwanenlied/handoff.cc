@@ -0,0 +1,214 @@
+/**
+ * @file    handoff.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Hot restart state and file descriptor hand off
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "schwanenlied/handoff.h"
+
+namespace schwanenlied {
+
+namespace {
+
+/** The header at the start of a hand off (Carries the SCM_RIGHTS) */
+struct HandoffHeader {
+  uint8_t magic_[8];      /**< kHandoffMagic */
+  uint32_t nr_fds_;       /**< The number of file descriptors */
+  uint32_t reserved_;     /**< Reserved (0) */
+  uint64_t state_len_;    /**< The length of the state that follows */
+};
+
+const char kHandoffMagic[8] = { 'S', 'L', 'H', 'O', 'F', 'F', '0', '1' };
+
+/** The SCM_RIGHTS control message buffer */
+union HandoffControl {
+  struct cmsghdr align_;  /**< Forces alignment */
+  uint8_t buf_[CMSG_SPACE(sizeof(int) * kMaxHandoffFds)]; /**< The buffer */
+};
+
+bool write_all(const int sock,
+               const uint8_t* buf,
+               size_t len) {
+  while (len > 0) {
+    const ssize_t ret = ::send(sock, buf, len, MSG_NOSIGNAL);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    buf += ret;
+    len -= ret;
+  }
+  return true;
+}
+
+bool read_all(const int sock,
+              uint8_t* buf,
+              size_t len) {
+  while (len > 0) {
+    const ssize_t ret = ::recv(sock, buf, len, 0);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    } else if (ret == 0) {
+      return false;
+    }
+    buf += ret;
+    len -= ret;
+  }
+  return true;
+}
+
+} // namespace
+
+int send_handoff(const int sock,
+                 const ::std::string& state,
+                 const int* fds,
+                 const size_t nr_fds) {
+  if (nr_fds > kMaxHandoffFds || state.size() > kMaxHandoffStateLength)
+    return kErrorMsgSize;
+  if (nr_fds > 0 && fds == nullptr)
+    return kErrorInval;
+
+  HandoffHeader hdr;
+  ::std::memset(&hdr, 0, sizeof(hdr));
+  ::std::memcpy(hdr.magic_, kHandoffMagic, sizeof(hdr.magic_));
+  hdr.nr_fds_ = nr_fds;
+  hdr.state_len_ = state.size();
+
+  // The file descriptors ride along with the header
+  struct iovec iov;
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+  struct msghdr msg;
+  ::std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  HandoffControl ctrl;
+  if (nr_fds > 0) {
+    ::std::memset(&ctrl, 0, sizeof(ctrl));
+    msg.msg_control = ctrl.buf_;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nr_fds);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nr_fds);
+    ::std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nr_fds);
+  }
+
+  ssize_t ret;
+  do {
+    ret = ::sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0)
+    return kErrorConnAborted;
+
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(&hdr);
+  if (!write_all(sock, p + ret, sizeof(hdr) - ret) ||
+      !write_all(sock, reinterpret_cast<const uint8_t*>(state.data()),
+                 state.size()))
+    return kErrorConnAborted;
+
+  return kErrorOk;
+}
+
+int recv_handoff(const int sock,
+                 ::std::string& state,
+                 ::std::vector<int>& fds) {
+  state.clear();
+  fds.clear();
+
+  HandoffHeader hdr;
+  struct iovec iov;
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+  struct msghdr msg;
+  ::std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  HandoffControl ctrl;
+  msg.msg_control = ctrl.buf_;
+  msg.msg_controllen = sizeof(ctrl.buf_);
+
+  ssize_t ret;
+  do {
+    ret = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (ret < 0 && errno == EINTR);
+  if (ret <= 0)
+    return kErrorConnAborted;
+
+  // Take ownership of the file descriptors before anything else can fail
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    const size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const int* p = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+    fds.insert(fds.end(), p, p + n);
+  }
+
+  int err = kErrorOk;
+  uint8_t* p = reinterpret_cast<uint8_t*>(&hdr);
+  if (msg.msg_flags & MSG_CTRUNC)
+    err = kErrorMsgSize;
+  else if (!read_all(sock, p + ret, sizeof(hdr) - ret))
+    err = kErrorConnAborted;
+  else if (::std::memcmp(hdr.magic_, kHandoffMagic, sizeof(hdr.magic_)) != 0 ||
+           hdr.nr_fds_ != fds.size())
+    err = kErrorInval;
+  else if (hdr.state_len_ > kMaxHandoffStateLength)
+    err = kErrorMsgSize;
+
+  if (err == kErrorOk) {
+    state.resize(hdr.state_len_);
+    if (!read_all(sock, reinterpret_cast<uint8_t*>(&state[0]), state.size()))
+      err = kErrorConnAborted;
+  }
+
+  if (err != kErrorOk) {
+    for (auto fd : fds)
+      ::close(fd);
+    fds.clear();
+    state.clear();
+  }
+
+  return err;
+}
+
+} // namespace schwanenlied
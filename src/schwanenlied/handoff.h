@@ -0,0 +1,101 @@
+/**
+ * @file    handoff.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Hot restart state and file descriptor hand off
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_HANDOFF_H__
+#define SCHWANENLIED_HANDOFF_H__
+
+#include <string>
+#include <vector>
+
+#include "schwanenlied/common.h"
+
+namespace schwanenlied {
+
+/** @{ */
+/** The maximum number of file descriptors in a hand off */
+const size_t kMaxHandoffFds = 64;
+/** The maximum length of the state in a hand off (1 GiB) */
+const size_t kMaxHandoffStateLength = 1024 * 1024 * 1024;
+/** @} */
+
+/** @{ */
+/**
+ * Hand off opaque state (Eg: LodpEndpoint::export_state()) and file
+ * descriptors (Eg: the UDP sockets) to another process
+ *
+ * The file descriptors are passed via SCM_RIGHTS along with a small header,
+ * followed by the state, over a connected AF_UNIX SOCK_STREAM socket.  This
+ * blocks until everything has been written, so the socket should be in
+ * blocking mode.  The file descriptors remain open in the caller, which
+ * should stop using them.
+ *
+ * @param[in] sock    The connected AF_UNIX socket
+ * @param[in] state   The state
+ * @param[in] fds     The file descriptors
+ * @param[in] nr_fds  The number of file descriptors (<= kMaxHandoffFds)
+ *
+ * @returns kErrorOk          - Success
+ * @returns kErrorInval       - fds is nullptr
+ * @returns kErrorMsgSize     - Too many file descriptors, or the state is
+ *                              too large
+ * @returns kErrorConnAborted - The write failed
+ */
+int send_handoff(const int sock,
+                 const ::std::string& state,
+                 const int* fds,
+                 const size_t nr_fds);
+
+/**
+ * Receive a hand off sent via send_handoff()
+ *
+ * The received file descriptors are close-on-exec.  On failure any file
+ * descriptors that were received are closed.
+ *
+ * @param[in] sock    The connected AF_UNIX socket
+ * @param[out] state  The state
+ * @param[out] fds    The file descriptors
+ *
+ * @returns kErrorOk          - Success
+ * @returns kErrorInval       - The peer did not send a hand off
+ * @returns kErrorMsgSize     - The hand off exceeds the limits
+ * @returns kErrorConnAborted - The read failed, or the peer disconnected
+ */
+int recv_handoff(const int sock,
+                 ::std::string& state,
+                 ::std::vector<int>& fds);
+/** @} */
+
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_HANDOFF_H__
@@ -0,0 +1,125 @@
+/*
+ * handoff_test.cc: Hot restart hand off tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "schwanenlied/handoff.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+
+class HandoffTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, sv_));
+  }
+
+  virtual void TearDown() {
+    if (sv_[0] >= 0)
+      ::close(sv_[0]);
+    if (sv_[1] >= 0)
+      ::close(sv_[1]);
+  }
+
+  int sv_[2];
+};
+
+TEST_F(HandoffTest, RoundTrip) {
+  int pipe_fds[2];
+  ASSERT_EQ(0, ::pipe(pipe_fds));
+
+  // Larger than the socket buffer, so the sender has to block
+  ::std::string state(4 * 1024 * 1024, '\0');
+  for (size_t i = 0; i < state.size(); i++)
+    state[i] = static_cast<char>(i * 7);
+
+  int send_ret = -1;
+  ::std::thread sender([&]() {
+    send_ret = send_handoff(sv_[0], state, pipe_fds, 2);
+  });
+  ::std::string rx_state;
+  ::std::vector<int> rx_fds;
+  const int ret = recv_handoff(sv_[1], rx_state, rx_fds);
+  sender.join();
+  ASSERT_EQ(kErrorOk, send_ret);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(state, rx_state);
+  ASSERT_EQ(2u, rx_fds.size());
+
+  // The received descriptors refer to the same pipe
+  const char msg[] = "hot restart";
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(msg)),
+            ::write(rx_fds[1], msg, sizeof(msg)));
+  char buf[sizeof(msg)];
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(msg)),
+            ::read(pipe_fds[0], buf, sizeof(buf)));
+  ASSERT_EQ(0, ::std::memcmp(msg, buf, sizeof(msg)));
+
+  for (auto fd : rx_fds)
+    ::close(fd);
+  ::close(pipe_fds[0]);
+  ::close(pipe_fds[1]);
+
+  // No descriptors, no state
+  ASSERT_EQ(kErrorOk, send_handoff(sv_[0], ::std::string(), nullptr, 0));
+  ASSERT_EQ(kErrorOk, recv_handoff(sv_[1], rx_state, rx_fds));
+  ASSERT_TRUE(rx_state.empty());
+  ASSERT_TRUE(rx_fds.empty());
+}
+
+TEST_F(HandoffTest, Errors) {
+  ::std::string state;
+  ::std::vector<int> fds;
+
+  // Too many descriptors
+  ::std::vector<int> many(kMaxHandoffFds + 1, 0);
+  ASSERT_EQ(kErrorMsgSize, send_handoff(sv_[0], state, many.data(),
+                                        many.size()));
+  ASSERT_EQ(kErrorInval, send_handoff(sv_[0], state, nullptr, 1));
+
+  // Not a hand off
+  const uint8_t garbage[32] = { 0 };
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(garbage)),
+            ::write(sv_[0], garbage, sizeof(garbage)));
+  ASSERT_EQ(kErrorInval, recv_handoff(sv_[1], state, fds));
+  ASSERT_TRUE(fds.empty());
+
+  // The peer went away
+  ::close(sv_[0]);
+  sv_[0] = -1;
+  ASSERT_EQ(kErrorConnAborted, recv_handoff(sv_[1], state, fds));
+}
+
+} // namespace schwanenlied
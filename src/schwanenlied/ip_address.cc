@@ -43,6 +43,10 @@ namespace schwanenlied {
 static const size_t kIPv4UdpMTU = 1402;
 static const size_t kIPv6UdpMTU = 1232;
 
+// Jumbo frames (9000 byte ethernet MTU) minus the IP/UDP headers
+static const size_t kIPv4MaxUdpMTU = 9000 - 20 - 8;
+static const size_t kIPv6MaxUdpMTU = 9000 - 40 - 8;
+
 IPAddress::IPAddress(const crypto::SipHash& hash,
                      const struct sockaddr* addr,
                      const socklen_t len,
@@ -158,6 +162,16 @@ const size_t IPAddress::udp_mtu() const {
   SL_ABORT("Unsupported address type");
 }
 
+const size_t IPAddress::udp_max_mtu() const {
+  if (version_ == 4) {
+    return kIPv4MaxUdpMTU;
+  } else if (version_ == 6) {
+    return kIPv6MaxUdpMTU;
+  }
+
+  SL_ABORT("Unsupported address type");
+}
+
 ::std::string IPAddress::to_string() const {
   std::string ret;
   char addrstr[INET6_ADDRSTRLEN];
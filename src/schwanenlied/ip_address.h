@@ -109,6 +109,14 @@ class IPAddress {
   /** Get the UDP MTU of the address in bytes */
   const size_t udp_mtu() const;
 
+  /**
+   * Get the largest UDP payload that will be sent to the address in bytes
+   *
+   * This is the largest payload that fits in a 9000 byte jumbo frame, and is
+   * used as the upper bound for path MTU discovery.
+   */
+  const size_t udp_max_mtu() const;
+
   /** Get a cryptographic hash of the IP/port combination */
   const uint64_t hash() const { return addr_hash_; }
 
@@ -0,0 +1,116 @@
+/**
+ * @file   latency_histogram.cc
+ * @author Yawning Angel (yawning at schwanenlied dot me)
+ * @brief  A log-linear (HDR style) Latency Histogram (IMPLEMENTATION)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cmath>
+#include <limits>
+
+#include "schwanenlied/latency_histogram.h"
+
+namespace schwanenlied {
+
+const int LatencyHistogram::kSubBucketBits;
+const int LatencyHistogram::kMaxMagnitude;
+const size_t LatencyHistogram::kNrBuckets;
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+  if (other.count_ == 0)
+    return;
+
+  for (size_t i = 0; i < kNrBuckets; i++)
+    counts_[i] += other.counts_[i];
+  count_ += other.count_;
+  sum_ += other.sum_;
+  if (other.min_ < min_)
+    min_ = other.min_;
+  if (other.max_ > max_)
+    max_ = other.max_;
+}
+
+void LatencyHistogram::reset() {
+  counts_.fill(0);
+  count_ = 0;
+  sum_ = 0;
+  min_ = ::std::numeric_limits<uint64_t>::max();
+  max_ = 0;
+}
+
+uint64_t LatencyHistogram::value_at_percentile(const double percentile) const {
+  if (count_ == 0)
+    return 0;
+
+  // The rank (1 based) of the value being queried
+  double p = percentile < 0.0 ? 0.0 : (percentile > 100.0 ? 100.0 : percentile);
+  uint64_t rank = static_cast<uint64_t>(::std::ceil(p / 100.0 * count_));
+  if (rank == 0)
+    rank = 1;
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNrBuckets; i++) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      const uint64_t upper = bucket_upper_bound(i);
+      return upper < max_ ? upper : max_;
+    }
+  }
+
+  return max_;
+}
+
+uint64_t LatencyHistogram::bucket_lower_bound(const size_t idx) {
+  SL_ASSERT(idx < kNrBuckets);
+
+  const size_t nr_sub = static_cast<size_t>(1) << kSubBucketBits;
+  if (idx < nr_sub)
+    return idx;
+
+  const size_t group = idx >> kSubBucketBits;
+  const uint64_t sub = idx & (nr_sub - 1);
+  return (nr_sub + sub) << (group - 1);
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(const size_t idx) {
+  SL_ASSERT(idx < kNrBuckets);
+
+  if (idx == kNrBuckets - 1)
+    return ::std::numeric_limits<uint64_t>::max();
+
+  const size_t nr_sub = static_cast<size_t>(1) << kSubBucketBits;
+  if (idx < nr_sub)
+    return idx;
+
+  const size_t group = idx >> kSubBucketBits;
+  return bucket_lower_bound(idx) + (static_cast<uint64_t>(1) << (group - 1)) -
+      1;
+}
+
+} // namespace schwanenlied
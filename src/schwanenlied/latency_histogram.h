@@ -0,0 +1,185 @@
+/**
+ * @file   latency_histogram.h
+ * @author Yawning Angel (yawning at schwanenlied dot me)
+ * @brief  A log-linear (HDR style) Latency Histogram
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_LATENCY_HISTOGRAM_H__
+#define SCHWANENLIED_LATENCY_HISTOGRAM_H__
+
+#include <array>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "schwanenlied/common.h"
+
+namespace schwanenlied {
+
+/**
+ * A log-linear (HDR style) Latency Histogram
+ *
+ * Values are bucketed by their magnitude (power of 2), and each magnitude is
+ * further split into 2^kSubBucketBits linear sub-buckets, giving a constant
+ * relative error of ~6% over the entire range with a fixed amount of storage
+ * and a record() that is a couple of shifts and an increment.  Values with a
+ * magnitude greater than kMaxMagnitude are clamped into the last bucket.
+ *
+ * The unit of the recorded values is up to the caller, though it is intended
+ * to be used with now(), which returns CPU cycles where cheaply available.
+ *
+ * Unlike most things in the library this is copyable, so that consumers can
+ * take consistent snapshots.
+ */
+class LatencyHistogram {
+ public:
+  /** The number of linear sub-buckets per magnitude as a power of 2 */
+  static const int kSubBucketBits = 4;
+  /** The largest magnitude that is tracked without clamping */
+  static const int kMaxMagnitude = 40;
+  /** The total number of buckets */
+  static const size_t kNrBuckets = static_cast<size_t>(
+      kMaxMagnitude - kSubBucketBits + 2) << kSubBucketBits;
+
+  LatencyHistogram() { reset(); }
+
+  /**
+   * Return the current timestamp in "ticks"
+   *
+   * This is the TSC on x86 and a monotonic nanosecond clock elsewhere.  The
+   * ticks are only meaningful when compared to other values from the same
+   * host.
+   */
+  static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return ::std::chrono::duration_cast< ::std::chrono::nanoseconds>(
+        ::std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  /** @{ */
+  /**
+   * Record a value
+   *
+   * @param[in] value The value to record
+   */
+  void record(const uint64_t value) {
+    counts_[bucket_index(value)]++;
+    count_++;
+    sum_ += value;
+    if (value < min_)
+      min_ = value;
+    if (value > max_)
+      max_ = value;
+  }
+
+  /**
+   * Record the time elapsed since a given timestamp
+   *
+   * @param[in] start A timestamp obtained from now()
+   */
+  void record_since(const uint64_t start) { record(now() - start); }
+
+  /**
+   * Add the contents of another LatencyHistogram to this one
+   *
+   * @param[in] other The LatencyHistogram to merge
+   */
+  void merge(const LatencyHistogram& other);
+
+  /** Clear all recorded values */
+  void reset();
+  /** @} */
+
+  /** @{ */
+  /** Return the number of recorded values */
+  uint64_t count() const { return count_; }
+  /** Return the sum of all of the recorded values */
+  uint64_t sum() const { return sum_; }
+  /** Return the smallest recorded value (0 if empty) */
+  uint64_t min() const { return count_ ? min_ : 0; }
+  /** Return the largest recorded value (0 if empty) */
+  uint64_t max() const { return max_; }
+  /** Return the mean of the recorded values (0 if empty) */
+  double mean() const {
+    return count_ ? static_cast<double>(sum_) / count_ : 0.0;
+  }
+
+  /**
+   * Return the value at a given percentile
+   *
+   * The returned value is the upper bound of the bucket that contains the
+   * requested percentile, capped to max().
+   *
+   * @param[in] percentile  The percentile to query ([0, 100])
+   */
+  uint64_t value_at_percentile(const double percentile) const;
+
+  /** Return the number of values recorded in a bucket */
+  uint64_t bucket_count(const size_t idx) const { return counts_[idx]; }
+  /** Return the smallest value that maps to a given bucket */
+  static uint64_t bucket_lower_bound(const size_t idx);
+  /** Return the largest value that maps to a given bucket */
+  static uint64_t bucket_upper_bound(const size_t idx);
+  /** @} */
+
+  /**
+   * Return the index of the bucket a value maps to
+   *
+   * @param[in] value The value to map
+   */
+  static size_t bucket_index(const uint64_t value) {
+    const uint64_t sub_mask = (1ULL << kSubBucketBits) - 1;
+    if (value <= sub_mask)
+      return static_cast<size_t>(value);
+
+    int magnitude = 63 - __builtin_clzll(value);
+    if (magnitude > kMaxMagnitude)
+      return kNrBuckets - 1;
+    const int shift = magnitude - kSubBucketBits;
+    return (static_cast<size_t>(shift + 1) << kSubBucketBits) +
+        static_cast<size_t>((value >> shift) & sub_mask);
+  }
+
+ private:
+  ::std::array<uint64_t, kNrBuckets> counts_; /**< The per-bucket counts */
+  uint64_t count_;  /**< The total number of recorded values */
+  uint64_t sum_;    /**< The sum of the recorded values */
+  uint64_t min_;    /**< The smallest recorded value */
+  uint64_t max_;    /**< The largest recorded value */
+};
+
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_LATENCY_HISTOGRAM_H__
@@ -0,0 +1,97 @@
+/*
+ * latency_histogram_test.cc: Latency Histogram tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "schwanenlied/latency_histogram.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+
+class LatencyHistogramTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {};
+  virtual void TearDown() {};
+};
+
+TEST_F(LatencyHistogramTest, Buckets) {
+  // Small values are exact
+  for (uint64_t v = 0; v < 32; v++) {
+    const size_t idx = LatencyHistogram::bucket_index(v);
+    ASSERT_EQ(v, LatencyHistogram::bucket_lower_bound(idx));
+    ASSERT_EQ(v, LatencyHistogram::bucket_upper_bound(idx));
+  }
+
+  // Larger values land in a bucket that contains them, and the buckets are
+  // contiguous
+  uint64_t prev_upper = 31;
+  for (size_t idx = 32; idx < LatencyHistogram::kNrBuckets - 1; idx++) {
+    const uint64_t lower = LatencyHistogram::bucket_lower_bound(idx);
+    const uint64_t upper = LatencyHistogram::bucket_upper_bound(idx);
+    ASSERT_EQ(prev_upper + 1, lower);
+    ASSERT_EQ(idx, LatencyHistogram::bucket_index(lower));
+    ASSERT_EQ(idx, LatencyHistogram::bucket_index(upper));
+    prev_upper = upper;
+  }
+
+  // Huge values are clamped
+  ASSERT_EQ(LatencyHistogram::kNrBuckets - 1,
+            LatencyHistogram::bucket_index(~0ULL));
+}
+
+TEST_F(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram h;
+  ASSERT_EQ(0u, h.value_at_percentile(99.0));
+
+  for (uint64_t v = 1; v <= 1000; v++)
+    h.record(v);
+  ASSERT_EQ(1000u, h.count());
+  ASSERT_EQ(1u, h.min());
+  ASSERT_EQ(1000u, h.max());
+  ASSERT_DOUBLE_EQ(500.5, h.mean());
+
+  // Within the relative error of the sub-buckets
+  const uint64_t p50 = h.value_at_percentile(50.0);
+  ASSERT_GE(p50, 500u);
+  ASSERT_LE(p50, 500u + 500u / 16);
+  const uint64_t p99 = h.value_at_percentile(99.0);
+  ASSERT_GE(p99, 990u);
+  ASSERT_LE(p99, 1000u);
+  ASSERT_EQ(1000u, h.value_at_percentile(100.0));
+
+  // Merge, then reset
+  LatencyHistogram other;
+  other.record(5000);
+  h.merge(other);
+  ASSERT_EQ(1001u, h.count());
+  ASSERT_EQ(5000u, h.max());
+  h.reset();
+  ASSERT_EQ(0u, h.count());
+  ASSERT_EQ(0u, h.min());
+}
+
+} // namespace schwanenlied
@@ -34,14 +34,20 @@
 #ifndef SCHWANENLIED_LODP_LODP_ENDPOINT_H__
 #define SCHWANENLIED_LODP_LODP_ENDPOINT_H__
 
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <unordered_map>
 #include <memory>
+#include <vector>
 
 #include "schwanenlied/common.h"
 #include "schwanenlied/bloom_filter.h"
+#include "schwanenlied/clock.h"
+#include "schwanenlied/flight_recorder.h"
 #include "schwanenlied/ip_address.h"
+#include "schwanenlied/packet_trace.h"
+#include "schwanenlied/seqlock.h"
 #include "schwanenlied/crypto/blake2s.h"
 #include "schwanenlied/crypto/curve25519.h"
 #include "schwanenlied/crypto/ntor.h"
@@ -50,10 +56,14 @@
 #include "schwanenlied/crypto/siv_blake2s_xchacha.h"
 #include "schwanenlied/crypto/utils.h"
 #include "schwanenlied/lodp/lodp_errors.h"
+#include "schwanenlied/lodp/lodp_events.h"
 #include "schwanenlied/lodp/lodp_session.h"
+#include "schwanenlied/lodp/lodp_stage_timing.h"
+#include "schwanenlied/lodp/lodp_stats.h"
 
 // Autogenerated Protocol Buffers Header
 #include "lodp.pb.h"
+#include "lodp_state.pb.h"
 
 namespace schwanenlied {
 namespace lodp {
@@ -78,13 +88,22 @@ class LodpCallbacks {
    * application is responsible for copying it elsewhere if it does not wish to
    * drop the packet.
    *
+   * Alternatively, returning kErrorAgain signals that the transport is
+   * temporarily unable to accept datagrams.  Packets belonging to a
+   * LodpSession are then queued in the LodpSession and retransmitted when the
+   * application calls LodpEndpoint::on_writable() (See
+   * LodpSession::set_tx_watermarks()).
+   *
    * @param[in] endpoint  The LodpEndpoint that wishes to send a packet
    * @param[in] buf       The packet to send
    * @param[in] buf_len   The length of the packet
    * @param[in] addr      The destination address/port
    * @param[in] addr_len  The length of the sockaddr
    *
-   * @returns Return value is ignored and propagated back to the application
+   * @returns kErrorAgain - The transport is full (LodpSession packets are
+   *                        queued)
+   * @returns Other return values are ignored and propagated back to the
+   *          application
    */
   virtual int sendto(LodpEndpoint& endpoint,
                      const void* buf,
@@ -92,6 +111,39 @@ class LodpCallbacks {
                      const struct sockaddr *addr,
                      const socklen_t addr_len) = 0;
 
+  /**
+   * Send a burst of equally sized datagrams (UDP Generic Segmentation Offload)
+   *
+   * LodpSession::send_burst() encrypts multiple packets back to back into a
+   * single buffer where every packet except for the last is exactly
+   * segment_size bytes, so that it can be handed to the kernel with one
+   * sendmsg() call and a UDP_SEGMENT control message.
+   *
+   * The default implementation invokes sendto() once per segment, so
+   * applications that are not able to take advantage of GSO do not need to
+   * override this.
+   *
+   * @warning The same buffer lifetime and kErrorAgain rules as sendto() apply.
+   *
+   * @param[in] endpoint      The LodpEndpoint that wishes to send packets
+   * @param[in] buf           The packets to send
+   * @param[in] buf_len       The total length of the packets
+   * @param[in] segment_size  The length of each packet (The last packet may
+   *                          be shorter)
+   * @param[in] addr          The destination address/port
+   * @param[in] addr_len      The length of the sockaddr
+   *
+   * @returns kErrorAgain - The transport is full (The burst is queued)
+   * @returns Other return values are ignored and propagated back to the
+   *          application
+   */
+  virtual int sendto_gso(LodpEndpoint& endpoint,
+                         const void* buf,
+                         const size_t buf_len,
+                         const size_t segment_size,
+                         const struct sockaddr *addr,
+                         const socklen_t addr_len);
+
   /**
    * Set the pad size to be added to an outgoing packet
    *
@@ -166,6 +218,43 @@ class LodpCallbacks {
                        const void* buf,
                        const size_t buf_len) = 0;
 
+  /**
+   * Fragmented message reassembly buffer allocation callback
+   *
+   * When the first fragment of a message sent with LodpSession::send_message()
+   * arrives, this gives the application the opportunity to provide the
+   * destination buffer, so that fragments are copied directly into their final
+   * location.  Once the message is complete, on_recv() is invoked with the
+   * returned buffer and ownership of the buffer returns to the application.
+   * If the message is dropped instead (Timeout, memory limits, or the
+   * LodpSession closing), on_message_free() is invoked.
+   *
+   * The default implementation returns nullptr, which causes the LodpSession
+   * to use internally allocated storage (With the usual on_recv() buffer
+   * lifetime rules).
+   *
+   * @param[in] session The LodpSession that is receiving the message
+   * @param[in] len     The length of the message
+   *
+   * @returns nullptr - Use internally allocated storage
+   * @returns (A pointer to a buffer at least len bytes long)
+   */
+  virtual void* on_message_alloc(LodpSession& session,
+                                 const size_t len) {
+    return nullptr;
+  }
+
+  /**
+   * Fragmented message reassembly buffer release callback
+   *
+   * @sa on_message_alloc()
+   *
+   * @param[in] session The LodpSession that was receiving the message
+   * @param[in] buf     The buffer returned from on_message_alloc()
+   */
+  virtual void on_message_free(LodpSession& session,
+                               void* buf) {}
+
   /**
    * Rekey needed callback
    *
@@ -213,7 +302,72 @@ class LodpCallbacks {
    */
   virtual void on_close(const LodpSession& session) = 0;
 
-  // XXX: Logging
+  /**
+   * LodpSession writable callback
+   *
+   * This callback notifies the application that a LodpSession that previously
+   * failed a send with kErrorAgain has drained it's send queue to the low
+   * watermark (See LodpSession::set_tx_watermarks()), and is accepting data
+   * again.
+   *
+   * The default implementation does nothing.
+   *
+   * @param[in] session The LodpSession that is writable
+   */
+  virtual void on_writable(LodpSession& session) {}
+};
+
+/**
+ * The default implementations of the optional callbacks, for applications that
+ * use BasicLodpEndpoint with their own callbacks class
+ *
+ * The callbacks class must provide the same member functions as LodpCallbacks
+ * (Taking BasicLodpEndpoint<Derived>/BasicLodpSession<Derived> in place of
+ * LodpEndpoint/LodpSession), but they do not need to be virtual.  Deriving from
+ * this class (CRTP) provides the callbacks that LodpCallbacks has default
+ * implementations for, and they can be hidden by defining them in Derived.
+ *
+ * @tparam Derived  The application's callbacks class
+ */
+template <class Derived>
+class BasicLodpCallbacks {
+ public:
+  /** @sa LodpCallbacks::sendto_gso() */
+  int sendto_gso(BasicLodpEndpoint<Derived>& endpoint,
+                 const void* buf,
+                 const size_t buf_len,
+                 const size_t segment_size,
+                 const struct sockaddr *addr,
+                 const socklen_t addr_len) {
+    SL_ASSERT(segment_size > 0);
+
+    // No GSO support, send each segment individually
+    const uint8_t* ptr = static_cast<const uint8_t*>(buf);
+    int ret = kErrorOk;
+    for (size_t off = 0; off < buf_len; off += segment_size) {
+      const size_t len = buf_len - off < segment_size ? buf_len - off :
+          segment_size;
+      ret = static_cast<Derived*>(this)->sendto(endpoint, ptr + off, len, addr,
+                                                addr_len);
+      if (ret != kErrorOk)
+        break;
+    }
+
+    return ret;
+  }
+
+  /** @sa LodpCallbacks::on_message_alloc() */
+  void* on_message_alloc(BasicLodpSession<Derived>& session,
+                         const size_t len) {
+    return nullptr;
+  }
+
+  /** @sa LodpCallbacks::on_message_free() */
+  void on_message_free(BasicLodpSession<Derived>& session,
+                       void* buf) {}
+
+  /** @sa LodpCallbacks::on_writable() */
+  void on_writable(BasicLodpSession<Derived>& session) {}
 };
 
 /**
@@ -228,30 +382,26 @@ class LodpCallbacks {
  * events, with the user calling on_packet() to process incoming packets
  * destined for the LodpEndpoint.
  *
+ * The callbacks are a template parameter.  LodpEndpoint (and LodpSession) use
+ * the virtual LodpCallbacks interface, and are compiled into the library.
+ * Applications that want the compiler to inline their handlers into the packet
+ * processing can instead derive a (non-virtual) callbacks class from
+ * BasicLodpCallbacks, and use BasicLodpEndpoint directly, which requires
+ * including lodp_endpoint_impl.h.
+ *
+ * @tparam Callbacks  The callbacks type (LodpCallbacks, or a class derived
+ *                    from BasicLodpCallbacks)
+ *
  * @todo Use schwanenlied::Timer for cookie rotation
  */
-class LodpEndpoint {
+template <class Callbacks>
+class BasicLodpEndpoint {
  public:
+  /** The LodpSession type used by this LodpEndpoint type */
+  typedef BasicLodpSession<Callbacks> Session;
+
   /** LodpEndpoint statistics */
-  struct Stats {
-    /** @{ */
-    uint64_t tx_bytes_;             /**< Total bytes sent */
-    uint64_t rx_bytes_;             /**< Total bytes received */
-    /** @} */
-
-    // Receive statistics (# of packets)
-    /** @{ */
-    uint64_t rx_undersized_;        /**< Undersized packets */
-    uint64_t rx_oversized_;         /**< Oversized packets */
-    uint64_t rx_decrypt_failed_;    /**< Packets we failed to decrypt */
-    uint64_t rx_invalid_envelope_;  /**< Protobuf deserialization error */
-    uint64_t rx_bad_packet_format_; /**< Packet format error */
-    uint64_t rx_init_replays_;      /**< Replayed INIT packets */
-    uint64_t rx_invalid_cookie_;    /**< Invalid HANDSHAKE cookies */
-    uint64_t rx_cookie_replays_;    /**< Replayed handshake cookies */
-    uint64_t rx_handshake_failed_;  /**< Failed ntor handshakes */
-    /** @} */
-  };
+  typedef LodpEndpointStats Stats;
 
   /**
    * Create a initiator (client) only LodpEndpoint.
@@ -265,10 +415,10 @@ class LodpEndpoint {
    * @param[in] ctxt          The LodpEndpoint user context handle
    * @param[in] safe_logging  Sanitize IP addresses when logging
    */
-  LodpEndpoint(crypto::Random& rng,
-               LodpCallbacks& callbacks,
-               void *ctxt,
-               const bool safe_logging);
+  BasicLodpEndpoint(crypto::Random& rng,
+                    Callbacks& callbacks,
+                    void *ctxt,
+                    const bool safe_logging);
 
   /**
    * Create a responder (client + server) LodpEndpoint.
@@ -287,26 +437,147 @@ class LodpEndpoint {
    * @param[in] node_id       The ID of the endpoint (for crypto::NtorHandshake)
    * @param[in] node_id_len   The length of the node_id
    */
-  LodpEndpoint(crypto::Random& rng,
-               LodpCallbacks& callbacks,
-               void *ctxt,
-               const bool safe_logging,
-               const crypto::Curve25519::PrivateKey& private_key,
-               const uint8_t* node_id,
-               const size_t node_id_len);
+  BasicLodpEndpoint(crypto::Random& rng,
+                    Callbacks& callbacks,
+                    void *ctxt,
+                    const bool safe_logging,
+                    const crypto::Curve25519::PrivateKey& private_key,
+                    const uint8_t* node_id,
+                    const size_t node_id_len);
 
-  ~LodpEndpoint();
+  ~BasicLodpEndpoint();
 
   /** @{ */
   /** Get the user defined context handle */
   void* context() const { return ctxt_; }
   /** Set the user defined context handle */
   void set_context(void *ctxt) { ctxt_ = ctxt; }
+
+  /** Get the Clock used for timekeeping and Timers */
+  Clock& clock() const { return *clock_; }
+
+  /**
+   * Set the Clock used for timekeeping and Timers (Eg: a SimClock)
+   *
+   * This must be called before any LodpSessions are created, and the Clock
+   * must outlive the LodpEndpoint.  The default is Clock::system().  Busy
+   * endpoints should use a CachedClock that is updated once per event loop
+   * iteration, as the time is otherwise read several times per packet.
+   *
+   * @param[in] clock The Clock to use
+   */
+  void set_clock(Clock& clock);
+
+  /** Get the largest UDP MTU accepted from peers with a LodpSession */
+  size_t max_rx_udp_mtu() const { return max_rx_udp_mtu_; }
+
+  /**
+   * Set the largest UDP MTU accepted from peers with a LodpSession
+   *
+   * Incoming packets larger than the peer's ceiling are dropped, and counted
+   * in Stats::rx_over_mtu_.  Peers without a LodpSession are limited to
+   * IPAddress::udp_mtu().  Peers with a LodpSession are limited to the
+   * largest of the LodpSession::udp_mtu(), the LodpSession's path MTU
+   * discovery limit, and max_udp_mtu.  The default (0) does not accept
+   * anything larger, so responders whose peers use path MTU discovery must
+   * raise this.
+   *
+   * @param[in] max_udp_mtu The largest UDP MTU to accept (Capped to
+   *                        IPAddress::udp_max_mtu())
+   */
+  void set_max_rx_udp_mtu(const size_t max_udp_mtu) {
+    max_rx_udp_mtu_ = max_udp_mtu;
+  }
   /** @} */
 
   /** @{ */
   /** Get the current LodpEndpoint Stats */
-  const struct Stats& stats() const { return stats_; }
+  const Stats& stats() const { return stats_; }
+
+  /**
+   * Get a snapshot of the hot path stage timing LatencyHistograms
+   *
+   * The histograms are in LatencyHistogram::now() ticks, and cover every
+   * LodpSession belonging to this LodpEndpoint.
+   *
+   * @param[out] hist The LodpStageHistograms to store the snapshot in
+   *
+   * @returns true - The snapshot was taken
+   * @returns false - The library was built without LODP_STAGE_TIMING (hist
+   *                  is cleared)
+   */
+  bool stage_histograms(LodpStageHistograms& hist) const;
+
+  /** Clear the hot path stage timing LatencyHistograms */
+  void reset_stage_histograms();
+
+  /**
+   * Publish a LodpStatsSnapshot for other threads
+   *
+   * This must be called from the thread that owns the LodpEndpoint.  The
+   * aggregate LodpSession counters are calculated by walking every
+   * LodpSession, so it should be called periodically (Eg: from a Timer)
+   * rather than per packet.
+   */
+  void publish_stats();
+
+  /**
+   * Get the most recently published LodpStatsSnapshot
+   *
+   * Unlike everything else, this may be called from any thread, and never
+   * blocks the thread that owns the LodpEndpoint.
+   *
+   * @param[out] snap The LodpStatsSnapshot to store the published stats in
+   */
+  void stats_snapshot(LodpStatsSnapshot& snap) const {
+    published_stats_.load(snap);
+  }
+  /** @} */
+
+  /** @{ */
+  /**
+   * Enable or disable the FlightRecorder
+   *
+   * When enabled, the packet lifecycle events (See LodpEvent) of this
+   * LodpEndpoint and every LodpSession belonging to it are recorded into a
+   * binary ring buffer.  Addresses are recorded as IPAddress::hash() if the
+   * LodpEndpoint was constructed with safe_logging set.  Changing the size
+   * discards all of the recorded events.
+   *
+   * @param[in] nr_records  The number of events to retain (0 disables)
+   */
+  void set_flight_recorder(const size_t nr_records);
+
+  /**
+   * Get the FlightRecorder
+   *
+   * This can be used to dump the recorded events on demand, or to arm the
+   * dump on error trigger (FlightRecorder::arm()), which fires the first time
+   * processing a authenticated packet fails.  Decode the events with
+   * FlightRecorder::render() and lodp_event_name().
+   *
+   * @returns nullptr - The FlightRecorder is disabled
+   */
+  FlightRecorder* flight_recorder() const { return recorder_.get(); }
+  /** @} */
+
+  /** @{ */
+  /**
+   * Enable or disable packet capture
+   *
+   * When enabled, every datagram passed to on_packet() (Including ones that
+   * are later rejected), and every datagram accepted by
+   * LodpCallbacks::sendto()/sendto_gso() (GSO bursts are split into
+   * datagrams) is captured into the PacketTrace, along with the Clock time and
+   * the peer's IPAddress::hash().  A PacketTrace may be shared by multiple
+   * LodpEndpoints, and must be detached before it is destroyed.
+   *
+   * @param[in] trace The PacketTrace to capture into (nullptr disables)
+   */
+  void set_packet_trace(PacketTrace* trace) { trace_ = trace; }
+
+  /** Get the PacketTrace (nullptr if capture is disabled) */
+  PacketTrace* packet_trace() const { return trace_; }
   /** @} */
 
   /** @{ */
@@ -318,7 +589,7 @@ class LodpEndpoint {
    * @returns nullptr - No LodpSession currently exists to the remote peer
    * @returns (a pointer to the LodpSession)
    */
-  LodpSession* session(const IPAddress& addr) const {
+  Session* session(const IPAddress& addr) const {
     auto got = session_table_.find(addr);
     if (got != session_table_.end())
       return got->second.get();
@@ -338,8 +609,8 @@ class LodpEndpoint {
    * @returns nullptr - No LodpSession currently exists to the remote peer
    * @returns (a pointer to the LodpSession)
    */
-  inline LodpSession* session(const struct sockaddr* addr,
-                              const socklen_t addr_len) const {
+  inline Session* session(const struct sockaddr* addr,
+                          const socklen_t addr_len) const {
     if (!IPAddress::is_sockaddr_valid(addr, addr_len))
       return nullptr;
 
@@ -381,7 +652,7 @@ class LodpEndpoint {
               const uint8_t* node_id,
               const size_t node_id_len,
               const IPAddress& addr,
-              LodpSession*& session);
+              Session*& session);
 
   /**
    * Connect to a remote peer given a sockaddr
@@ -411,7 +682,7 @@ class LodpEndpoint {
                      const size_t node_id_len,
                      const struct sockaddr *addr,
                      const socklen_t addr_len,
-                     LodpSession*& session) {
+                     Session*& session) {
     if (!IPAddress::is_sockaddr_valid(addr, addr_len))
       return kErrorAFNoSupport;
 
@@ -472,12 +743,181 @@ class LodpEndpoint {
     const IPAddress src_addr(hash_, addr, addr_len, safe_logging_);
     return on_packet(buf, buf_len, src_addr);
   }
+
+  /**
+   * Process a coalesced burst of incoming packets (UDP Generic Receive
+   * Offload)
+   *
+   * When UDP_GRO is enabled on a socket, the kernel may return multiple
+   * datagrams from the same peer in one recvmsg() call, with every datagram
+   * except for the last being exactly segment_size bytes (The segment size is
+   * returned in a UDP_GRO control message).  This splits such a buffer and
+   * processes each datagram as if it were passed to on_packet().
+   *
+   * @param[in] buf           A pointer to a buffer containing the packets
+   * @param[in] buf_len       The total length of the packets
+   * @param[in] segment_size  The length of each packet (The last packet may
+   *                          be shorter)
+   * @param[in] addr          The source IP address/port of the packets
+   *
+   * @returns kErrorOK    - Every packet was processed successfully
+   * @returns kErrorInval - The parameters are invalid
+   * @returns (Any on_packet() return value) - The first error encountered
+   *          (Processing continues with the remaining packets)
+   */
+  int on_packets(const uint8_t* buf,
+                 const size_t buf_len,
+                 const size_t segment_size,
+                 const IPAddress& addr);
+
+  /**
+   * Process a coalesced burst of incoming packets
+   *
+   * This is a convenience wrapper for people that do not want to use IPAddress.
+   *
+   * @sa on_packets()
+   *
+   * @param[in] buf           A pointer to a buffer containing the packets
+   * @param[in] buf_len       The total length of the packets
+   * @param[in] segment_size  The length of each packet (The last packet may
+   *                          be shorter)
+   * @param[in] addr          The source IP address/port of the packets
+   * @param[in] addr_len      The length of the sockaddr
+   *
+   * @returns kErrorOK          - Every packet was processed successfully
+   * @returns kErrorInval       - The parameters are invalid
+   * @returns kErrorAFNoSupport - The address family is not supported
+   * @returns (Any on_packet() return value) - The first error encountered
+   */
+  inline int on_packets(const uint8_t* buf,
+                        const size_t buf_len,
+                        const size_t segment_size,
+                        const struct sockaddr *addr,
+                        const socklen_t addr_len) {
+    if (!IPAddress::is_sockaddr_valid(addr, addr_len))
+      return kErrorAFNoSupport;
+
+    const IPAddress src_addr(hash_, addr, addr_len, safe_logging_);
+    return on_packets(buf, buf_len, segment_size, src_addr);
+  }
+  /** @} */
+
+  /** @{ */
+  /**
+   * Transmit all pending coalesced messages
+   *
+   * This calls LodpSession::flush() on every LodpSession with coalesced
+   * messages pending transmission (See LodpSession::set_coalescing()).  It is
+   * intended to be called once at the end of each event loop iteration.
+   * LodpSessions that can not be flushed yet (Eg: A rekey is in progress)
+   * stay pending, and are retried by the next call.
+   *
+   * @returns kErrorOk - Success
+   * @returns (User specified value) - The first non-kErrorOk value returned
+   *                                   from the callback
+   */
+  int flush();
+
+  /**
+   * Transmit packets queued while the transport was full
+   *
+   * This should be called when the transport becomes writable again after
+   * LodpCallbacks::sendto() returned kErrorAgain.  The queued packets of each
+   * LodpSession are retransmitted in the order that the LodpSessions were
+   * blocked, until the queues are empty or the transport fills up again.
+   * LodpCallbacks::on_writable() is invoked for LodpSessions that drain to
+   * their low watermark.
+   *
+   * @returns kErrorOk    - Success (All queued packets were sent)
+   * @returns kErrorAgain - The transport filled up again (Call this again when
+   *                        it becomes writable)
+   * @returns (User specified value) - The first non-kErrorOk value returned
+   *                                   from the callback (The packet is
+   *                                   dropped)
+   */
+  int on_writable();
+  /** @} */
+
+  /** @{ */
+  /**
+   * Serialize the responder state for a hot restart
+   *
+   * The cookie keys, the INIT/cookie replay filters and every established
+   * LodpSession (session keys, sequence numbers and the receive bitmap) are
+   * serialized and encrypted with a key derived from the identity private key,
+   * so that only a process with the same identity can import_state() it.
+   * Plaintext copies of the state are wiped before this returns.
+   *
+   * LodpSessions that are still handshaking or rekeying are not exported (the
+   * peer will retransmit and handshake with the new process), and neither are
+   * queued or partially reassembled messages, or FEC blocks.  Once the state
+   * has been exported, the LodpEndpoint must not process or send any more
+   * packets, so the LodpSessions should be closed with
+   * LodpSession::close(false) and the LodpEndpoint destroyed.
+   *
+   * @param[out] state The std::string where the encrypted state is stored
+   *
+   * @returns kErrorOk           - Success
+   * @returns kErrorNotResponder - The LodpEndpoint is not a responder
+   */
+  int export_state(::std::string& state) const;
+
+  /**
+   * Import the responder state serialized by export_state()
+   *
+   * This must be called on a freshly constructed responder with the same
+   * identity key and node ID as the exporting LodpEndpoint, before any
+   * packets are processed.  Each imported LodpSession is handed to the
+   * application via LodpCallbacks::on_accept() (should_accept() is not
+   * consulted).  On failure, the LodpEndpoint is left untouched.
+   *
+   * @param[in] buf The encrypted state
+   * @param[in] len The length of the encrypted state
+   *
+   * @returns kErrorOk           - Success
+   * @returns kErrorNotResponder - The LodpEndpoint is not a responder
+   * @returns kErrorIsConn       - The LodpEndpoint already has LodpSessions
+   * @returns kErrorInval        - The state is corrupt, or was exported by a
+   *                               LodpEndpoint with a different identity
+   */
+  int import_state(const void* buf,
+                   const size_t len);
+  /** @} */
+
+  /** @{ */
+  /**
+   * Back the INIT and cookie replay filters with files
+   *
+   * The filters are kept in shared mappings of the files (See
+   * BloomFilter::map_file()), so a responder that is restarted with the same
+   * paths resumes with the replay filters of it's predecessor instead of with
+   * empty ones.  A file that does not hold a compatible filter is
+   * initialized with the current filter.  The mappings are not explicitly
+   * written back while packets are being processed.  A filter whose file can
+   * not be used is left in memory.
+   *
+   * @param[in] init_path   The path to the INIT replay filter file
+   * @param[in] cookie_path The path to the cookie replay filter file
+   *
+   * @returns kErrorOk           - Success
+   * @returns kErrorNotResponder - The LodpEndpoint is not a responder
+   * @returns kErrorBadFD        - A file could not be opened or mapped
+   */
+  int map_replay_filters(const char* init_path,
+                         const char* cookie_path);
+
+  /**
+   * Synchronously write the file backed replay filters back to disk
+   *
+   * This is intended for orderly shutdown.
+   */
+  void sync_replay_filters();
   /** @} */
 
  private:
-  LodpEndpoint() = delete;
-  LodpEndpoint(const LodpEndpoint&) = delete;
-  void operator=(const LodpEndpoint&) = delete;
+  BasicLodpEndpoint() = delete;
+  BasicLodpEndpoint(const BasicLodpEndpoint&) = delete;
+  void operator=(const BasicLodpEndpoint&) = delete;
 
   // Implementation specifc constants
   /** @{ */
@@ -489,6 +929,8 @@ class LodpEndpoint {
   static const int kCookieRotateInterval = 30;
   /** The time past the cookie generation time that a cookie is valid (sec) */
   static const int kCookieGraceInterval = 30 * 2;
+  /** The export_state() format version */
+  static const uint32_t kStateVersion = 1;
   /** @} */
 
   // Protocol constants
@@ -506,8 +948,10 @@ class LodpEndpoint {
   /** @{ */
   /**
    * Rotate the key used in cookie generation if needed
+   *
+   * @param[in] now The current time
    */
-  void rotate_cookie();
+  void rotate_cookie(const Clock::time_point& now);
 
   /**
    * Given a INIT or HANDSHAKE packet, calculate (*but not validate*) a cookie
@@ -535,6 +979,74 @@ class LodpEndpoint {
   bool validate_cookie(const IPAddress& addr, const packet::Envelope& pkt);
   /** @} */
 
+  /**
+   * Deliver received data to the user via LodpCallbacks::on_recv()
+   *
+   * This exists so that the time spent in the callback can be accounted for,
+   * without touching the LodpSession after the callback returns (it may have
+   * been closed).
+   */
+  void on_recv(Session& session,
+               const void* buf,
+               const size_t len) {
+    LODP_STAGE_START(start);
+    callbacks_.on_recv(session, buf, len);
+    LODP_STAGE_RECORD(*this, kRxCallback, start);
+  }
+
+  // FlightRecorder
+  /** @{ */
+  /** Record a event in the FlightRecorder, if enabled */
+  void log_event(const LodpEvent event,
+                 const Session* session,
+                 const IPAddress* addr,
+                 const uint64_t arg0 = 0,
+                 const uint64_t arg1 = 0) {
+    if (recorder_)
+      recorder_->record(static_cast<uint16_t>(event),
+                        reinterpret_cast<uintptr_t>(session), addr, arg0,
+                        arg1);
+  }
+
+  /**
+   * Record a LodpEvent::kError, and fire the dump on error trigger
+   *
+   * @param[in] error   The error code
+   * @param[in] session The LodpSession if any (Not dereferenced)
+   * @param[in] addr    The peer address
+   */
+  void log_error(const int error,
+                 const Session* session,
+                 const IPAddress& addr);
+  /** @} */
+
+  // PacketTrace
+  /** @{ */
+  /**
+   * Capture a datagram (or a GSO burst) in the PacketTrace, if enabled
+   *
+   * @param[in] direction     PacketTrace::kDirRx/kDirTx
+   * @param[in] addr          The peer address
+   * @param[in] buf           The packet(s)
+   * @param[in] len           The total length of the packet(s)
+   * @param[in] segment_size  The GSO segment size (0 for a single datagram)
+   */
+  void trace_packet(const uint8_t direction,
+                    const IPAddress& addr,
+                    const void* buf,
+                    const size_t len,
+                    const size_t segment_size = 0) {
+    if (trace_ == nullptr)
+      return;
+
+    const Clock::time_point now = clock_->now();
+    const uint8_t* p = static_cast<const uint8_t*>(buf);
+    const size_t seg = segment_size > 0 ? segment_size : len;
+    for (size_t off = 0; off < len; off += seg)
+      trace_->record(direction, now, addr, p + off, ::std::min(seg, len - off));
+  }
+  /** @} */
+
   // Packet RX/TX
   /** @{ */
   /**
@@ -584,7 +1096,7 @@ class LodpEndpoint {
    */
   int on_handshake_packet(const packet::Envelope& pkt,
                           const IPAddress& addr,
-                          LodpSession* tcb);
+                          Session* tcb);
 
   /**
    * Encrypt and transmit a packet, given KDF material
@@ -607,9 +1119,11 @@ class LodpEndpoint {
 
   // User config/callbacks
   /** @{ */
-  LodpCallbacks& callbacks_;  /**< Callbacks for this LodpEndpoint and LodpSession */
+  Callbacks& callbacks_;  /**< Callbacks for this LodpEndpoint and LodpSession */
   void* ctxt_;                /**< The LodpEndpoint user context handle */
   const bool safe_logging_;   /**< Sanitize IP addresses when logging? */
+  Clock* clock_;              /**< The Clock used for timekeeping */
+  size_t max_rx_udp_mtu_;     /**< The largest UDP MTU accepted (0 = none) */
   /** @} */
 
   // Generic crypto
@@ -665,22 +1179,45 @@ class LodpEndpoint {
    * When a LodpSession is removed from this table (via LodpSession::close()),
    * the resources associated with the session are released.
    */
-  ::std::unordered_map<IPAddress, ::std::unique_ptr<LodpSession>> session_table_;
+  ::std::unordered_map<IPAddress, ::std::unique_ptr<Session>> session_table_;
+  /** LodpSessions with coalesced messages pending transmission */
+  ::std::vector<Session*> flush_pending_;
+  /** LodpSessions with packets queued while the transport was full */
+  ::std::vector<Session*> tx_pending_;
   /** @} */
 
   /** @{ */
-  struct Stats stats_;    /**< Various LodpEndpoint statistics */
+  Stats stats_;          /**< Various LodpEndpoint statistics */
+  /** The LodpSessionStats of every closed LodpSession */
+  LodpSessionStats closed_session_stats_;
+  /** The stats published by publish_stats() */
+  SeqLock<LodpStatsSnapshot> published_stats_;
+#ifdef LODP_STAGE_TIMING
+  LodpStageHistograms stage_hist_; /**< Hot path stage timing */
+#endif
   /** @} */
 
+  /** The FlightRecorder (nullptr if disabled) */
+  ::std::unique_ptr<FlightRecorder> recorder_;
+  /** The PacketTrace (nullptr if disabled, not owned) */
+  PacketTrace* trace_;
+
   /** LodpSession is tightly coupled with LodpEndpoint */
-  friend LodpSession;
+  friend Session;
 };
 
+// LodpEndpoint/LodpSession are instantiated in lodp_endpoint.cc/lodp_session.cc
+extern template class BasicLodpEndpoint<LodpCallbacks>;
+extern template class BasicLodpSession<LodpCallbacks>;
+
 crypto::SecureBuffer derive_intro_siv_key(const crypto::Curve25519::PublicKey&
                                           public_key);
 crypto::SecureBuffer derive_initiator_siv_key(const crypto::SecureBuffer&
                                               key_source);
 crypto::SecureBuffer derive_initiator_siv_key(const ::std::string &key_source);
+crypto::SecureBuffer derive_state_siv_key(const crypto::Curve25519::PrivateKey&
+                                          private_key);
+void scrub_state(state::Endpoint& state);
 
 } // namespace lodp
 } // namespace schwanenlied
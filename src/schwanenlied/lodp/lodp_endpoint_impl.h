@@ -0,0 +1,938 @@
+/**
+ * @file    lodp_endpoint_impl.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   LODP endpoint (TEMPLATE IMPLEMENTATION)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_LODP_LODP_ENDPOINT_IMPL_H__
+#define SCHWANENLIED_LODP_LODP_ENDPOINT_IMPL_H__
+
+#include <algorithm>
+
+#include "schwanenlied/lodp/lodp_endpoint.h"
+#include "schwanenlied/lodp/lodp_probes.h"
+#include "schwanenlied/lodp/lodp_session_impl.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+template <class Callbacks>
+const int BasicLodpEndpoint<Callbacks>::kCookieRotateInterval;
+
+template <class Callbacks>
+const int BasicLodpEndpoint<Callbacks>::kCookieGraceInterval;
+
+template <class Callbacks>
+const uint32_t BasicLodpEndpoint<Callbacks>::kStateVersion;
+
+template <class Callbacks>
+BasicLodpEndpoint<Callbacks>::BasicLodpEndpoint(crypto::Random& rng,
+                                                Callbacks& callbacks,
+                                                void* ctxt,
+                                                const bool safe_logging) :
+    callbacks_(callbacks),
+    ctxt_(ctxt),
+    safe_logging_(safe_logging),
+    clock_(&Clock::system()),
+    max_rx_udp_mtu_(0),
+    rng_(rng),
+    hash_(rng),
+    is_listening_(false),
+    stats_(),
+    closed_session_stats_(),
+    published_stats_(),
+    trace_(nullptr) {
+  // Empty!
+}
+
+template <class Callbacks>
+BasicLodpEndpoint<Callbacks>::BasicLodpEndpoint(
+    crypto::Random& rng,
+    Callbacks& callbacks,
+    void* ctxt,
+    const bool safe_logging,
+    const crypto::Curve25519::PrivateKey& private_key,
+    const uint8_t* node_id,
+    const size_t node_id_len) :
+    callbacks_(callbacks),
+    ctxt_(ctxt),
+    safe_logging_(safe_logging),
+    clock_(&Clock::system()),
+    max_rx_udp_mtu_(0),
+    rng_(rng),
+    hash_(rng),
+    is_listening_(true),
+    node_id_(new crypto::SecureBuffer(node_id, node_id_len)),
+    identity_private_key_(new crypto::Curve25519::PrivateKey(private_key)),
+    identity_public_key_(new crypto::Curve25519::PublicKey(private_key)),
+    introduction_siv_(new crypto::SIVBlake2sXChaCha(rng)),
+    ephemeral_tx_siv_(new crypto::SIVBlake2sXChaCha(rng)),
+    init_filter_(new BloomFilter(rng, kInitFilterSize, 0.001)),
+    cookie_filter_(new BloomFilter(rng, kCookieFilterSize, 0.001)),
+    cookie_(new crypto::Blake2s(rng)),
+    prev_cookie_(new crypto::Blake2s(rng)),
+    cookie_rotate_time_(clock_->now() +
+                        ::std::chrono::seconds(kCookieRotateInterval)),
+    cookie_expire_time_(clock_->now()),
+    stats_(),
+    closed_session_stats_(),
+    published_stats_(),
+    trace_(nullptr) {
+  // Validate that the user didn't screw up
+  SL_ASSERT(node_id_->length() > 0);
+
+  // Derive and set the key for introduction_siv_
+  const auto intro_siv_key = derive_intro_siv_key(*identity_public_key_);
+  introduction_siv_->set_key(intro_siv_key.data(), intro_siv_key.length());
+}
+
+template <class Callbacks>
+BasicLodpEndpoint<Callbacks>::~BasicLodpEndpoint() {
+  /** @todo Close off all of the sessions instead of asserting */
+  SL_ASSERT(session_table_.empty());
+}
+
+template <class Callbacks>
+int BasicLodpEndpoint<Callbacks>::connect(
+    void* ctxt,
+    const crypto::Curve25519::PublicKey& public_key,
+    const uint8_t* node_id,
+    const size_t node_id_len,
+    const IPAddress& addr,
+    Session*& session) {
+  if (node_id == nullptr)
+    return kErrorInval;
+  if (node_id_len == 0)
+    return kErrorInval;
+  if (session_table_.count(addr) != 0)
+    return kErrorIsConn;
+
+  Session* tcb = new Session(*this, ctxt, public_key, node_id,
+                             node_id_len, addr);
+  session_table_[addr] = ::std::unique_ptr<Session>(tcb);
+  session = tcb;
+  stats_.sessions_connected_++;
+  LODP_PROBE3(session_create, LODP_PROBE_SESSION_ID(tcb), addr.hash(), 1);
+  log_event(LodpEvent::kSessionCreate, tcb, &addr, 1);
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpEndpoint<Callbacks>::on_packet(const uint8_t* buf,
+                                            const size_t buf_len,
+                                            const IPAddress& addr) {
+  if (buf == nullptr)
+    return kErrorInval;
+  if (buf_len == 0)
+    return kErrorInval;
+
+  stats_.rx_bytes_ += buf_len;
+  LODP_PROBE2(rx, addr.hash(), buf_len);
+  log_event(LodpEvent::kRx, nullptr, &addr, buf_len);
+  trace_packet(PacketTrace::kDirRx, addr, buf, buf_len);
+
+  // Drop packets that are under/oversized without further processing
+  if (buf_len < kMinPacketLength) {
+    stats_.rx_undersized_++;
+    return kErrorUndersizedPacket;
+  }
+  if (buf_len > addr.udp_max_mtu()) {
+    stats_.rx_oversized_++;
+    return kErrorOversizedPacket;
+  }
+
+  /*
+   * Drop packets that are larger than what the peer could have legitimately
+   * sent.  Nothing larger than IPAddress::udp_mtu() is accepted until there
+   * is a LodpSession, after which it is whatever the LodpSession has probed
+   * or is configured to accept.
+   */
+  Session* tcb = nullptr;
+  size_t max_mtu = addr.udp_mtu();
+  auto got = session_table_.find(addr);
+  if (got != session_table_.end()) {
+    tcb = got->second.get();
+    max_mtu = ::std::max(max_mtu, tcb->rx_udp_mtu());
+    max_mtu = ::std::max(max_mtu, ::std::min(max_rx_udp_mtu_,
+                                             addr.udp_max_mtu()));
+  }
+  if (buf_len > max_mtu) {
+    stats_.rx_over_mtu_++;
+    return kErrorOversizedPacket;
+  }
+
+  // Allocate a buffer to store the plaintext
+  ::std::string plaintext;  // TODO/Performance: Buffer pool
+
+  // Attempt to decrypt the packet
+  LODP_STAGE_START(decrypt_start);
+  bool session_decrypt = false;
+  if (tcb != nullptr) {
+    // A Session exists, try the Session's keys
+    session_decrypt = tcb->siv_decrypt(buf, buf_len, plaintext);
+    if (session_decrypt)
+      goto decrypt_ok;
+  }
+  if (is_listening_) {
+    // Try the Endpoint's Introduction key
+    if (introduction_siv_->decrypt(buf, buf_len, plaintext))
+      goto decrypt_ok;
+  }
+
+  // Welp, failed to decrypt the packet, drop it and return
+  LODP_STAGE_RECORD(*this, kRxDecrypt, decrypt_start);
+  LODP_PROBE2(decrypt_fail, addr.hash(), buf_len);
+  log_event(LodpEvent::kDecryptFail, nullptr, &addr, buf_len);
+  stats_.rx_decrypt_failed_++;
+  return kErrorDecryptionFailure;
+
+decrypt_ok:
+  LODP_STAGE_RECORD(*this, kRxDecrypt, decrypt_start);
+  LODP_PROBE3(decrypt_ok, addr.hash(), buf_len, session_decrypt ? 0 : 1);
+  log_event(LodpEvent::kDecryptOk, session_decrypt ? tcb : nullptr, &addr,
+            buf_len, session_decrypt ? 0 : 1);
+
+  // Deserialize the packet into a protobuf object
+  LODP_STAGE_START(parse_start);
+  ::std::unique_ptr<packet::Envelope> envelope(new packet::Envelope());  // TODO/Performance: Buffer pool
+  bool parsed = envelope->ParseFromString(plaintext);
+  LODP_STAGE_RECORD(*this, kRxParse, parse_start);
+  if (!parsed) {
+    stats_.rx_invalid_envelope_++;
+    return kErrorInvalidEnvelope;
+  }
+  if (!envelope->has_packet_type()) {
+    stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  stats_.rx_packets_[envelope->packet_type()]++;
+  LODP_PROBE3(dispatch, addr.hash(),
+              session_decrypt ? LODP_PROBE_SESSION_ID(tcb) : 0,
+              static_cast<int>(envelope->packet_type()));
+  log_event(LodpEvent::kDispatch, session_decrypt ? tcb : nullptr, &addr,
+            envelope->packet_type());
+
+  /*
+   * Do the actual packet processing, now that we have a "tenatively" valid
+   * packet (We could decrypt it, and it contained a valid protobuf)
+   */
+  if (session_decrypt) {
+    SL_ASSERT(tcb != nullptr);
+    // Packets aimed at a session
+    LODP_STAGE_START(dispatch_start);
+    int ret = kErrorBadPacketFormat;
+    switch (envelope->packet_type()) {
+    case packet::Envelope::DATA:
+      ret = tcb->on_data_packet(*envelope);
+      break;
+    case packet::Envelope::INIT_ACK:
+      ret = tcb->on_init_ack_packet(*envelope);
+      break;
+    case packet::Envelope::HANDSHAKE_ACK:
+      ret = tcb->on_handshake_ack_packet(*envelope);
+      break;
+    case packet::Envelope::REKEY:
+      ret = tcb->on_rekey_packet(*envelope);
+      break;
+    case packet::Envelope::REKEY_ACK:
+      ret = tcb->on_rekey_ack_packet(*envelope);
+      break;
+    case packet::Envelope::SHUTDOWN:
+      ret = tcb->on_shutdown_packet(*envelope);
+      break;
+    case packet::Envelope::PMTU_PROBE:
+      ret = tcb->on_pmtu_probe_packet(*envelope);
+      break;
+    case packet::Envelope::PMTU_PROBE_ACK:
+      ret = tcb->on_pmtu_probe_ack_packet(*envelope);
+      break;
+    case packet::Envelope::FEC_FEEDBACK:
+      ret = tcb->on_fec_feedback_packet(*envelope);
+      break;
+    default:
+      stats_.rx_bad_packet_format_++;
+      return kErrorBadPacketFormat;
+    }
+    LODP_STAGE_RECORD(*this, kRxDispatch, dispatch_start);
+    if (ret != kErrorOk && ret != kErrorAgain)
+      log_error(ret, tcb, addr);  // tcb may have been closed
+    return ret;
+  } else {
+    // Packets aimed at the endpoint
+    if (envelope->packet_type() == packet::Envelope::INIT) {
+      return on_init_packet(*envelope, addr, buf, buf_len);
+    } else if (envelope->packet_type() == packet::Envelope::HANDSHAKE) {
+      int ret = on_handshake_packet(*envelope, addr, tcb);
+      if (ret == kErrorHandshakeFailed)
+        log_error(ret, tcb, addr);
+      return ret;
+    }
+  }
+
+  // I-it's not like I decrypted that packet for you or anything.... baka.
+  stats_.rx_bad_packet_format_++;
+  return kErrorBadPacketFormat;
+}
+
+template <class Callbacks>
+int BasicLodpEndpoint<Callbacks>::on_packets(const uint8_t* buf,
+                                             const size_t buf_len,
+                                             const size_t segment_size,
+                                             const IPAddress& addr) {
+  if (buf == nullptr)
+    return kErrorInval;
+  if (buf_len == 0 || segment_size == 0)
+    return kErrorInval;
+
+  /*
+   * Each segment is a independent datagram, so processing may close the
+   * LodpSession half way through the burst.  on_packet() looks up the session
+   * each time so this is harmless.
+   */
+  int ret = kErrorOk;
+  for (size_t off = 0; off < buf_len; off += segment_size) {
+    const size_t len = ::std::min(segment_size, buf_len - off);
+    int pkt_ret = on_packet(buf + off, len, addr);
+    if (pkt_ret != kErrorOk && ret == kErrorOk)
+      ret = pkt_ret;
+  }
+
+  return ret;
+}
+
+template <class Callbacks>
+int BasicLodpEndpoint<Callbacks>::flush() {
+  /*
+   * Transmitting can invoke callbacks that close() sessions (including the
+   * one being flushed, which removes it from flush_pending_) or queue more
+   * messages, so always work off the head of the list, and leave the session
+   * there while it is flushed.  Sessions that still have data queued after
+   * flushing (Eg: kErrorMustRekey) go back on the tail to be retried by the
+   * next call, so only as many sessions as were pending on entry are
+   * processed.
+   */
+  int ret = kErrorOk;
+  for (size_t n = flush_pending_.size(); n > 0 && !flush_pending_.empty();
+       n--) {
+    Session* tcb = flush_pending_.front();
+    int flush_ret = tcb->flush();
+    if (flush_ret != kErrorOk && ret == kErrorOk)
+      ret = flush_ret;
+    if (flush_pending_.empty() || flush_pending_.front() != tcb)
+      continue;  // close()d
+
+    flush_pending_.erase(flush_pending_.begin());
+    if (tcb->needs_flush())
+      flush_pending_.push_back(tcb);
+    else
+      tcb->flush_pending_ = false;
+  }
+
+  return ret;
+}
+
+template <class Callbacks>
+int BasicLodpEndpoint<Callbacks>::on_writable() {
+  /*
+   * LodpSession::drain_tx_queue() removes the session from tx_pending_ unless
+   * the transport is full again, and the on_writable() callback can close()
+   * sessions or queue more packets, so always work off the head of the list.
+   */
+  int ret = kErrorOk;
+  while (!tx_pending_.empty()) {
+    Session* tcb = tx_pending_.front();
+    int drain_ret = tcb->drain_tx_queue();
+    if (drain_ret == kErrorAgain)
+      return kErrorAgain;
+    if (drain_ret != kErrorOk && ret == kErrorOk)
+      ret = drain_ret;
+  }
+
+  return ret;
+}
+
+template <class Callbacks>
+void BasicLodpEndpoint<Callbacks>::rotate_cookie(
+    const Clock::time_point& now) {
+  SL_ASSERT(is_listening_);
+
+  if (now > cookie_rotate_time_) {
+    // Generate a new key
+    ::std::array<uint8_t, crypto::Blake2s::kKeyLength> new_key;
+    rng_.get_bytes(&new_key[0], new_key.size());
+
+    // Flip the keys
+    prev_cookie_->set_key(new_key.data(), new_key.size());
+    cookie_.swap(prev_cookie_);
+    cookie_expire_time_ = cookie_rotate_time_ +
+        ::std::chrono::seconds(kCookieGraceInterval);
+    cookie_rotate_time_ = now + ::std::chrono::seconds(kCookieRotateInterval);
+
+    // Scrub the stack
+    crypto::memwipe(&new_key[0], new_key.size());
+    LODP_PROBE0(cookie_rotate);
+    log_event(LodpEvent::kCookieRotate, nullptr, nullptr);
+  }
+}
+
+template <class Callbacks>
+void BasicLodpEndpoint<Callbacks>::generate_cookie(
+    crypto::Blake2s& hash,
+    const IPAddress& addr,
+    const packet::Envelope& pkt,
+    ::std::array<uint8_t, kCookieLength>& cookie) {
+  /*
+   * The INIT/HANDSHAKE cookie defined in the spec is:
+   *  BLAKE2s(key, source_ip | source_port | siv_key_source)
+   *
+   * Since we already have a cryptographic digest of the address/port,
+   * just do BLAKE2s(key, addr.hash() | siv_key_source) instead, since it saves
+   * us the trouble of having to deal with address types.
+   */
+  hash.init(cookie.size());
+  uint64_t addr_hash = addr.hash();
+  bool ret = true;
+  ret &= hash.update(reinterpret_cast<uint8_t*>(&addr_hash), sizeof(addr_hash));
+
+  // By the time this routine is invoked, the pkt is known to be valid
+  if (pkt.packet_type() == packet::Envelope::INIT)
+    ret &= hash.update(pkt.msg_init().intro_siv_key_source());
+  else if (pkt.packet_type() == packet::Envelope::HANDSHAKE)
+    ret &= hash.update(pkt.msg_handshake().intro_siv_key_source());
+  else
+    SL_ABORT("Unsupported packet type");
+
+  ret &= hash.final(&cookie[0], cookie.size());
+  SL_ASSERT(ret);
+}
+
+template <class Callbacks>
+bool BasicLodpEndpoint<Callbacks>::validate_cookie(
+    const IPAddress& addr,
+    const packet::Envelope& pkt) {
+  const auto now = clock_->now();
+  rotate_cookie(now);
+
+  // By the time this routine gets called, pkt contains a valid INIT/HANDSHAKE
+
+  // By virtue of calling rotate_cookie(), cookie_ is always the current key
+  ::std::array<uint8_t, kCookieLength> cookie;
+  generate_cookie(*cookie_, addr, pkt, cookie);
+  if (0 == crypto::memequals(pkt.msg_handshake().handshake_cookie().data(),
+                             cookie.data(), cookie.size()))
+    return true;
+
+  // If the previous cookie key is still valid, check with the old key
+  if (now < cookie_expire_time_) {
+    generate_cookie(*prev_cookie_, addr, pkt, cookie);
+    if (0 == crypto::memequals(pkt.msg_handshake().handshake_cookie().data(),
+                               cookie.data(), cookie.size()))
+      return true;
+  }
+
+  return false;
+}
+
+template <class Callbacks>
+int BasicLodpEndpoint<Callbacks>::on_init_packet(const packet::Envelope& pkt,
+                                                 const IPAddress& addr,
+                                                 const uint8_t* ciphertext,
+                                                 const size_t len) {
+  // Validate that the INIT envelope is well formed
+  if (!pkt.has_msg_init()) {
+    stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_init().has_intro_siv_key_source()) {
+    stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (pkt.msg_init().intro_siv_key_source().length() != kSIVSourceLength) {
+    stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  /*
+   * Check to see if this INIT packet was replayed, by looking for the SIV Nonce
+   * in the bloom filter.  Potentially 2 different initiators could generate the
+   * same 128 bit nonces but that's unlikely (and the Bloom Filter's false
+   * positive rate is higher than the odds of that happening).
+   *
+   * By virtue of having a valid INIT packet, it's safe to look at the
+   * ciphertext buffer directly (and this is the only place not in
+   * on_init_packet() that does so.
+   */
+  if (init_filter_->test_and_set(ciphertext + crypto::SIVBlake2sXChaCha::kSIVLength,
+                                 crypto::SIVBlake2sXChaCha::kNonceLength)) {
+    stats_.rx_init_replays_++;
+    return kErrorInitReplayed;
+  }
+
+  /*
+   * Ok, at this point this is a legitamate peer trying to connect to us, or
+   * someone that's trying to DDOS us by spamming INITs.  It would be nice to be
+   * able to rate-limit incoming INITs by source IP/port, but that opens the
+   * code up to resource exhaustion attacks.
+   */
+
+  // Generate the INIT ACK
+  ::std::unique_ptr<packet::Envelope> init_ack(new packet::Envelope());  // TODO/Performance: Buffer pool
+  init_ack->set_packet_type(packet::Envelope::INIT_ACK);
+  ::std::array<uint8_t, kCookieLength> cookie;
+  rotate_cookie(clock_->now());
+  generate_cookie(*cookie_, addr, pkt, cookie);
+  packet::InitAck* init_ack_msg = init_ack->mutable_msg_init_ack();
+  init_ack_msg->set_handshake_cookie(cookie.data(), cookie.size());
+
+  /*
+   * To avoid amplification attacks, limit the amount of random padding to the
+   * size of the random padding in the INIT packet that we just received.  This
+   * limits the amplification factor to 1:1, at the expense of lowering the
+   * amount of variance observed in packet sizes slightly.
+   */
+
+  /**
+   * @todo Investigate the tradeoff made between amplification attack prevention
+   * and annonymity here.
+   */
+  if (pkt.has_pad()) {
+    ::std::string* pad = init_ack->mutable_pad();
+    size_t pad_len = rng_.get_uint32_range(pkt.pad().length());
+    pad->resize(pad_len, 0);
+    char *ptr = const_cast<char *>(pad->data());
+    rng_.get_bytes(ptr, pad_len);
+  }
+
+  // Transmit the packet
+  return send_packet(*init_ack, addr, pkt.msg_init().intro_siv_key_source());
+}
+
+template <class Callbacks>
+int BasicLodpEndpoint<Callbacks>::on_handshake_packet(
+    const packet::Envelope& pkt,
+    const IPAddress& addr,
+    Session* tcb) {
+  // Validate that the HANDSHAKE packet is well formed
+  if (!pkt.has_msg_handshake()) {
+    stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_handshake().has_intro_siv_key_source()) {
+    stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (pkt.msg_handshake().intro_siv_key_source().length() != kSIVSourceLength) {
+    stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_handshake().has_initiator_public_key()) {
+    stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (pkt.msg_handshake().initiator_public_key().length() !=
+      crypto::Curve25519::PublicKey::kKeyLength) {
+    stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_handshake().has_handshake_cookie()) {
+    stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (pkt.msg_handshake().handshake_cookie().length() != kCookieLength) {
+    stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  /*
+   * Validate the cookie to ensure it is something that we have generated and
+   * something that is sufficiently recent.
+   */
+  LODP_STAGE_START(cookie_start);
+  if (!validate_cookie(addr, pkt)) {
+    LODP_STAGE_RECORD(*this, kHandshakeCookie, cookie_start);
+    stats_.rx_invalid_cookie_++;
+    return kErrorInvalidCookie;
+  }
+
+  /*
+   * If we already have an existing Session associated with this peer, have the
+   * Session object handle this packet.
+   *
+   * Note:
+   * This is explicitly before the reuse check is done since the case that is
+   * being handled here occurs when the HANDSHAKE ACK packet gets lost.
+   */
+  if (tcb != nullptr) {
+    LODP_STAGE_RECORD(*this, kHandshakeCookie, cookie_start);
+    return tcb->on_handshake_packet(pkt);
+  }
+
+  /*
+   * Check to see if the cookie was reused.  Retransmitted HANDSHAKE packets
+   * won't trigger this as they are processed by Session::on_handshake_packet().
+   *
+   * Doing the check here has the sideeffect of forcing the initiator to obtain
+   * a new cookie if the user rejects the connection attempt from the callback.
+   */
+  const bool replayed = cookie_filter_->test_and_set(
+      pkt.msg_handshake().handshake_cookie().data(),
+      pkt.msg_handshake().handshake_cookie().length());
+  LODP_STAGE_RECORD(*this, kHandshakeCookie, cookie_start);
+  if (replayed) {
+    stats_.rx_cookie_replays_++;
+    return kErrorCookieReplayed;
+  }
+
+  /*
+   * Pull out the peer's session key, generate the session keys, and complete
+   * the ntor handshake.
+   */
+  LODP_STAGE_START(ntor_start);
+  const crypto::Curve25519::PublicKey
+      peer_public(reinterpret_cast<const
+                  uint8_t*>(pkt.msg_handshake().initiator_public_key().data()),
+                  pkt.msg_handshake().initiator_public_key().length());
+  const crypto::Curve25519::PrivateKey session_private(rng_);
+  const crypto::Curve25519::PublicKey session_public(session_private);
+  crypto::SecureBuffer shared_secret(crypto::NtorHandshake::kSecretLength, 0);
+  crypto::SecureBuffer auth(crypto::NtorHandshake::kAuthLength, 0);
+  if (!ntor_.responder(peer_public, *identity_public_key_, session_public,
+                       *identity_private_key_, session_private, *node_id_,
+                       shared_secret, auth)) {
+    LODP_STAGE_RECORD(*this, kHandshakeNtor, ntor_start);
+    stats_.rx_handshake_failed_++;
+    return kErrorHandshakeFailed;
+  }
+  LODP_STAGE_RECORD(*this, kHandshakeNtor, ntor_start);
+
+  // Callback to the user to inform them that a peer wishes to talk to us
+  LODP_STAGE_START(accept_start);
+  if (!callbacks_.should_accept(*this, addr.sockaddr(), addr.length())) {
+    LODP_STAGE_RECORD(*this, kHandshakeCallback, accept_start);
+    return kErrorConnRefused;
+  }
+  LODP_STAGE_RECORD(*this, kHandshakeCallback, accept_start);
+
+  // Allocate the TCB
+  Session* new_tcb = new Session(*this, session_public, peer_public,
+                                 shared_secret, auth, addr);
+  session_table_[addr] = ::std::unique_ptr<Session>(new_tcb);
+  stats_.sessions_accepted_++;
+  LODP_PROBE3(session_create, LODP_PROBE_SESSION_ID(new_tcb), addr.hash(), 0);
+  log_event(LodpEvent::kSessionCreate, new_tcb, &addr, 0);
+
+  // Have the session dispatch the HANDSHAKE ACK
+  int ret = new_tcb->send_handshake_ack_packet(pkt.msg_handshake().intro_siv_key_source());
+  LODP_STAGE_START(on_accept_start);
+  callbacks_.on_accept(*this, new_tcb, addr.sockaddr(), addr.length());
+  LODP_STAGE_RECORD(*this, kHandshakeCallback, on_accept_start);
+  return ret;
+}
+
+template <class Callbacks>
+bool BasicLodpEndpoint<Callbacks>::stage_histograms(
+    LodpStageHistograms& hist) const {
+#ifdef LODP_STAGE_TIMING
+  hist = stage_hist_;
+  return true;
+#else
+  for (auto& h : hist)
+    h.reset();
+  return false;
+#endif
+}
+
+template <class Callbacks>
+void BasicLodpEndpoint<Callbacks>::reset_stage_histograms() {
+#ifdef LODP_STAGE_TIMING
+  for (auto& h : stage_hist_)
+    h.reset();
+#endif
+}
+
+template <class Callbacks>
+void BasicLodpEndpoint<Callbacks>::publish_stats() {
+  LodpStatsSnapshot snap = LodpStatsSnapshot();
+  snap.endpoint_ = stats_;
+  snap.session_ = closed_session_stats_;
+  for (const auto& entry : session_table_) {
+    const Session* tcb = entry.second.get();
+    snap.sessions_++;
+    if (tcb->is_established() || tcb->is_rekeying())
+      snap.sessions_established_++;
+    snap.session_.merge(tcb->stats());
+  }
+
+  published_stats_.store(snap);
+}
+
+template <class Callbacks>
+void BasicLodpEndpoint<Callbacks>::set_clock(Clock& clock) {
+  SL_ASSERT(session_table_.empty());
+
+  // Restart the cookie key schedule in the new timebase
+  clock_ = &clock;
+  cookie_rotate_time_ = clock_->now() +
+      ::std::chrono::seconds(kCookieRotateInterval);
+  cookie_expire_time_ = clock_->now();
+}
+
+template <class Callbacks>
+int BasicLodpEndpoint<Callbacks>::export_state(::std::string& buf) const {
+  if (!is_listening_)
+    return kErrorNotResponder;
+
+  const Clock::time_point now = clock_->now();
+  auto to_ms = [&now](const Clock::time_point& t) -> int64_t {
+    return ::std::chrono::duration_cast< ::std::chrono::milliseconds>(
+        t - now).count();
+  };
+
+  state::Endpoint st;
+  st.set_version(kStateVersion);
+  st.set_identity_public_key(identity_public_key_->data(),
+                             identity_public_key_->length());
+  st.set_cookie_key(cookie_->key().data(), cookie_->key().size());
+  st.set_prev_cookie_key(prev_cookie_->key().data(),
+                         prev_cookie_->key().size());
+  st.set_cookie_rotate_in(to_ms(cookie_rotate_time_));
+  st.set_cookie_expire_in(to_ms(cookie_expire_time_));
+
+  crypto::SecureBuffer filter;
+  init_filter_->export_state(filter);
+  st.set_init_filter(filter.data(), filter.size());
+  cookie_filter_->export_state(filter);
+  st.set_cookie_filter(filter.data(), filter.size());
+
+  for (const auto& entry : session_table_) {
+    const Session* tcb = entry.second.get();
+    if (tcb->is_established())
+      tcb->export_state(*st.add_sessions());
+  }
+
+  // Serialize, wipe the key material, and encrypt
+  ::std::string plaintext;
+  bool ret = st.SerializeToString(&plaintext);
+  SL_ASSERT(ret);
+  scrub_state(st);
+
+  const auto key = derive_state_siv_key(*identity_private_key_);
+  crypto::SIVBlake2sXChaCha siv(rng_, key.data(), key.length());
+  siv.encrypt(plaintext, buf);
+  crypto::memwipe(&plaintext[0], plaintext.size());
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpEndpoint<Callbacks>::import_state(const void* buf,
+                                               const size_t len) {
+  if (!is_listening_)
+    return kErrorNotResponder;
+  if (!session_table_.empty())
+    return kErrorIsConn;
+  if (buf == nullptr || len < kMinPacketLength)
+    return kErrorInval;
+
+  // Decrypt and deserialize
+  const auto key = derive_state_siv_key(*identity_private_key_);
+  crypto::SIVBlake2sXChaCha siv(rng_, key.data(), key.length());
+  ::std::string plaintext;
+  state::Endpoint st;
+  bool ok = siv.decrypt(static_cast<const uint8_t*>(buf), len, plaintext) &&
+      st.ParseFromString(plaintext);
+  crypto::memwipe(&plaintext[0], plaintext.size());
+
+  // Validate everything before touching the LodpEndpoint
+  ok = ok && st.version() == kStateVersion &&
+      st.identity_public_key().size() == identity_public_key_->length() &&
+      crypto::memequals(st.identity_public_key().data(),
+                        identity_public_key_->data(),
+                        identity_public_key_->length()) == 0 &&
+      st.cookie_key().size() == crypto::Blake2s::kKeyLength &&
+      st.prev_cookie_key().size() == crypto::Blake2s::kKeyLength;
+
+  ::std::unique_ptr<BloomFilter> init_filter(new BloomFilter(rng_,
+      kInitFilterSize, 0.001));
+  ::std::unique_ptr<BloomFilter> cookie_filter(new BloomFilter(rng_,
+      kCookieFilterSize, 0.001));
+  ok = ok && init_filter->import_state(
+      reinterpret_cast<const uint8_t*>(st.init_filter().data()),
+      st.init_filter().size());
+  ok = ok && cookie_filter->import_state(
+      reinterpret_cast<const uint8_t*>(st.cookie_filter().data()),
+      st.cookie_filter().size());
+
+  ::std::vector<IPAddress> addrs;
+  for (int i = 0; ok && i < st.sessions_size(); i++) {
+    const state::Session& sst = st.sessions(i);
+    const auto sa = reinterpret_cast<const struct sockaddr*>(
+        sst.peer_addr().data());
+    const socklen_t sa_len = sst.peer_addr().size();
+    ok = Session::is_state_valid(sst) &&
+        IPAddress::is_sockaddr_valid(sa, sa_len);
+    if (ok)
+      addrs.emplace_back(hash_, sa, sa_len, safe_logging_);
+  }
+  if (!ok) {
+    scrub_state(st);
+    return kErrorInval;
+  }
+
+  // Take over the cookie keys and the replay filters
+  const Clock::time_point now = clock_->now();
+  cookie_->set_key(reinterpret_cast<const uint8_t*>(st.cookie_key().data()),
+                   st.cookie_key().size());
+  prev_cookie_->set_key(
+      reinterpret_cast<const uint8_t*>(st.prev_cookie_key().data()),
+      st.prev_cookie_key().size());
+  cookie_rotate_time_ = now + ::std::chrono::milliseconds(
+      st.cookie_rotate_in());
+  cookie_expire_time_ = now + ::std::chrono::milliseconds(
+      st.cookie_expire_in());
+  // (Imported in place, so that file backed filters stay that way)
+  init_filter_->import_state(
+      reinterpret_cast<const uint8_t*>(st.init_filter().data()),
+      st.init_filter().size());
+  cookie_filter_->import_state(
+      reinterpret_cast<const uint8_t*>(st.cookie_filter().data()),
+      st.cookie_filter().size());
+
+  // Recreate the LodpSessions
+  ::std::vector<Session*> sessions;
+  for (int i = 0; i < st.sessions_size(); i++) {
+    const IPAddress& addr = addrs[i];
+    if (session_table_.count(addr) != 0)
+      continue;
+
+    Session* tcb = new Session(*this, st.sessions(i), addr);
+    session_table_[addr] = ::std::unique_ptr<Session>(tcb);
+    LODP_PROBE3(session_create, LODP_PROBE_SESSION_ID(tcb), addr.hash(), 0);
+    log_event(LodpEvent::kSessionCreate, tcb, &addr, 0);
+    sessions.push_back(tcb);
+  }
+  scrub_state(st);
+
+  // Hand the LodpSessions to the user
+  for (auto tcb : sessions)
+    callbacks_.on_accept(*this, tcb, tcb->peer_addr_.sockaddr(),
+                         tcb->peer_addr_.length());
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpEndpoint<Callbacks>::map_replay_filters(const char* init_path,
+                                                     const char* cookie_path) {
+  if (!is_listening_)
+    return kErrorNotResponder;
+
+  const int ret = init_filter_->map_file(init_path);
+  if (ret != kErrorOk)
+    return ret;
+
+  return cookie_filter_->map_file(cookie_path);
+}
+
+template <class Callbacks>
+void BasicLodpEndpoint<Callbacks>::sync_replay_filters() {
+  if (!is_listening_)
+    return;
+
+  init_filter_->sync();
+  cookie_filter_->sync();
+}
+
+template <class Callbacks>
+void BasicLodpEndpoint<Callbacks>::set_flight_recorder(
+    const size_t nr_records) {
+  if (nr_records == 0)
+    recorder_.reset();
+  else
+    recorder_.reset(new FlightRecorder(nr_records, safe_logging_));
+}
+
+template <class Callbacks>
+void BasicLodpEndpoint<Callbacks>::log_error(const int error,
+                                             const Session* session,
+                                             const IPAddress& addr) {
+  if (!recorder_)
+    return;
+
+  recorder_->record(static_cast<uint16_t>(LodpEvent::kError),
+                    reinterpret_cast<uintptr_t>(session), &addr,
+                    static_cast<uint64_t>(static_cast<int64_t>(error)));
+  recorder_->trigger();
+}
+
+template <class Callbacks>
+int BasicLodpEndpoint<Callbacks>::send_packet(
+    const packet::Envelope& pkt,
+    const IPAddress& addr,
+    const std::string& siv_key_source) {
+  // Serialize the protobuf object to a binary blob
+  ::std::string serialized; // TODO/Performance: Buffer Pool
+  bool ret = pkt.SerializeToString(&serialized);
+  SL_ASSERT(ret);
+
+  /*
+   * Derive the peer's Session RX key from the keying material they provided in
+   * the INIT/INIT ACK, and encrypt the packet
+   */
+  const auto siv_key = derive_initiator_siv_key(siv_key_source);
+  ephemeral_tx_siv_->set_key(siv_key.data(), siv_key.length());
+  ::std::string ciphertext; // TODO/Performance: Buffer pool
+  ephemeral_tx_siv_->encrypt(serialized, ciphertext);
+  ephemeral_tx_siv_->clear_key();
+
+  /** @bug Someone somewhere should scrub the intro_key_source() component that
+   * siv_key_source is based off of.  It's not the end of the world if we don't
+   * since the key has a lifespan of 2 packets, and it's ephemeral per session,
+   * but wiping it is the right thing to do.
+   */
+
+  stats_.tx_bytes_ += ciphertext.length();
+  stats_.tx_packets_[pkt.packet_type()]++;
+  LODP_PROBE4(sendto, addr.hash(), 0, ciphertext.length(), 0);
+  log_event(LodpEvent::kSendto, nullptr, &addr, ciphertext.length(), 0);
+  const int xmit_ret = callbacks_.sendto(*this, ciphertext.data(),
+                                         ciphertext.length(), addr.sockaddr(),
+                                         addr.length());
+  if (xmit_ret != kErrorAgain)
+    trace_packet(PacketTrace::kDirTx, addr, ciphertext.data(),
+                 ciphertext.length());
+  return xmit_ret;
+}
+
+} // namespace lodp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_LODP_LODP_ENDPOINT_IMPL_H__
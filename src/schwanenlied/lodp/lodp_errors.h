@@ -81,6 +81,18 @@ const int kErrorCookieReplayed = -(kErrorOffset | 23);
 const int kErrorHandshakeFailed = -(kErrorOffset | 24);
 /** @} */
 
+/**
+ * Return a human readable name for a return code
+ *
+ * Both the LODP specific errors and the generic errors from common.h are
+ * handled, since the latter are propagated through LODP unmodified.
+ *
+ * @param[in] error The return code
+ *
+ * @returns nullptr - The return code is not known
+ */
+const char* lodp_error_name(const int error);
+
 } // namespace lodp
 } // namespace schwanenlied
 
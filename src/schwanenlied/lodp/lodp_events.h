@@ -0,0 +1,93 @@
+/**
+ * @file    lodp_events.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   LODP Flight Recorder events
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_LODP_LODP_EVENTS_H__
+#define SCHWANENLIED_LODP_LODP_EVENTS_H__
+
+#include "schwanenlied/common.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+/**
+ * The events recorded in a LodpEndpoint's FlightRecorder
+ *
+ * These mirror the USDT probes (See lodp_probes.h).  The FlightRecorder
+ * session is the address of the LodpSession object (0 for packets handled by
+ * the LodpEndpoint itself), and the address is the peer.
+ *
+ * | Event          | Arguments                                        |
+ * |----------------|--------------------------------------------------|
+ * | kRx            | length                                           |
+ * | kDecryptOk     | length, key_class (0 = LodpSession, 1 = Intro)   |
+ * | kDecryptFail   | length                                           |
+ * | kDispatch      | packet_type                                      |
+ * | kSessionCreate | is_initiator                                     |
+ * | kSessionClose  | (none)                                           |
+ * | kRekeyStart    | generation                                       |
+ * | kRekeyDone     | generation                                       |
+ * | kCookieRotate  | (none)                                           |
+ * | kSendto        | length, segment_size                             |
+ * | kError         | error code (sign extended)                       |
+ */
+enum class LodpEvent : uint16_t {
+  kRx,            /**< A packet was received */
+  kDecryptOk,     /**< A packet was decrypted */
+  kDecryptFail,   /**< A packet failed to decrypt */
+  kDispatch,      /**< A packet is being processed */
+  kSessionCreate, /**< A LodpSession was created */
+  kSessionClose,  /**< A LodpSession was closed */
+  kRekeyStart,    /**< A LodpSession started rekeying */
+  kRekeyDone,     /**< A LodpSession finished rekeying */
+  kCookieRotate,  /**< The cookie key was rotated */
+  kSendto,        /**< A packet (or GSO burst) was handed to sendto() */
+  kError,         /**< Processing a authenticated packet failed */
+  kCount          /**< The number of events (Not a event) */
+};
+
+/**
+ * Return a human readable name for a LodpEvent
+ *
+ * This is suitable for use as a FlightRecorder::EventNameFn.
+ *
+ * @param[in] event The event id
+ *
+ * @returns nullptr - The event id is not a LodpEvent
+ */
+const char* lodp_event_name(const uint16_t event);
+
+} // namespace lodp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_LODP_LODP_EVENTS_H__
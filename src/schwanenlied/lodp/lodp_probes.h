@@ -0,0 +1,83 @@
+/**
+ * @file    lodp_probes.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   LODP static tracepoints (USDT)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_LODP_LODP_PROBES_H__
+#define SCHWANENLIED_LODP_LODP_PROBES_H__
+
+/**
+ * @file
+ *
+ * Statically defined tracepoints under the "lodp" provider, usable with
+ * bpftrace/perf/SystemTap (Eg: `bpftrace -e 'usdt:./liblodpxx:lodp:rx ...'`).
+ * Each disabled probe is a single nop in the instruction stream.  The probes
+ * are only compiled in if `sys/sdt.h` is available (HAVE_SYS_SDT_H).
+ *
+ * Peers are identified by IPAddress::hash(), which is keyed per-LodpEndpoint
+ * and thus never exposes the actual address.  LodpSessions are identified by
+ * the address of the LodpSession object, with 0 standing in for packets that
+ * are handled by the LodpEndpoint itself.  The decryption key class is 0 for
+ * LodpSession keys, and 1 for the LodpEndpoint Introduction key.
+ *
+ * | Probe          | Arguments                                        |
+ * |----------------|--------------------------------------------------|
+ * | rx             | addr_hash, length                                |
+ * | decrypt_ok     | addr_hash, length, key_class                     |
+ * | decrypt_fail   | addr_hash, length                                |
+ * | dispatch       | addr_hash, session_id, packet_type               |
+ * | session_create | session_id, addr_hash, is_initiator              |
+ * | session_close  | session_id, addr_hash                            |
+ * | rekey_start    | session_id, generation                           |
+ * | rekey_done     | session_id, generation                           |
+ * | cookie_rotate  | (none)                                           |
+ * | sendto         | addr_hash, session_id, length, segment_size      |
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define LODP_PROBE0(name) DTRACE_PROBE(lodp, name)
+#define LODP_PROBE2(name, a1, a2) DTRACE_PROBE2(lodp, name, a1, a2)
+#define LODP_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(lodp, name, a1, a2, a3)
+#define LODP_PROBE4(name, a1, a2, a3, a4)                               \
+  DTRACE_PROBE4(lodp, name, a1, a2, a3, a4)
+#else
+#define LODP_PROBE0(name) do {} while (0)
+#define LODP_PROBE2(name, a1, a2) do {} while (0)
+#define LODP_PROBE3(name, a1, a2, a3) do {} while (0)
+#define LODP_PROBE4(name, a1, a2, a3, a4) do {} while (0)
+#endif
+
+/** The session_id probe argument for a LodpSession */
+#define LODP_PROBE_SESSION_ID(session) reinterpret_cast<uintptr_t>(session)
+
+#endif // SCHWANENLIED_LODP_LODP_PROBES_H__
@@ -34,8 +34,14 @@
 #ifndef SCHWANENLIED_LODP_LODP_SESSION_H__
 #define SCHWANENLIED_LODP_LODP_SESSION_H__
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <deque>
 #include <memory>
+#include <vector>
+
+#include <sys/uio.h>
 
 #include "schwanenlied/common.h"
 #include "schwanenlied/ip_address.h"
@@ -44,14 +50,26 @@
 #include "schwanenlied/crypto/random.h"
 #include "schwanenlied/crypto/siv_blake2s_xchacha.h"
 #include "schwanenlied/crypto/utils.h"
+#include "schwanenlied/lodp/lodp_stats.h"
 
 // Autogenerated Protocol Buffers Header
 #include "lodp.pb.h"
+#include "lodp_state.pb.h"
 
 namespace schwanenlied {
+
+class Timer;
+
 namespace lodp {
 
-class LodpEndpoint;
+class LodpCallbacks;
+template <class Callbacks> class BasicLodpEndpoint;
+template <class Callbacks> class BasicLodpSession;
+
+/** The LodpEndpoint used with the (virtual) LodpCallbacks interface */
+typedef BasicLodpEndpoint<LodpCallbacks> LodpEndpoint;
+/** The LodpSession used with the (virtual) LodpCallbacks interface */
+typedef BasicLodpSession<LodpCallbacks> LodpSession;
 
 /**
  * The LODP Session
@@ -64,31 +82,35 @@ class LodpEndpoint;
  * but instead will obtain them via LodpEndpoint::connect()/the incoming
  * connection callback and destroy them via LodpSession::close().
  *
+ * The callbacks type is a template parameter so that applications can have
+ * their handlers inlined into the packet processing (See BasicLodpEndpoint).
+ *
+ * @tparam Callbacks  The callbacks type (LodpCallbacks, or a class derived
+ *                    from BasicLodpCallbacks)
+ *
  * @todo The REKEY handling should be more sophisticated and save off the
  * previous key/sequence numbering state so that it is possible to transmit data
  * even while rekeying.  The current implementation blocks the initiator from
  * sending any data till it has confirmation that the peer received the REKEY
  * ACK.
  */
-class LodpSession {
+template <class Callbacks>
+class BasicLodpSession {
  public:
+  /** The LodpEndpoint type that owns this LodpSession type */
+  typedef BasicLodpEndpoint<Callbacks> Endpoint;
+
   /** LodpSession statistics */
-  struct Stats {
-    /** @{ */
-    uint64_t tx_bytes_;         /**< Total bytes sent */
-    uint64_t rx_bytes_;         /**< Total bytes received */
-    uint64_t tx_goodput_bytes_; /**< Total payload sent */
-    uint64_t rx_goodput_bytes_; /**< Total payload received */
-    /** @} */
-
-    /** @{ */
-    uint32_t generation_id_;    /**< Generation ID (counts rekeys) */
-    uint32_t generation_tx_;    /**< Data packets sent this generation */
-    uint32_t generation_rx_;    /**< Data packets received this generation */
-    /** @} */
-  };
+  typedef LodpSessionStats Stats;
 
-  ~LodpSession();
+  /** The maximum length of a message sent via send_message() */
+  static const size_t kMaxMessageLength = 65536;
+  /** The maximum number of source packets in a FEC block */
+  static const size_t kMaxFecK = 64;
+  /** The maximum number of parity packets in a FEC block */
+  static const size_t kMaxFecM = 16;
+
+  ~BasicLodpSession();
 
   /** @{ */
   /** Get the user defined context handle */
@@ -100,8 +122,18 @@ class LodpSession {
   /** @{ */
   /** Get the maximum transmittable payload length in bytes */
   const size_t mtu() const;
+  /** Get the current UDP MTU of the path to the peer in bytes */
+  const size_t udp_mtu() const { return pmtu_; }
+  /** Get the number of source packets per FEC block */
+  const size_t fec_k() const { return fec_k_; }
+  /** Get the number of parity packets per FEC block */
+  const size_t fec_m() const { return fec_m_; }
+  /** Get the FEC packet loss reported by the peer (parts per million) */
+  const uint32_t fec_loss() const { return fec_loss_ppm_; }
+  /** Get the number of bytes waiting for the transport to become writable */
+  const size_t tx_queue_bytes() const { return tx_queue_bytes_; }
   /** Get the current LodpSession Stats */
-  const struct Stats& stats() const { return stats_; }
+  const Stats& stats() const { return stats_; }
   /** @} */
 
   /** @{ */
@@ -136,11 +168,19 @@ class LodpSession {
   /**
    * Send data to the remote peer
    *
+   * If coalescing is enabled (See set_coalescing()) and the buffer is small
+   * enough, the data is queued and transmitted later along with other
+   * messages in a single DATA packet.  Regardless of coalescing, each call to
+   * send() results in exactly one LodpCallbacks::on_recv() on the peer.
+   *
    * @param[in] buf  The buffer to send
    * @param[in] len  The lenght of the buffer
    *
    * @returns kErrorInval   - The parameters are invalid
    * @returns kErrorMsgSize - The size of the buffer is bigger than the mtu().
+   * @returns kErrorAgain   - The send queue is above the high watermark (See
+   *                          set_tx_watermarks()), retry after
+   *                          LodpCallbacks::on_writable()
    * @returns kErrorNotConn - The connection is not fully handshaked
    * @returns kErrorConnAborted - No remaining sequence number space to send
    *                              *ANY* data (Must close() the LodpSession)
@@ -150,6 +190,211 @@ class LodpSession {
    */
   int send(const void* buf, const size_t len);
 
+  /**
+   * Send a burst of data to the remote peer
+   *
+   * Each element of iov is sent as a separate DATA packet, exactly as if
+   * send() was called for each.  The packets are encrypted back to back into
+   * one contiguous buffer and handed to LodpCallbacks::sendto_gso() in groups
+   * of equally sized packets, so that applications that support UDP Generic
+   * Segmentation Offload can transmit the entire burst with a single system
+   * call.  This works best when the padding policy pads packets to a fixed
+   * size (Eg: The full MTU).
+   *
+   * @param[in] iov     The buffers to send
+   * @param[in] iovcnt  The number of buffers
+   *
+   * @returns kErrorInval   - The parameters are invalid
+   * @returns kErrorMsgSize - The size of any of the buffers is bigger than the
+   *                          mtu() (Nothing was sent)
+   * @returns kErrorAgain   - The send queue is above the high watermark (See
+   *                          set_tx_watermarks()), retry after
+   *                          LodpCallbacks::on_writable()
+   * @returns kErrorNotConn - The connection is not fully handshaked
+   * @returns kErrorConnAborted - No remaining sequence number space to send
+   *                              *ANY* data (Must close() the LodpSession)
+   * @returns kErrorMustRekey - The initiator must rekey() before it can send
+   *                            data.
+   * @returns (User specified value) - The first non-kErrorOk value returned
+   *                                   from the callback (The remainder of the
+   *                                   burst is not sent)
+   */
+  int send_burst(const struct iovec* iov, const size_t iovcnt);
+
+  /**
+   * Send a message of up to kMaxMessageLength bytes to the remote peer
+   *
+   * Messages that are larger than the mtu() are split into fragments that
+   * are carried in separate DATA packets, and reassembled by the peer, which
+   * will see exactly one LodpCallbacks::on_recv() call for the entire
+   * message.  If any fragment is lost the peer will drop the message after a
+   * timeout, unless parity is enabled, in which case one additional fragment
+   * is sent that allows the peer to recover from the loss of any single
+   * fragment.
+   *
+   * Messages that fit in the mtu() are sent as if send() was called.
+   *
+   * @param[in] buf     The buffer to send
+   * @param[in] len     The lenght of the buffer
+   * @param[in] parity  Send a parity fragment
+   *
+   * @returns kErrorInval   - The parameters are invalid
+   * @returns kErrorMsgSize - The size of the buffer is bigger than
+   *                          kMaxMessageLength
+   * @returns kErrorAgain   - The send queue is above the high watermark (See
+   *                          set_tx_watermarks()), retry after
+   *                          LodpCallbacks::on_writable()
+   * @returns kErrorNotConn - The connection is not fully handshaked
+   * @returns kErrorConnAborted - No remaining sequence number space to send
+   *                              *ANY* data (Must close() the LodpSession)
+   * @returns kErrorMustRekey - The initiator must rekey() before it can send
+   *                            data.
+   * @returns (User specified value) - The first non-kErrorOk value returned
+   *                                   from the callback (The remainder of the
+   *                                   message is not sent)
+   */
+  int send_message(const void* buf,
+                   const size_t len,
+                   const bool parity = false);
+
+  /**
+   * Enable/Disable coalescing of small messages
+   *
+   * When enabled, send() queues messages instead of transmitting them
+   * immediately, and multiple queued messages are framed inside a single
+   * DATA packet, saving the per-packet encryption and system call overhead
+   * for chatty workloads.  Queued messages are transmitted when:
+   *
+   *  * flush() or LodpEndpoint::flush() is called (Eg: At the end of each
+   *    event loop iteration).
+   *  * At least threshold bytes are queued.
+   *  * The oldest queued message has been waiting for delay (If delay is
+   *    non-zero, this uses a schwanenlied::Timer from the LodpEndpoint's
+   *    Clock, so the libuv event loop must be running for the deadline to be
+   *    enforced when the application is idle).
+   *
+   * Messages that are larger than the threshold are never queued, but will
+   * cause the queued messages to be flushed first to preserve ordering.
+   *
+   * @warning The peer must support coalesced DATA packets.
+   *
+   * @param[in] enable    Enable coalescing (Disabling flushes queued data)
+   * @param[in] threshold The number of queued bytes that triggers a flush (0 to
+   *                      use the mtu())
+   * @param[in] delay     The maximum time a message may be queued (0 to
+   *                      disable the deadline)
+   *
+   * @returns kErrorOk    - Success
+   * @returns kErrorInval - The threshold is larger than the mtu()
+   * @returns (Any flush() return value) - Disabling coalescing failed to flush
+   *                                       the queued messages
+   */
+  int set_coalescing(const bool enable,
+                     const size_t threshold = 0,
+                     const ::std::chrono::microseconds& delay =
+                        ::std::chrono::microseconds::zero());
+
+  /**
+   * Enable/disable packetization layer path MTU discovery
+   *
+   * By default LodpSession uses the conservative IPAddress::udp_mtu().  When
+   * path MTU discovery is enabled, PMTU PROBE packets padded out to the size
+   * being tested are sent to the peer, and each size that is acknowledged
+   * raises the udp_mtu() (and mtu()).  The search tries max_udp_mtu first,
+   * and falls back to a binary search if that fails.
+   *
+   * Once the search completes, the current udp_mtu() is periodically
+   * confirmed.  If a confirmation probe is lost kPmtuMaxProbes times in a row
+   * the path is assumed to have become a black hole, and the udp_mtu() drops
+   * back to IPAddress::udp_mtu() before searching again.
+   *
+   * @warning The peer must support PMTU PROBE packets and accept packets up
+   * to max_udp_mtu (See LodpEndpoint::set_max_rx_udp_mtu()), the
+   * LodpEndpoint's receive buffers must be able to hold max_udp_mtu byte
+   * packets, and the LodpEndpoint's Clock (the libuv event loop by default)
+   * must be running for probes to time out.
+   *
+   * @param[in] enable        Enable path MTU discovery (Disabling reverts to
+   *                          IPAddress::udp_mtu())
+   * @param[in] max_udp_mtu   The largest UDP MTU to search for (0 to use
+   *                          IPAddress::udp_max_mtu())
+   * @param[in] probe_timeout The time to wait for each PMTU PROBE ACK (The
+   *                          confirmation and search restart intervals are
+   *                          multiples of this)
+   *
+   * @returns kErrorOk      - Success
+   * @returns kErrorInval   - The max_udp_mtu or probe_timeout is invalid
+   * @returns kErrorNotConn - The connection is not fully handshaked
+   */
+  int set_pmtu_discovery(const bool enable,
+                         const size_t max_udp_mtu = 0,
+                         const ::std::chrono::milliseconds& probe_timeout =
+                            ::std::chrono::milliseconds(kPmtuProbeTimeout));
+
+  /**
+   * Enable/disable forward error correction
+   *
+   * When enabled, packets sent via send()/send_burst() are grouped into blocks
+   * of k source packets, each followed by m Reed-Solomon parity packets (m = 1
+   * is XOR parity).  The receiver can recover up to m lost source packets per
+   * block, which are delivered via the on_recv() callback (possibly out of
+   * order).  Partial blocks are closed by flush().  Coalesced and fragmented
+   * DATA packets are not protected.
+   *
+   * If k and m are 0, the block parameters adapt to the packet loss reported
+   * by the peer (FEC FEEDBACK), starting at k = 16, m = 1.
+   *
+   * Enabling FEC reduces the mtu() to make room for the FEC framing.
+   *
+   * @warning The peer must support FEC DATA packets.
+   *
+   * @param[in] enable  Enable FEC (Disabling closes the current block)
+   * @param[in] k       The number of source packets per block (<= kMaxFecK)
+   * @param[in] m       The number of parity packets per block (<= kMaxFecM)
+   *
+   * @returns kErrorOk    - Success
+   * @returns kErrorInval - The block parameters are invalid
+   * @returns (Any flush() return value) - Flushing queued data failed
+   */
+  int set_fec(const bool enable,
+              const size_t k = 0,
+              const size_t m = 0);
+
+  /**
+   * Set the send queue watermarks
+   *
+   * When LodpCallbacks::sendto() returns kErrorAgain the transport is
+   * temporarily unable to accept datagrams, and the packet (along with every
+   * packet sent after it) is queued in the LodpSession until the application
+   * calls LodpEndpoint::on_writable().  Once high bytes are queued, send(),
+   * send_burst() and send_message() fail with kErrorAgain, and when the queue
+   * drains to low bytes or less, LodpCallbacks::on_writable() is called.
+   *
+   * Handshake and control packets are always queued, so the queue can exceed
+   * the high watermark slightly.
+   *
+   * @param[in] high  The queued length that blocks sending (bytes)
+   * @param[in] low   The queued length that unblocks sending (bytes)
+   *
+   * @returns kErrorOk    - Success
+   * @returns kErrorInval - high is 0 or low is greater than high
+   */
+  int set_tx_watermarks(const size_t high,
+                        const size_t low);
+
+  /**
+   * Transmit any queued coalesced messages and FEC parity
+   *
+   * @returns kErrorOk      - Success (Or nothing was queued)
+   * @returns kErrorNotConn - The connection is not fully handshaked
+   * @returns kErrorConnAborted - No remaining sequence number space to send
+   *                              *ANY* data (Must close() the LodpSession)
+   * @returns kErrorMustRekey - The initiator must rekey() before it can send
+   *                            data (The messages remain queued)
+   * @returns (User specified value) - The value returned from the callback
+   */
+  int flush();
+
   /**
    * Attempt to rekey the ephemeral session keys (Initiator only)
    *
@@ -176,22 +421,74 @@ class LodpSession {
   /** @} */
 
  private:
-  LodpSession() = delete;
-  LodpSession(const LodpSession&) = delete;
-  void operator=(const LodpSession&) = delete;
+  BasicLodpSession() = delete;
+  BasicLodpSession(const BasicLodpSession&) = delete;
+  void operator=(const BasicLodpSession&) = delete;
 
   // Implementaton specific constants
   /** @{ */
   /** Inform the user to rekey() at this send seq nr (2^31) */
   static const uint32_t kRekeyPacketCount = 0x80000000;
+  /** The maximum number of packets in a single GSO send (UDP_MAX_SEGMENTS) */
+  static const size_t kMaxBurstSegments = 64;
+  /** The maximum length of a single GSO send (IPv4 UDP payload limit) */
+  static const size_t kMaxBurstLength = 65507;
   /** @} */
 
   // Protocol constants
   /** @{ */
   /** The Protobuf framing overhead of a DATA packet */
-  static const size_t kDataFramingOverhead = 12;
+  static const size_t kDataFramingOverhead = 13;
   /** The maximum Protobuf framing overhead for padding mtu() sized packets */
   static const size_t kMaxPadFramingOverhead = 3;
+  /** The maximum Protobuf framing overhead for each coalesced message */
+  static const size_t kCoalesceFramingOverhead = 3;
+  /** The maximum Protobuf framing overhead of a Fragment */
+  static const size_t kFragmentFramingOverhead = 24;
+  /** The maximum overhead of FEC (Protobuf framing + parity length prefix) */
+  static const size_t kFecFramingOverhead = 16;
+  /** @} */
+
+  // Fragment reassembly limits
+  /** @{ */
+  /** The maximum number of messages being reassembled at once */
+  static const size_t kMaxReassemblyMessages = 8;
+  /** The maximum amount of memory used for reassembly (bytes) */
+  static const size_t kMaxReassemblyBytes = 4 * kMaxMessageLength;
+  /** The time a partially reassembled message is kept around (sec) */
+  static const int kReassemblyTimeout = 5;
+  /** The number of recently completed message IDs remembered */
+  static const size_t kCompletedMessageIds = 16;
+  /** @} */
+
+  // Path MTU discovery
+  /** @{ */
+  /** The default time to wait for a PMTU PROBE ACK (ms) */
+  static const int kPmtuProbeTimeout = 1000;
+  /** The number of lost probes before a size is considered to not work */
+  static const int kPmtuMaxProbes = 3;
+  /** The search stops when the range is smaller than this (bytes) */
+  static const size_t kPmtuSearchGranularity = 32;
+  /** The interval between confirmation probes (probe timeouts) */
+  static const int kPmtuConfirmInterval = 30;
+  /** The interval before searching for a larger MTU again (probe timeouts) */
+  static const int kPmtuRaiseInterval = 600;
+  /** @} */
+
+  // Forward error correction
+  /** @{ */
+  /** The number of FEC blocks the receiver tracks at once */
+  static const size_t kFecMaxRxBlocks = 8;
+  /** The number of retired FEC blocks per FEC FEEDBACK packet */
+  static const size_t kFecFeedbackBlocks = 16;
+  /** @} */
+
+  // Transmit queue
+  /** @{ */
+  /** The default send queue high watermark (bytes) */
+  static const size_t kDefaultTxHighWatermark = 256 * 1024;
+  /** The default send queue low watermark (bytes) */
+  static const size_t kDefaultTxLowWatermark = 64 * 1024;
   /** @} */
 
   /** @{ */
@@ -207,12 +504,12 @@ class LodpSession {
    * @param[in] node_id_len       The length of node_id
    * @param[in] addr              The remote LodpEndpoint's IP address/port
    */
-  LodpSession(LodpEndpoint& ep,
-              void* ctxt,
-              const crypto::Curve25519::PublicKey& peer_identity_key,
-              const uint8_t* node_id,
-              const size_t node_id_len,
-              const IPAddress& addr);
+  BasicLodpSession(Endpoint& ep,
+                   void* ctxt,
+                   const crypto::Curve25519::PublicKey& peer_identity_key,
+                   const uint8_t* node_id,
+                   const size_t node_id_len,
+                   const IPAddress& addr);
 
   /**
    * Create the responder (server) side LodpSession object
@@ -233,12 +530,45 @@ class LodpSession {
    *                              crypto::NtorHandshake
    * @param[in] addr              The remote LodpEndpoint's IP address/port
    */
-  LodpSession(LodpEndpoint& ep,
-              const crypto::Curve25519::PublicKey& session_key,
-              const crypto::Curve25519::PublicKey& peer_session_key,
-              const crypto::SecureBuffer& shared_secret,
-              const crypto::SecureBuffer& auth,
-              const IPAddress& addr);
+  BasicLodpSession(Endpoint& ep,
+                   const crypto::Curve25519::PublicKey& session_key,
+                   const crypto::Curve25519::PublicKey& peer_session_key,
+                   const crypto::SecureBuffer& shared_secret,
+                   const crypto::SecureBuffer& auth,
+                   const IPAddress& addr);
+
+  /**
+   * Create a established LodpSession from state serialized by export_state()
+   * in another process (LodpEndpoint::import_state())
+   *
+   * @warning The state must have been checked with is_state_valid().
+   *
+   * @param[in] ep    The LodpEndpoint associated with this LodpSession
+   * @param[in] state The serialized LodpSession
+   * @param[in] addr  The remote LodpEndpoint's IP address/port
+   */
+  BasicLodpSession(Endpoint& ep,
+                   const state::Session& state,
+                   const IPAddress& addr);
+  /** @} */
+
+  /** @{ */
+  /**
+   * Serialize a established LodpSession (LodpEndpoint::export_state())
+   *
+   * @param[out] state The state::Session to store the LodpSession in
+   */
+  void export_state(state::Session& state) const;
+
+  /**
+   * Check that serialized LodpSession state is well formed
+   *
+   * @param[in] state The serialized LodpSession
+   *
+   * @returns true - The state can be passed to the constructor
+   * @returns false - The state is malformed
+   */
+  static bool is_state_valid(const state::Session& state);
   /** @} */
 
   /** @{ */
@@ -248,9 +578,11 @@ class LodpSession {
   /**
    * Add random padding to a packet to disguise payload size
    *
-   * @warning The amount of framing overhead is tuned for standard ethernet
-   * frames.  If you are using a interface that has a MTU greater than 1500
-   * bytes or so, kMaxPadFramingOverhead will need to be changed.
+   * Packets that already have padding (PMTU PROBE) are left as is.
+   *
+   * @warning The amount of framing overhead is tuned for MTUs up to 16 KiB
+   * (2 byte length prefix).  If you are using a interface that has a larger
+   * MTU than that, kMaxPadFramingOverhead will need to be changed.
    */
   void pad_packet(packet::Envelope& pkt);
 
@@ -265,6 +597,197 @@ class LodpSession {
    */
   int siv_encrypt_and_xmit(packet::Envelope& pkt);
 
+  /**
+   * Transmit a buffer of packets built by send_burst()
+   *
+   * @param[in] burst         The packets
+   * @param[in] segment_size  The length of each packet (The last packet may
+   *                          be shorter)
+   *
+   * @returns (User specified value) - The value returned from the callback
+   */
+  int xmit_burst(const ::std::string& burst,
+                 const size_t segment_size);
+
+  /**
+   * Hand encrypted packets to the transport, or queue them
+   *
+   * Packets are queued instead if the send queue is not empty (to preserve
+   * ordering), or if the callback returns kErrorAgain.
+   *
+   * @param[in] buf           The packets
+   * @param[in] len           The total length of the packets
+   * @param[in] segment_size  The length of each packet (0 for a single
+   *                          packet)
+   *
+   * @returns kErrorOk - The packets were sent or queued
+   * @returns (User specified value) - The value returned from the callback
+   */
+  int xmit(const void* buf,
+           const size_t len,
+           const size_t segment_size);
+
+  /**
+   * Transmit as much of the send queue as the transport will accept
+   *
+   * Once the queue is empty the LodpSession is removed from
+   * LodpEndpoint::tx_pending_.  If the application was refused with
+   * kErrorAgain, and the queue is at or below the low watermark, this calls
+   * LodpCallbacks::on_writable() (Which may close() the LodpSession) if
+   * notify is set.
+   *
+   * @param[in] notify  Call LodpCallbacks::on_writable()?
+   *
+   * @returns kErrorOk    - The queue was drained
+   * @returns kErrorAgain - The transport can not accept more packets
+   * @returns (User specified value) - The first error returned from the
+   *                                   callback (The packet is dropped)
+   */
+  int drain_tx_queue(const bool notify = true);
+
+  /**
+   * Get the crypto::SIVBlake2sXChaCha instance used to encrypt outgoing
+   * packets
+   *
+   * If the LodpSession is the responder in the middle of a rekey() operation,
+   * this will be the old key.
+   */
+  crypto::SIVBlake2sXChaCha& tx_siv();
+
+  /** Is there coalesced data or a partial FEC block to flush()? */
+  bool needs_flush() const { return coalesce_len_ > 0 || fec_tx_count_ > 0; }
+
+  /** The largest UDP MTU probed or configured for path MTU discovery */
+  size_t rx_udp_mtu() const { return ::std::max(pmtu_, pmtu_max_); }
+
+  /**
+   * Transmit any queued coalesced messages (But not FEC parity)
+   *
+   * @returns (Any flush() return value)
+   */
+  int flush_coalesced();
+
+  /**
+   * Queue a message for coalesced transmission
+   *
+   * @param[in] buf  The buffer to send
+   * @param[in] len  The lenght of the buffer
+   *
+   * @returns kErrorOk - Success
+   * @returns (Any flush() return value) - Flushing the queued messages failed
+   */
+  int coalesce(const void* buf, const size_t len);
+
+  /** A message in the process of being reassembled */
+  struct Reassembly {
+    uint32_t message_id_;     /**< The message ID */
+    size_t length_;           /**< The length of the message */
+    size_t fragment_size_;    /**< The size of each data fragment */
+    uint32_t count_;          /**< The number of data fragments */
+    uint32_t received_;       /**< The number of data fragments received */
+    ::std::vector<bool> have_;  /**< The data fragments received */
+    uint8_t* dst_;            /**< The destination buffer */
+    bool user_dst_;           /**< Was dst_ provided by the application? */
+    ::std::unique_ptr<uint8_t[]> storage_;  /**< Internal storage (if any) */
+    ::std::unique_ptr<uint8_t[]> parity_;   /**< The parity fragment (if any) */
+    /** When the message will be dropped */
+    ::std::chrono::steady_clock::time_point expire_time_;
+  };
+
+  /**
+   * Process a inbound DATA packet containing a Fragment
+   *
+   * @param[in] data_msg  The DATA packet to process
+   *
+   * @returns kErrorOk - Success
+   * @returns kErrorBadPacketFormat - The Fragment is malformed
+   */
+  int on_fragment_packet(const packet::Data& data_msg);
+
+  /**
+   * Drop a partially reassembled message
+   *
+   * @param[in] idx   The index of the message in reassembly_
+   */
+  void drop_reassembly(const size_t idx);
+
+  /** Recover a single missing data fragment from the parity fragment */
+  void recover_from_parity(Reassembly& r);
+
+  /**
+   * Probe the next PMTU search candidate, or schedule the next confirmation
+   * probe if the search is complete
+   */
+  void pmtu_next_probe();
+
+  /** Transmit the PMTU PROBE for pmtu_probe_size_ and start the timer */
+  void pmtu_xmit_probe();
+
+  /** The PMTU probe for pmtu_probe_size_ was lost kPmtuMaxProbes times */
+  void on_pmtu_probe_failed();
+
+  /** The path MTU discovery Timer expired */
+  void on_pmtu_timer();
+
+  /** A FEC block being received */
+  struct FecRxBlock {
+    uint32_t block_id_;       /**< The block ID */
+    size_t k_;                /**< Source packets (0 = No parity received yet) */
+    size_t m_;                /**< Parity packets */
+    size_t shard_len_;        /**< The length of each parity shard */
+    size_t received_;         /**< The number of packets received */
+    size_t nr_sources_;       /**< Source shards present (Received/recovered) */
+    size_t nr_parity_;        /**< Parity shards present */
+    bool recovered_;          /**< Were source shards recovered? */
+    /** The shards (Sources are length prefixed) */
+    ::std::vector<::std::string> shards_;
+    ::std::vector<bool> have_;  /**< The shards present */
+  };
+
+  /**
+   * Add a DATA packet to the current FEC block
+   *
+   * @param[in,out] data_msg  The DATA packet (Must have a payload)
+   *
+   * @returns true  - The block is full, and fec_xmit_parity() must be called
+   * @returns false - The block has room for more packets
+   */
+  bool fec_protect(packet::Data& data_msg);
+
+  /**
+   * Transmit the parity packets for the current FEC block, and start the next
+   *
+   * @returns kErrorConnAborted - No remaining sequence number space to send
+   *                              *ANY* data (Must close() the LodpSession)
+   * @returns (User specified value) - The value returned from the callback
+   */
+  int fec_xmit_parity();
+
+  /** Pick the FEC block parameters based on the peer's loss reports */
+  void fec_adapt();
+
+  /**
+   * Process a inbound DATA packet containing a Fec header
+   *
+   * @param[in] data_msg  The DATA packet to process
+   *
+   * @returns kErrorOk - Success
+   * @returns kErrorBadPacketFormat - The Fec header is malformed
+   */
+  int on_fec_packet(const packet::Data& data_msg);
+
+  /**
+   * Attempt to recover the missing source packets of a FEC block
+   *
+   * @param[in,out] b         The FEC block
+   * @param[out] recovered    The recovered payloads
+   */
+  void fec_recover(FecRxBlock& b,
+                   ::std::vector<::std::string>& recovered);
+
+  /** Retire the oldest FEC block, and account for any loss */
+  void fec_retire_block();
+
   /**
    * Decrypt and authenticate a packet
    *
@@ -283,6 +806,8 @@ class LodpSession {
   /** @} */
 
   /** @{ */
+  /** Is the send queue above the high watermark? (Blocks the LodpSession) */
+  bool tx_would_block();
   /** Validate the current transmit sequence number */
   bool tx_seq_ok();
   /** Validate the sequence number in a incoming packet */
@@ -342,6 +867,36 @@ class LodpSession {
    * connection is getting torn down.
    */
   void send_shutdown_packet();
+
+  /**
+   * Send a PMTU PROBE packet padded to pmtu_probe_size_
+   *
+   * @returns kErrorNotConn     - The connection is not fully handshaked
+   * @returns kErrorConnAborted - No remaining sequence number space to send
+   *                              *ANY* data (Must close() the LodpSession)
+   * @returns (User specified value) - The value returned from the callback
+   */
+  int send_pmtu_probe_packet();
+
+  /**
+   * Send a PMTU PROBE ACK packet
+   *
+   * @param[in] probe_id  The ID of the PMTU PROBE being acknowledged
+   *
+   * @returns kErrorConnAborted - No remaining sequence number space to send
+   *                              *ANY* data (Must close() the LodpSession)
+   * @returns (User specified value) - The value returned from the callback
+   */
+  int send_pmtu_probe_ack_packet(const uint32_t probe_id);
+
+  /**
+   * Send a FEC FEEDBACK packet
+   *
+   * @returns kErrorConnAborted - No remaining sequence number space to send
+   *                              *ANY* data (Must close() the LodpSession)
+   * @returns (User specified value) - The value returned from the callback
+   */
+  int send_fec_feedback_packet();
   /** @} */
 
   /** @{ */
@@ -436,6 +991,42 @@ class LodpSession {
    * @returns kErrorBadPacketFormat - The SHUTDOWN packet is malformed
    */
   int on_shutdown_packet(const packet::Envelope& pkt);
+
+  /**
+   * Validate and process a inbound PMTU PROBE packet
+   *
+   * @param[in] pkt   The PMTU PROBE packet to process
+   *
+   * @returns kErrorProtocol - The LodpSession is not in a state that allows
+   *                           PMTU PROBE packets/Packet out of window
+   * @returns kErrorBadPacketFormat - The PMTU PROBE packet is malformed
+   * @returns (User specified value) - The value returned from the callback
+   */
+  int on_pmtu_probe_packet(const packet::Envelope& pkt);
+
+  /**
+   * Validate and process a inbound PMTU PROBE ACK packet
+   *
+   * @param[in] pkt   The PMTU PROBE ACK packet to process
+   *
+   * @returns kErrorOk - Success
+   * @returns kErrorProtocol - The LodpSession is not in a state that allows
+   *                           PMTU PROBE ACK packets/Packet out of window
+   * @returns kErrorBadPacketFormat - The PMTU PROBE ACK packet is malformed
+   */
+  int on_pmtu_probe_ack_packet(const packet::Envelope& pkt);
+
+  /**
+   * Validate and process a inbound FEC FEEDBACK packet
+   *
+   * @param[in] pkt   The FEC FEEDBACK packet to process
+   *
+   * @returns kErrorOk - Success
+   * @returns kErrorProtocol - The LodpSession is not in a state that allows
+   *                           FEC FEEDBACK packets/Packet out of window
+   * @returns kErrorBadPacketFormat - The FEC FEEDBACK packet is malformed
+   */
+  int on_fec_feedback_packet(const packet::Envelope& pkt);
   /** @} */
 
   // User config/callbacks
@@ -446,7 +1037,7 @@ class LodpSession {
   // Session state
   /** @{ */
   /** The LodpEndpoint associated with this session */
-  LodpEndpoint& endpoint_;
+  Endpoint& endpoint_;
   /** The LodpSession protocol state */
   enum class State {
     kINVALID,     /**< Invalid Session */
@@ -500,15 +1091,112 @@ class LodpSession {
   ::std::chrono::steady_clock::time_point cookie_expire_time_;
   /** @} */
 
+  // Small message coalescing
+  /** @{ */
+  bool coalesce_;               /**< Is coalescing enabled? */
+  /** The queued length that triggers a flush (0 = mtu()) */
+  size_t coalesce_threshold_;
+  /** The maximum time a message will be queued */
+  ::std::chrono::microseconds coalesce_delay_;
+  /** When the oldest queued message must be sent */
+  ::std::chrono::steady_clock::time_point coalesce_deadline_;
+  /** The DATA packet containing the queued messages */
+  ::std::unique_ptr<packet::Envelope> coalesce_pkt_;
+  size_t coalesce_len_;         /**< The framed length of the queued messages */
+  size_t coalesce_bytes_;       /**< The payload length of the queued messages */
+  /** The Timer used to enforce coalesce_delay_ */
+  ::std::unique_ptr<Timer> coalesce_timer_;
+  /** Is the LodpSession in LodpEndpoint::flush_pending_? */
+  bool flush_pending_;
+  /** @} */
+
+  // Fragmentation/reassembly
+  /** @{ */
+  uint32_t tx_message_id_;      /**< The last fragmented message ID sent */
+  /** The messages currently being reassembled (Oldest first) */
+  ::std::vector<::std::unique_ptr<Reassembly>> reassembly_;
+  size_t reassembly_bytes_;     /**< The memory used by reassembly_ */
+  /** Recently completed message IDs (To ignore late fragments) */
+  ::std::array<uint32_t, kCompletedMessageIds> rx_completed_ids_;
+  size_t rx_completed_idx_;     /**< The next rx_completed_ids_ slot */
+  /** @} */
+
+  // Path MTU discovery
+  /** @{ */
+  size_t pmtu_;                 /**< The current UDP MTU of the path */
+  size_t pmtu_max_;             /**< The largest UDP MTU to search for (0 = off) */
+  size_t pmtu_ceiling_;         /**< The largest size not known to be too big */
+  size_t pmtu_probe_size_;      /**< The size being probed (0 = none) */
+  uint32_t pmtu_probe_id_;      /**< The ID of the current probe */
+  int pmtu_probe_count_;        /**< The number of times the size was probed */
+  bool pmtu_searching_;         /**< Is a search in progress? */
+  /** The time to wait for a PMTU PROBE ACK */
+  ::std::chrono::milliseconds pmtu_probe_timeout_;
+  /** When the last search completed */
+  ::std::chrono::steady_clock::time_point pmtu_search_time_;
+  /** The Timer used for probe timeouts and confirmation */
+  ::std::unique_ptr<Timer> pmtu_timer_;
+  /** @} */
+
+  // Forward error correction
+  /** @{ */
+  bool fec_;                    /**< Is FEC enabled? */
+  bool fec_adaptive_;           /**< Adapt the block parameters to loss? */
+  size_t fec_k_;                /**< Source packets per block */
+  size_t fec_m_;                /**< Parity packets per block */
+  uint32_t fec_loss_ppm_;       /**< The peer reported loss (ppm, EWMA) */
+  uint32_t fec_tx_block_id_;    /**< The current transmit block ID */
+  size_t fec_tx_k_;             /**< The current block's k */
+  size_t fec_tx_m_;             /**< The current block's m */
+  size_t fec_tx_count_;         /**< Source packets in the current block */
+  size_t fec_tx_shard_len_;     /**< The longest shard in the current block */
+  /** The parity shards of the current block */
+  ::std::vector<::std::vector<uint8_t>> fec_tx_parity_;
+  /** The FEC blocks being received (Ordered by block ID) */
+  ::std::vector<::std::unique_ptr<FecRxBlock>> fec_rx_blocks_;
+  uint32_t fec_rx_floor_;       /**< Blocks below this ID are retired */
+  /** Retired blocks with recovered sources (Bit N = fec_rx_floor_ - 1 - N) */
+  uint64_t fec_rx_recovered_;
+  uint32_t fec_rx_expected_;    /**< Packets expected since the last feedback */
+  uint32_t fec_rx_lost_;        /**< Packets lost since the last feedback */
+  size_t fec_rx_retired_;       /**< Blocks retired since the last feedback */
+  /** @} */
+
+  // Transmit queue
+  /** @{ */
+  /** A queued packet (or GSO burst) waiting for the transport */
+  struct TxQueueEntry {
+    ::std::string buf_;         /**< The encrypted packets */
+    size_t segment_size_;       /**< The GSO segment size (0 = one packet) */
+  };
+  /** The packets waiting for the transport to become writable */
+  ::std::deque<TxQueueEntry> tx_queue_;
+  size_t tx_queue_bytes_;       /**< The length of the queued packets */
+  size_t tx_high_watermark_;    /**< The queue length that blocks send() */
+  size_t tx_low_watermark_;     /**< The queue length that unblocks send() */
+  bool tx_blocked_;             /**< Was send() refused with kErrorAgain? */
+  /** Is the LodpSession in LodpEndpoint::tx_pending_? */
+  bool tx_pending_;
+  /** @} */
+
+  /**
+   * Set to true when the LodpSession is destroyed (Used to detect close() from
+   * within the on_recv() callback when delivering coalesced messages)
+   */
+  bool* destroyed_;
+
   // Connection statistics
   /** @{ */
-  struct Stats stats_;  /**< Various LodpSession statistics */
+  Stats stats_;         /**< Various LodpSession statistics */
   /** @} */
 
   /** LodpEndpoint is tightly coupled with LodpSession */
-  friend LodpEndpoint;
+  friend Endpoint;
 };
 
+crypto::SecureBuffer derive_session_siv_key(const crypto::SecureBuffer&
+                                            secret);
+
 } // namespace lodp
 } // namespace schwanenlied
 
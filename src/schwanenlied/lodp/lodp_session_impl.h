@@ -0,0 +1,2584 @@
+/**
+ * @file    lodp_session_impl.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   LODP Session (TEMPLATE IMPLEMENTATION)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_LODP_LODP_SESSION_IMPL_H__
+#define SCHWANENLIED_LODP_LODP_SESSION_IMPL_H__
+
+#include <algorithm>
+#include <cstring>
+
+#include "schwanenlied/reed_solomon.h"
+#include "schwanenlied/timer.h"
+#include "schwanenlied/lodp/lodp_session.h"
+#include "schwanenlied/lodp/lodp_endpoint.h"
+#include "schwanenlied/lodp/lodp_probes.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+template <class Callbacks>
+const int BasicLodpSession<Callbacks>::kReassemblyTimeout;
+
+template <class Callbacks>
+const int BasicLodpSession<Callbacks>::kPmtuProbeTimeout;
+
+template <class Callbacks>
+const int BasicLodpSession<Callbacks>::kPmtuConfirmInterval;
+
+template <class Callbacks>
+const int BasicLodpSession<Callbacks>::kPmtuRaiseInterval;
+
+template <class Callbacks>
+BasicLodpSession<Callbacks>::BasicLodpSession(
+    Endpoint& ep, void *ctxt,
+    const crypto::Curve25519::PublicKey& peer_identity_key,
+    const uint8_t* node_id,
+    const size_t node_id_len,
+    const IPAddress& addr) :
+    ctxt_(ctxt),
+    endpoint_(ep),
+    state_(State::kINIT),
+    peer_addr_(addr),
+    peer_identity_key_(new crypto::Curve25519::PublicKey(peer_identity_key)),
+    node_id_(new crypto::SecureBuffer(node_id, node_id_len)),
+    ephemeral_rx_siv_(new crypto::SIVBlake2sXChaCha(ep.rng_)),
+    ephemeral_tx_siv_(new crypto::SIVBlake2sXChaCha(ep.rng_)),
+    tx_last_seq_(0),
+    rx_last_seq_(0),
+    rx_bitmap_(0),
+    has_cached_state_(false),
+    siv_key_source_(new crypto::SecureBuffer(ep.kSIVSourceLength, 0)),
+    coalesce_(false),
+    coalesce_threshold_(0),
+    coalesce_delay_(0),
+    coalesce_len_(0),
+    coalesce_bytes_(0),
+    flush_pending_(false),
+    tx_message_id_(0),
+    reassembly_bytes_(0),
+    rx_completed_ids_(),
+    rx_completed_idx_(0),
+    pmtu_(addr.udp_mtu()),
+    pmtu_max_(0),
+    pmtu_ceiling_(0),
+    pmtu_probe_size_(0),
+    pmtu_probe_id_(0),
+    pmtu_probe_count_(0),
+    pmtu_searching_(false),
+    pmtu_probe_timeout_(kPmtuProbeTimeout),
+    fec_(false),
+    fec_adaptive_(false),
+    fec_k_(0),
+    fec_m_(0),
+    fec_loss_ppm_(0),
+    fec_tx_block_id_(0),
+    fec_tx_k_(0),
+    fec_tx_m_(0),
+    fec_tx_count_(0),
+    fec_tx_shard_len_(0),
+    fec_rx_floor_(0),
+    fec_rx_recovered_(0),
+    fec_rx_expected_(0),
+    fec_rx_lost_(0),
+    fec_rx_retired_(0),
+    tx_queue_(),
+    tx_queue_bytes_(0),
+    tx_high_watermark_(kDefaultTxHighWatermark),
+    tx_low_watermark_(kDefaultTxLowWatermark),
+    tx_blocked_(false),
+    tx_pending_(false),
+    destroyed_(nullptr),
+    stats_() {
+  // Validate that the user didn't screw up
+  SL_ASSERT(node_id_->length() > 0);
+
+  //  RX key (Responder->Initiator) is based off random input to the KDF
+  endpoint_.rng_.get_bytes(&(*siv_key_source_)[0], siv_key_source_->length());
+  const auto rx_siv_key = derive_initiator_siv_key(*siv_key_source_);
+  ephemeral_rx_siv_->set_key(rx_siv_key.data(), rx_siv_key.length());
+
+  // TX key (Initiator->Responder) is derived from public_key
+  const auto intro_siv_key = derive_intro_siv_key(*peer_identity_key_);
+  ephemeral_tx_siv_->set_key(intro_siv_key.data(), intro_siv_key.length());
+}
+
+template <class Callbacks>
+BasicLodpSession<Callbacks>::BasicLodpSession(
+    Endpoint& ep,
+    const crypto::Curve25519::PublicKey& session_key,
+    const crypto::Curve25519::PublicKey& peer_session_key,
+    const crypto::SecureBuffer& shared_secret,
+    const crypto::SecureBuffer& auth,
+    const IPAddress& addr) :
+    ctxt_(nullptr),
+    endpoint_(ep),
+    state_(State::kESTABLISHED),
+    peer_addr_(addr),
+    ephemeral_rx_siv_(new crypto::SIVBlake2sXChaCha(ep.rng_)),
+    ephemeral_tx_siv_(new crypto::SIVBlake2sXChaCha(ep.rng_)),
+    tx_last_seq_(0),
+    rx_last_seq_(0),
+    rx_bitmap_(0),
+    has_cached_state_(true),
+    session_key_(new crypto::Curve25519::PublicKey(session_key)),
+    peer_session_key_(new crypto::Curve25519::PublicKey(peer_session_key)),
+    auth_(new crypto::SecureBuffer(auth)),
+    coalesce_(false),
+    coalesce_threshold_(0),
+    coalesce_delay_(0),
+    coalesce_len_(0),
+    coalesce_bytes_(0),
+    flush_pending_(false),
+    tx_message_id_(0),
+    reassembly_bytes_(0),
+    rx_completed_ids_(),
+    rx_completed_idx_(0),
+    pmtu_(addr.udp_mtu()),
+    pmtu_max_(0),
+    pmtu_ceiling_(0),
+    pmtu_probe_size_(0),
+    pmtu_probe_id_(0),
+    pmtu_probe_count_(0),
+    pmtu_searching_(false),
+    pmtu_probe_timeout_(kPmtuProbeTimeout),
+    fec_(false),
+    fec_adaptive_(false),
+    fec_k_(0),
+    fec_m_(0),
+    fec_loss_ppm_(0),
+    fec_tx_block_id_(0),
+    fec_tx_k_(0),
+    fec_tx_m_(0),
+    fec_tx_count_(0),
+    fec_tx_shard_len_(0),
+    fec_rx_floor_(0),
+    fec_rx_recovered_(0),
+    fec_rx_expected_(0),
+    fec_rx_lost_(0),
+    fec_rx_retired_(0),
+    tx_queue_(),
+    tx_queue_bytes_(0),
+    tx_high_watermark_(kDefaultTxHighWatermark),
+    tx_low_watermark_(kDefaultTxLowWatermark),
+    tx_blocked_(false),
+    tx_pending_(false),
+    destroyed_(nullptr),
+    stats_() {
+  // Setup the SIV keys based on the Shared Secret
+  const auto key = derive_session_siv_key(shared_secret);
+  ephemeral_rx_siv_->set_key(key.data(), crypto::SIVBlake2sXChaCha::kKeyLength);
+  ephemeral_tx_siv_->set_key(key.data() + crypto::SIVBlake2sXChaCha::kKeyLength,
+                             crypto::SIVBlake2sXChaCha::kKeyLength);
+}
+
+template <class Callbacks>
+BasicLodpSession<Callbacks>::BasicLodpSession(
+    Endpoint& ep,
+    const state::Session& state,
+    const IPAddress& addr) :
+    ctxt_(nullptr),
+    endpoint_(ep),
+    state_(State::kESTABLISHED),
+    peer_addr_(addr),
+    ephemeral_rx_siv_(new crypto::SIVBlake2sXChaCha(ep.rng_)),
+    ephemeral_tx_siv_(new crypto::SIVBlake2sXChaCha(ep.rng_)),
+    tx_last_seq_(state.tx_last_seq()),
+    rx_last_seq_(state.rx_last_seq()),
+    rx_bitmap_(state.rx_bitmap()),
+    has_cached_state_(false),
+    coalesce_(false),
+    coalesce_threshold_(0),
+    coalesce_delay_(0),
+    coalesce_len_(0),
+    coalesce_bytes_(0),
+    flush_pending_(false),
+    tx_message_id_(state.tx_message_id()),
+    reassembly_bytes_(0),
+    rx_completed_ids_(),
+    rx_completed_idx_(0),
+    pmtu_(addr.udp_mtu()),
+    pmtu_max_(0),
+    pmtu_ceiling_(0),
+    pmtu_probe_size_(0),
+    pmtu_probe_id_(0),
+    pmtu_probe_count_(0),
+    pmtu_searching_(false),
+    pmtu_probe_timeout_(kPmtuProbeTimeout),
+    fec_(false),
+    fec_adaptive_(false),
+    fec_k_(0),
+    fec_m_(0),
+    fec_loss_ppm_(0),
+    fec_tx_block_id_(0),
+    fec_tx_k_(0),
+    fec_tx_m_(0),
+    fec_tx_count_(0),
+    fec_tx_shard_len_(0),
+    fec_rx_floor_(0),
+    fec_rx_recovered_(0),
+    fec_rx_expected_(0),
+    fec_rx_lost_(0),
+    fec_rx_retired_(0),
+    tx_queue_(),
+    tx_queue_bytes_(0),
+    tx_high_watermark_(kDefaultTxHighWatermark),
+    tx_low_watermark_(kDefaultTxLowWatermark),
+    tx_blocked_(false),
+    tx_pending_(false),
+    destroyed_(nullptr),
+    stats_() {
+  auto key_ptr = [](const ::std::string& key) {
+    return reinterpret_cast<const uint8_t*>(key.data());
+  };
+
+  ephemeral_rx_siv_->set_key(key_ptr(state.rx_key()), state.rx_key().size());
+  ephemeral_tx_siv_->set_key(key_ptr(state.tx_key()), state.tx_key().size());
+  if (state.has_prev_rx_key()) {
+    prev_ephemeral_rx_siv_.reset(new crypto::SIVBlake2sXChaCha(ep.rng_,
+        key_ptr(state.prev_rx_key()), state.prev_rx_key().size()));
+    prev_ephemeral_tx_siv_.reset(new crypto::SIVBlake2sXChaCha(ep.rng_,
+        key_ptr(state.prev_tx_key()), state.prev_tx_key().size()));
+  }
+
+  if (state.initiator()) {
+    peer_identity_key_.reset(new crypto::Curve25519::PublicKey(
+        key_ptr(state.peer_identity_key()), state.peer_identity_key().size()));
+    node_id_.reset(new crypto::SecureBuffer(key_ptr(state.node_id()),
+                                            state.node_id().size()));
+  } else if (state.has_auth()) {
+    // The peer may not have seen the HANDSHAKE ACK yet
+    has_cached_state_ = true;
+    session_key_.reset(new crypto::Curve25519::PublicKey(
+        key_ptr(state.session_key()), state.session_key().size()));
+    peer_session_key_.reset(new crypto::Curve25519::PublicKey(
+        key_ptr(state.peer_session_key()), state.peer_session_key().size()));
+    auth_.reset(new crypto::SecureBuffer(key_ptr(state.auth()),
+                                         state.auth().size()));
+  }
+
+  if (state.pmtu() > pmtu_ && state.pmtu() <= addr.udp_max_mtu())
+    pmtu_ = state.pmtu();
+  stats_.generation_id_ = state.generation_id();
+  stats_.generation_tx_ = state.generation_tx();
+  stats_.generation_rx_ = state.generation_rx();
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::export_state(state::Session& state) const {
+  SL_ASSERT(state_ == State::kESTABLISHED);
+
+  crypto::SecureBuffer key;
+  auto set_key = [&key](::std::string* dst,
+                        const crypto::SIVBlake2sXChaCha& siv) {
+    siv.get_key(key);
+    dst->assign(reinterpret_cast<const char*>(key.data()), key.size());
+  };
+
+  state.set_peer_addr(peer_addr_.sockaddr(), peer_addr_.length());
+  state.set_initiator(peer_identity_key_ != nullptr);
+  set_key(state.mutable_rx_key(), *ephemeral_rx_siv_);
+  set_key(state.mutable_tx_key(), *ephemeral_tx_siv_);
+  if (prev_ephemeral_rx_siv_) {
+    set_key(state.mutable_prev_rx_key(), *prev_ephemeral_rx_siv_);
+    set_key(state.mutable_prev_tx_key(), *prev_ephemeral_tx_siv_);
+  }
+  state.set_tx_last_seq(tx_last_seq_);
+  state.set_rx_last_seq(rx_last_seq_);
+  state.set_rx_bitmap(rx_bitmap_);
+
+  if (peer_identity_key_) {
+    state.set_peer_identity_key(peer_identity_key_->data(),
+                                peer_identity_key_->length());
+    state.set_node_id(node_id_->data(), node_id_->length());
+  } else if (has_cached_state_ && auth_) {
+    state.set_session_key(session_key_->data(), session_key_->length());
+    state.set_peer_session_key(peer_session_key_->data(),
+                               peer_session_key_->length());
+    state.set_auth(auth_->data(), auth_->length());
+  }
+
+  state.set_generation_id(stats_.generation_id_);
+  state.set_generation_tx(stats_.generation_tx_);
+  state.set_generation_rx(stats_.generation_rx_);
+  state.set_pmtu(pmtu_);
+  state.set_tx_message_id(tx_message_id_);
+}
+
+template <class Callbacks>
+bool BasicLodpSession<Callbacks>::is_state_valid(const state::Session& state) {
+  const size_t key_len = crypto::SIVBlake2sXChaCha::kKeyLength;
+  const size_t pub_len = crypto::Curve25519::PublicKey::kKeyLength;
+
+  if (state.rx_key().size() != key_len || state.tx_key().size() != key_len)
+    return false;
+  if (state.has_prev_rx_key() != state.has_prev_tx_key())
+    return false;
+  if (state.has_prev_rx_key() && (state.prev_rx_key().size() != key_len ||
+                                  state.prev_tx_key().size() != key_len))
+    return false;
+
+  if (state.initiator()) {
+    if (state.peer_identity_key().size() != pub_len)
+      return false;
+    if (state.node_id().empty())
+      return false;
+  } else if (state.has_auth()) {
+    if (state.session_key().size() != pub_len ||
+        state.peer_session_key().size() != pub_len ||
+        state.auth().size() != crypto::NtorHandshake::kAuthLength)
+      return false;
+  }
+
+  return true;
+}
+
+template <class Callbacks>
+BasicLodpSession<Callbacks>::~BasicLodpSession() {
+  // Blow up in the user's face if they didn't close()
+  SL_ASSERT(state_ == State::kINVALID);
+
+  if (destroyed_ != nullptr)
+    *destroyed_ = true;
+}
+
+template <class Callbacks>
+const size_t BasicLodpSession<Callbacks>::mtu() const {
+  return pmtu_ - Endpoint::kMinPacketLength -
+      kDataFramingOverhead - (fec_ ? kFecFramingOverhead : 0);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::handshake() {
+  if (!peer_identity_key_)
+    return kErrorNotInitiator;
+
+  switch (state_) {
+  case State::kINIT:
+    return send_init_packet();
+    break;
+  case State::kHANDSHAKE:
+    return send_handshake_packet();
+    break;
+  case State::kESTABLISHED: // FALLSTHROUGH
+  case State::kREKEY:
+    return kErrorIsConn;
+  default:
+    return kErrorBadFD;
+  }
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::send(const void* buf,
+                                      const size_t len) {
+  if (buf == nullptr && len > 0)
+    return kErrorInval;
+  if (len > mtu())
+    return kErrorMsgSize;
+  if (state_ == State::kREKEY)
+    return kErrorMustRekey;
+  if (state_ != State::kESTABLISHED)
+    return kErrorNotConn;
+  if (tx_would_block())
+    return kErrorAgain;
+
+  // Queue small messages if coalescing is enabled
+  if (coalesce_ && kCoalesceFramingOverhead + len <=
+      (coalesce_threshold_ > 0 ? coalesce_threshold_ : mtu()))
+    return coalesce(buf, len);
+  if (coalesce_len_ > 0) {
+    // Transmit the queued messages first to preserve ordering
+    int ret = flush_coalesced();
+    if (ret != kErrorOk)
+      return ret;
+  }
+
+  // Generate the DATA packet and transmit it
+  ::std::unique_ptr<packet::Envelope> data(new packet::Envelope());  // TODO/Performance: Buffer pool
+  data->set_packet_type(packet::Envelope::DATA);
+  packet::Data* data_msg = data->mutable_msg_data();
+  data_msg->set_sequence_number(++tx_last_seq_);
+  data_msg->set_payload(buf, len);
+
+  if (!tx_seq_ok())
+    return kErrorConnAborted;
+
+  const bool fec_block_full = fec_ && fec_protect(*data_msg);
+  stats_.tx_goodput_bytes_ += len;
+  stats_.generation_tx_++;
+  int ret = siv_encrypt_and_xmit(*data);
+  if (fec_block_full) {
+    int fec_ret = fec_xmit_parity();
+    if (ret == kErrorOk)
+      ret = fec_ret;
+  }
+
+  if (should_rekey())
+    endpoint_.callbacks_.on_rekey_needed(*this);
+
+  return ret;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::send_burst(const struct iovec* iov,
+                                            const size_t iovcnt) {
+  if (iov == nullptr && iovcnt > 0)
+    return kErrorInval;
+  for (size_t i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_base == nullptr && iov[i].iov_len > 0)
+      return kErrorInval;
+    if (iov[i].iov_len > mtu())
+      return kErrorMsgSize;
+  }
+  if (state_ == State::kREKEY)
+    return kErrorMustRekey;
+  if (state_ != State::kESTABLISHED)
+    return kErrorNotConn;
+  if (tx_would_block())
+    return kErrorAgain;
+  if (coalesce_len_ > 0) {
+    // Transmit the queued messages first to preserve ordering
+    int ret = flush_coalesced();
+    if (ret != kErrorOk)
+      return ret;
+  }
+
+  // Generate the DATA packets, reusing the same Envelope for each
+  ::std::unique_ptr<packet::Envelope> data(new packet::Envelope());
+  data->set_packet_type(packet::Envelope::DATA);
+  packet::Data* data_msg = data->mutable_msg_data();
+  ::std::string serialized;
+  ::std::string burst;  // TODO/Performance: Buffer pool
+  size_t segment_size = 0;
+  size_t nr_segments = 0;
+  int ret = kErrorOk;
+
+  for (size_t i = 0; i < iovcnt; i++) {
+    data_msg->set_sequence_number(++tx_last_seq_);
+    data_msg->set_payload(iov[i].iov_base, iov[i].iov_len);
+    data->clear_pad();
+
+    if (!tx_seq_ok()) {
+      ret = kErrorConnAborted;
+      break;
+    }
+
+    const bool fec_block_full = fec_ && fec_protect(*data_msg);
+    pad_packet(*data);
+    bool serialized_ok = data->SerializeToString(&serialized);
+    SL_ASSERT(serialized_ok);
+    const size_t ct_len = Endpoint::kMinPacketLength + serialized.length();
+
+    /*
+     * GSO requires that every segment but the last be the same size, so a
+     * packet that is larger than the current segment size (or one that will
+     * not fit) forces the pending burst out.
+     */
+    if (nr_segments > 0 && (ct_len > segment_size ||
+                            nr_segments == kMaxBurstSegments ||
+                            burst.length() + ct_len > kMaxBurstLength)) {
+      nr_segments = 0;
+      ret = xmit_burst(burst, segment_size);
+      if (ret != kErrorOk)
+        break;
+    }
+    if (nr_segments == 0) {
+      burst.clear();
+      segment_size = ct_len;
+    }
+
+    // Encrypt the packet directly into the burst buffer
+    const size_t offset = burst.length();
+    burst.resize(offset + ct_len);
+    tx_siv().encrypt(serialized, reinterpret_cast<uint8_t*>(&burst[offset]));
+    nr_segments++;
+    endpoint_.stats_.tx_packets_[packet::Envelope::DATA]++;
+    stats_.tx_goodput_bytes_ += iov[i].iov_len;
+    stats_.generation_tx_++;
+
+    // A undersized packet terminates the burst
+    if (ct_len < segment_size) {
+      nr_segments = 0;
+      ret = xmit_burst(burst, segment_size);
+      if (ret != kErrorOk)
+        break;
+    }
+
+    // So does the end of a FEC block, as the parity goes out next
+    if (fec_block_full) {
+      if (nr_segments > 0) {
+        nr_segments = 0;
+        ret = xmit_burst(burst, segment_size);
+        if (ret != kErrorOk)
+          break;
+      }
+      ret = fec_xmit_parity();
+      if (ret != kErrorOk)
+        break;
+    }
+  }
+  if (nr_segments > 0) {
+    int xmit_ret = xmit_burst(burst, segment_size);
+    if (ret == kErrorOk)
+      ret = xmit_ret;
+  }
+
+  if (should_rekey())
+    endpoint_.callbacks_.on_rekey_needed(*this);
+
+  return ret;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::send_message(const void* buf,
+                                              const size_t len,
+                                              const bool parity) {
+  if (buf == nullptr && len > 0)
+    return kErrorInval;
+  if (len > kMaxMessageLength)
+    return kErrorMsgSize;
+  if (len <= mtu())
+    return send(buf, len);
+  if (state_ == State::kREKEY)
+    return kErrorMustRekey;
+  if (state_ != State::kESTABLISHED)
+    return kErrorNotConn;
+  if (tx_would_block())
+    return kErrorAgain;
+  if (coalesce_len_ > 0) {
+    // Transmit the queued messages first to preserve ordering
+    int ret = flush_coalesced();
+    if (ret != kErrorOk)
+      return ret;
+  }
+
+  // Split the message into evenly sized fragments
+  const size_t max_fragment_size = mtu() - kFragmentFramingOverhead;
+  const uint32_t count = (len + max_fragment_size - 1) / max_fragment_size;
+  const size_t fragment_size = (len + count - 1) / count;
+  const uint8_t* ptr = static_cast<const uint8_t*>(buf);
+  ::std::unique_ptr<uint8_t[]> parity_buf;
+  if (parity)
+    parity_buf.reset(new uint8_t[fragment_size]());
+
+  // Generate the DATA packets, reusing the same Envelope for each
+  ::std::unique_ptr<packet::Envelope> data(new packet::Envelope());
+  data->set_packet_type(packet::Envelope::DATA);
+  packet::Data* data_msg = data->mutable_msg_data();
+  packet::Fragment* fragment = data_msg->mutable_fragment();
+  if (++tx_message_id_ == 0)
+    ++tx_message_id_;  // 0 is used to mark empty rx_completed_ids_ slots
+  fragment->set_message_id(tx_message_id_);
+  fragment->set_count(count);
+  fragment->set_message_length(len);
+
+  int ret = kErrorOk;
+  for (uint32_t i = 0; i < count + (parity ? 1 : 0); i++) {
+    size_t fragment_len = fragment_size;
+    if (i < count) {
+      const size_t offset = i * fragment_size;
+      fragment_len = ::std::min(fragment_size, len - offset);
+      data_msg->set_payload(ptr + offset, fragment_len);
+      fragment->set_index(i);
+      if (parity) {
+        for (size_t j = 0; j < fragment_len; j++)
+          parity_buf[j] ^= ptr[offset + j];
+      }
+      stats_.tx_goodput_bytes_ += fragment_len;
+    } else {
+      data_msg->set_payload(parity_buf.get(), fragment_size);
+      fragment->clear_index();
+      fragment->set_parity(true);
+    }
+    data_msg->set_sequence_number(++tx_last_seq_);
+    data->clear_pad();
+
+    if (!tx_seq_ok()) {
+      ret = kErrorConnAborted;
+      break;
+    }
+
+    stats_.tx_fragments_++;
+    stats_.generation_tx_++;
+    ret = siv_encrypt_and_xmit(*data);
+    if (ret != kErrorOk)
+      break;
+  }
+
+  if (should_rekey())
+    endpoint_.callbacks_.on_rekey_needed(*this);
+
+  return ret;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::set_coalescing(
+    const bool enable,
+    const size_t threshold,
+    const ::std::chrono::microseconds& delay) {
+  if (threshold > mtu())
+    return kErrorInval;
+
+  if (!enable) {
+    coalesce_ = false;
+    return flush_coalesced();
+  }
+
+  coalesce_ = true;
+  coalesce_threshold_ = threshold;
+  coalesce_delay_ = delay;
+  if (coalesce_delay_.count() > 0 && !coalesce_timer_)
+    coalesce_timer_.reset(new Timer([this]() { flush_coalesced(); },
+                                    *endpoint_.clock_));
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::set_pmtu_discovery(
+    const bool enable,
+    const size_t max_udp_mtu,
+    const ::std::chrono::milliseconds&
+    probe_timeout) {
+  if (!enable) {
+    pmtu_max_ = 0;
+    pmtu_probe_size_ = 0;
+    pmtu_searching_ = false;
+    if (pmtu_timer_)
+      pmtu_timer_->stop();
+    if (pmtu_ != peer_addr_.udp_mtu()) {
+      flush_coalesced();
+      pmtu_ = peer_addr_.udp_mtu();
+    }
+    return kErrorOk;
+  }
+
+  const size_t max_mtu = max_udp_mtu > 0 ? max_udp_mtu :
+      peer_addr_.udp_max_mtu();
+  if (max_mtu < peer_addr_.udp_mtu() || max_mtu > peer_addr_.udp_max_mtu())
+    return kErrorInval;
+  if (probe_timeout.count() <= 0)
+    return kErrorInval;
+  if (state_ != State::kESTABLISHED && state_ != State::kREKEY)
+    return kErrorNotConn;
+
+  if (!pmtu_timer_)
+    pmtu_timer_.reset(new Timer([this]() { on_pmtu_timer(); },
+                                *endpoint_.clock_));
+  else
+    pmtu_timer_->stop();
+  if (pmtu_ > max_mtu) {
+    flush_coalesced();
+    pmtu_ = max_mtu;
+  }
+  pmtu_max_ = max_mtu;
+  pmtu_ceiling_ = max_mtu;
+  pmtu_probe_timeout_ = probe_timeout;
+  pmtu_probe_size_ = 0;
+  pmtu_searching_ = true;
+  pmtu_next_probe();
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::set_fec(const bool enable,
+                                         const size_t k,
+                                         const size_t m) {
+  if (k > kMaxFecK || m > kMaxFecM || (k == 0) != (m == 0))
+    return kErrorInval;
+
+  if (!enable) {
+    if (!fec_)
+      return kErrorOk;
+    int ret = kErrorOk;
+    if (fec_tx_count_ > 0)
+      ret = fec_xmit_parity();
+    fec_ = false;
+    fec_tx_parity_.clear();
+    return ret;
+  }
+
+  if (!fec_ && coalesce_len_ > 0) {
+    // The mtu() is about to shrink, so send the queued messages
+    int ret = flush_coalesced();
+    if (ret != kErrorOk)
+      return ret;
+  }
+
+  fec_ = true;
+  fec_adaptive_ = k == 0;
+  if (fec_adaptive_)
+    fec_adapt();
+  else {
+    fec_k_ = k;
+    fec_m_ = m;
+  }
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::set_tx_watermarks(const size_t high,
+                                                   const size_t low) {
+  if (high == 0 || low > high)
+    return kErrorInval;
+
+  tx_high_watermark_ = high;
+  tx_low_watermark_ = low;
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::flush() {
+  if (!needs_flush())
+    return kErrorOk;
+  if (state_ == State::kREKEY)
+    return kErrorMustRekey;
+  if (state_ != State::kESTABLISHED)
+    return kErrorNotConn;
+
+  int ret = flush_coalesced();
+  if (fec_tx_count_ > 0) {
+    // Close the partial FEC block
+    int fec_ret = fec_xmit_parity();
+    if (ret == kErrorOk)
+      ret = fec_ret;
+  }
+
+  return ret;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::flush_coalesced() {
+  if (coalesce_len_ == 0)
+    return kErrorOk;
+  if (state_ == State::kREKEY)
+    return kErrorMustRekey;
+  if (state_ != State::kESTABLISHED)
+    return kErrorNotConn;
+
+  if (coalesce_timer_)
+    coalesce_timer_->stop();
+
+  // Finish building the DATA packet and transmit it
+  packet::Data* data_msg = coalesce_pkt_->mutable_msg_data();
+  data_msg->set_sequence_number(++tx_last_seq_);
+  coalesce_pkt_->clear_pad();
+  const size_t nr_messages = data_msg->messages_size();
+  const size_t len = coalesce_bytes_;
+  coalesce_len_ = 0;
+  coalesce_bytes_ = 0;
+
+  if (!tx_seq_ok()) {
+    data_msg->clear_messages();
+    return kErrorConnAborted;
+  }
+
+  stats_.tx_goodput_bytes_ += len;
+  stats_.tx_coalesced_ += nr_messages;
+  stats_.generation_tx_++;
+  int ret = siv_encrypt_and_xmit(*coalesce_pkt_);
+  data_msg->clear_messages();
+
+  if (should_rekey())
+    endpoint_.callbacks_.on_rekey_needed(*this);
+
+  return ret;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::rekey() {
+  if (!peer_identity_key_)
+    return kErrorNotInitiator;
+
+  if (state_ != State::kESTABLISHED && state_ != State::kREKEY)
+    return kErrorNotConn;
+
+  // Queued messages go out under the current keys
+  if (state_ == State::kESTABLISHED) {
+    flush();
+    LODP_PROBE2(rekey_start, LODP_PROBE_SESSION_ID(this),
+                stats_.generation_id_);
+    endpoint_.log_event(LodpEvent::kRekeyStart, this, &peer_addr_,
+                        stats_.generation_id_);
+  }
+
+  state_ = State::kREKEY;
+
+  LODP_STAGE_START(stage_start);
+  int ret = send_rekey_packet();
+  LODP_STAGE_RECORD(endpoint_, kRekey, stage_start);
+  return ret;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::close(const bool send_shutdown) {
+  if (state_ != State::kINVALID) {
+    if (send_shutdown) {
+      flush();
+      send_shutdown_packet();
+
+      // Give the queued packets one last chance to go out, without letting
+      // on_writable() re-enter a session that is being torn down
+      drain_tx_queue(false);
+    }
+    while (!reassembly_.empty())
+      drop_reassembly(reassembly_.size() - 1);
+    state_ = State::kINVALID;
+    endpoint_.callbacks_.on_close(*this);
+  }
+
+  // Remove the session from the endpoint's pending flush list
+  if (flush_pending_) {
+    auto& pending = endpoint_.flush_pending_;
+    pending.erase(::std::remove(pending.begin(), pending.end(), this),
+                  pending.end());
+    flush_pending_ = false;
+  }
+
+  // Remove the session from the endpoint's pending transmit list
+  if (tx_pending_) {
+    auto& pending = endpoint_.tx_pending_;
+    pending.erase(::std::remove(pending.begin(), pending.end(), this),
+                  pending.end());
+    tx_pending_ = false;
+  }
+
+  // Remove the session from the endpoint's connection table
+  endpoint_.closed_session_stats_.merge(stats_);
+  endpoint_.stats_.sessions_closed_++;
+  LODP_PROBE2(session_close, LODP_PROBE_SESSION_ID(this), peer_addr_.hash());
+  endpoint_.log_event(LodpEvent::kSessionClose, this, &peer_addr_);
+  auto got = endpoint_.session_table_.find(peer_addr_);
+  SL_ASSERT(got != endpoint_.session_table_.end());
+  endpoint_.session_table_.erase(got);  // This invokes ~LodpSession()
+
+  // Elvis has left the building, the session object is no longer valid
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::scrub_handshake_state() {
+  if (has_cached_state_) {
+    session_key_.reset();
+    session_private_key_.reset();
+    peer_session_key_.reset();
+    siv_key_source_.reset();
+    auth_.reset();
+    has_cached_state_ = false;
+  }
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::pad_packet(packet::Envelope& pkt) {
+  if (pkt.has_pad())
+    return;
+
+  const size_t mtu = pmtu_;
+  size_t pkt_sz = Endpoint::kMinPacketLength + pkt.ByteSize();
+
+  SL_ASSERT(mtu >= pkt_sz);
+
+  pkt_sz += kMaxPadFramingOverhead;
+  if (mtu > pkt_sz) {
+    size_t pad_len = endpoint_.callbacks_.pad_size(*this, mtu - pkt_sz);
+    if (pad_len + pkt_sz > mtu)
+      pad_len = mtu - pkt_sz;
+    if (pad_len > 0) {
+      ::std::string* pad = pkt.mutable_pad();
+      pad->resize(pad_len, 0);
+      char *ptr = const_cast<char*>(pad->data());
+      endpoint_.rng_.get_bytes(ptr, pad_len);
+      SL_ASSERT(Endpoint::kMinPacketLength + pkt.ByteSize() <= mtu);
+    }
+  }
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::siv_encrypt_and_xmit(packet::Envelope& pkt) {
+  if (state_ == State::kINVALID || state_ == State::kERROR)
+    return kErrorBadFD;
+
+  LODP_STAGE_START(serialize_start);
+  pad_packet(pkt);
+
+  // Serialize the protobuf object to a binary blob
+  ::std::string serialized; // TODO/Performance: Buffer Pool
+  bool ret = pkt.SerializeToString(&serialized);
+  SL_ASSERT(ret);
+  LODP_STAGE_RECORD(endpoint_, kTxSerialize, serialize_start);
+
+  // Encrypt the packet
+  // XXX: If this is the responder, I need to encrypt with the old key if
+  // state_ == REKEY.
+  LODP_STAGE_START(encrypt_start);
+  ::std::string ciphertext; // TODO/Performance:: Buffer Pool
+  tx_siv().encrypt(serialized, ciphertext);
+  LODP_STAGE_RECORD(endpoint_, kTxEncrypt, encrypt_start);
+
+  stats_.tx_bytes_ += ciphertext.length();
+  endpoint_.stats_.tx_bytes_ += ciphertext.length();
+  endpoint_.stats_.tx_packets_[pkt.packet_type()]++;
+
+  LODP_STAGE_START(xmit_start);
+  int xmit_ret = xmit(ciphertext.data(), ciphertext.length(), 0);
+  LODP_STAGE_RECORD(endpoint_, kTxXmit, xmit_start);
+  return xmit_ret;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::xmit_burst(const ::std::string& burst,
+                                            const size_t segment_size) {
+  stats_.tx_bytes_ += burst.length();
+  endpoint_.stats_.tx_bytes_ += burst.length();
+  return xmit(burst.data(), burst.length(),
+              burst.length() > segment_size ? segment_size : 0);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::xmit(const void* buf,
+                                      const size_t len,
+                                      const size_t segment_size) {
+  if (tx_queue_.empty()) {
+    LODP_PROBE4(sendto, peer_addr_.hash(), LODP_PROBE_SESSION_ID(this), len,
+                segment_size);
+    endpoint_.log_event(LodpEvent::kSendto, this, &peer_addr_, len,
+                        segment_size);
+    int ret;
+    if (segment_size == 0)
+      ret = endpoint_.callbacks_.sendto(this->endpoint_, buf, len,
+                                        peer_addr_.sockaddr(),
+                                        peer_addr_.length());
+    else
+      ret = endpoint_.callbacks_.sendto_gso(this->endpoint_, buf, len,
+                                            segment_size,
+                                            peer_addr_.sockaddr(),
+                                            peer_addr_.length());
+    if (ret != kErrorAgain) {
+      endpoint_.trace_packet(PacketTrace::kDirTx, peer_addr_, buf, len,
+                             segment_size);
+      return ret;
+    }
+
+    /*
+     * The transport is full, hold on to the packets till the application
+     * calls LodpEndpoint::on_writable().  If part of a burst made it out
+     * before the transport filled up, the peer will discard the duplicates
+     * as replays.
+     */
+    endpoint_.tx_pending_.push_back(this);
+    tx_pending_ = true;
+  }
+
+  tx_queue_.push_back(TxQueueEntry());  // TODO/Performance: Buffer pool
+  TxQueueEntry& entry = tx_queue_.back();
+  entry.buf_.assign(static_cast<const char*>(buf), len);
+  entry.segment_size_ = segment_size;
+  tx_queue_bytes_ += len;
+  stats_.tx_queued_ += segment_size == 0 ? 1 :
+      (len + segment_size - 1) / segment_size;
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::drain_tx_queue(const bool notify) {
+  int ret = kErrorOk;
+  while (!tx_queue_.empty()) {
+    const TxQueueEntry& entry = tx_queue_.front();
+    LODP_PROBE4(sendto, peer_addr_.hash(), LODP_PROBE_SESSION_ID(this),
+                entry.buf_.length(), entry.segment_size_);
+    endpoint_.log_event(LodpEvent::kSendto, this, &peer_addr_,
+                        entry.buf_.length(), entry.segment_size_);
+    int xmit_ret;
+    if (entry.segment_size_ == 0)
+      xmit_ret = endpoint_.callbacks_.sendto(this->endpoint_,
+                                             entry.buf_.data(),
+                                             entry.buf_.length(),
+                                             peer_addr_.sockaddr(),
+                                             peer_addr_.length());
+    else
+      xmit_ret = endpoint_.callbacks_.sendto_gso(this->endpoint_,
+                                                 entry.buf_.data(),
+                                                 entry.buf_.length(),
+                                                 entry.segment_size_,
+                                                 peer_addr_.sockaddr(),
+                                                 peer_addr_.length());
+    if (xmit_ret == kErrorAgain) {
+      ret = kErrorAgain;
+      break;
+    }
+    endpoint_.trace_packet(PacketTrace::kDirTx, peer_addr_, entry.buf_.data(),
+                           entry.buf_.length(), entry.segment_size_);
+
+    // Packets the transport rejects for other reasons are lost
+    if (xmit_ret != kErrorOk && ret == kErrorOk)
+      ret = xmit_ret;
+    tx_queue_bytes_ -= entry.buf_.length();
+    tx_queue_.pop_front();
+  }
+
+  if (tx_queue_.empty() && tx_pending_) {
+    auto& pending = endpoint_.tx_pending_;
+    pending.erase(::std::remove(pending.begin(), pending.end(), this),
+                  pending.end());
+    tx_pending_ = false;
+  }
+
+  if (notify && tx_blocked_ && tx_queue_bytes_ <= tx_low_watermark_) {
+    tx_blocked_ = false;
+    endpoint_.callbacks_.on_writable(*this);  // This may close() the session
+  }
+
+  return ret;
+}
+
+template <class Callbacks>
+crypto::SIVBlake2sXChaCha& BasicLodpSession<Callbacks>::tx_siv() {
+  if (!prev_ephemeral_tx_siv_)
+    return *ephemeral_tx_siv_;
+
+  // Responder, REKEY ACK in flight, encrypt with the old key
+  SL_ASSERT(!peer_identity_key_);
+  SL_ASSERT(state_ == State::kREKEY);
+  return *prev_ephemeral_tx_siv_;
+}
+
+template <class Callbacks>
+bool BasicLodpSession<Callbacks>::fec_protect(packet::Data& data_msg) {
+  SL_ASSERT(fec_);
+  SL_ASSERT(data_msg.has_payload());
+
+  if (fec_tx_count_ == 0) {
+    // Start a new block
+    fec_tx_k_ = fec_k_;
+    fec_tx_m_ = fec_m_;
+    fec_tx_shard_len_ = 0;
+    fec_tx_parity_.resize(fec_tx_m_);
+    for (auto& parity : fec_tx_parity_)
+      parity.assign(mtu() + 2, 0);
+    if (!flush_pending_) {
+      endpoint_.flush_pending_.push_back(this);
+      flush_pending_ = true;
+    }
+  }
+
+  packet::Fec* fec = data_msg.mutable_fec();
+  fec->set_block_id(fec_tx_block_id_);
+  fec->set_index(fec_tx_count_);
+
+  // The source shard is the payload with a 2 byte length prefix
+  const ::std::string& payload = data_msg.payload();
+  const uint8_t hdr[2] = {
+    static_cast<uint8_t>(payload.length() >> 8),
+    static_cast<uint8_t>(payload.length())
+  };
+  const size_t shard_len = sizeof(hdr) + payload.length();
+  fec_tx_shard_len_ = ::std::max(fec_tx_shard_len_, shard_len);
+  for (size_t i = 0; i < fec_tx_m_; i++) {
+    auto& parity = fec_tx_parity_[i];
+    if (parity.size() < shard_len)
+      parity.resize(shard_len, 0);  // The PMTU grew mid-block
+    const uint8_t c = ReedSolomon::coefficient(i, fec_tx_count_);
+    ReedSolomon::mul_add(&parity[0], hdr, c, sizeof(hdr));
+    ReedSolomon::mul_add(&parity[sizeof(hdr)],
+                         reinterpret_cast<const uint8_t*>(payload.data()), c,
+                         payload.length());
+  }
+
+  return ++fec_tx_count_ == fec_tx_k_;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::fec_xmit_parity() {
+  SL_ASSERT(fec_tx_count_ > 0);
+
+  // Generate the parity packets, reusing the same Envelope for each
+  ::std::unique_ptr<packet::Envelope> data(new packet::Envelope());
+  data->set_packet_type(packet::Envelope::DATA);
+  packet::Data* data_msg = data->mutable_msg_data();
+  packet::Fec* fec = data_msg->mutable_fec();
+  fec->set_block_id(fec_tx_block_id_);
+  fec->set_k(fec_tx_count_);
+  fec->set_m(fec_tx_m_);
+
+  int ret = kErrorOk;
+  for (size_t i = 0; i < fec_tx_m_; i++) {
+    data_msg->set_sequence_number(++tx_last_seq_);
+    data_msg->set_payload(&fec_tx_parity_[i][0], fec_tx_shard_len_);
+    fec->set_index(fec_tx_count_ + i);
+    data->clear_pad();
+
+    if (!tx_seq_ok()) {
+      ret = kErrorConnAborted;
+      break;
+    }
+
+    stats_.tx_fec_parity_++;
+    stats_.generation_tx_++;
+    ret = siv_encrypt_and_xmit(*data);
+    if (ret != kErrorOk)
+      break;
+  }
+
+  fec_tx_block_id_++;
+  fec_tx_count_ = 0;
+
+  return ret;
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::fec_adapt() {
+  /*
+   * Smaller blocks as loss increases, with one parity packet plus enough to
+   * cover four times the expected number of lost packets per block.
+   */
+  const uint64_t loss = fec_loss_ppm_;
+  const size_t k = loss < 10000 ? 16 : loss < 50000 ? 8 : 4;
+  const size_t m = 1 + static_cast<size_t>(4 * loss * k / 1000000);
+  fec_k_ = k;
+  fec_m_ = m < kMaxFecM ? m : kMaxFecM;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::coalesce(const void* buf,
+                                          const size_t len) {
+  const size_t framed_len = kCoalesceFramingOverhead + len;
+  const auto now = endpoint_.clock_->now();
+
+  // Flush if the message will not fit, or the deadline has passed
+  if (coalesce_len_ > 0 && (coalesce_len_ + framed_len > mtu() ||
+                            (coalesce_delay_.count() > 0 &&
+                             now >= coalesce_deadline_))) {
+    int ret = flush_coalesced();
+    if (ret != kErrorOk)
+      return ret;
+  }
+
+  if (!coalesce_pkt_) {
+    coalesce_pkt_.reset(new packet::Envelope());
+    coalesce_pkt_->set_packet_type(packet::Envelope::DATA);
+  }
+  coalesce_pkt_->mutable_msg_data()->add_messages(buf, len);
+  if (coalesce_len_ == 0) {
+    if (coalesce_delay_.count() > 0) {
+      // schwanenlied::Timer has millisecond resolution, so round up
+      coalesce_deadline_ = now + coalesce_delay_;
+      coalesce_timer_->start(::std::chrono::duration_cast<
+          ::std::chrono::milliseconds>(coalesce_delay_ +
+                                       ::std::chrono::microseconds(999)));
+    }
+    if (!flush_pending_) {
+      endpoint_.flush_pending_.push_back(this);
+      flush_pending_ = true;
+    }
+  }
+  coalesce_len_ += framed_len;
+  coalesce_bytes_ += len;
+
+  if (coalesce_len_ >= (coalesce_threshold_ > 0 ? coalesce_threshold_ : mtu()))
+    return flush_coalesced();
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+bool BasicLodpSession<Callbacks>::siv_decrypt(const uint8_t* buf,
+                                              const size_t buf_len,
+                                              ::std::string& plaintext) {
+  if (state_ == State::kINVALID || state_ == State::kERROR)
+    return false;
+
+  /*
+   * Try the current key first, if it's successful, we know that we can discard
+   * the handshake related data if present so do so.
+   */
+  bool ret = ephemeral_rx_siv_->decrypt(buf, buf_len, plaintext);
+  if (!peer_identity_key_) {
+    if (ret) {
+      /*
+       * If we have are the responder and we just received a packet encrypted with
+       * what we thing the most recent session key is, we can destroy the
+       * handshake/rekey state because the peer needs to have received the
+       * HANDSHAKE ACK/REKEY ACK to have encrypted the packet.
+       */
+      scrub_handshake_state();
+      if (state_ == State::kREKEY) {
+        prev_ephemeral_rx_siv_.reset();
+        prev_ephemeral_tx_siv_.reset();
+        on_rekey_done();
+      }
+    } else if (prev_ephemeral_rx_siv_)
+      ret = prev_ephemeral_rx_siv_->decrypt(buf, buf_len, plaintext);
+  }
+
+  if (ret)
+    stats_.rx_bytes_ += buf_len;
+
+  return ret;
+}
+
+template <class Callbacks>
+inline bool BasicLodpSession<Callbacks>::tx_would_block() {
+  if (tx_queue_bytes_ < tx_high_watermark_)
+    return false;
+
+  tx_blocked_ = true;
+  stats_.tx_would_block_++;
+
+  return true;
+}
+
+template <class Callbacks>
+bool BasicLodpSession<Callbacks>::tx_seq_ok() {
+  /*
+   * If the sequence number is 0, then something went horribly wrong and the
+   * session wasn't rekeyed as it should have been.
+   *
+   * Note:
+   * It's also possible that rekeying has failed for exceedingly large number of
+   * attempts, but most likely the initiator in this connection is fucking
+   * broken and doesn't support rekeying.
+   */
+  if (tx_last_seq_ == 0) {
+    state_ = State::kERROR;
+    return false;
+  }
+
+  return true;
+}
+
+template <class Callbacks>
+inline bool BasicLodpSession<Callbacks>::rx_seq_ok(const uint32_t seq) {
+  /*
+   * This implements a sliding window scheme as proposed in RFC 2401, except
+   * with a 64 bit bitmap.  This limits the number of packets that can be sent
+   * without rekeying to 2^32 - 1, but the threshold for rekeying is
+   * considerably earlier.
+   */
+  if (seq == 0)
+    return false;
+  if (seq > rx_last_seq_) {
+    uint32_t diff = seq - rx_last_seq_;
+    if (diff < sizeof(rx_bitmap_) * 8) {
+      // In the window
+      rx_bitmap_ <<= diff;
+      rx_bitmap_ |= 1;
+    } else {
+      // To the right of window
+      rx_bitmap_ = 1;
+    }
+    rx_last_seq_ = seq;
+  } else {
+    uint32_t diff = rx_last_seq_ - seq;
+    if (diff > sizeof(rx_bitmap_) * 8) {
+      // To the left of the window
+      return false;
+    }
+
+    if (rx_bitmap_ & (1ull << diff)) {
+      // Seen in the bitmap
+      return false;
+    }
+
+    rx_bitmap_ |= (1ull << diff);
+  }
+
+  return true;
+}
+
+template <class Callbacks>
+inline bool BasicLodpSession<Callbacks>::should_rekey() {
+  if (state_ != State::kESTABLISHED)
+    return false;
+
+  /*
+   * If a peer is horribly broken they can send more than 2^32 packets using
+   * the same key by sending out of window data.  They just waste bandwidth, so
+   * it's ok to use the sequence number here.
+   */
+  if (tx_last_seq_ > kRekeyPacketCount || rx_last_seq_ > kRekeyPacketCount)
+    return true;
+
+  return false;
+}
+
+template <class Callbacks>
+inline void BasicLodpSession<Callbacks>::on_rekey_done() {
+  SL_ASSERT(state_ == State::kREKEY);
+
+  // Reset the replay protection state
+  tx_last_seq_ = 0;
+  rx_last_seq_ = 0;
+  rx_bitmap_ = 0;
+
+  // Update the statistics
+  stats_.generation_id_++;
+  stats_.generation_rx_ = 0;
+  stats_.generation_tx_ = 0;
+
+  state_ = State::kESTABLISHED;
+  LODP_PROBE2(rekey_done, LODP_PROBE_SESSION_ID(this), stats_.generation_id_);
+  endpoint_.log_event(LodpEvent::kRekeyDone, this, &peer_addr_,
+                      stats_.generation_id_);
+  endpoint_.callbacks_.on_rekey(*this, kErrorOk);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::send_init_packet() {
+  SL_ASSERT(peer_identity_key_);
+  SL_ASSERT(state_ == State::kINIT);
+
+  // Generate the INIT packet
+  ::std::unique_ptr<packet::Envelope> init(new packet::Envelope());  // TODO/Performance: Buffer pool
+  init->set_packet_type(packet::Envelope::INIT);
+  packet::Init* init_msg = init->mutable_msg_init();
+  init_msg->set_intro_siv_key_source(siv_key_source_->data(),
+                                     siv_key_source_->length());
+
+  return siv_encrypt_and_xmit(*init);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::send_handshake_packet() {
+  SL_ASSERT(peer_identity_key_);
+  SL_ASSERT(state_ == State::kHANDSHAKE);
+
+  /*
+   * The cookie has a finite lifespan, if it's been too long since we received
+   * the HANDSHAKE ACK, transition to the INIT state to obtain a fresh cookie
+   * instead.
+   */
+  if (endpoint_.clock_->now() > cookie_expire_time_) {
+    /*
+     * Discard the stale state, including the ephemeral keys that were generated
+     * on the off chance that they are invalid.
+     */
+    cookie_.reset();
+    session_key_.reset();
+    session_private_key_.reset();
+    state_ = State::kINIT;
+    return send_init_packet();
+  }
+
+  // Generate the ephemeral Curve25519 keypair
+  if (!session_private_key_) {
+    session_private_key_.reset(new crypto::Curve25519::PrivateKey(endpoint_.rng_));
+    session_key_.reset(new crypto::Curve25519::PublicKey(*session_private_key_));
+  }
+
+  // Generate the HANDSHAKE packet
+  ::std::unique_ptr<packet::Envelope> hs(new packet::Envelope());  // TODO/Performance: Buffer pool
+  hs->set_packet_type(packet::Envelope::HANDSHAKE);
+  packet::Handshake* hs_msg = hs->mutable_msg_handshake();
+  hs_msg->set_intro_siv_key_source(siv_key_source_->data(),
+                                   siv_key_source_->length());
+  hs_msg->set_initiator_public_key(session_key_->data(),
+                                   session_key_->length());
+  hs_msg->set_handshake_cookie(*cookie_);
+
+  return siv_encrypt_and_xmit(*hs);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::send_handshake_ack_packet(
+    const ::std::string& siv_key_source) {
+  SL_ASSERT(!peer_identity_key_);
+
+  if (!has_cached_state_)
+    return kErrorProtocol;
+  if (state_ != State::kESTABLISHED)
+    return kErrorProtocol;
+
+  // Build a HANDSHAKE ACK packet from the the cached session key/auth
+  ::std::unique_ptr<packet::Envelope> hs_ack(new packet::Envelope());  // TODO/Performance: Buffer pool
+  hs_ack->set_packet_type(packet::Envelope::HANDSHAKE_ACK);
+  packet::HandshakeAck* hs_ack_msg = hs_ack->mutable_msg_handshake_ack();
+  hs_ack_msg->set_responder_public_key(session_key_->data(),
+                                       session_key_->length());
+  hs_ack_msg->set_handshake_auth(auth_->data(), auth_->length());
+
+  pad_packet(*hs_ack);
+
+  // Transmit the packet
+  stats_.tx_bytes_ += Endpoint::kMinPacketLength + hs_ack->ByteSize();
+  return endpoint_.send_packet(*hs_ack, peer_addr_, siv_key_source);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::send_rekey_packet() {
+  SL_ASSERT(state_ == State::kREKEY);
+
+  // Generate the new session key
+  if (!session_private_key_) {
+    session_private_key_.reset(new crypto::Curve25519::PrivateKey(endpoint_.rng_));
+    session_key_.reset(new crypto::Curve25519::PublicKey(*session_private_key_));
+    has_cached_state_ = true;
+  }
+
+  // Generate the REKEY packet
+  ::std::unique_ptr<packet::Envelope> rekey(new packet::Envelope()); // TODO/Performace: Buffer pool
+  rekey->set_packet_type(packet::Envelope::REKEY);
+  packet::Rekey* rekey_msg = rekey->mutable_msg_rekey();
+  rekey_msg->set_sequence_number(++tx_last_seq_);
+  rekey_msg->set_initiator_public_key(session_key_->data(),
+                                      session_key_->length());
+
+  if (!tx_seq_ok())
+    return kErrorConnAborted;
+
+  return siv_encrypt_and_xmit(*rekey);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::send_rekey_ack_packet() {
+  SL_ASSERT(!peer_identity_key_);
+  SL_ASSERT(state_ == State::kREKEY);
+  SL_ASSERT(has_cached_state_);
+
+  // Build a REKEY ACK packet from the the cached session key/auth
+  ::std::unique_ptr<packet::Envelope> rekey_ack(new packet::Envelope());  // TODO/Performance: Buffer pool
+  rekey_ack->set_packet_type(packet::Envelope::REKEY_ACK);
+  packet::RekeyAck* rekey_ack_msg = rekey_ack->mutable_msg_rekey_ack();
+  rekey_ack_msg->set_sequence_number(++tx_last_seq_);
+  rekey_ack_msg->set_responder_public_key(session_key_->data(),
+                                          session_key_->length());
+  rekey_ack_msg->set_handshake_auth(auth_->data(), auth_->length());
+
+  if (!tx_seq_ok())
+    return kErrorConnAborted;
+
+  return siv_encrypt_and_xmit(*rekey_ack);
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::send_shutdown_packet() {
+  if (state_ != State::kESTABLISHED && state_ != State::kREKEY)
+    return;
+
+  // Build a SHUTDOWN packet
+  ::std::unique_ptr<packet::Envelope> shutdown(new packet::Envelope());  // TODO/Performance: Buffer pool
+  shutdown->set_packet_type(packet::Envelope::SHUTDOWN);
+  packet::Shutdown* shutdown_msg = shutdown->mutable_msg_shutdown();
+  shutdown_msg->set_sequence_number(++tx_last_seq_);
+
+  if (!tx_seq_ok())
+    return;
+
+  siv_encrypt_and_xmit(*shutdown);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::send_pmtu_probe_packet() {
+  if (state_ != State::kESTABLISHED && state_ != State::kREKEY)
+    return kErrorNotConn;
+
+  // Build a PMTU PROBE packet
+  ::std::unique_ptr<packet::Envelope> probe(new packet::Envelope());  // TODO/Performance: Buffer pool
+  probe->set_packet_type(packet::Envelope::PMTU_PROBE);
+  packet::PmtuProbe* probe_msg = probe->mutable_msg_pmtu_probe();
+  probe_msg->set_sequence_number(++tx_last_seq_);
+  probe_msg->set_probe_id(pmtu_probe_id_);
+  probe_msg->set_probe_size(pmtu_probe_size_);
+
+  if (!tx_seq_ok())
+    return kErrorConnAborted;
+
+  // Pad the packet out to exactly the size being probed
+  const size_t pkt_sz = Endpoint::kMinPacketLength + probe->ByteSize() +
+      kMaxPadFramingOverhead;
+  SL_ASSERT(pmtu_probe_size_ > pkt_sz);
+  const size_t pad_len = pmtu_probe_size_ - pkt_sz;
+  ::std::string* pad = probe->mutable_pad();
+  pad->resize(pad_len, 0);
+  char *ptr = const_cast<char*>(pad->data());
+  endpoint_.rng_.get_bytes(ptr, pad_len);
+  SL_ASSERT(Endpoint::kMinPacketLength + probe->ByteSize() ==
+            pmtu_probe_size_);
+
+  stats_.tx_pmtu_probes_++;
+  return siv_encrypt_and_xmit(*probe);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::send_pmtu_probe_ack_packet(
+    const uint32_t probe_id) {
+  // Build a PMTU PROBE ACK packet
+  ::std::unique_ptr<packet::Envelope> ack(new packet::Envelope());  // TODO/Performance: Buffer pool
+  ack->set_packet_type(packet::Envelope::PMTU_PROBE_ACK);
+  packet::PmtuProbeAck* ack_msg = ack->mutable_msg_pmtu_probe_ack();
+  ack_msg->set_sequence_number(++tx_last_seq_);
+  ack_msg->set_probe_id(probe_id);
+
+  if (!tx_seq_ok())
+    return kErrorConnAborted;
+
+  return siv_encrypt_and_xmit(*ack);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::send_fec_feedback_packet() {
+  // Build a FEC FEEDBACK packet
+  ::std::unique_ptr<packet::Envelope> feedback(new packet::Envelope());  // TODO/Performance: Buffer pool
+  feedback->set_packet_type(packet::Envelope::FEC_FEEDBACK);
+  packet::FecFeedback* feedback_msg = feedback->mutable_msg_fec_feedback();
+  feedback_msg->set_sequence_number(++tx_last_seq_);
+  feedback_msg->set_shards_expected(fec_rx_expected_);
+  feedback_msg->set_shards_lost(fec_rx_lost_);
+
+  if (!tx_seq_ok())
+    return kErrorConnAborted;
+
+  stats_.tx_fec_feedback_++;
+  return siv_encrypt_and_xmit(*feedback);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_data_packet(const packet::Envelope& pkt) {
+  if (state_ != State::kESTABLISHED && state_ != State::kREKEY)
+    return kErrorProtocol;
+
+  // Validate the packet
+  if (!pkt.has_msg_data()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_data().has_sequence_number()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  const packet::Data& data_msg = pkt.msg_data();
+  if (!data_msg.has_payload() && data_msg.messages_size() == 0) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  // Verify that the packet is in window
+  if (!rx_seq_ok(data_msg.sequence_number()))
+    return kErrorProtocol;
+
+  stats_.generation_rx_++;
+
+  if (state_ != State::kREKEY && should_rekey())
+    endpoint_.callbacks_.on_rekey_needed(*this);
+
+  if (data_msg.has_fragment())
+    return on_fragment_packet(data_msg);
+  if (data_msg.has_fec())
+    return on_fec_packet(data_msg);
+
+  stats_.rx_goodput_bytes_ += data_msg.payload().length();
+  for (int i = 0; i < data_msg.messages_size(); i++)
+    stats_.rx_goodput_bytes_ += data_msg.messages(i).length();
+
+  if (data_msg.messages_size() == 0) {
+    endpoint_.on_recv(*this, data_msg.payload().data(),
+                      data_msg.payload().length());
+    return kErrorOk;
+  }
+
+  /*
+   * Coalesced messages get delivered individually.  The user is allowed to
+   * close() the session from the callback, so watch for that and stop
+   * delivering messages if it happens.
+   */
+  stats_.rx_coalesced_ += data_msg.messages_size();
+  bool destroyed = false;
+  destroyed_ = &destroyed;
+  if (data_msg.has_payload()) {
+    endpoint_.on_recv(*this, data_msg.payload().data(),
+                      data_msg.payload().length());
+    if (destroyed)
+      return kErrorOk;
+  }
+  for (int i = 0; i < data_msg.messages_size(); i++) {
+    endpoint_.on_recv(*this, data_msg.messages(i).data(),
+                      data_msg.messages(i).length());
+    if (destroyed)
+      return kErrorOk;
+  }
+  destroyed_ = nullptr;
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_fragment_packet(
+    const packet::Data& data_msg) {
+  const packet::Fragment& fragment = data_msg.fragment();
+  const bool is_parity = fragment.parity();
+
+  // Validate the fragment
+  if (!fragment.has_message_id() || !fragment.has_count() ||
+      !fragment.has_message_length() || !data_msg.has_payload() ||
+      (!is_parity && !fragment.has_index())) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  const uint32_t message_id = fragment.message_id();
+  const size_t len = fragment.message_length();
+  const uint32_t count = fragment.count();
+  if (message_id == 0 || len > kMaxMessageLength || count < 2 || count > len) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  const size_t fragment_size = (len + count - 1) / count;
+  if ((count - 1) * fragment_size >= len) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  const uint32_t index = fragment.index();
+  size_t fragment_len = fragment_size;
+  if (!is_parity) {
+    if (index >= count) {
+      endpoint_.stats_.rx_bad_packet_format_++;
+      return kErrorBadPacketFormat;
+    }
+    if (index == count - 1)
+      fragment_len = len - index * fragment_size;
+  }
+  if (data_msg.payload().length() != fragment_len) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  stats_.rx_fragments_++;
+
+  // Ignore late fragments for recently completed messages
+  for (auto id : rx_completed_ids_) {
+    if (id == message_id)
+      return kErrorOk;
+  }
+
+  // Drop expired messages, and find the message this fragment belongs to
+  const auto now = endpoint_.clock_->now();
+  Reassembly* r = nullptr;
+  for (size_t i = 0; i < reassembly_.size(); ) {
+    if (reassembly_[i]->expire_time_ <= now) {
+      drop_reassembly(i);
+      continue;
+    }
+    if (reassembly_[i]->message_id_ == message_id)
+      r = reassembly_[i].get();
+    i++;
+  }
+
+  if (r == nullptr) {
+    // Make room for the new message, by dropping the oldest ones
+    const size_t footprint = len + fragment_size;
+    while (!reassembly_.empty() &&
+           (reassembly_.size() >= kMaxReassemblyMessages ||
+            reassembly_bytes_ + footprint > kMaxReassemblyBytes))
+      drop_reassembly(0);
+
+    r = new Reassembly;
+    reassembly_.push_back(::std::unique_ptr<Reassembly>(r));
+    reassembly_bytes_ += footprint;
+    r->message_id_ = message_id;
+    r->length_ = len;
+    r->fragment_size_ = fragment_size;
+    r->count_ = count;
+    r->received_ = 0;
+    r->have_.assign(count, false);
+    r->dst_ = static_cast<uint8_t*>(
+        endpoint_.callbacks_.on_message_alloc(*this, len));
+    r->user_dst_ = r->dst_ != nullptr;
+    if (!r->user_dst_) {
+      r->storage_.reset(new uint8_t[len]);  // TODO/Performance: Buffer pool
+      r->dst_ = r->storage_.get();
+    }
+    r->expire_time_ = now + ::std::chrono::seconds(kReassemblyTimeout);
+  } else if (r->length_ != len || r->count_ != count) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  // Scatter the fragment into the destination buffer
+  if (is_parity) {
+    if (!r->parity_) {
+      r->parity_.reset(new uint8_t[fragment_size]);
+      ::std::memcpy(r->parity_.get(), data_msg.payload().data(), fragment_size);
+    }
+  } else if (!r->have_[index]) {
+    ::std::memcpy(r->dst_ + index * fragment_size, data_msg.payload().data(),
+                  fragment_len);
+    r->have_[index] = true;
+    r->received_++;
+    stats_.rx_goodput_bytes_ += fragment_len;
+  }
+  if (r->received_ == r->count_ - 1 && r->parity_)
+    recover_from_parity(*r);
+  if (r->received_ < r->count_)
+    return kErrorOk;
+
+  // The message is complete, remove it from the reassembly list and deliver it
+  ::std::unique_ptr<Reassembly> done;
+  for (auto it = reassembly_.begin(); it != reassembly_.end(); ++it) {
+    if (it->get() == r) {
+      done.swap(*it);
+      reassembly_.erase(it);
+      break;
+    }
+  }
+  SL_ASSERT(done);
+  reassembly_bytes_ -= done->length_ + done->fragment_size_;
+  rx_completed_ids_[rx_completed_idx_] = message_id;
+  rx_completed_idx_ = (rx_completed_idx_ + 1) % kCompletedMessageIds;
+  stats_.rx_reassembled_++;
+
+  endpoint_.on_recv(*this, done->dst_, done->length_);
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::drop_reassembly(const size_t idx) {
+  SL_ASSERT(idx < reassembly_.size());
+
+  ::std::unique_ptr<Reassembly> r;
+  r.swap(reassembly_[idx]);
+  reassembly_.erase(reassembly_.begin() + idx);
+  reassembly_bytes_ -= r->length_ + r->fragment_size_;
+  stats_.rx_reassembly_dropped_++;
+
+  if (r->user_dst_)
+    endpoint_.callbacks_.on_message_free(*this, r->dst_);
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::recover_from_parity(Reassembly& r) {
+  SL_ASSERT(r.received_ == r.count_ - 1);
+  SL_ASSERT(r.parity_);
+
+  uint32_t missing = 0;
+  while (r.have_[missing])
+    missing++;
+
+  // The missing fragment is the XOR of the parity and every other fragment
+  const size_t fragment_size = r.fragment_size_;
+  const size_t offset = missing * fragment_size;
+  const size_t len = ::std::min(fragment_size, r.length_ - offset);
+  uint8_t* dst = r.dst_ + offset;
+  ::std::memcpy(dst, r.parity_.get(), len);
+  for (uint32_t i = 0; i < r.count_; i++) {
+    if (i == missing)
+      continue;
+    const uint8_t* src = r.dst_ + i * fragment_size;
+    const size_t src_len = ::std::min(fragment_size,
+                                      r.length_ - i * fragment_size);
+    for (size_t j = 0; j < ::std::min(len, src_len); j++)
+      dst[j] ^= src[j];
+  }
+
+  r.have_[missing] = true;
+  r.received_++;
+  stats_.rx_goodput_bytes_ += len;
+  stats_.rx_parity_recovered_++;
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::pmtu_next_probe() {
+  SL_ASSERT(pmtu_max_ > 0);
+
+  pmtu_probe_count_ = 0;
+  if (pmtu_searching_) {
+    if (pmtu_ceiling_ >= pmtu_ + kPmtuSearchGranularity) {
+      /*
+       * Try the ceiling first since it is the most likely to work (Jumbo
+       * frames), and binary search once that fails.
+       */
+      if (pmtu_ceiling_ == pmtu_max_)
+        pmtu_probe_size_ = pmtu_ceiling_;
+      else
+        pmtu_probe_size_ = pmtu_ + (pmtu_ceiling_ - pmtu_) / 2;
+      pmtu_probe_id_++;
+      pmtu_xmit_probe();
+      return;
+    }
+
+    // The search is complete
+    pmtu_searching_ = false;
+    pmtu_search_time_ = endpoint_.clock_->now();
+  }
+
+  pmtu_probe_size_ = 0;
+  pmtu_timer_->start(pmtu_probe_timeout_ * kPmtuConfirmInterval);
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::pmtu_xmit_probe() {
+  SL_ASSERT(pmtu_probe_size_ > 0);
+
+  /*
+   * The peer may acknowledge the probe before sendto() returns (and that
+   * will start the next probe), so the timer must be started first.
+   */
+  pmtu_timer_->start(pmtu_probe_timeout_);
+  const uint32_t probe_id = pmtu_probe_id_;
+  int ret = send_pmtu_probe_packet();
+  if (ret == kErrorMsgSize && pmtu_probe_id_ == probe_id) {
+    // The local interface can not send a packet this large, don't bother
+    // retransmitting
+    on_pmtu_probe_failed();
+  }
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::on_pmtu_probe_failed() {
+  SL_ASSERT(pmtu_probe_size_ > 0);
+
+  const size_t probe_size = pmtu_probe_size_;
+  pmtu_probe_size_ = 0;
+  if (!pmtu_searching_) {
+    // The current MTU stopped working, fall back and search again
+    SL_ASSERT(probe_size == pmtu_);
+    stats_.pmtu_black_holes_++;
+    flush_coalesced();
+    pmtu_ = peer_addr_.udp_mtu();
+    pmtu_searching_ = true;
+  }
+  pmtu_ceiling_ = probe_size - 1;
+  pmtu_next_probe();
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::on_pmtu_timer() {
+  if (pmtu_max_ == 0)
+    return;
+  if (state_ != State::kESTABLISHED && state_ != State::kREKEY)
+    return;
+
+  if (pmtu_probe_size_ > 0) {
+    // The probe timed out
+    if (++pmtu_probe_count_ < kPmtuMaxProbes)
+      pmtu_xmit_probe();
+    else
+      on_pmtu_probe_failed();
+    return;
+  }
+
+  // Periodically check if the path MTU has grown
+  if (pmtu_ < pmtu_max_ && endpoint_.clock_->now() -
+      pmtu_search_time_ >= pmtu_probe_timeout_ * kPmtuRaiseInterval) {
+    pmtu_ceiling_ = pmtu_max_;
+    pmtu_searching_ = true;
+    pmtu_next_probe();
+    return;
+  }
+
+  // Confirm that the current MTU still works
+  if (pmtu_ > peer_addr_.udp_mtu()) {
+    pmtu_probe_size_ = pmtu_;
+    pmtu_probe_count_ = 0;
+    pmtu_probe_id_++;
+    pmtu_xmit_probe();
+  } else
+    pmtu_timer_->start(pmtu_probe_timeout_ * kPmtuConfirmInterval);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_fec_packet(const packet::Data& data_msg) {
+  const packet::Fec& fec = data_msg.fec();
+  const bool is_parity = fec.has_k();
+
+  // Validate the Fec header
+  if (!fec.has_block_id() || !fec.has_index() || !data_msg.has_payload()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  const uint32_t block_id = fec.block_id();
+  const uint32_t index = fec.index();
+  const ::std::string& payload = data_msg.payload();
+  if (is_parity) {
+    if (!fec.has_m() || fec.k() == 0 || fec.k() > kMaxFecK || fec.m() == 0 ||
+        fec.m() > kMaxFecM || index < fec.k() || index >= fec.k() + fec.m() ||
+        payload.length() < 2) {
+      endpoint_.stats_.rx_bad_packet_format_++;
+      return kErrorBadPacketFormat;
+    }
+    stats_.rx_fec_parity_++;
+  } else {
+    if (index >= kMaxFecK) {
+      endpoint_.stats_.rx_bad_packet_format_++;
+      return kErrorBadPacketFormat;
+    }
+  }
+
+  /*
+   * Find the block.  Source packets for blocks that are not being tracked are
+   * delivered without the block bookkeeping, unless the block was retired
+   * after recovering source packets, which means this one was delivered
+   * already.
+   */
+  FecRxBlock* b = nullptr;
+  auto it = fec_rx_blocks_.begin();
+  for (; it != fec_rx_blocks_.end(); ++it) {
+    if ((*it)->block_id_ >= block_id)
+      break;
+  }
+  if (it != fec_rx_blocks_.end() && (*it)->block_id_ == block_id)
+    b = it->get();
+  else if (block_id < fec_rx_floor_ ||
+           (it == fec_rx_blocks_.begin() &&
+            fec_rx_blocks_.size() >= kFecMaxRxBlocks)) {
+    if (is_parity)
+      return kErrorOk;
+    stats_.rx_fec_late_++;
+    if (block_id < fec_rx_floor_) {
+      const uint32_t age = fec_rx_floor_ - 1 - block_id;
+      if (age >= sizeof(fec_rx_recovered_) * 8 ||
+          (fec_rx_recovered_ & (1ull << age)))
+        return kErrorOk;
+    }
+    stats_.rx_goodput_bytes_ += payload.length();
+    endpoint_.on_recv(*this, payload.data(), payload.length());
+    return kErrorOk;
+  } else {
+    b = new FecRxBlock;
+    b->block_id_ = block_id;
+    b->k_ = 0;
+    b->m_ = 0;
+    b->shard_len_ = 0;
+    b->received_ = 0;
+    b->nr_sources_ = 0;
+    b->nr_parity_ = 0;
+    b->recovered_ = false;
+    b->shards_.resize(kMaxFecK + kMaxFecM);
+    b->have_.assign(kMaxFecK + kMaxFecM, false);
+    fec_rx_blocks_.insert(it, ::std::unique_ptr<FecRxBlock>(b));
+    if (fec_rx_blocks_.size() > kFecMaxRxBlocks)
+      fec_retire_block();
+  }
+
+  // Store the shard
+  if (is_parity) {
+    if (b->k_ == 0) {
+      /*
+       * Source packets that arrived before k was known may claim indexes that
+       * turn out to be parity slots.  The block is unusable, so evict it rather
+       * than attempting recovery with sources standing in for parity.
+       */
+      for (size_t i = fec.k(); i < kMaxFecK; i++) {
+        if (!b->have_[i])
+          continue;
+        for (auto bit = fec_rx_blocks_.begin(); bit != fec_rx_blocks_.end();
+             ++bit) {
+          if (bit->get() == b) {
+            fec_rx_blocks_.erase(bit);
+            break;
+          }
+        }
+        endpoint_.stats_.rx_bad_packet_format_++;
+        return kErrorBadPacketFormat;
+      }
+      b->k_ = fec.k();
+      b->m_ = fec.m();
+      b->shard_len_ = payload.length();
+    } else if (b->k_ != fec.k() || b->m_ != fec.m() ||
+               b->shard_len_ != payload.length()) {
+      endpoint_.stats_.rx_bad_packet_format_++;
+      return kErrorBadPacketFormat;
+    }
+    b->received_++;
+    if (b->nr_sources_ < b->k_ && !b->have_[index]) {
+      b->shards_[index] = payload;
+      b->have_[index] = true;
+      b->nr_parity_++;
+    }
+  } else {
+    if (b->k_ != 0 && index >= b->k_) {
+      endpoint_.stats_.rx_bad_packet_format_++;
+      return kErrorBadPacketFormat;
+    }
+    b->received_++;
+    if (b->have_[index])
+      return kErrorOk;  // Already recovered (and delivered)
+    b->have_[index] = true;
+    b->nr_sources_++;
+    stats_.rx_goodput_bytes_ += payload.length();
+    ::std::string& shard = b->shards_[index];
+    shard.reserve(2 + payload.length());
+    shard.push_back(static_cast<char>(payload.length() >> 8));
+    shard.push_back(static_cast<char>(payload.length()));
+    shard.append(payload);
+  }
+
+  ::std::vector<::std::string> recovered;
+  fec_recover(*b, recovered);
+  if (recovered.empty()) {
+    if (!is_parity)
+      endpoint_.on_recv(*this, payload.data(), payload.length());
+    return kErrorOk;
+  }
+
+  // The user is allowed to close() the session from the callback
+  bool destroyed = false;
+  destroyed_ = &destroyed;
+  if (!is_parity) {
+    endpoint_.on_recv(*this, payload.data(), payload.length());
+    if (destroyed)
+      return kErrorOk;
+  }
+  for (const auto& msg : recovered) {
+    endpoint_.on_recv(*this, msg.data(), msg.length());
+    if (destroyed)
+      return kErrorOk;
+  }
+  destroyed_ = nullptr;
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::fec_recover(
+    FecRxBlock& b,
+    ::std::vector<::std::string>& recovered) {
+  if (b.k_ == 0 || b.nr_sources_ == b.k_ || b.nr_sources_ + b.nr_parity_ < b.k_)
+    return;
+
+  // Build the zero padded shards
+  const size_t len = b.shard_len_;
+  ::std::unique_ptr<uint8_t[]> buf(new uint8_t[b.k_ * len]());
+  uint8_t* data[kMaxFecK];
+  bool present[kMaxFecK];
+  const uint8_t* parity[kMaxFecM];
+  for (size_t j = 0; j < b.k_; j++) {
+    data[j] = buf.get() + j * len;
+    present[j] = b.have_[j];
+    if (present[j]) {
+      if (b.shards_[j].length() > len)
+        return;  // The peer is sending garbage
+      ::std::memcpy(data[j], b.shards_[j].data(), b.shards_[j].length());
+    }
+  }
+  for (size_t i = 0; i < b.m_; i++) {
+    parity[i] = b.have_[b.k_ + i] ?
+        reinterpret_cast<const uint8_t*>(b.shards_[b.k_ + i].data()) : nullptr;
+  }
+  if (!ReedSolomon::reconstruct(data, present, b.k_, parity, b.m_, len))
+    return;
+
+  // Extract the recovered payloads
+  for (size_t j = 0; j < b.k_; j++) {
+    if (present[j])
+      continue;
+    const size_t msg_len = (static_cast<size_t>(data[j][0]) << 8) | data[j][1];
+    if (msg_len + 2 > len)
+      continue;
+    recovered.push_back(::std::string(reinterpret_cast<char*>(data[j] + 2),
+                                      msg_len));
+    stats_.rx_fec_recovered_++;
+    stats_.rx_goodput_bytes_ += msg_len;
+  }
+
+  // Every source packet is accounted for, so release the shards
+  b.nr_sources_ = b.k_;
+  b.recovered_ = true;
+  for (size_t j = 0; j < b.k_; j++)
+    b.have_[j] = true;
+  for (auto& shard : b.shards_)
+    ::std::string().swap(shard);
+}
+
+template <class Callbacks>
+void BasicLodpSession<Callbacks>::fec_retire_block() {
+  SL_ASSERT(!fec_rx_blocks_.empty());
+
+  // Blocks that never saw a parity packet have a unknown size, so skip them
+  const FecRxBlock& b = *fec_rx_blocks_.front();
+  if (b.k_ != 0) {
+    fec_rx_expected_ += b.k_ + b.m_;
+    fec_rx_lost_ += b.k_ + b.m_ - ::std::min(b.received_, b.k_ + b.m_);
+    fec_rx_retired_++;
+  }
+  const uint32_t shift = b.block_id_ + 1 - fec_rx_floor_;
+  if (shift < sizeof(fec_rx_recovered_) * 8)
+    fec_rx_recovered_ <<= shift;
+  else
+    fec_rx_recovered_ = 0;
+  if (b.recovered_)
+    fec_rx_recovered_ |= 1;
+  fec_rx_floor_ = b.block_id_ + 1;
+  fec_rx_blocks_.erase(fec_rx_blocks_.begin());
+
+  if (fec_rx_retired_ >= kFecFeedbackBlocks) {
+    send_fec_feedback_packet();
+    fec_rx_expected_ = 0;
+    fec_rx_lost_ = 0;
+    fec_rx_retired_ = 0;
+  }
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_init_ack_packet(
+    const packet::Envelope& pkt) {
+  if (!peer_identity_key_)
+    return kErrorProtocol;
+  if (state_ != State::kINIT)
+    return kErrorProtocol;
+
+  // Validate the packet
+  if (!pkt.has_msg_init_ack()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_init_ack().has_handshake_cookie()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  // Save the handshake cookie (Guess at the expiration time)
+  cookie_.reset(new ::std::string(pkt.msg_init_ack().handshake_cookie()));
+  cookie_expire_time_ = endpoint_.clock_->now() +
+      ::std::chrono::seconds(Endpoint::kCookieRotateInterval);
+  has_cached_state_ = true;
+
+  // Continue the handshake
+  state_ = State::kHANDSHAKE;
+  return send_handshake_packet();
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_handshake_packet(
+    const packet::Envelope& pkt) {
+  if (peer_identity_key_)
+    return kErrorProtocol;
+  if (state_ != State::kESTABLISHED)
+    return kErrorProtocol;
+  if (!has_cached_state_)
+    return kErrorProtocol;
+  if (auth_ == nullptr)
+    return kErrorProtocol;
+
+  /*
+   * This routine is called after HANDSHAKE packet and cookie is validated but
+   * before the cookie is checked for reuse.
+   *
+   * We will only ever get a handshake packet with an existing TCB if:
+   *  1) The HANDSHAKE ACK gets lost and the peer retransmits (most likely).
+   *  2) The peer crashes between sending the HANDSHAKE and receiving the
+   *     HANDSHAKE ACK, and happens to use the same source port.
+   *  3) The peer attempts to open multiple Sessions to the same peer via the
+   *     same LodpEndpoint.
+   *
+   * We handle case 1 by checking to see if the public key in the HANDSHAKE
+   * packet we just received is identical to the one used when creating the TCB.
+   * Naturally we would be retransmitting in error if the peer happened to have
+   * reused the same Curve25519 key pair between multiple Sessions, but that
+   * situation is undetectable.
+   *
+   * There is nothing that can be done about case 2, since LODP does not have
+   * anything analagous to TCP's RST, so the HANDSHAKE packet is dropped.
+   * Eventually the peer will give up, our side will reap the idle connection,
+   * or the peer will retry with a different source port (NB: All of these
+   * things are the responsiblity of the application code).
+   *
+   * As of now, liblodpxx only supports one session between any given
+   * LodpEndpoint pairs, so case 3 is handled identically to case 2.
+   */
+  if (0 == crypto::memequals(peer_session_key_->data(),
+                             pkt.msg_handshake().initiator_public_key().data(),
+                             peer_session_key_->length()))
+    return send_handshake_ack_packet(pkt.msg_handshake().intro_siv_key_source());
+
+  return kErrorProtocol;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_handshake_ack_packet(
+    const packet::Envelope& pkt) {
+  if (!peer_identity_key_)
+    return kErrorProtocol;
+  if (state_ != State::kHANDSHAKE)
+    return kErrorProtocol;
+
+  SL_ASSERT(has_cached_state_);
+
+  // Validate the packet
+  if (!pkt.has_msg_handshake_ack()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_handshake_ack().has_responder_public_key()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (pkt.msg_handshake_ack().responder_public_key().length() !=
+      crypto::Curve25519::PublicKey::kKeyLength) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_handshake_ack().has_handshake_auth()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (pkt.msg_handshake_ack().handshake_auth().length() !=
+      crypto::NtorHandshake::kAuthLength) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  // Complete the ntor handshake
+  const crypto::Curve25519::PublicKey peer_public(reinterpret_cast<const
+                                                  uint8_t*>(pkt.msg_handshake_ack().responder_public_key().data()),
+                                                            pkt.msg_handshake_ack().responder_public_key().length());
+  crypto::SecureBuffer shared_secret(crypto::NtorHandshake::kSecretLength, 0);
+  const crypto::SecureBuffer peer_auth(reinterpret_cast<const
+                                       uint8_t*>(pkt.msg_handshake_ack().handshake_auth().data()),
+                                       pkt.msg_handshake_ack().handshake_auth().length());
+  if (!endpoint_.ntor_.initiator(peer_public, *peer_identity_key_,
+                                 *session_key_, *session_private_key_,
+                                 *node_id_, peer_auth, shared_secret)) {
+    // Connection failed, mark the Session as invalid
+    scrub_handshake_state();
+    state_ = State::kERROR;
+    endpoint_.callbacks_.on_connect(*this, kErrorConnAborted);
+    return kErrorConnAborted;
+  }
+
+  // Derive the ephemeral SIV keys
+  const auto key = derive_session_siv_key(shared_secret);
+  ephemeral_tx_siv_->set_key(key.data(), crypto::SIVBlake2sXChaCha::kKeyLength);
+  ephemeral_rx_siv_->set_key(key.data() + crypto::SIVBlake2sXChaCha::kKeyLength,
+                             crypto::SIVBlake2sXChaCha::kKeyLength);
+
+  // Finalize the new session
+  scrub_handshake_state();
+  state_ = State::kESTABLISHED;
+  endpoint_.callbacks_.on_connect(*this, kErrorOk);
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_rekey_packet(const packet::Envelope& pkt) {
+  if (peer_identity_key_)
+    return kErrorProtocol;
+  if (state_ != State::kESTABLISHED && state_ != State::kREKEY)
+    return kErrorProtocol;
+
+  // Validate the packet
+  if (!pkt.has_msg_rekey()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_rekey().has_sequence_number()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_rekey().has_initiator_public_key()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (pkt.msg_rekey().initiator_public_key().length() !=
+      crypto::Curve25519::PublicKey::kKeyLength) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  // Verify that the packet is in window
+  if (!rx_seq_ok(pkt.msg_rekey().sequence_number()))
+    return kErrorProtocol;
+
+  /*
+   * If this REKEY is a retransmission, validate that the public_key used is
+   * identical to the one sent previously, and just retransmit the REKEY ACK.
+   */
+  if (state_ == State::kREKEY) {
+    if (0 == crypto::memequals(peer_session_key_->data(),
+                               pkt.msg_rekey().initiator_public_key().data(),
+                               peer_session_key_->length()))
+      return send_rekey_ack_packet();
+
+    /*
+     * Why is the peer sending a REKEY with a different key?  I could be
+     * "forgiving" and redo the ntor handshake, but since this behavior is a
+     * sign of a bug in my code somewhere, just drop the packet.
+     */
+    return kErrorProtocol;
+  }
+
+  /*
+   * Pull out the peer's session key, generate the session keys, and complete
+   * the ntor handshake.
+   */
+  const crypto::Curve25519::PublicKey
+      peer_public(reinterpret_cast<const
+                  uint8_t*>(pkt.msg_rekey().initiator_public_key().data()),
+                            pkt.msg_rekey().initiator_public_key().length());
+  const crypto::Curve25519::PrivateKey session_private(endpoint_.rng_);
+  const crypto::Curve25519::PublicKey session_public(session_private);
+  crypto::SecureBuffer shared_secret(crypto::NtorHandshake::kSecretLength, 0);
+  crypto::SecureBuffer auth(crypto::NtorHandshake::kAuthLength, 0);
+  if (!endpoint_.ntor_.responder(peer_public, *endpoint_.identity_public_key_,
+                                 session_public,
+                                 *endpoint_.identity_private_key_,
+                                 session_private, *endpoint_.node_id_,
+                                 shared_secret, auth)) {
+    return kErrorProtocol;
+  }
+
+  // Derive the new keys
+  has_cached_state_ = true;
+  session_key_.reset(new crypto::Curve25519::PublicKey(session_public));
+  peer_session_key_.reset(new crypto::Curve25519::PublicKey(peer_public));
+  auth_.reset(new crypto::SecureBuffer(auth));
+
+  // Setup the SIV keys based on the Shared Secret
+  const auto key = derive_session_siv_key(shared_secret);
+  prev_ephemeral_rx_siv_.swap(ephemeral_rx_siv_);
+  prev_ephemeral_tx_siv_.swap(ephemeral_tx_siv_);
+  ephemeral_rx_siv_.reset(new crypto::SIVBlake2sXChaCha(endpoint_.rng_,
+                                                        key.data(),
+                                                        crypto::SIVBlake2sXChaCha::kKeyLength));
+  ephemeral_tx_siv_.reset(new crypto::SIVBlake2sXChaCha(endpoint_.rng_,
+                                                        key.data() + crypto::SIVBlake2sXChaCha::kKeyLength,
+                                                        crypto::SIVBlake2sXChaCha::kKeyLength));
+  if (state_ != State::kREKEY) {
+    LODP_PROBE2(rekey_start, LODP_PROBE_SESSION_ID(this),
+                stats_.generation_id_);
+    endpoint_.log_event(LodpEvent::kRekeyStart, this, &peer_addr_,
+                        stats_.generation_id_);
+  }
+  state_ = State::kREKEY;
+
+  return send_rekey_ack_packet();
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_rekey_ack_packet(
+    const packet::Envelope& pkt) {
+  if (!peer_identity_key_)
+    return kErrorProtocol;
+  if (state_ != State::kREKEY)
+    return kErrorProtocol;
+
+  SL_ASSERT(has_cached_state_);
+
+  // Validate the packet
+  if (!pkt.has_msg_rekey_ack()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_rekey_ack().has_sequence_number()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_rekey_ack().has_responder_public_key()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (pkt.msg_rekey_ack().responder_public_key().length() !=
+      crypto::Curve25519::PublicKey::kKeyLength) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_rekey_ack().has_handshake_auth()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (pkt.msg_rekey_ack().handshake_auth().length() !=
+      crypto::NtorHandshake::kAuthLength) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  // Verify that the packet is in window
+  if (!rx_seq_ok(pkt.msg_rekey_ack().sequence_number()))
+    return kErrorProtocol;
+
+  // Complete the ntor handshake
+  const crypto::Curve25519::PublicKey peer_public(reinterpret_cast<const
+                                                  uint8_t*>(pkt.msg_rekey_ack().responder_public_key().data()),
+                                                            pkt.msg_rekey_ack().responder_public_key().length());
+  crypto::SecureBuffer shared_secret(crypto::NtorHandshake::kSecretLength, 0);
+  const crypto::SecureBuffer peer_auth(reinterpret_cast<const
+                                       uint8_t*>(pkt.msg_rekey_ack().handshake_auth().data()),
+                                       pkt.msg_rekey_ack().handshake_auth().length());
+  if (!endpoint_.ntor_.initiator(peer_public, *peer_identity_key_,
+                                 *session_key_, *session_private_key_,
+                                 *node_id_, peer_auth, shared_secret)) {
+    // Rekey failed, mark the Session as invalid
+    scrub_handshake_state();
+    state_ = State::kERROR;
+    endpoint_.callbacks_.on_rekey(*this, kErrorConnAborted);
+    return kErrorConnAborted;
+  }
+
+  // Derive the ephemeral SIV keys
+  const auto key = derive_session_siv_key(shared_secret);
+  ephemeral_tx_siv_->set_key(key.data(), crypto::SIVBlake2sXChaCha::kKeyLength);
+  ephemeral_rx_siv_->set_key(key.data() + crypto::SIVBlake2sXChaCha::kKeyLength,
+                             crypto::SIVBlake2sXChaCha::kKeyLength);
+
+  // Finalize the new keys
+  scrub_handshake_state();
+  on_rekey_done();
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_shutdown_packet(
+    const packet::Envelope& pkt) {
+  if (state_ != State::kESTABLISHED && state_ != State::kREKEY)
+    return kErrorProtocol;
+
+  // Validate the packet
+  if (!pkt.has_msg_shutdown()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  if (!pkt.msg_shutdown().has_sequence_number()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+  }
+
+  // Verify that the packet is in window
+  if (!rx_seq_ok(pkt.msg_shutdown().sequence_number()))
+    return kErrorProtocol;
+
+  return close(false);
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_pmtu_probe_packet(
+    const packet::Envelope& pkt) {
+  if (state_ != State::kESTABLISHED && state_ != State::kREKEY)
+    return kErrorProtocol;
+
+  // Validate the packet
+  if (!pkt.has_msg_pmtu_probe()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  const packet::PmtuProbe& probe_msg = pkt.msg_pmtu_probe();
+  if (!probe_msg.has_sequence_number() || !probe_msg.has_probe_id() ||
+      !probe_msg.has_probe_size()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  // Verify that the packet is in window
+  if (!rx_seq_ok(probe_msg.sequence_number()))
+    return kErrorProtocol;
+
+  return send_pmtu_probe_ack_packet(probe_msg.probe_id());
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_pmtu_probe_ack_packet(
+    const packet::Envelope& pkt) {
+  if (state_ != State::kESTABLISHED && state_ != State::kREKEY)
+    return kErrorProtocol;
+
+  // Validate the packet
+  if (!pkt.has_msg_pmtu_probe_ack()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  const packet::PmtuProbeAck& ack_msg = pkt.msg_pmtu_probe_ack();
+  if (!ack_msg.has_sequence_number() || !ack_msg.has_probe_id()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  // Verify that the packet is in window
+  if (!rx_seq_ok(ack_msg.sequence_number()))
+    return kErrorProtocol;
+
+  stats_.rx_pmtu_probe_acks_++;
+
+  // Ignore ACKs for stale probes
+  if (pmtu_probe_size_ == 0 || ack_msg.probe_id() != pmtu_probe_id_)
+    return kErrorOk;
+
+  // The probe made it to the peer, so the path supports at least this much
+  SL_ASSERT(pmtu_probe_size_ >= pmtu_);
+  pmtu_ = pmtu_probe_size_;
+  pmtu_probe_size_ = 0;
+  if (pmtu_searching_)
+    pmtu_next_probe();
+  else {
+    pmtu_probe_count_ = 0;
+    pmtu_timer_->start(pmtu_probe_timeout_ * kPmtuConfirmInterval);
+  }
+
+  return kErrorOk;
+}
+
+template <class Callbacks>
+int BasicLodpSession<Callbacks>::on_fec_feedback_packet(
+    const packet::Envelope& pkt) {
+  if (state_ != State::kESTABLISHED && state_ != State::kREKEY)
+    return kErrorProtocol;
+
+  // Validate the packet
+  if (!pkt.has_msg_fec_feedback()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+  const packet::FecFeedback& feedback_msg = pkt.msg_fec_feedback();
+  if (!feedback_msg.has_sequence_number() ||
+      !feedback_msg.has_shards_expected() || !feedback_msg.has_shards_lost() ||
+      feedback_msg.shards_lost() > feedback_msg.shards_expected()) {
+    endpoint_.stats_.rx_bad_packet_format_++;
+    return kErrorBadPacketFormat;
+  }
+
+  // Verify that the packet is in window
+  if (!rx_seq_ok(feedback_msg.sequence_number()))
+    return kErrorProtocol;
+
+  if (feedback_msg.shards_expected() == 0)
+    return kErrorOk;
+
+  // Update the loss estimate (EWMA, alpha = 1/4)
+  const uint32_t loss = static_cast<uint32_t>(
+      static_cast<uint64_t>(feedback_msg.shards_lost()) * 1000000 /
+      feedback_msg.shards_expected());
+  if (stats_.rx_fec_feedback_++ == 0)
+    fec_loss_ppm_ = loss;
+  else
+    fec_loss_ppm_ = (3 * static_cast<uint64_t>(fec_loss_ppm_) + loss) / 4;
+  if (fec_ && fec_adaptive_)
+    fec_adapt();
+
+  return kErrorOk;
+}
+
+} // namespace lodp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_LODP_LODP_SESSION_IMPL_H__
@@ -0,0 +1,383 @@
+/**
+ * @file    lodp_sim.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Deterministic discrete event LODP network simulator (IMPLEMENTATION)
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <arpa/inet.h>
+
+#include "schwanenlied/lodp/lodp_sim.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+namespace {
+
+/** The responder's address (10.0.0.1:2323) */
+const uint32_t kResponderAddr = 0x0a000001;
+const uint16_t kResponderPort = 2323;
+/** The first initiator's address (10.0.0.2:6969), the rest follow */
+const uint32_t kFirstInitiatorAddr = 0x0a000002;
+const uint16_t kInitiatorPort = 6969;
+/** The number of initiators that fit in 10.0.0.0/8 */
+const size_t kMaxInitiators = 0x00fffffd;
+
+const uint8_t kNodeId[] = { 'S', 'i', 'm', 'N', 'o', 'd', 'e' };
+
+void make_addr(struct sockaddr_in& sa,
+               const uint32_t addr,
+               const uint16_t port) {
+  ::std::memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(addr);
+  sa.sin_port = htons(port);
+}
+
+uint64_t to_ns(const Clock::duration& d) {
+  return ::std::chrono::duration_cast< ::std::chrono::nanoseconds>(d).count();
+}
+
+} // namespace
+
+LodpSimRandom::LodpSimRandom(const uint64_t seed) {
+  // Mix in a tag so that the stream is distinct from the link PRNG's
+  ::std::seed_seq seq { static_cast<uint32_t>(seed),
+                        static_cast<uint32_t>(seed >> 32),
+                        static_cast<uint32_t>(0x6b657973) };  // "keys"
+  prng_.seed(seq);
+}
+
+void LodpSimRandom::get_bytes(void* buf, const size_t len) {
+  uint8_t* p = static_cast<uint8_t*>(buf);
+  for (size_t i = 0; i < len; i += sizeof(uint64_t)) {
+    const uint64_t v = prng_();
+    ::std::memcpy(p + i, &v, ::std::min(sizeof(v), len - i));
+  }
+}
+
+uint32_t LodpSimRandom::get_uint32() {
+  return static_cast<uint32_t>(prng_() >> 32);
+}
+
+uint32_t LodpSimRandom::get_uint32_range(uint32_t max) {
+  if (max == UINT32_MAX)
+    return get_uint32();
+  return static_cast<uint32_t>(prng_() % (static_cast<uint64_t>(max) + 1));
+}
+
+double LodpSimResults::goodput() const {
+  const uint64_t ns = to_ns(elapsed_);
+  if (ns == 0)
+    return 0.0;
+
+  return bytes_delivered_ * 8 * 1e9 / ns;
+}
+
+LodpSimulator::LodpSimulator(const LodpSimConfig& config) :
+    config_(config),
+    clock_(),
+    prng_(config.seed_),
+    rng_(config.seed_),
+    results_(),
+    responder_key_(rng_),
+    uplink_busy_(config.nr_sessions_),
+    downlink_busy_(config.nr_sessions_) {
+  SL_ASSERT(config_.nr_sessions_ > 0);
+  SL_ASSERT(config_.nr_sessions_ <= kMaxInitiators);
+  SL_ASSERT(config_.message_size_ >= sizeof(uint64_t));
+  SL_ASSERT(config_.message_size_ <= LodpSession::kMaxMessageLength);
+
+  // Bring up the responder
+  make_addr(responder_addr_, kResponderAddr, kResponderPort);
+  responder_.reset(new LodpEndpoint(rng_, *this, nullptr, false,
+                                    responder_key_, kNodeId,
+                                    sizeof(kNodeId)));
+  responder_->set_clock(clock_);
+  const crypto::Curve25519::PublicKey responder_public(responder_key_);
+
+  // Bring up the initiators, and schedule their handshakes
+  initiators_.reserve(config_.nr_sessions_);
+  for (size_t i = 0; i < config_.nr_sessions_; i++) {
+    Initiator* host = new Initiator();
+    initiators_.push_back(::std::unique_ptr<Initiator>(host));
+    host->index_ = i;
+    make_addr(host->addr_, kFirstInitiatorAddr + static_cast<uint32_t>(i),
+              kInitiatorPort);
+    host->endpoint_.reset(new LodpEndpoint(rng_, *this, host, false));
+    host->endpoint_->set_clock(clock_);
+    host->session_ = nullptr;
+    host->attempts_ = 0;
+    host->messages_left_ = 0;
+    host->retry_pending_ = false;
+
+    const struct sockaddr* addr =
+        reinterpret_cast<const struct sockaddr*>(&responder_addr_);
+    int ret = host->endpoint_->connect(host, responder_public, kNodeId,
+                                       sizeof(kNodeId), addr,
+                                       sizeof(responder_addr_),
+                                       host->session_);
+    SL_ASSERT(ret == kErrorOk);
+
+    clock_.schedule(uniform(config_.connect_spread_),
+                    [this, host]() { handshake(*host); });
+  }
+}
+
+LodpSimulator::~LodpSimulator() {
+  // Tear down every LodpSession so that the LodpEndpoints can be destroyed
+  for (auto& host : initiators_) {
+    if (host->session_ != nullptr)
+      host->session_->close(false);
+    SL_ASSERT(host->session_ == nullptr);
+  }
+
+  ::std::vector<LodpSession*> sessions;
+  for (auto session : responder_sessions_)
+    sessions.push_back(const_cast<LodpSession*>(session));
+  for (auto session : sessions)
+    session->close(false);
+  SL_ASSERT(responder_sessions_.empty());
+}
+
+const LodpSimResults& LodpSimulator::run() {
+  const Clock::time_point start = clock_.now();
+  clock_.run_until(start + config_.run_limit_);
+  results_.elapsed_ = clock_.now() - start;
+
+  return results_;
+}
+
+double LodpSimulator::uniform() {
+  // 53 bits of randomness, so this is exact and identical on every platform
+  return (prng_() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+Clock::duration LodpSimulator::uniform(const Clock::duration& max) {
+  if (max.count() <= 0)
+    return Clock::duration(0);
+
+  const uint64_t range = static_cast<uint64_t>(max.count()) + 1;
+  return Clock::duration(static_cast<Clock::duration::rep>(prng_() % range));
+}
+
+LodpSimulator::Initiator* LodpSimulator::lookup(const struct sockaddr* addr) {
+  SL_ASSERT(addr->sa_family == AF_INET);
+
+  const struct sockaddr_in* sa =
+      reinterpret_cast<const struct sockaddr_in*>(addr);
+  const uint32_t a = ntohl(sa->sin_addr.s_addr);
+  if (a < kFirstInitiatorAddr)
+    return nullptr;
+  const size_t idx = a - kFirstInitiatorAddr;
+  return idx < initiators_.size() ? initiators_[idx].get() : nullptr;
+}
+
+void LodpSimulator::handshake(Initiator& host) {
+  host.retry_pending_ = false;
+  if (host.session_ == nullptr || !host.session_->is_handshaking())
+    return;
+  if (host.attempts_ > config_.handshake_retries_) {
+    results_.handshake_failures_++;
+    return;
+  }
+
+  if (host.attempts_++ == 0)
+    host.connect_time_ = clock_.now();
+  host.session_->handshake();
+
+  // Responses always arrive via the SimClock, so this can't have completed
+  Initiator* h = &host;
+  host.retry_event_ = clock_.schedule(config_.handshake_timeout_,
+                                      [this, h]() { handshake(*h); });
+  host.retry_pending_ = true;
+}
+
+void LodpSimulator::send_next(Initiator& host) {
+  if (host.session_ == nullptr || host.messages_left_ == 0)
+    return;
+
+  // Timestamp the message so the responder can measure the latency
+  ::std::string msg(config_.message_size_, '\0');
+  const uint64_t ts = to_ns(clock_.now().time_since_epoch());
+  ::std::memcpy(&msg[0], &ts, sizeof(ts));
+  if (host.session_->send_message(msg.data(), msg.size()) == kErrorOk)
+    results_.messages_sent_++;
+  else
+    results_.send_errors_++;
+
+  if (--host.messages_left_ > 0) {
+    Initiator* h = &host;
+    clock_.schedule(config_.message_interval_, [this, h]() { send_next(*h); });
+  }
+}
+
+void LodpSimulator::transmit(const LodpSimLink& link,
+                             Clock::time_point& busy,
+                             LodpEndpoint& dst,
+                             const struct sockaddr_in& src_addr,
+                             const void* buf,
+                             const size_t len) {
+  results_.packets_sent_++;
+  if (link.loss_ > 0.0 && uniform() < link.loss_) {
+    results_.packets_lost_++;
+    return;
+  }
+
+  // Queue at the bottleneck, and serialize
+  const Clock::time_point now = clock_.now();
+  Clock::duration delay(0);
+  if (link.bandwidth_ > 0) {
+    if (busy < now)
+      busy = now;
+    if (link.queue_limit_ > 0) {
+      const uint64_t backlog = to_ns(busy - now) * link.bandwidth_ /
+          (8 * 1000000000ULL);
+      if (backlog + len > link.queue_limit_) {
+        results_.packets_queue_dropped_++;
+        return;
+      }
+    }
+    busy += ::std::chrono::duration_cast<Clock::duration>(
+        ::std::chrono::nanoseconds(len * 8 * 1000000000ULL / link.bandwidth_));
+    delay = busy - now;
+  }
+
+  // Propagate, with jitter and reordering
+  delay += link.delay_ + uniform(link.jitter_);
+  if (link.reorder_ > 0.0 && uniform() < link.reorder_)
+    delay += link.reorder_delay_;
+
+  LodpEndpoint* ep = &dst;
+  const struct sockaddr_in src = src_addr;
+  const ::std::string pkt(static_cast<const char*>(buf), len);
+  clock_.schedule(delay, [ep, src, pkt]() {
+    ep->on_packet(reinterpret_cast<const uint8_t*>(pkt.data()), pkt.size(),
+                  reinterpret_cast<const struct sockaddr*>(&src),
+                  sizeof(src));
+  });
+}
+
+int LodpSimulator::sendto(LodpEndpoint& endpoint,
+                          const void* buf,
+                          const size_t buf_len,
+                          const struct sockaddr* addr,
+                          const socklen_t addr_len) {
+  Initiator* src = static_cast<Initiator*>(endpoint.context());
+  if (src != nullptr) {
+    transmit(config_.uplink_, uplink_busy_[src->index_], *responder_,
+             src->addr_, buf, buf_len);
+  } else {
+    Initiator* dst = lookup(addr);
+    SL_ASSERT(dst != nullptr);
+    transmit(config_.downlink_, downlink_busy_[dst->index_], *dst->endpoint_,
+             responder_addr_, buf, buf_len);
+  }
+
+  return kErrorOk;
+}
+
+size_t LodpSimulator::pad_size(const LodpSession& session,
+                               const size_t available) {
+  // Padding would make packet sizes depend on crypto::Random
+  return 0;
+}
+
+bool LodpSimulator::should_accept(const LodpEndpoint& endpoint,
+                                  const struct sockaddr* addr,
+                                  const socklen_t addr_len) {
+  return true;
+}
+
+void LodpSimulator::on_accept(LodpEndpoint& endpoint,
+                              LodpSession* session,
+                              const struct sockaddr* addr,
+                              const socklen_t addr_len) {
+  responder_sessions_.insert(session);
+}
+
+void LodpSimulator::on_connect(LodpSession& session,
+                               const int status) {
+  Initiator* host = static_cast<Initiator*>(session.context());
+  SL_ASSERT(host != nullptr);
+  if (host->retry_pending_) {
+    clock_.cancel(host->retry_event_);
+    host->retry_pending_ = false;
+  }
+  if (status != kErrorOk) {
+    results_.handshake_failures_++;
+    return;
+  }
+
+  results_.sessions_established_++;
+  results_.handshake_latency_.record(to_ns(clock_.now() -
+                                           host->connect_time_));
+  host->messages_left_ = config_.nr_messages_;
+  if (host->messages_left_ > 0)
+    clock_.schedule(Clock::duration(0), [this, host]() { send_next(*host); });
+}
+
+void LodpSimulator::on_recv(LodpSession& session,
+                            const void* buf,
+                            const size_t buf_len) {
+  if (session.context() != nullptr || buf_len < sizeof(uint64_t))
+    return;
+
+  uint64_t ts;
+  ::std::memcpy(&ts, buf, sizeof(ts));
+  results_.message_latency_.record(to_ns(clock_.now().time_since_epoch()) -
+                                   ts);
+  results_.messages_delivered_++;
+  results_.bytes_delivered_ += buf_len;
+}
+
+void LodpSimulator::on_rekey_needed(LodpSession& session) {
+  // Scenarios are not long enough to exhaust the sequence number space
+}
+
+void LodpSimulator::on_rekey(LodpSession& session,
+                             const int status) {
+  // Nothing to do
+}
+
+void LodpSimulator::on_close(const LodpSession& session) {
+  Initiator* host = static_cast<Initiator*>(session.context());
+  if (host != nullptr)
+    host->session_ = nullptr;
+  else
+    responder_sessions_.erase(&session);
+}
+
+} // namespace lodp
+} // namespace schwanenlied
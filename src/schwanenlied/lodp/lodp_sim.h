@@ -0,0 +1,344 @@
+/**
+ * @file    lodp_sim.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Deterministic discrete event LODP network simulator
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_LODP_LODP_SIM_H__
+#define SCHWANENLIED_LODP_LODP_SIM_H__
+
+#include <memory>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/latency_histogram.h"
+#include "schwanenlied/sim_clock.h"
+#include "schwanenlied/crypto/random.h"
+#include "schwanenlied/lodp/lodp_endpoint.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+/** A simulated unidirectional network path */
+struct LodpSimLink {
+  LodpSimLink() :
+      delay_(::std::chrono::milliseconds(10)),
+      jitter_(0),
+      loss_(0.0),
+      reorder_(0.0),
+      reorder_delay_(0),
+      bandwidth_(0),
+      queue_limit_(0) {}
+
+  /** @{ */
+  Clock::duration delay_;         /**< Propagation delay */
+  Clock::duration jitter_;        /**< Maximum additional (uniform) delay */
+  double loss_;                   /**< Probability that a packet is lost */
+  double reorder_;                /**< Probability that a packet is held */
+  Clock::duration reorder_delay_; /**< The extra delay of held packets */
+  uint64_t bandwidth_;            /**< Bottleneck rate (bits/sec, 0 = inf) */
+  size_t queue_limit_;            /**< Bottleneck queue (bytes, 0 = inf) */
+  /** @} */
+};
+
+/**
+ * A crypto::Random that draws from a seeded PRNG
+ *
+ * LodpSimulator keys every simulated LodpEndpoint (Identity Keys, ephemeral
+ * keys, cookie and replay filter keys, SIV nonces) from one of these so that a
+ * run is reproducible from LodpSimConfig::seed_.
+ *
+ * @warning The output is entirely predictable, never use this outside of a
+ * simulation.
+ */
+class LodpSimRandom : public crypto::Random {
+ public:
+  /**
+   * Construct a LodpSimRandom
+   *
+   * @param[in] seed  The seed
+   */
+  explicit LodpSimRandom(const uint64_t seed);
+
+  /** @{ */
+  void get_bytes(void* buf, const size_t len) override;
+  uint32_t get_uint32() override;
+  uint32_t get_uint32_range(uint32_t max) override;
+  /** @} */
+
+ private:
+  LodpSimRandom() = delete;
+  LodpSimRandom(const LodpSimRandom&) = delete;
+  void operator=(const LodpSimRandom&) = delete;
+
+  ::std::mt19937_64 prng_;  /**< The underlying PRNG */
+};
+
+/** LodpSimulator scenario */
+struct LodpSimConfig {
+  LodpSimConfig() :
+      seed_(0),
+      nr_sessions_(1),
+      connect_spread_(0),
+      handshake_timeout_(::std::chrono::milliseconds(500)),
+      handshake_retries_(5),
+      message_size_(512),
+      nr_messages_(10),
+      message_interval_(::std::chrono::milliseconds(10)),
+      run_limit_(::std::chrono::seconds(3600)) {}
+
+  uint64_t seed_;           /**< The seed for all of the randomness */
+  size_t nr_sessions_;      /**< The number of initiators */
+  LodpSimLink uplink_;      /**< The initiator -> responder paths */
+  LodpSimLink downlink_;    /**< The responder -> initiator paths */
+
+  /** @{ */
+  /** The initiators start uniformly distributed over this interval */
+  Clock::duration connect_spread_;
+  /** The initiator handshake retransmission interval */
+  Clock::duration handshake_timeout_;
+  /** The number of handshake retransmissions before giving up */
+  int handshake_retries_;
+  /** @} */
+
+  /** @{ */
+  /** The size of each message (>= 8 bytes) */
+  size_t message_size_;
+  /** The number of messages each initiator sends once connected */
+  size_t nr_messages_;
+  /** The interval between each initiator's messages */
+  Clock::duration message_interval_;
+  /** @} */
+
+  /** The virtual time after which the simulation is stopped */
+  Clock::duration run_limit_;
+};
+
+/** LodpSimulator results */
+struct LodpSimResults {
+  LodpSimResults() :
+      sessions_established_(0),
+      handshake_failures_(0),
+      messages_sent_(0),
+      messages_delivered_(0),
+      bytes_delivered_(0),
+      send_errors_(0),
+      packets_sent_(0),
+      packets_lost_(0),
+      packets_queue_dropped_(0),
+      elapsed_(0) {}
+
+  /** @{ */
+  uint64_t sessions_established_; /**< Handshakes that completed */
+  uint64_t handshake_failures_;   /**< Handshakes that ran out of retries */
+  /** @} */
+
+  /** @{ */
+  uint64_t messages_sent_;        /**< Messages successfully sent */
+  uint64_t messages_delivered_;   /**< Messages received by the responder */
+  uint64_t bytes_delivered_;      /**< Message bytes received */
+  uint64_t send_errors_;          /**< Messages that failed to send */
+  /** @} */
+
+  /** @{ */
+  uint64_t packets_sent_;         /**< Packets handed to a link */
+  uint64_t packets_lost_;         /**< Packets lost to LodpSimLink::loss_ */
+  uint64_t packets_queue_dropped_; /**< Packets lost to queue overflow */
+  /** @} */
+
+  /** The virtual time from the start to the last event */
+  Clock::duration elapsed_;
+
+  /** @{ */
+  /** Initiator handshake() to on_connect() latency (ns) */
+  LatencyHistogram handshake_latency_;
+  /** Message send to responder on_recv() latency (ns) */
+  LatencyHistogram message_latency_;
+  /** @} */
+
+  /** Return the message goodput in bits per second of virtual time */
+  double goodput() const;
+};
+
+/**
+ * A deterministic discrete event LODP network simulator
+ *
+ * A single responder LodpEndpoint and config.nr_sessions_ initiator
+ * LodpEndpoints (each with one LodpSession) are connected by LodpSimLinks, and
+ * driven by a SimClock that is also the LodpEndpoint Clock, so that cookie
+ * expiration and Timers run in virtual time.  Each initiator handshakes
+ * (retransmitting as configured), then sends a fixed number of messages, each
+ * of which is timestamped so the responder can measure the one way latency.
+ *
+ * Time spent in computation (Eg: the ntor handshake) is not modeled, so a run
+ * completes as fast as the CPU can do the cryptography, regardless of the
+ * amount of virtual time covered.  All of the link behavior is taken from a
+ * PRNG seeded with config.seed_, and all of the endpoints are keyed from a
+ * LodpSimRandom derived from the same seed, so a given seed and config always
+ * produce the same results.
+ */
+class LodpSimulator : private LodpCallbacks {
+ public:
+  /**
+   * Construct a LodpSimulator
+   *
+   * @param[in] config  The scenario
+   */
+  explicit LodpSimulator(const LodpSimConfig& config);
+
+  ~LodpSimulator();
+
+  /**
+   * Run the scenario to completion (or config.run_limit_)
+   *
+   * @returns The LodpSimResults
+   */
+  const LodpSimResults& run();
+
+  /** @{ */
+  /** Get the SimClock driving the simulation */
+  SimClock& clock() { return clock_; }
+  /** Get the responder LodpEndpoint */
+  LodpEndpoint& responder() { return *responder_; }
+  /** Get the results (Valid after run()) */
+  const LodpSimResults& results() const { return results_; }
+  /** @} */
+
+ private:
+  LodpSimulator() = delete;
+  LodpSimulator(const LodpSimulator&) = delete;
+  void operator=(const LodpSimulator&) = delete;
+
+  /** A simulated initiator host */
+  struct Initiator {
+    size_t index_;                        /**< The index in initiators_ */
+    struct sockaddr_in addr_;             /**< The address */
+    ::std::unique_ptr<LodpEndpoint> endpoint_;  /**< The LodpEndpoint */
+    LodpSession* session_;                /**< The LodpSession */
+    Clock::time_point connect_time_;      /**< The first handshake() */
+    int attempts_;                        /**< handshake() calls so far */
+    size_t messages_left_;                /**< Messages left to send */
+    bool retry_pending_;                  /**< retry_event_ is scheduled */
+    SimClock::EventId retry_event_;       /**< The retransmission event */
+  };
+
+  /** @{ */
+  /** Return a uniformly distributed double in [0, 1) */
+  double uniform();
+  /** Return a uniformly distributed duration in [0, max] */
+  Clock::duration uniform(const Clock::duration& max);
+  /** Map a address back to the Initiator (nullptr for the responder) */
+  Initiator* lookup(const struct sockaddr* addr);
+  /** @} */
+
+  /** @{ */
+  /** Start (or retransmit) a Initiator's handshake */
+  void handshake(Initiator& host);
+  /** Send the next message from a Initiator */
+  void send_next(Initiator& host);
+  /**
+   * Carry a packet over a LodpSimLink
+   *
+   * @param[in] link      The link
+   * @param[in,out] busy  When the link's bottleneck queue drains
+   * @param[in] dst       The receiving LodpEndpoint
+   * @param[in] src_addr  The address of the sender
+   * @param[in] buf       The packet
+   * @param[in] len       The length of the packet
+   */
+  void transmit(const LodpSimLink& link,
+                Clock::time_point& busy,
+                LodpEndpoint& dst,
+                const struct sockaddr_in& src_addr,
+                const void* buf,
+                const size_t len);
+  /** @} */
+
+  // LodpCallbacks
+  /** @{ */
+  int sendto(LodpEndpoint& endpoint,
+             const void* buf,
+             const size_t buf_len,
+             const struct sockaddr* addr,
+             const socklen_t addr_len) override;
+  size_t pad_size(const LodpSession& session,
+                  const size_t available) override;
+  bool should_accept(const LodpEndpoint& endpoint,
+                     const struct sockaddr* addr,
+                     const socklen_t addr_len) override;
+  void on_accept(LodpEndpoint& endpoint,
+                 LodpSession* session,
+                 const struct sockaddr* addr,
+                 const socklen_t addr_len) override;
+  void on_connect(LodpSession& session,
+                  const int status) override;
+  void on_recv(LodpSession& session,
+               const void* buf,
+               const size_t buf_len) override;
+  void on_rekey_needed(LodpSession& session) override;
+  void on_rekey(LodpSession& session,
+                const int status) override;
+  void on_close(const LodpSession& session) override;
+  /** @} */
+
+  const LodpSimConfig config_;    /**< The scenario */
+  SimClock clock_;                /**< The virtual time source */
+  ::std::mt19937_64 prng_;        /**< The link PRNG */
+  LodpSimRandom rng_;             /**< The endpoint key material source */
+  LodpSimResults results_;        /**< The results */
+
+  /** @{ */
+  /** The responder's address */
+  struct sockaddr_in responder_addr_;
+  /** The responder's Identity Key */
+  crypto::Curve25519::PrivateKey responder_key_;
+  /** The responder LodpEndpoint */
+  ::std::unique_ptr<LodpEndpoint> responder_;
+  /** The responder's LodpSessions */
+  ::std::unordered_set<const LodpSession*> responder_sessions_;
+  /** @} */
+
+  /** @{ */
+  /** The initiators */
+  ::std::vector<::std::unique_ptr<Initiator>> initiators_;
+  /** When each link's bottleneck queue drains (Indexed as initiators_) */
+  ::std::vector<Clock::time_point> uplink_busy_;
+  /** When each link's bottleneck queue drains (Indexed as initiators_) */
+  ::std::vector<Clock::time_point> downlink_busy_;
+  /** @} */
+};
+
+} // namespace lodp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_LODP_LODP_SIM_H__
@@ -0,0 +1,122 @@
+/*
+ * lodp_sim_test.cc: LODP network simulator tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "schwanenlied/lodp/lodp_sim.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+class LodpSimTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {};
+  virtual void TearDown() {};
+};
+
+TEST_F(LodpSimTest, Lossless) {
+  LodpSimConfig config;
+  config.nr_sessions_ = 1000;
+  config.connect_spread_ = ::std::chrono::seconds(1);
+
+  LodpSimulator sim(config);
+  const LodpSimResults& r = sim.run();
+  ASSERT_EQ(1000u, r.sessions_established_);
+  ASSERT_EQ(0u, r.handshake_failures_);
+  ASSERT_EQ(10000u, r.messages_sent_);
+  ASSERT_EQ(10000u, r.messages_delivered_);
+  ASSERT_EQ(10000u * config.message_size_, r.bytes_delivered_);
+  ASSERT_EQ(0u, r.packets_lost_);
+
+  // The handshake is 2 RTTs, and the links have no jitter or queueing
+  const uint64_t one_way = 10000000;
+  ASSERT_EQ(1000u, r.handshake_latency_.count());
+  ASSERT_EQ(4 * one_way, r.handshake_latency_.min());
+  ASSERT_EQ(4 * one_way, r.handshake_latency_.max());
+  ASSERT_EQ(one_way, r.message_latency_.min());
+  ASSERT_EQ(one_way, r.message_latency_.max());
+  ASSERT_GT(r.goodput(), 0.0);
+  ASSERT_LE(r.elapsed_, ::std::chrono::seconds(2));
+}
+
+TEST_F(LodpSimTest, Impaired) {
+  LodpSimConfig config;
+  config.seed_ = 0x5eed;
+  config.nr_sessions_ = 200;
+  config.uplink_.jitter_ = ::std::chrono::milliseconds(5);
+  config.uplink_.loss_ = 0.02;
+  config.uplink_.reorder_ = 0.01;
+  config.uplink_.reorder_delay_ = ::std::chrono::milliseconds(20);
+  config.uplink_.bandwidth_ = 1000000;
+  config.uplink_.queue_limit_ = 4096;
+  config.downlink_.loss_ = 0.02;
+  config.message_interval_ = ::std::chrono::milliseconds(1);
+
+  LodpSimResults a, b, c;
+  {
+    LodpSimulator sim(config);
+    a = sim.run();
+  }
+  {
+    LodpSimulator sim(config);
+    b = sim.run();
+  }
+  config.seed_++;
+  {
+    LodpSimulator sim(config);
+    c = sim.run();
+  }
+
+  // Impairments show up in the results
+  ASSERT_LT(0u, a.packets_lost_);
+  ASSERT_LT(0u, a.packets_queue_dropped_);
+  ASSERT_LT(a.messages_delivered_, a.messages_sent_);
+  ASSERT_LT(0u, a.sessions_established_);
+  ASSERT_LE(a.message_latency_.min(), a.message_latency_.max());
+  ASSERT_GE(a.message_latency_.min(), 10000000u);
+
+  // The same seed reproduces the run exactly
+  ASSERT_EQ(a.sessions_established_, b.sessions_established_);
+  ASSERT_EQ(a.handshake_failures_, b.handshake_failures_);
+  ASSERT_EQ(a.messages_sent_, b.messages_sent_);
+  ASSERT_EQ(a.messages_delivered_, b.messages_delivered_);
+  ASSERT_EQ(a.packets_sent_, b.packets_sent_);
+  ASSERT_EQ(a.packets_lost_, b.packets_lost_);
+  ASSERT_EQ(a.packets_queue_dropped_, b.packets_queue_dropped_);
+  ASSERT_EQ(a.elapsed_, b.elapsed_);
+  ASSERT_EQ(a.message_latency_.sum(), b.message_latency_.sum());
+  ASSERT_EQ(a.handshake_latency_.sum(), b.handshake_latency_.sum());
+
+  // And a different one doesn't
+  ASSERT_TRUE(a.packets_lost_ != c.packets_lost_ ||
+              a.message_latency_.sum() != c.message_latency_.sum());
+}
+
+} // namespace lodp
+} // namespace schwanenlied
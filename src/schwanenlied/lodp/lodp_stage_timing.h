@@ -0,0 +1,95 @@
+/**
+ * @file    lodp_stage_timing.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   LODP hot path stage timing instrumentation
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_LODP_LODP_STAGE_TIMING_H__
+#define SCHWANENLIED_LODP_LODP_STAGE_TIMING_H__
+
+#include <array>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/latency_histogram.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+/**
+ * The instrumented stages of the LODP hot paths
+ *
+ * The stages are only timed when the library is built with LODP_STAGE_TIMING
+ * defined (the LODP_STAGE_TIMING CMake option).  Since this changes the layout
+ * of LodpEndpoint, everything linking against the library must be built with
+ * the same setting.
+ */
+enum class LodpStage {
+  kRxDecrypt,           /**< Trial decryption of a received packet */
+  kRxParse,             /**< Deserializing the received Envelope */
+  kRxDispatch,          /**< Session packet processing (incl. callbacks) */
+  kRxCallback,          /**< The user's on_recv() callback */
+  kHandshakeCookie,     /**< HANDSHAKE cookie validation/replay check */
+  kHandshakeNtor,       /**< The responder side ntor handshake */
+  kHandshakeCallback,   /**< The user's should_accept()/on_accept() */
+  kTxSerialize,         /**< Padding and serializing an outgoing Envelope */
+  kTxEncrypt,           /**< SIV encrypting an outgoing packet */
+  kTxXmit,              /**< Handing the ciphertext to sendto() */
+  kRekey,               /**< Initiating a rekey */
+  kCount                /**< The number of stages (Not a stage) */
+};
+
+/** The per-stage LatencyHistograms, indexed by LodpStage */
+typedef ::std::array<LatencyHistogram,
+                     static_cast<size_t>(LodpStage::kCount)> LodpStageHistograms;
+
+/**
+ * Return a human readable name for a LodpStage
+ *
+ * @param[in] stage The stage
+ */
+const char* lodp_stage_name(const LodpStage stage);
+
+/** @{ */
+#ifdef LODP_STAGE_TIMING
+/** Take the start timestamp for a stage */
+#define LODP_STAGE_START(var) const uint64_t var = LatencyHistogram::now()
+/** Record the time elapsed since LODP_STAGE_START() for a stage */
+#define LODP_STAGE_RECORD(ep, stage, var) \
+  (ep).stage_hist_[static_cast<size_t>(LodpStage::stage)].record_since(var)
+#else
+#define LODP_STAGE_START(var) do {} while (0)
+#define LODP_STAGE_RECORD(ep, stage, var) do {} while (0)
+#endif
+/** @} */
+
+} // namespace lodp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_LODP_LODP_STAGE_TIMING_H__
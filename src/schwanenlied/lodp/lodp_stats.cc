@@ -0,0 +1,327 @@
+/**
+ * @file    lodp_stats.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   LODP statistics and Prometheus exporter (IMPLEMENTATION)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+
+#include <unistd.h>
+
+#include "schwanenlied/lodp/lodp_stats.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+/** @{ */
+/** A exported counter */
+template <class T>
+struct Metric {
+  const char* name_;      /**< The Prometheus metric name */
+  const char* help_;      /**< The Prometheus HELP text */
+  uint64_t T::*field_;    /**< The field being exported */
+};
+
+static const Metric<LodpEndpointStats> kEndpointMetrics[] = {
+  { "lodp_endpoint_tx_bytes_total", "Total bytes sent",
+    &LodpEndpointStats::tx_bytes_ },
+  { "lodp_endpoint_rx_bytes_total", "Total bytes received",
+    &LodpEndpointStats::rx_bytes_ },
+  { "lodp_endpoint_rx_undersized_total", "Undersized packets",
+    &LodpEndpointStats::rx_undersized_ },
+  { "lodp_endpoint_rx_oversized_total", "Oversized packets",
+    &LodpEndpointStats::rx_oversized_ },
+  { "lodp_endpoint_rx_over_mtu_total",
+    "Packets larger than the peer's UDP MTU",
+    &LodpEndpointStats::rx_over_mtu_ },
+  { "lodp_endpoint_rx_decrypt_failed_total", "Packets that failed to decrypt",
+    &LodpEndpointStats::rx_decrypt_failed_ },
+  { "lodp_endpoint_rx_invalid_envelope_total",
+    "Protobuf deserialization errors",
+    &LodpEndpointStats::rx_invalid_envelope_ },
+  { "lodp_endpoint_rx_bad_packet_format_total", "Packet format errors",
+    &LodpEndpointStats::rx_bad_packet_format_ },
+  { "lodp_endpoint_rx_init_replays_total", "Replayed INIT packets",
+    &LodpEndpointStats::rx_init_replays_ },
+  { "lodp_endpoint_rx_invalid_cookie_total", "Invalid HANDSHAKE cookies",
+    &LodpEndpointStats::rx_invalid_cookie_ },
+  { "lodp_endpoint_rx_cookie_replays_total", "Replayed HANDSHAKE cookies",
+    &LodpEndpointStats::rx_cookie_replays_ },
+  { "lodp_endpoint_rx_handshake_failed_total", "Failed ntor handshakes",
+    &LodpEndpointStats::rx_handshake_failed_ },
+  { "lodp_endpoint_sessions_accepted_total", "Sessions accepted",
+    &LodpEndpointStats::sessions_accepted_ },
+  { "lodp_endpoint_sessions_connected_total", "Sessions created via connect()",
+    &LodpEndpointStats::sessions_connected_ },
+  { "lodp_endpoint_sessions_closed_total", "Sessions closed",
+    &LodpEndpointStats::sessions_closed_ },
+};
+
+static const Metric<LodpSessionStats> kSessionMetrics[] = {
+  { "lodp_session_tx_bytes_total", "Total session bytes sent",
+    &LodpSessionStats::tx_bytes_ },
+  { "lodp_session_rx_bytes_total", "Total session bytes received",
+    &LodpSessionStats::rx_bytes_ },
+  { "lodp_session_tx_goodput_bytes_total", "Total payload sent",
+    &LodpSessionStats::tx_goodput_bytes_ },
+  { "lodp_session_rx_goodput_bytes_total", "Total payload received",
+    &LodpSessionStats::rx_goodput_bytes_ },
+  { "lodp_session_tx_coalesced_total", "Messages sent coalesced",
+    &LodpSessionStats::tx_coalesced_ },
+  { "lodp_session_rx_coalesced_total", "Messages received coalesced",
+    &LodpSessionStats::rx_coalesced_ },
+  { "lodp_session_tx_fragments_total", "Fragments sent",
+    &LodpSessionStats::tx_fragments_ },
+  { "lodp_session_rx_fragments_total", "Fragments received",
+    &LodpSessionStats::rx_fragments_ },
+  { "lodp_session_rx_reassembled_total", "Fragmented messages reassembled",
+    &LodpSessionStats::rx_reassembled_ },
+  { "lodp_session_rx_reassembly_dropped_total",
+    "Fragmented messages dropped",
+    &LodpSessionStats::rx_reassembly_dropped_ },
+  { "lodp_session_rx_parity_recovered_total",
+    "Fragments recovered via parity",
+    &LodpSessionStats::rx_parity_recovered_ },
+  { "lodp_session_tx_pmtu_probes_total", "PMTU PROBE packets sent",
+    &LodpSessionStats::tx_pmtu_probes_ },
+  { "lodp_session_rx_pmtu_probe_acks_total", "PMTU PROBE ACK packets received",
+    &LodpSessionStats::rx_pmtu_probe_acks_ },
+  { "lodp_session_pmtu_black_holes_total", "PMTU black holes detected",
+    &LodpSessionStats::pmtu_black_holes_ },
+  { "lodp_session_tx_fec_parity_total", "FEC parity packets sent",
+    &LodpSessionStats::tx_fec_parity_ },
+  { "lodp_session_rx_fec_parity_total", "FEC parity packets received",
+    &LodpSessionStats::rx_fec_parity_ },
+  { "lodp_session_rx_fec_recovered_total", "FEC source packets recovered",
+    &LodpSessionStats::rx_fec_recovered_ },
+  { "lodp_session_rx_fec_late_total", "FEC source packets received late",
+    &LodpSessionStats::rx_fec_late_ },
+  { "lodp_session_tx_fec_feedback_total", "FEC FEEDBACK packets sent",
+    &LodpSessionStats::tx_fec_feedback_ },
+  { "lodp_session_rx_fec_feedback_total", "FEC FEEDBACK packets received",
+    &LodpSessionStats::rx_fec_feedback_ },
+  { "lodp_session_tx_queued_total", "Packets queued due to backpressure",
+    &LodpSessionStats::tx_queued_ },
+  { "lodp_session_tx_would_block_total", "Sends refused with kErrorAgain",
+    &LodpSessionStats::tx_would_block_ },
+};
+
+/** The "type" label values, indexed by packet::Envelope::Type */
+static const char* const kPacketTypeNames[] = {
+  "data", "init", "init_ack", "handshake", "handshake_ack", "rekey",
+  "rekey_ack", "shutdown", "pmtu_probe", "pmtu_probe_ack", "fec_feedback"
+};
+static_assert(sizeof(kPacketTypeNames) / sizeof(kPacketTypeNames[0]) ==
+              kNrPacketTypes, "kPacketTypeNames is out of date");
+/** @} */
+
+void LodpEndpointStats::merge(const LodpEndpointStats& other) {
+  for (const auto& m : kEndpointMetrics)
+    this->*m.field_ += other.*m.field_;
+  for (size_t i = 0; i < kNrPacketTypes; i++) {
+    rx_packets_[i] += other.rx_packets_[i];
+    tx_packets_[i] += other.tx_packets_[i];
+  }
+}
+
+void LodpSessionStats::merge(const LodpSessionStats& other) {
+  for (const auto& m : kSessionMetrics)
+    this->*m.field_ += other.*m.field_;
+}
+
+void LodpStatsSnapshot::merge(const LodpStatsSnapshot& other) {
+  sessions_ += other.sessions_;
+  sessions_established_ += other.sessions_established_;
+  endpoint_.merge(other.endpoint_);
+  session_.merge(other.session_);
+}
+
+/**
+ * Append a label set (Eg: {shard="0",type="data"}) to a metric line
+ *
+ * The shard label value is escaped per the text exposition format.
+ */
+static void append_labels(::std::string& out,
+                          const ::std::string* shard,
+                          const char* type) {
+  if (shard == nullptr && type == nullptr)
+    return;
+
+  out += '{';
+  if (shard != nullptr) {
+    out += "shard=\"";
+    for (const char c : *shard) {
+      if (c == '\\' || c == '"')
+        out += '\\';
+      if (c == '\n')
+        out += "\\n";
+      else
+        out += c;
+    }
+    out += '"';
+  }
+  if (type != nullptr) {
+    if (shard != nullptr)
+      out += ',';
+    out += "type=\"";
+    out += type;
+    out += '"';
+  }
+  out += '}';
+}
+
+static void append_header(::std::string& out,
+                          const char* name,
+                          const char* help,
+                          const char* type) {
+  out += "# HELP ";
+  out += name;
+  out += ' ';
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += ' ';
+  out += type;
+  out += '\n';
+}
+
+static void append_value(::std::string& out,
+                         const char* name,
+                         const ::std::string* shard,
+                         const char* type,
+                         const uint64_t value) {
+  char buf[24];
+  ::std::snprintf(buf, sizeof(buf), "%" PRIu64, value);
+  out += name;
+  append_labels(out, shard, type);
+  out += ' ';
+  out += buf;
+  out += '\n';
+}
+
+LodpStatsExporter::LodpStatsExporter() :
+    shards_(),
+    total_() {
+  // Nothing to do
+}
+
+void LodpStatsExporter::add(const ::std::string& shard,
+                            const LodpStatsSnapshot& snap) {
+  shards_.emplace_back(shard, snap);
+  total_.merge(snap);
+}
+
+void LodpStatsExporter::clear() {
+  shards_.clear();
+  total_ = LodpStatsSnapshot();
+}
+
+void LodpStatsExporter::render(::std::string& out,
+                               const bool per_shard) const {
+  /*
+   * The exposition format requires that all of the samples for a given
+   * metric are grouped together, so iterate over the metrics and then the
+   * shards.
+   */
+  ::std::vector<::std::pair<const ::std::string*, const LodpStatsSnapshot*>>
+      series;
+  if (per_shard) {
+    for (const auto& s : shards_)
+      series.emplace_back(&s.first, &s.second);
+  } else {
+    series.emplace_back(nullptr, &total_);
+  }
+
+  append_header(out, "lodp_sessions", "Sessions currently open", "gauge");
+  for (const auto& s : series)
+    append_value(out, "lodp_sessions", s.first, nullptr, s.second->sessions_);
+  append_header(out, "lodp_sessions_established",
+                "Sessions currently established", "gauge");
+  for (const auto& s : series)
+    append_value(out, "lodp_sessions_established", s.first, nullptr,
+                 s.second->sessions_established_);
+
+  for (const auto& m : kEndpointMetrics) {
+    append_header(out, m.name_, m.help_, "counter");
+    for (const auto& s : series)
+      append_value(out, m.name_, s.first, nullptr,
+                   s.second->endpoint_.*m.field_);
+  }
+
+  append_header(out, "lodp_endpoint_rx_packets_total",
+                "Valid packets received by type", "counter");
+  for (const auto& s : series) {
+    for (size_t i = 0; i < kNrPacketTypes; i++)
+      append_value(out, "lodp_endpoint_rx_packets_total", s.first,
+                   kPacketTypeNames[i], s.second->endpoint_.rx_packets_[i]);
+  }
+  append_header(out, "lodp_endpoint_tx_packets_total",
+                "Packets sent by type", "counter");
+  for (const auto& s : series) {
+    for (size_t i = 0; i < kNrPacketTypes; i++)
+      append_value(out, "lodp_endpoint_tx_packets_total", s.first,
+                   kPacketTypeNames[i], s.second->endpoint_.tx_packets_[i]);
+  }
+
+  for (const auto& m : kSessionMetrics) {
+    append_header(out, m.name_, m.help_, "counter");
+    for (const auto& s : series)
+      append_value(out, m.name_, s.first, nullptr,
+                   s.second->session_.*m.field_);
+  }
+}
+
+int LodpStatsExporter::write(const int fd,
+                             const bool per_shard) const {
+  ::std::string out;
+  render(out, per_shard);
+
+  const char* ptr = out.data();
+  size_t len = out.length();
+  while (len > 0) {
+    const ssize_t ret = ::write(fd, ptr, len);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return kErrorAgain;
+      return kErrorConnAborted;
+    }
+    ptr += ret;
+    len -= static_cast<size_t>(ret);
+  }
+
+  return kErrorOk;
+}
+
+} // namespace lodp
+} // namespace schwanenlied
@@ -0,0 +1,247 @@
+/**
+ * @file    lodp_stats.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   LODP statistics and Prometheus exporter
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_LODP_LODP_STATS_H__
+#define SCHWANENLIED_LODP_LODP_STATS_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "schwanenlied/common.h"
+
+// Autogenerated Protocol Buffers Header
+#include "lodp.pb.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+/** The number of LODP packet types (packet::Envelope::Type) */
+const size_t kNrPacketTypes = packet::Envelope::Type_ARRAYSIZE;
+
+/** LodpEndpoint statistics */
+struct LodpEndpointStats {
+  /** @{ */
+  uint64_t tx_bytes_;             /**< Total bytes sent */
+  uint64_t rx_bytes_;             /**< Total bytes received */
+  /** @} */
+
+  // Receive statistics (# of packets)
+  /** @{ */
+  uint64_t rx_undersized_;        /**< Undersized packets */
+  uint64_t rx_oversized_;         /**< Oversized packets */
+  uint64_t rx_over_mtu_;          /**< Packets over the peer's UDP MTU */
+  uint64_t rx_decrypt_failed_;    /**< Packets we failed to decrypt */
+  uint64_t rx_invalid_envelope_;  /**< Protobuf deserialization error */
+  uint64_t rx_bad_packet_format_; /**< Packet format error */
+  uint64_t rx_init_replays_;      /**< Replayed INIT packets */
+  uint64_t rx_invalid_cookie_;    /**< Invalid HANDSHAKE cookies */
+  uint64_t rx_cookie_replays_;    /**< Replayed handshake cookies */
+  uint64_t rx_handshake_failed_;  /**< Failed ntor handshakes */
+  /** @} */
+
+  // Per packet type statistics (# of packets, indexed by Envelope::Type)
+  /** @{ */
+  uint64_t rx_packets_[kNrPacketTypes]; /**< Valid packets received */
+  uint64_t tx_packets_[kNrPacketTypes]; /**< Packets sent */
+  /** @} */
+
+  /** @{ */
+  uint64_t sessions_accepted_;    /**< LodpSessions accepted (responder) */
+  uint64_t sessions_connected_;   /**< LodpSessions created via connect() */
+  uint64_t sessions_closed_;      /**< LodpSessions closed */
+  /** @} */
+
+  /**
+   * Add the counters from another LodpEndpointStats to this one
+   *
+   * @param[in] other The LodpEndpointStats to add
+   */
+  void merge(const LodpEndpointStats& other);
+};
+
+/** LodpSession statistics */
+struct LodpSessionStats {
+  /** @{ */
+  uint64_t tx_bytes_;         /**< Total bytes sent */
+  uint64_t rx_bytes_;         /**< Total bytes received */
+  uint64_t tx_goodput_bytes_; /**< Total payload sent */
+  uint64_t rx_goodput_bytes_; /**< Total payload received */
+  /** @} */
+
+  /** @{ */
+  uint32_t generation_id_;    /**< Generation ID (counts rekeys) */
+  uint32_t generation_tx_;    /**< Data packets sent this generation */
+  uint32_t generation_rx_;    /**< Data packets received this generation */
+  /** @} */
+
+  /** @{ */
+  uint64_t tx_coalesced_;     /**< Messages sent coalesced */
+  uint64_t rx_coalesced_;     /**< Messages received coalesced */
+  /** @} */
+
+  /** @{ */
+  uint64_t tx_fragments_;     /**< Fragments sent (Including parity) */
+  uint64_t rx_fragments_;     /**< Fragments received (Including parity) */
+  uint64_t rx_reassembled_;   /**< Fragmented messages reassembled */
+  uint64_t rx_reassembly_dropped_; /**< Fragmented messages dropped */
+  uint64_t rx_parity_recovered_;   /**< Fragments recovered via parity */
+  /** @} */
+
+  /** @{ */
+  uint64_t tx_pmtu_probes_;   /**< PMTU PROBE packets sent */
+  uint64_t rx_pmtu_probe_acks_; /**< PMTU PROBE ACK packets received */
+  uint64_t pmtu_black_holes_; /**< PMTU black holes detected */
+  /** @} */
+
+  /** @{ */
+  uint64_t tx_fec_parity_;    /**< FEC parity packets sent */
+  uint64_t rx_fec_parity_;    /**< FEC parity packets received */
+  uint64_t rx_fec_recovered_; /**< FEC source packets recovered */
+  uint64_t rx_fec_late_;      /**< FEC source packets after block retirement */
+  uint64_t tx_fec_feedback_;  /**< FEC FEEDBACK packets sent */
+  uint64_t rx_fec_feedback_;  /**< FEC FEEDBACK packets received */
+  /** @} */
+
+  /** @{ */
+  uint64_t tx_queued_;        /**< Packets queued due to backpressure */
+  uint64_t tx_would_block_;   /**< Sends refused with kErrorAgain */
+  /** @} */
+
+  /**
+   * Add the counters from another LodpSessionStats to this one
+   *
+   * The per-generation fields are instantaneous LodpSession state and are
+   * left untouched.
+   *
+   * @param[in] other The LodpSessionStats to add
+   */
+  void merge(const LodpSessionStats& other);
+};
+
+/**
+ * A point in time snapshot of a LodpEndpoint's statistics
+ *
+ * This is what LodpEndpoint::publish_stats() hands to other threads, and what
+ * LodpStatsExporter renders.  The LodpSession counters are the totals across
+ * every LodpSession that the LodpEndpoint has had, including closed ones.
+ */
+struct LodpStatsSnapshot {
+  /** @{ */
+  uint64_t sessions_;             /**< LodpSessions currently open */
+  uint64_t sessions_established_; /**< LodpSessions currently established */
+  /** @} */
+
+  /** @{ */
+  LodpEndpointStats endpoint_;    /**< The LodpEndpoint counters */
+  LodpSessionStats session_;      /**< The aggregate LodpSession counters */
+  /** @} */
+
+  /**
+   * Add another LodpStatsSnapshot (Eg: from another shard) to this one
+   *
+   * @param[in] other The LodpStatsSnapshot to add
+   */
+  void merge(const LodpStatsSnapshot& other);
+};
+
+/**
+ * A Prometheus text format exporter for LodpStatsSnapshots
+ *
+ * Applications that run one LodpEndpoint per thread (shard) collect each
+ * shard's LodpEndpoint::stats_snapshot() into a LodpStatsExporter from the
+ * monitoring thread, and render() the result for a scraper (Eg: over a Unix
+ * domain socket via write()).
+ */
+class LodpStatsExporter {
+ public:
+  LodpStatsExporter();
+
+  /** @{ */
+  /**
+   * Add a shard's LodpStatsSnapshot
+   *
+   * @param[in] shard The value of the "shard" label for this snapshot
+   * @param[in] snap  The LodpStatsSnapshot
+   */
+  void add(const ::std::string& shard,
+           const LodpStatsSnapshot& snap);
+
+  /** Remove all of the shards */
+  void clear();
+
+  /** Return the sum of all of the shards */
+  const LodpStatsSnapshot& total() const { return total_; }
+  /** @} */
+
+  /** @{ */
+  /**
+   * Render the shards in the Prometheus text exposition format
+   *
+   * @param[out] out        The std::string to append the output to
+   * @param[in]  per_shard  Emit one series per shard (labeled) instead of
+   *                        the aggregate
+   */
+  void render(::std::string& out,
+              const bool per_shard) const;
+
+  /**
+   * Render the shards, and write the result to a file descriptor
+   *
+   * This is intended for serving a scraper over a connected (blocking) Unix
+   * domain socket.
+   *
+   * @param[in] fd          The file descriptor to write to
+   * @param[in] per_shard   See render()
+   *
+   * @returns kErrorOk          - Success
+   * @returns kErrorAgain       - The descriptor is non-blocking and full
+   * @returns kErrorConnAborted - The write failed
+   */
+  int write(const int fd,
+            const bool per_shard) const;
+  /** @} */
+
+ private:
+  LodpStatsExporter(const LodpStatsExporter&) = delete;
+  void operator=(const LodpStatsExporter&) = delete;
+
+  /** The per shard LodpStatsSnapshots */
+  ::std::vector<::std::pair<::std::string, LodpStatsSnapshot>> shards_;
+  LodpStatsSnapshot total_; /**< The sum of shards_ */
+};
+
+} // namespace lodp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_LODP_LODP_STATS_H__
@@ -0,0 +1,121 @@
+/*
+ * lodp_stats_test.cc: LODP statistics exporter tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "schwanenlied/lodp/lodp_stats.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+class LodpStatsTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    shard_a_ = LodpStatsSnapshot();
+    shard_a_.sessions_ = 2;
+    shard_a_.endpoint_.rx_bytes_ = 100;
+    shard_a_.endpoint_.rx_packets_[packet::Envelope::DATA] = 3;
+    shard_a_.session_.tx_goodput_bytes_ = 10;
+    shard_a_.session_.generation_id_ = 7;
+
+    shard_b_ = LodpStatsSnapshot();
+    shard_b_.sessions_ = 1;
+    shard_b_.endpoint_.rx_bytes_ = 50;
+    shard_b_.endpoint_.rx_packets_[packet::Envelope::DATA] = 1;
+    shard_b_.session_.tx_goodput_bytes_ = 5;
+  }
+  virtual void TearDown() {}
+
+  LodpStatsSnapshot shard_a_;
+  LodpStatsSnapshot shard_b_;
+};
+
+TEST_F(LodpStatsTest, Aggregate) {
+  LodpStatsExporter exporter;
+  exporter.add("a", shard_a_);
+  exporter.add("b", shard_b_);
+
+  const LodpStatsSnapshot& total = exporter.total();
+  ASSERT_EQ(3u, total.sessions_);
+  ASSERT_EQ(150u, total.endpoint_.rx_bytes_);
+  ASSERT_EQ(4u, total.endpoint_.rx_packets_[packet::Envelope::DATA]);
+  ASSERT_EQ(15u, total.session_.tx_goodput_bytes_);
+  ASSERT_EQ(0u, total.session_.generation_id_); // Not a counter
+
+  ::std::string out;
+  exporter.render(out, false);
+  ASSERT_NE(::std::string::npos,
+            out.find("# TYPE lodp_sessions gauge\nlodp_sessions 3\n"));
+  ASSERT_NE(::std::string::npos,
+            out.find("\nlodp_endpoint_rx_bytes_total 150\n"));
+  ASSERT_NE(::std::string::npos,
+            out.find("\nlodp_endpoint_rx_packets_total{type=\"data\"} 4\n"));
+
+  exporter.clear();
+  ASSERT_EQ(0u, exporter.total().sessions_);
+}
+
+TEST_F(LodpStatsTest, PerShard) {
+  LodpStatsExporter exporter;
+  exporter.add("a", shard_a_);
+  exporter.add("b\"", shard_b_);
+
+  ::std::string out;
+  exporter.render(out, true);
+
+  // Each metric has one HELP/TYPE, followed by the samples for every shard
+  const ::std::string expected =
+      "# HELP lodp_endpoint_rx_bytes_total Total bytes received\n"
+      "# TYPE lodp_endpoint_rx_bytes_total counter\n"
+      "lodp_endpoint_rx_bytes_total{shard=\"a\"} 100\n"
+      "lodp_endpoint_rx_bytes_total{shard=\"b\\\"\"} 50\n";
+  ASSERT_NE(::std::string::npos, out.find(expected));
+  ASSERT_NE(::std::string::npos, out.find(
+      "lodp_endpoint_tx_packets_total{shard=\"a\",type=\"fec_feedback\"} 0\n"));
+
+  // Write it out over a socket
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  ASSERT_EQ(kErrorOk, exporter.write(fds[0], true));
+  ::close(fds[0]);
+  ::std::string got;
+  char buf[4096];
+  ssize_t len;
+  while ((len = ::read(fds[1], buf, sizeof(buf))) > 0)
+    got.append(buf, len);
+  ::close(fds[1]);
+  ASSERT_EQ(out, got);
+}
+
+} // namespace lodp
+} // namespace schwanenlied
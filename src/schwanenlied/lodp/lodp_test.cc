@@ -28,13 +28,21 @@
  */
 
 #include <arpa/inet.h>
+#include <unistd.h>
 
+#include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+#include <uv.h>
 
 // If you're really anal about valgrind...
 //#include <google/protobuf/stubs/common.h>
 
 #include "schwanenlied/lodp/lodp_endpoint.h"
+#include "schwanenlied/lodp/lodp_endpoint_impl.h"
 #include "schwanenlied/lodp/lodp_session.h"
 #include "gtest/gtest.h"
 
@@ -43,6 +51,10 @@ namespace lodp {
 
 class LodpTest : public ::testing::Test {
  protected:
+  LodpTest() :
+      server_priv_key_(rng_),
+      server_pub_key_(server_priv_key_) {}
+
   virtual void SetUp() {
     // Initialize the client/server "addresses" (fake)
     ::std::memset(&client_addr_, 0, sizeof(client_addr_));
@@ -57,11 +69,60 @@ class LodpTest : public ::testing::Test {
   };
   virtual void TearDown() {};
 
+  // Create the client and server endpoints for cbs
+  template <typename Callbacks>
+  void create_endpoints(Callbacks& cbs,
+                        const bool server_safe_logging = false) {
+    typedef typename ::std::remove_pointer<
+        decltype(cbs.client_endpoint_)>::type Endpoint;
+
+    cbs.client_endpoint_ = new Endpoint(rng_, cbs, nullptr, false);
+    ASSERT_NE(nullptr, cbs.client_endpoint_);
+    cbs.server_endpoint_ = new Endpoint(rng_, cbs, nullptr,
+                                        server_safe_logging,
+                                        server_priv_key_, kNodeId,
+                                        sizeof(kNodeId));
+    ASSERT_NE(nullptr, cbs.server_endpoint_);
+  }
+
+  // Connect cbs's client endpoint to the server, and handshake
+  template <typename Callbacks>
+  void connect(Callbacks& cbs,
+               const bool handshake = true) {
+    int ret = cbs.client_endpoint_->connect(nullptr, server_pub_key_,
+                                            kNodeId, sizeof(kNodeId),
+                                            reinterpret_cast<sockaddr*>(&server_addr_),
+                                            sizeof(server_addr_),
+                                            cbs.client_session_);
+    ASSERT_EQ(kErrorOk, ret);
+    ASSERT_NE(nullptr, cbs.client_session_);
+    if (!handshake)
+      return;
+
+    ret = cbs.client_session_->handshake();
+    ASSERT_EQ(kErrorOk, ret);
+    ASSERT_NE(nullptr, cbs.server_session_);
+  }
+
+  // Both of the above
+  template <typename Callbacks>
+  void establish(Callbacks& cbs,
+                 const bool server_safe_logging = false) {
+    ASSERT_NO_FATAL_FAILURE(create_endpoints(cbs, server_safe_logging));
+    connect(cbs);
+  }
+
+  static const uint8_t kNodeId[8];
+
   struct sockaddr_in client_addr_;
   struct sockaddr_in server_addr_;
-
+  crypto::Random rng_;
+  crypto::Curve25519::PrivateKey server_priv_key_;
+  crypto::Curve25519::PublicKey server_pub_key_;
 };
 
+const uint8_t LodpTest::kNodeId[] = { 'T', 'e', 's', 't', 'N', 'o', 'd', 'e' };
+
 // A callback class that implements a simple loopback interface
 // that implements a echo server on the responder end and pushes data
 // between two endpoints.
@@ -71,7 +132,16 @@ class TestCallbacks : public LodpCallbacks {
       client_endpoint_(nullptr),
       server_endpoint_(nullptr),
       client_session_(nullptr),
-      server_session_(nullptr) {}
+      server_session_(nullptr),
+      gso_bursts_(0),
+      client_recvs_(0),
+      client_drop_countdown_(0),
+      client_delay_countdown_(0),
+      client_max_packet_(0),
+      client_drop_every_(0),
+      client_sent_(0),
+      client_full_(false),
+      client_writables_(0) {}
 
   int sendto(LodpEndpoint& endpoint,
              const void* buf,
@@ -79,6 +149,13 @@ class TestCallbacks : public LodpCallbacks {
              const struct sockaddr* addr,
              const socklen_t addr_len) override;
 
+  int sendto_gso(LodpEndpoint& endpoint,
+                 const void* buf,
+                 const size_t buf_len,
+                 const size_t segment_size,
+                 const struct sockaddr* addr,
+                 const socklen_t addr_len) override;
+
   size_t pad_size(const LodpSession& session,
                   const size_t available) override;
 
@@ -105,10 +182,22 @@ class TestCallbacks : public LodpCallbacks {
 
   void on_close(const LodpSession& session) override;
 
+  void on_writable(LodpSession& session) override;
+
   LodpEndpoint* client_endpoint_;
   LodpEndpoint* server_endpoint_;
   LodpSession* client_session_;
   LodpSession* server_session_;
+  int gso_bursts_;
+  int client_recvs_;
+  int client_drop_countdown_;  // Drop the Nth packet sent by the client
+  int client_delay_countdown_; // Hold the Nth packet sent by the client
+  ::std::string client_delayed_;  // The held packet
+  size_t client_max_packet_;   // Drop larger packets sent by the client
+  int client_drop_every_;      // Drop every Nth packet sent by the client
+  int client_sent_;
+  bool client_full_;           // The client's transport is full
+  int client_writables_;
 };
 
 int TestCallbacks::sendto(LodpEndpoint& endpoint,
@@ -119,6 +208,18 @@ int TestCallbacks::sendto(LodpEndpoint& endpoint,
   SCOPED_TRACE("sendto() callback");
 
   if (&endpoint == client_endpoint_) {
+    if (client_full_)
+      return kErrorAgain;
+    if (client_delay_countdown_ > 0 && --client_delay_countdown_ == 0) {
+      client_delayed_.assign(static_cast<const char*>(buf), buf_len);
+      return kErrorOk;
+    }
+    if (client_drop_countdown_ > 0 && --client_drop_countdown_ == 0)
+      return kErrorOk;
+    if (client_max_packet_ > 0 && buf_len > client_max_packet_)
+      return kErrorOk;
+    if (client_drop_every_ > 0 && ++client_sent_ % client_drop_every_ == 0)
+      return kErrorOk;
     int ret = server_endpoint_->on_packet(reinterpret_cast<const uint8_t*>(buf),
                                           buf_len, addr, addr_len);
     EXPECT_EQ(kErrorOk, ret);
@@ -134,6 +235,36 @@ int TestCallbacks::sendto(LodpEndpoint& endpoint,
   return -1;
 }
 
+int TestCallbacks::sendto_gso(LodpEndpoint& endpoint,
+                              const void* buf,
+                              const size_t buf_len,
+                              const size_t segment_size,
+                              const struct sockaddr* addr,
+                              const socklen_t addr_len) {
+  SCOPED_TRACE("sendto_gso() callback");
+
+  // Pretend to be the kernel doing GSO on one end and GRO on the other
+  if (&endpoint == client_endpoint_ && client_full_)
+    return kErrorAgain;
+  gso_bursts_++;
+  if (&endpoint == client_endpoint_) {
+    int ret = server_endpoint_->on_packets(reinterpret_cast<const uint8_t*>(buf),
+                                           buf_len, segment_size, addr,
+                                           addr_len);
+    EXPECT_EQ(kErrorOk, ret);
+    return ret;
+  } else if (&endpoint == server_endpoint_) {
+    int ret = client_endpoint_->on_packets(reinterpret_cast<const uint8_t*>(buf),
+                                           buf_len, segment_size, addr,
+                                           addr_len);
+    EXPECT_EQ(kErrorOk, ret);
+    return ret;
+  } else
+    ADD_FAILURE(); // WTF endpoint is this?
+
+  return -1;
+}
+
 size_t TestCallbacks::pad_size(const LodpSession& session,
                                const size_t available) {
   SCOPED_TRACE("pad_size() callback");
@@ -192,7 +323,8 @@ void TestCallbacks::on_recv(LodpSession& session,
   if (&session == server_session_) {
     int ret = server_session_->send(buf, buf_len);
     ASSERT_EQ(kErrorOk, ret);
-  }
+  } else
+    client_recvs_++;
 }
 
 void TestCallbacks::on_rekey_needed(LodpSession& session) {
@@ -215,6 +347,38 @@ void TestCallbacks::on_close(const LodpSession& session) {
     FAIL(); // WTF session is this?
 }
 
+void TestCallbacks::on_writable(LodpSession& session) {
+  SCOPED_TRACE("on_writable() callback");
+  EXPECT_EQ(client_session_, &session);
+  client_writables_++;
+}
+
+// TestCallbacks with a echo server that uses send_message(), for tests that
+// send payloads larger than the server's mtu()
+class MessageCallbacks : public TestCallbacks {
+ public:
+  void on_recv(LodpSession& session,
+               const void* buf,
+               const size_t buf_len) override;
+};
+
+void MessageCallbacks::on_recv(LodpSession& session,
+                               const void* buf,
+                               const size_t buf_len) {
+  SCOPED_TRACE("on_recv() callback");
+
+  if (&session != server_session_) {
+    TestCallbacks::on_recv(session, buf, buf_len);
+    return;
+  }
+
+  const uint8_t* ptr = static_cast<const uint8_t*>(buf);
+  for (size_t i = 0; i < buf_len; i++)
+    ASSERT_TRUE(ptr[i] == static_cast<uint8_t>(i));
+  int ret = server_session_->send_message(buf, buf_len);
+  ASSERT_EQ(kErrorOk, ret);
+}
+
 // A simple loopback based test that exercises the "successful" codepaths for
 // everything
 TEST_F(LodpTest, LoopbackTest) {
@@ -300,5 +464,962 @@ TEST_F(LodpTest, LoopbackTest) {
   //::google::protobuf::ShutdownProtobufLibrary();
 }
 
+// Exercise burst transmission via sendto_gso()
+TEST_F(LodpTest, GsoTest) {
+  TestCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(establish(cbs));
+  int ret;
+
+  uint8_t buf[1500] = { 0 };  // This is *always* bigger than the MTU
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+
+  // Send a burst, every packet is padded to the MTU so it is one GSO send
+  struct iovec iov[100];
+  for (size_t i = 0; i < sizeof(iov) / sizeof(iov[0]); i++) {
+    iov[i].iov_base = buf;
+    iov[i].iov_len = i % cbs.client_session_->mtu();
+  }
+  ret = cbs.client_session_->send_burst(iov, 16);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(1, cbs.gso_bursts_);
+
+  // Bursts larger than 64 KiB get split (46 MTU sized IPv4 packets per send)
+  cbs.gso_bursts_ = 0;
+  ret = cbs.client_session_->send_burst(iov, sizeof(iov) / sizeof(iov[0]));
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(3, cbs.gso_bursts_);
+
+  // Validate that all of the data was actually sent
+  ASSERT_EQ(cbs.client_session_->stats().tx_goodput_bytes_,
+            cbs.server_session_->stats().rx_goodput_bytes_);
+  ASSERT_EQ(cbs.client_session_->stats().tx_goodput_bytes_,
+            cbs.client_session_->stats().rx_goodput_bytes_);
+
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.client_session_);
+  ASSERT_EQ(nullptr, cbs.server_session_);
+
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
+// Exercise small message coalescing
+TEST_F(LodpTest, CoalesceTest) {
+  TestCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(establish(cbs));
+  int ret;
+
+  uint8_t buf[256];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+  ASSERT_EQ(kErrorInval, cbs.client_session_->set_coalescing(true,
+      cbs.client_session_->mtu() + 1));
+
+  // Queued messages are sent on flush()
+  ASSERT_EQ(kErrorOk, cbs.client_session_->set_coalescing(true));
+  for (size_t i = 0; i < 10; i++) {
+    ret = cbs.client_session_->send(buf, 20 + i);
+    ASSERT_EQ(kErrorOk, ret);
+  }
+  ASSERT_EQ(0u, cbs.server_session_->stats().generation_rx_);
+  ASSERT_EQ(kErrorOk, cbs.client_session_->flush());
+  ASSERT_EQ(1u, cbs.server_session_->stats().generation_rx_);
+  ASSERT_EQ(10u, cbs.server_session_->stats().rx_coalesced_);
+  ASSERT_EQ(10, cbs.client_recvs_);  // The echo is not coalesced
+
+  // Queued messages are sent when the threshold is reached
+  ASSERT_EQ(kErrorOk, cbs.client_session_->set_coalescing(true, 100));
+  for (size_t i = 0; i < 5; i++) {
+    ret = cbs.client_session_->send(buf, 20);
+    ASSERT_EQ(kErrorOk, ret);
+  }
+  ASSERT_EQ(2u, cbs.server_session_->stats().generation_rx_);
+
+  // Large messages bypass coalescing but preserve ordering
+  ret = cbs.client_session_->send(buf, 10);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(2u, cbs.server_session_->stats().generation_rx_);
+  ret = cbs.client_session_->send(buf, 150);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(4u, cbs.server_session_->stats().generation_rx_);
+
+  // Queued messages are sent by the endpoint's flush()
+  ret = cbs.client_session_->send(buf, 10);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(4u, cbs.server_session_->stats().generation_rx_);
+  ASSERT_EQ(kErrorOk, cbs.client_endpoint_->flush());
+  ASSERT_EQ(5u, cbs.server_session_->stats().generation_rx_);
+
+  // Queued messages are sent when the deadline expires
+  ASSERT_EQ(kErrorOk, cbs.client_session_->set_coalescing(true, 0,
+      ::std::chrono::microseconds(1500)));
+  ret = cbs.client_session_->send(buf, 20);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(5u, cbs.server_session_->stats().generation_rx_);
+  uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+  ASSERT_EQ(6u, cbs.server_session_->stats().generation_rx_);
+
+  // Disabling coalescing flushes, and everything made it across
+  ret = cbs.client_session_->send(buf, 20);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(kErrorOk, cbs.client_session_->set_coalescing(false));
+  ASSERT_EQ(7u, cbs.server_session_->stats().generation_rx_);
+  ASSERT_EQ(cbs.client_session_->stats().tx_goodput_bytes_,
+            cbs.server_session_->stats().rx_goodput_bytes_);
+  ASSERT_EQ(cbs.client_session_->stats().tx_goodput_bytes_,
+            cbs.client_session_->stats().rx_goodput_bytes_);
+  ASSERT_EQ(20, cbs.client_recvs_);
+
+  // A session that can not be flushed while a rekey is in progress stays
+  // pending, and is flushed once the rekey completes
+  ASSERT_EQ(kErrorOk, cbs.server_session_->set_coalescing(true));
+  ret = cbs.server_session_->send(buf, 20);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(kErrorOk, cbs.client_session_->rekey());
+  ASSERT_EQ(kErrorMustRekey, cbs.server_endpoint_->flush());
+  ASSERT_EQ(20, cbs.client_recvs_);
+  ret = cbs.client_session_->send(buf, 20);  // Completes the rekey
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(kErrorOk, cbs.server_endpoint_->flush());
+  ASSERT_EQ(22, cbs.client_recvs_);
+
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.client_session_);
+  ASSERT_EQ(nullptr, cbs.server_session_);
+
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
+// Exercise large message fragmentation and reassembly
+TEST_F(LodpTest, FragmentTest) {
+  MessageCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(establish(cbs));
+  int ret;
+
+  const size_t len = LodpSession::kMaxMessageLength;
+  ::std::unique_ptr<uint8_t[]> buf(new uint8_t[len]);
+  for (size_t i = 0; i < len; i++)
+    buf[i] = static_cast<uint8_t>(i);
+  ASSERT_EQ(kErrorMsgSize, cbs.client_session_->send_message(buf.get(),
+                                                             len + 1));
+
+  // Small messages are sent as is
+  ret = cbs.client_session_->send_message(buf.get(), 100);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(0u, cbs.server_session_->stats().rx_fragments_);
+  ASSERT_EQ(1, cbs.client_recvs_);
+
+  // Large messages are fragmented, and echoed back fragmented
+  ret = cbs.client_session_->send_message(buf.get(), len);
+  ASSERT_EQ(kErrorOk, ret);
+  const uint64_t count = cbs.client_session_->stats().tx_fragments_;
+  ASSERT_LT(1u, count);
+  ASSERT_EQ(count, cbs.server_session_->stats().rx_fragments_);
+  ASSERT_EQ(1u, cbs.server_session_->stats().rx_reassembled_);
+  ASSERT_EQ(1u, cbs.client_session_->stats().rx_reassembled_);
+  ASSERT_EQ(2, cbs.client_recvs_);
+
+  // A single lost fragment is recovered with the parity fragment
+  cbs.client_drop_countdown_ = 3;
+  ret = cbs.client_session_->send_message(buf.get(), len - 1, true);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(2u, cbs.server_session_->stats().rx_reassembled_);
+  ASSERT_EQ(1u, cbs.server_session_->stats().rx_parity_recovered_);
+  ASSERT_EQ(3, cbs.client_recvs_);
+
+  // Without parity, a lost fragment loses the message, but not the session
+  cbs.client_drop_countdown_ = 1;
+  ret = cbs.client_session_->send_message(buf.get(), len);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(2u, cbs.server_session_->stats().rx_reassembled_);
+  ASSERT_EQ(3, cbs.client_recvs_);
+  ret = cbs.client_session_->send_message(buf.get(), len / 2);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(3u, cbs.server_session_->stats().rx_reassembled_);
+  ASSERT_EQ(4, cbs.client_recvs_);
+
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.client_session_);
+  ASSERT_EQ(nullptr, cbs.server_session_);
+
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
+// Exercise path MTU discovery
+TEST_F(LodpTest, PmtuTest) {
+  MessageCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(create_endpoints(cbs));
+  ASSERT_NO_FATAL_FAILURE(connect(cbs, false));
+  ASSERT_EQ(kErrorNotConn,
+            cbs.client_session_->set_pmtu_discovery(true));
+  int ret = cbs.client_session_->handshake();
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_NE(nullptr, cbs.server_session_);
+
+  const size_t base_mtu = cbs.client_session_->udp_mtu();
+  const size_t base_payload = cbs.client_session_->mtu();
+  ASSERT_EQ(kErrorInval,
+            cbs.client_session_->set_pmtu_discovery(true, base_mtu - 1));
+
+  // The server only accepts larger packets once it is configured to
+  ::std::unique_ptr<uint8_t[]> junk(new uint8_t[base_mtu + 1]());
+  ASSERT_EQ(kErrorOversizedPacket,
+            cbs.server_endpoint_->on_packet(junk.get(), base_mtu + 1,
+                                            reinterpret_cast<sockaddr*>(&server_addr_),
+                                            sizeof(server_addr_)));
+  ASSERT_EQ(1u, cbs.server_endpoint_->stats().rx_over_mtu_);
+  cbs.server_endpoint_->set_max_rx_udp_mtu(4000);
+
+  // The path accepts up to 4000 bytes, the search finds it
+  const ::std::chrono::milliseconds timeout(5);
+  cbs.client_max_packet_ = 4000;
+  ret = cbs.client_session_->set_pmtu_discovery(true, 0, timeout);
+  ASSERT_EQ(kErrorOk, ret);
+  for (int i = 0; i < 1000 && cbs.client_session_->udp_mtu() + 32 <= 4000; i++)
+    uv_run(uv_default_loop(), UV_RUN_ONCE);
+  ASSERT_LT(4000u - 32, cbs.client_session_->udp_mtu());
+  ASSERT_GE(4000u, cbs.client_session_->udp_mtu());
+  ASSERT_LT(base_payload, cbs.client_session_->mtu());
+  ASSERT_LT(0u, cbs.server_session_->stats().rx_bytes_);
+
+  // Payloads up to the new mtu() get through
+  ::std::unique_ptr<uint8_t[]> buf(new uint8_t[cbs.client_session_->mtu()]);
+  for (size_t i = 0; i < cbs.client_session_->mtu(); i++)
+    buf[i] = static_cast<uint8_t>(i);
+  ret = cbs.client_session_->send(buf.get(), cbs.client_session_->mtu());
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(1, cbs.client_recvs_);
+
+  // The path shrinks, the confirmation probes notice and the search restarts
+  cbs.client_max_packet_ = 2000;
+  for (int i = 0; i < 1000 &&
+       (cbs.client_session_->stats().pmtu_black_holes_ == 0 ||
+        cbs.client_session_->udp_mtu() + 32 <= 2000); i++)
+    uv_run(uv_default_loop(), UV_RUN_ONCE);
+  ASSERT_EQ(1u, cbs.client_session_->stats().pmtu_black_holes_);
+  ASSERT_LT(2000u - 32, cbs.client_session_->udp_mtu());
+  ASSERT_GE(2000u, cbs.client_session_->udp_mtu());
+
+  // Disabling reverts to the default
+  ASSERT_EQ(kErrorOk, cbs.client_session_->set_pmtu_discovery(false));
+  ASSERT_EQ(base_mtu, cbs.client_session_->udp_mtu());
+
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.client_session_);
+  ASSERT_EQ(nullptr, cbs.server_session_);
+
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+  uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+}
+
+// Exercise forward error correction
+TEST_F(LodpTest, FecTest) {
+  TestCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(establish(cbs));
+  int ret;
+
+  const size_t mtu = cbs.client_session_->mtu();
+  ASSERT_EQ(kErrorInval, cbs.client_session_->set_fec(true, 4, 0));
+  ASSERT_EQ(kErrorInval, cbs.client_session_->set_fec(true,
+      LodpSession::kMaxFecK + 1, 1));
+  ASSERT_EQ(kErrorOk, cbs.client_session_->set_fec(true, 4, 2));
+  ASSERT_GT(mtu, cbs.client_session_->mtu());
+
+  uint8_t buf[1500];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+
+  // Two full blocks, including mtu() sized packets
+  for (size_t i = 0; i < 8; i++) {
+    ret = cbs.client_session_->send(buf, cbs.client_session_->mtu() - i * 100);
+    ASSERT_EQ(kErrorOk, ret);
+  }
+  ASSERT_EQ(4u, cbs.server_session_->stats().rx_fec_parity_);
+  ASSERT_EQ(0u, cbs.server_session_->stats().rx_fec_recovered_);
+  ASSERT_EQ(8, cbs.client_recvs_);
+
+  // A lost source packet is recovered from the parity
+  cbs.client_drop_countdown_ = 2;
+  for (size_t i = 0; i < 4; i++) {
+    ret = cbs.client_session_->send(buf, 100 + i);
+    ASSERT_EQ(kErrorOk, ret);
+  }
+  ASSERT_EQ(1u, cbs.server_session_->stats().rx_fec_recovered_);
+  ASSERT_EQ(12, cbs.client_recvs_);
+
+  // Partial blocks are closed by flush()
+  cbs.client_drop_countdown_ = 1;
+  for (size_t i = 0; i < 3; i++) {
+    ret = cbs.client_session_->send(buf, 200 + i);
+    ASSERT_EQ(kErrorOk, ret);
+  }
+  ASSERT_EQ(14, cbs.client_recvs_);
+  ASSERT_EQ(kErrorOk, cbs.client_endpoint_->flush());
+  ASSERT_EQ(2u, cbs.server_session_->stats().rx_fec_recovered_);
+  ASSERT_EQ(15, cbs.client_recvs_);
+  ASSERT_EQ(8u, cbs.server_session_->stats().rx_fec_parity_);
+
+  // Bursts are protected as well
+  struct iovec iov[6];
+  for (size_t i = 0; i < 6; i++) {
+    iov[i].iov_base = buf;
+    iov[i].iov_len = 300 + i;
+  }
+  ret = cbs.client_session_->send_burst(iov, 6);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(10u, cbs.server_session_->stats().rx_fec_parity_);
+  ASSERT_EQ(kErrorOk, cbs.client_endpoint_->flush());
+  ASSERT_EQ(12u, cbs.server_session_->stats().rx_fec_parity_);
+  ASSERT_EQ(21, cbs.client_recvs_);
+  ASSERT_EQ(cbs.client_session_->stats().tx_goodput_bytes_,
+            cbs.server_session_->stats().rx_goodput_bytes_);
+
+  // Adaptive FEC starts out cheap, and adds parity as loss is reported
+  ASSERT_EQ(kErrorOk, cbs.client_session_->set_fec(true));
+  ASSERT_EQ(16u, cbs.client_session_->fec_k());
+  ASSERT_EQ(1u, cbs.client_session_->fec_m());
+  cbs.client_drop_every_ = 10;
+  for (size_t i = 0; i < 16 * 17 * 2; i++) {
+    ret = cbs.client_session_->send(buf, 100);
+    ASSERT_EQ(kErrorOk, ret);
+  }
+  cbs.client_drop_every_ = 0;
+  ASSERT_LT(0u, cbs.client_session_->stats().rx_fec_feedback_);
+  ASSERT_LT(50000u, cbs.client_session_->fec_loss());
+  ASSERT_EQ(4u, cbs.client_session_->fec_k());
+  ASSERT_EQ(2u, cbs.client_session_->fec_m());
+  ASSERT_LT(2u, cbs.server_session_->stats().rx_fec_recovered_);
+
+  ASSERT_EQ(kErrorOk, cbs.client_session_->set_fec(false));
+  ASSERT_EQ(mtu, cbs.client_session_->mtu());
+
+  // Reordered source packets are delivered, but only once
+  ASSERT_EQ(kErrorOk, cbs.client_session_->set_fec(true, 4, 1));
+  const int recvs = cbs.client_recvs_;
+  const uint64_t late = cbs.server_session_->stats().rx_fec_late_;
+  auto deliver_delayed = [&]() {
+    return cbs.server_endpoint_->on_packet(
+        reinterpret_cast<const uint8_t*>(cbs.client_delayed_.data()),
+        cbs.client_delayed_.size(), reinterpret_cast<sockaddr*>(&server_addr_),
+        sizeof(server_addr_));
+  };
+  auto send_blocks = [&](const size_t nr_blocks) {
+    for (size_t i = 0; i < 4 * nr_blocks; i++)
+      ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, 100));
+  };
+
+  // A late packet that was already recovered is a duplicate
+  cbs.client_delay_countdown_ = 2;
+  send_blocks(1);
+  ASSERT_EQ(recvs + 4, cbs.client_recvs_);
+  ASSERT_EQ(kErrorOk, deliver_delayed());
+  ASSERT_EQ(recvs + 4, cbs.client_recvs_);
+
+  // A packet from a unrecoverable block is delivered after it is retired
+  cbs.client_delay_countdown_ = 1;
+  cbs.client_drop_countdown_ = 1;
+  send_blocks(1);
+  ASSERT_EQ(recvs + 6, cbs.client_recvs_);
+  send_blocks(8);  // LodpSession::kFecMaxRxBlocks
+  ASSERT_EQ(recvs + 38, cbs.client_recvs_);
+  ASSERT_EQ(kErrorOk, deliver_delayed());
+  ASSERT_EQ(recvs + 39, cbs.client_recvs_);
+  ASSERT_EQ(late + 1, cbs.server_session_->stats().rx_fec_late_);
+
+  // A packet from a recovered block is not delivered after it is retired
+  cbs.client_delay_countdown_ = 3;
+  send_blocks(1);
+  ASSERT_EQ(recvs + 43, cbs.client_recvs_);
+  send_blocks(8);
+  ASSERT_EQ(kErrorOk, deliver_delayed());
+  ASSERT_EQ(recvs + 75, cbs.client_recvs_);
+  ASSERT_EQ(late + 2, cbs.server_session_->stats().rx_fec_late_);
+
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.client_session_);
+  ASSERT_EQ(nullptr, cbs.server_session_);
+
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
+// Exercise the send queue when the transport is full
+TEST_F(LodpTest, WritableTest) {
+  TestCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(establish(cbs));
+  int ret;
+
+  // Every packet is padded to the udp_mtu(), so 4 packets hit the watermark
+  const size_t udp_mtu = cbs.client_session_->udp_mtu();
+  ASSERT_EQ(kErrorInval, cbs.client_session_->set_tx_watermarks(0, 0));
+  ASSERT_EQ(kErrorInval, cbs.client_session_->set_tx_watermarks(100, 200));
+  ASSERT_EQ(kErrorOk, cbs.client_session_->set_tx_watermarks(4 * udp_mtu,
+                                                             udp_mtu));
+
+  uint8_t buf[1500];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+
+  // Packets are queued while the transport is full, till the high watermark
+  cbs.client_full_ = true;
+  for (size_t i = 0; i < 4; i++) {
+    ret = cbs.client_session_->send(buf, 100 + i);
+    ASSERT_EQ(kErrorOk, ret);
+  }
+  ASSERT_EQ(4 * udp_mtu, cbs.client_session_->tx_queue_bytes());
+  ASSERT_EQ(kErrorAgain, cbs.client_session_->send(buf, 100));
+  ASSERT_EQ(kErrorAgain, cbs.client_session_->send_message(buf, 1500));
+  ASSERT_EQ(4u, cbs.client_session_->stats().tx_queued_);
+  ASSERT_EQ(2u, cbs.client_session_->stats().tx_would_block_);
+  ASSERT_EQ(0, cbs.client_recvs_);
+
+  // Nothing happens till the transport actually has room
+  ASSERT_EQ(kErrorAgain, cbs.client_endpoint_->on_writable());
+  ASSERT_EQ(0, cbs.client_writables_);
+
+  cbs.client_full_ = false;
+  ASSERT_EQ(kErrorOk, cbs.client_endpoint_->on_writable());
+  ASSERT_EQ(0u, cbs.client_session_->tx_queue_bytes());
+  ASSERT_EQ(1, cbs.client_writables_);
+  ASSERT_EQ(4, cbs.client_recvs_);
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, 100));
+  ASSERT_EQ(5, cbs.client_recvs_);
+
+  // Bursts are queued as a whole
+  struct iovec iov[3];
+  for (size_t i = 0; i < 3; i++) {
+    iov[i].iov_base = buf;
+    iov[i].iov_len = 200 + i;
+  }
+  cbs.client_full_ = true;
+  ret = cbs.client_session_->send_burst(iov, 3);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(7u, cbs.client_session_->stats().tx_queued_);
+  ASSERT_EQ(0, cbs.gso_bursts_);
+  cbs.client_full_ = false;
+  ASSERT_EQ(kErrorOk, cbs.client_endpoint_->on_writable());
+  ASSERT_EQ(1, cbs.gso_bursts_);
+  ASSERT_EQ(8, cbs.client_recvs_);
+  ASSERT_EQ(1, cbs.client_writables_);  // The session never got blocked
+  ASSERT_EQ(cbs.client_session_->stats().tx_goodput_bytes_,
+            cbs.server_session_->stats().rx_goodput_bytes_);
+
+  // Closing a session with queued packets discards them
+  cbs.client_full_ = true;
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, 100));
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.client_session_);
+  ASSERT_EQ(kErrorOk, cbs.client_endpoint_->on_writable());
+  ASSERT_NE(nullptr, cbs.server_session_);
+  cbs.server_session_->close(false);
+  ASSERT_EQ(nullptr, cbs.server_session_);
+
+  // Closing a blocked session flushes the queue without calling on_writable()
+  cbs.client_full_ = false;
+  ASSERT_NO_FATAL_FAILURE(connect(cbs));
+  ASSERT_EQ(kErrorOk, cbs.client_session_->set_tx_watermarks(4 * udp_mtu,
+                                                             udp_mtu));
+  cbs.client_full_ = true;
+  for (size_t i = 0; i < 4; i++)
+    ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, 100));
+  ASSERT_EQ(kErrorAgain, cbs.client_session_->send(buf, 100));
+  cbs.client_full_ = false;
+  const int writables = cbs.client_writables_;
+  const int recvs = cbs.client_recvs_;
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.client_session_);
+  ASSERT_EQ(writables, cbs.client_writables_);
+  ASSERT_EQ(recvs + 4, cbs.client_recvs_);
+  ASSERT_EQ(nullptr, cbs.server_session_);
+
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
+TEST_F(LodpTest, StageTimingTest) {
+  TestCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(establish(cbs));
+
+  uint8_t buf[100];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, sizeof(buf)));
+  ASSERT_EQ(1, cbs.client_recvs_);
+
+  LodpStageHistograms hist;
+  if (cbs.server_endpoint_->stage_histograms(hist)) {
+    auto count = [&hist](LodpStage stage) {
+      return hist[static_cast<size_t>(stage)].count();
+    };
+    ASSERT_EQ(1u, count(LodpStage::kHandshakeNtor));
+    ASSERT_EQ(1u, count(LodpStage::kRxCallback));
+    ASSERT_LT(0u, count(LodpStage::kRxDecrypt));
+    ASSERT_LT(0u, count(LodpStage::kTxEncrypt));
+    ASSERT_EQ(0u, count(LodpStage::kRekey));
+
+    cbs.server_endpoint_->reset_stage_histograms();
+    ASSERT_TRUE(cbs.server_endpoint_->stage_histograms(hist));
+    ASSERT_EQ(0u, count(LodpStage::kRxDecrypt));
+  } else {
+    // Instrumentation compiled out
+    for (const auto& h : hist)
+      ASSERT_EQ(0u, h.count());
+  }
+  ASSERT_STREQ("handshake_ntor", lodp_stage_name(LodpStage::kHandshakeNtor));
+
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.server_session_);
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
+TEST_F(LodpTest, StatsTest) {
+  TestCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(establish(cbs));
+
+  uint8_t buf[100];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, sizeof(buf)));
+  ASSERT_EQ(1, cbs.client_recvs_);
+
+  // Nothing is visible till the stats are published
+  LodpStatsSnapshot snap;
+  cbs.server_endpoint_->stats_snapshot(snap);
+  ASSERT_EQ(0u, snap.sessions_);
+
+  cbs.server_endpoint_->publish_stats();
+  ::std::thread monitor([&cbs, &snap]() {
+    cbs.server_endpoint_->stats_snapshot(snap);
+  });
+  monitor.join();
+  ASSERT_EQ(1u, snap.sessions_);
+  ASSERT_EQ(1u, snap.sessions_established_);
+  ASSERT_EQ(1u, snap.endpoint_.sessions_accepted_);
+  ASSERT_EQ(1u, snap.endpoint_.rx_packets_[packet::Envelope::INIT]);
+  ASSERT_EQ(1u, snap.endpoint_.rx_packets_[packet::Envelope::HANDSHAKE]);
+  ASSERT_EQ(1u, snap.endpoint_.rx_packets_[packet::Envelope::DATA]);
+  ASSERT_EQ(1u, snap.endpoint_.tx_packets_[packet::Envelope::DATA]);
+  ASSERT_EQ(1u, snap.endpoint_.tx_packets_[packet::Envelope::INIT_ACK]);
+  ASSERT_EQ(sizeof(buf), snap.session_.rx_goodput_bytes_);
+
+  // Closed sessions still count towards the totals
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.server_session_);
+  cbs.server_endpoint_->publish_stats();
+  cbs.server_endpoint_->stats_snapshot(snap);
+  ASSERT_EQ(0u, snap.sessions_);
+  ASSERT_EQ(1u, snap.endpoint_.sessions_closed_);
+  ASSERT_EQ(1u, snap.endpoint_.rx_packets_[packet::Envelope::SHUTDOWN]);
+  ASSERT_EQ(sizeof(buf), snap.session_.rx_goodput_bytes_);
+
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
+TEST_F(LodpTest, FlightRecorderTest) {
+  TestCallbacks cbs;
+
+  // The client logs addresses, the server is "safe"
+  ASSERT_NO_FATAL_FAILURE(create_endpoints(cbs, true));
+  ASSERT_EQ(nullptr, cbs.server_endpoint_->flight_recorder());
+  cbs.client_endpoint_->set_flight_recorder(64);
+  cbs.server_endpoint_->set_flight_recorder(64);
+  ASSERT_NE(nullptr, cbs.server_endpoint_->flight_recorder());
+  ASSERT_NO_FATAL_FAILURE(connect(cbs));
+
+  uint8_t buf[100];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, sizeof(buf)));
+  ASSERT_EQ(1, cbs.client_recvs_);
+
+  // Garbage fails to decrypt, which does not fire the dump on error trigger
+  cbs.server_endpoint_->flight_recorder()->arm(STDERR_FILENO);
+  ::std::memset(buf, 0xa5, sizeof(buf));
+  ASSERT_EQ(kErrorDecryptionFailure,
+            cbs.server_endpoint_->on_packet(buf, sizeof(buf),
+                                            reinterpret_cast<sockaddr*>(&client_addr_),
+                                            sizeof(client_addr_)));
+  ASSERT_TRUE(cbs.server_endpoint_->flight_recorder()->armed());
+  cbs.server_endpoint_->flight_recorder()->arm(-1);
+
+  // The client side has addresses
+  ::std::vector<FlightRecorder::Record> records;
+  cbs.client_endpoint_->flight_recorder()->snapshot(records);
+  ASSERT_FALSE(records.empty());
+  const auto& create = records.front();
+  ASSERT_EQ(static_cast<uint16_t>(LodpEvent::kSessionCreate), create.event_);
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(cbs.client_session_),
+            create.session_);
+  ASSERT_EQ(1u, create.args_[0]);
+  ASSERT_EQ(FlightRecorder::kAddrIPv4, create.addr_type_);
+  ASSERT_EQ(2323, create.port_);
+  ASSERT_EQ(0, ::std::memcmp(&server_addr_.sin_addr, create.addr_, 4));
+
+  // The server side only has hashes
+  cbs.server_endpoint_->flight_recorder()->snapshot(records);
+  ASSERT_FALSE(records.empty());
+  size_t creates = 0, decrypt_fails = 0, sends = 0;
+  for (const auto& r : records) {
+    if (r.addr_type_ != FlightRecorder::kAddrNone) {
+      ASSERT_EQ(FlightRecorder::kAddrHash, r.addr_type_);
+    }
+    switch (static_cast<LodpEvent>(r.event_)) {
+    case LodpEvent::kSessionCreate:
+      ASSERT_EQ(0u, r.args_[0]);
+      creates++;
+      break;
+    case LodpEvent::kDecryptFail:
+      ASSERT_EQ(sizeof(buf), r.args_[0]);
+      decrypt_fails++;
+      break;
+    case LodpEvent::kSendto:
+      sends++;
+      break;
+    case LodpEvent::kError:
+      FAIL();
+    default:
+      break;
+    }
+  }
+  ASSERT_EQ(1u, creates);
+  ASSERT_EQ(1u, decrypt_fails);
+  ASSERT_LT(0u, sends);
+  ASSERT_EQ(static_cast<uint16_t>(LodpEvent::kDecryptFail),
+            records.back().event_);
+
+  ::std::string text;
+  FlightRecorder::render(records, LatencyHistogram::now(), lodp_event_name,
+                         text);
+  ASSERT_NE(::std::string::npos, text.find(" session_create "));
+  ASSERT_EQ(::std::string::npos, text.find("127.0.0.1"));
+
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.server_session_);
+  cbs.server_endpoint_->set_flight_recorder(0);
+  ASSERT_EQ(nullptr, cbs.server_endpoint_->flight_recorder());
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
+TEST_F(LodpTest, PacketTraceTest) {
+  TestCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(create_endpoints(cbs, true));
+
+  char path[] = "/tmp/lodp_trace_XXXXXX";
+  const int fd = ::mkstemp(path);
+  ASSERT_LE(0, fd);
+  PacketTrace* trace = new PacketTrace(fd);
+  ASSERT_EQ(nullptr, cbs.server_endpoint_->packet_trace());
+  cbs.server_endpoint_->set_packet_trace(trace);
+  ASSERT_EQ(trace, cbs.server_endpoint_->packet_trace());
+
+  // INIT, HANDSHAKE, DATA and garbage
+  ASSERT_NO_FATAL_FAILURE(connect(cbs));
+  uint8_t buf[100];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, sizeof(buf)));
+  // (TestCallbacks passes the destination as the source address)
+  ::std::memset(buf, 0xa5, sizeof(buf));
+  ASSERT_EQ(kErrorDecryptionFailure,
+            cbs.server_endpoint_->on_packet(buf, sizeof(buf),
+                                            reinterpret_cast<sockaddr*>(&server_addr_),
+                                            sizeof(server_addr_)));
+
+  cbs.server_endpoint_->set_packet_trace(nullptr);
+  const uint64_t recorded = trace->recorded();
+  ASSERT_EQ(0u, trace->dropped());
+  delete trace;
+  ::close(fd);
+
+  PacketTraceReader reader;
+  ASSERT_EQ(kErrorOk, reader.open(path));
+  ::unlink(path);
+  const PacketTrace::Record* r;
+  const uint8_t* pkt;
+  uint64_t n = 0, rx = 0, tx = 0, prev_ts = 0, hash = 0;
+  while (reader.next(r, pkt)) {
+    // Every packet is to/from the client
+    if (n++ == 0)
+      hash = r->addr_hash_;
+    ASSERT_EQ(hash, r->addr_hash_);
+    ASSERT_EQ(4, r->family_);
+    ASSERT_LE(prev_ts, r->timestamp_);
+    prev_ts = r->timestamp_;
+    if (r->direction_ == PacketTrace::kDirRx)
+      rx++;
+    else
+      tx++;
+  }
+  ASSERT_FALSE(reader.truncated());
+  ASSERT_EQ(recorded, n);
+  ASSERT_EQ(4u, rx);
+  ASSERT_LE(3u, tx);
+
+  // The last packet is the garbage
+  ASSERT_EQ(PacketTrace::kDirRx, r->direction_);
+  ASSERT_EQ(sizeof(buf), r->length_);
+  ASSERT_EQ(0, ::std::memcmp(buf, pkt, sizeof(buf)));
+
+  cbs.client_session_->close();
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
+// Hand a established session off to a new responder
+TEST_F(LodpTest, HotRestartTest) {
+  TestCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(establish(cbs));
+  uint8_t buf[100];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, sizeof(buf)));
+  ASSERT_EQ(1, cbs.client_recvs_);
+
+  // Only responders have state worth exporting
+  ::std::string state;
+  ASSERT_EQ(kErrorNotResponder, cbs.client_endpoint_->export_state(state));
+  ASSERT_EQ(kErrorOk, cbs.server_endpoint_->export_state(state));
+
+  // Tear down the old responder without telling the client
+  cbs.server_session_->close(false);
+  ASSERT_EQ(nullptr, cbs.server_session_);
+  delete cbs.server_endpoint_;
+
+  // A responder with a different identity can't use the state
+  crypto::Curve25519::PrivateKey other_priv_key(rng_);
+  cbs.server_endpoint_ = new LodpEndpoint(rng_, cbs, nullptr, false,
+                                          other_priv_key, kNodeId,
+                                          sizeof(kNodeId));
+  ASSERT_EQ(kErrorInval, cbs.server_endpoint_->import_state(state.data(),
+                                                            state.size()));
+  ASSERT_EQ(nullptr, cbs.server_session_);
+  delete cbs.server_endpoint_;
+
+  // The new responder picks up where the old one left off
+  cbs.server_endpoint_ = new LodpEndpoint(rng_, cbs, nullptr, false,
+                                          server_priv_key_, kNodeId,
+                                          sizeof(kNodeId));
+  ::std::string corrupt(state);
+  corrupt[corrupt.size() - 1] ^= 0x01;
+  ASSERT_EQ(kErrorInval, cbs.server_endpoint_->import_state(corrupt.data(),
+                                                            corrupt.size()));
+  ASSERT_EQ(kErrorOk, cbs.server_endpoint_->import_state(state.data(),
+                                                         state.size()));
+  ASSERT_NE(nullptr, cbs.server_session_);
+  ASSERT_TRUE(cbs.server_session_->is_established());
+  ASSERT_EQ(kErrorIsConn, cbs.server_endpoint_->import_state(state.data(),
+                                                             state.size()));
+
+  // Data flows in both directions without a new handshake
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, sizeof(buf)));
+  ASSERT_EQ(2, cbs.client_recvs_);
+  ASSERT_EQ(0u, cbs.server_endpoint_->stats().sessions_accepted_);
+
+  // The identity key is all that is needed to rekey
+  ASSERT_EQ(kErrorOk, cbs.client_session_->rekey());
+  ASSERT_TRUE(cbs.client_session_->is_established());
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, sizeof(buf)));
+  ASSERT_EQ(3, cbs.client_recvs_);
+
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.server_session_);
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
+// Replay a INIT to a restarted responder with file backed replay filters
+TEST_F(LodpTest, ReplayFilterTest) {
+  TestCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(create_endpoints(cbs));
+
+  char init_path[] = "/tmp/lodp_init_filter_XXXXXX";
+  char cookie_path[] = "/tmp/lodp_cookie_filter_XXXXXX";
+  ::close(::mkstemp(init_path));
+  ::close(::mkstemp(cookie_path));
+  ASSERT_EQ(kErrorNotResponder,
+            cbs.client_endpoint_->map_replay_filters(init_path, cookie_path));
+  ASSERT_EQ(kErrorBadFD,
+            cbs.server_endpoint_->map_replay_filters("/nonexistent/init",
+                                                     cookie_path));
+  ASSERT_EQ(kErrorOk,
+            cbs.server_endpoint_->map_replay_filters(init_path, cookie_path));
+
+  // Capture the INIT
+  char trace_path[] = "/tmp/lodp_trace_XXXXXX";
+  const int fd = ::mkstemp(trace_path);
+  ASSERT_LE(0, fd);
+  PacketTrace* trace = new PacketTrace(fd);
+  cbs.server_endpoint_->set_packet_trace(trace);
+  ASSERT_NO_FATAL_FAILURE(connect(cbs));
+  cbs.server_endpoint_->set_packet_trace(nullptr);
+  delete trace;
+  ::close(fd);
+
+  cbs.client_session_->close();
+  cbs.server_endpoint_->sync_replay_filters();
+  delete cbs.server_endpoint_;
+
+  // The restarted responder still remembers the INIT
+  cbs.server_endpoint_ = new LodpEndpoint(rng_, cbs, nullptr, false,
+                                          server_priv_key_, kNodeId,
+                                          sizeof(kNodeId));
+  ASSERT_EQ(kErrorOk,
+            cbs.server_endpoint_->map_replay_filters(init_path, cookie_path));
+  PacketTraceReader reader;
+  ASSERT_EQ(kErrorOk, reader.open(trace_path));
+  const PacketTrace::Record* r;
+  const uint8_t* pkt;
+  ASSERT_TRUE(reader.next(r, pkt));
+  ASSERT_EQ(PacketTrace::kDirRx, r->direction_);
+  ASSERT_EQ(kErrorInitReplayed,
+            cbs.server_endpoint_->on_packet(pkt, r->length_,
+                                            reinterpret_cast<sockaddr*>(&server_addr_),
+                                            sizeof(server_addr_)));
+  ASSERT_EQ(1u, cbs.server_endpoint_->stats().rx_init_replays_);
+  reader.close();
+
+  ::unlink(trace_path);
+  ::unlink(init_path);
+  ::unlink(cookie_path);
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
+// A non-virtual callback class that implements the same loopback/echo server
+// as TestCallbacks, for use with BasicLodpEndpoint
+class PolicyCallbacks : public BasicLodpCallbacks<PolicyCallbacks> {
+ public:
+  typedef BasicLodpEndpoint<PolicyCallbacks> Endpoint;
+  typedef Endpoint::Session Session;
+
+  PolicyCallbacks() :
+      client_endpoint_(nullptr),
+      server_endpoint_(nullptr),
+      client_session_(nullptr),
+      server_session_(nullptr),
+      client_recvs_(0) {}
+
+  int sendto(Endpoint& endpoint,
+             const void* buf,
+             const size_t buf_len,
+             const struct sockaddr* addr,
+             const socklen_t addr_len) {
+    Endpoint* dst = (&endpoint == client_endpoint_) ? server_endpoint_ :
+        client_endpoint_;
+    int ret = dst->on_packet(reinterpret_cast<const uint8_t*>(buf), buf_len,
+                             addr, addr_len);
+    EXPECT_EQ(kErrorOk, ret);
+    return ret;
+  }
+
+  size_t pad_size(const Session& session,
+                  const size_t available) {
+    return available;
+  }
+
+  bool should_accept(const Endpoint& endpoint,
+                     const struct sockaddr* addr,
+                     const socklen_t addr_len) {
+    EXPECT_EQ(server_endpoint_, &endpoint);
+    return server_session_ == nullptr;
+  }
+
+  void on_accept(Endpoint& endpoint,
+                 Session* session,
+                 const struct sockaddr* addr,
+                 const socklen_t addr_len) {
+    server_session_ = session;
+  }
+
+  void on_connect(Session& session,
+                  const int status) {
+    EXPECT_EQ(client_session_, &session);
+    EXPECT_EQ(kErrorOk, status);
+  }
+
+  void on_recv(Session& session,
+               const void* buf,
+               const size_t buf_len) {
+    const uint8_t* ptr = static_cast<const uint8_t*>(buf);
+    for (size_t i = 0; i < buf_len; i++)
+      ASSERT_TRUE(ptr[i] == static_cast<uint8_t>(i));
+
+    if (&session == server_session_) {
+      int ret = server_session_->send_message(buf, buf_len);
+      ASSERT_EQ(kErrorOk, ret);
+    } else
+      client_recvs_++;
+  }
+
+  void on_rekey_needed(Session& session) {}
+
+  void on_rekey(Session& session,
+                const int status) {
+    EXPECT_EQ(kErrorOk, status);
+  }
+
+  void on_close(const Session& session) {
+    if (&session == client_session_)
+      client_session_ = nullptr;
+    else if (&session == server_session_)
+      server_session_ = nullptr;
+    else
+      FAIL(); // WTF session is this?
+  }
+
+  Endpoint* client_endpoint_;
+  Endpoint* server_endpoint_;
+  Session* client_session_;
+  Session* server_session_;
+  int client_recvs_;
+};
+
+// Exercise BasicLodpEndpoint with a non-virtual callback class
+TEST_F(LodpTest, PolicyTest) {
+  PolicyCallbacks cbs;
+  ASSERT_NO_FATAL_FAILURE(establish(cbs));
+  int ret;
+
+  uint8_t buf[4096];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+
+  for (size_t sz = 0; sz < cbs.client_session_->mtu(); sz += 100) {
+    ret = cbs.client_session_->send(buf, sz);
+    ASSERT_EQ(kErrorOk, ret);
+  }
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send_message(buf, sizeof(buf)));
+
+  // The burst goes out via the BasicLodpCallbacks::sendto_gso() default
+  struct iovec iov[4];
+  for (size_t i = 0; i < 4; i++) {
+    iov[i].iov_base = buf;
+    iov[i].iov_len = 100 + i;
+  }
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send_burst(iov, 4));
+
+  ASSERT_EQ(kErrorOk, cbs.client_session_->rekey());
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, 100));
+
+  const int nr_sends = (cbs.client_session_->mtu() + 99) / 100 + 6;
+  ASSERT_EQ(nr_sends, cbs.client_recvs_);
+  ASSERT_EQ(cbs.client_session_->stats().tx_goodput_bytes_,
+            cbs.client_session_->stats().rx_goodput_bytes_);
+
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.client_session_);
+  ASSERT_EQ(nullptr, cbs.server_session_);
+
+  delete cbs.server_endpoint_;
+  delete cbs.client_endpoint_;
+}
+
 } // namespace lodp
 } // namespace schwanenlied
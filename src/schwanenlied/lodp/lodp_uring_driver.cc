@@ -0,0 +1,795 @@
+/**
+ * @file    lodp_uring_driver.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   LODP io_uring UDP driver (IMPLEMENTATION)
+ */
+
+/*
+ * Copyright (c) 2014, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "schwanenlied/lodp/lodp_uring_driver.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+/*
+ * liburing is not a dependency, so talk to the kernel directly.  The only
+ * subtle part of this is getting the memory ordering on the ring indexes
+ * right, which is handled by the following helpers.
+ */
+
+static inline int sys_io_uring_setup(const unsigned entries,
+                                     struct io_uring_params* p) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+static inline int sys_io_uring_enter(const int fd,
+                                     const unsigned to_submit,
+                                     const unsigned min_complete,
+                                     const unsigned flags) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, nullptr, 0));
+}
+
+static inline int sys_io_uring_register(const int fd,
+                                        const unsigned opcode,
+                                        void* arg,
+                                        const unsigned nr_args) {
+  return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg,
+                                    nr_args));
+}
+
+template<typename T>
+static inline T load_acquire(const T* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template<typename T>
+static inline void store_release(T* p, const T v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+/*
+ * The user_data of each request is tagged with the request type in the low
+ * bits.  Everything that gets a pointer stored in user_data is at least 8 byte
+ * aligned.
+ */
+static const uint64_t kTagMask = 0x7;
+static const uint64_t kTagRecv = 0x1;
+static const uint64_t kTagSend = 0x2;
+static const uint64_t kTagTimeout = 0x3;
+static const uint64_t kTagTimeoutRemove = 0x4;
+
+struct LodpUringDriver::TimeoutOp {
+  Timer* timer_;                  /**< The owning Timer (nullptr if orphaned) */
+  struct __kernel_timespec ts_;   /**< The relative timeout */
+  bool in_flight_;                /**< Is the request owned by the kernel? */
+};
+
+LodpUringDriver::Timer::Timer(LodpUringDriver& driver,
+                              const ::std::function<void()> callback_fn) :
+    driver_(driver),
+    callback_fn_(callback_fn),
+    op_(nullptr) {
+  SL_ASSERT(callback_fn_);
+}
+
+LodpUringDriver::Timer::~Timer() {
+  stop();
+}
+
+bool LodpUringDriver::Timer::start(const ::std::chrono::microseconds& delta_t) {
+  // Stop the existing timer, if running
+  stop();
+
+  TimeoutOp* op = driver_.alloc_timeout_op();
+  op->timer_ = this;
+  op->ts_.tv_sec = delta_t.count() / 1000000;
+  op->ts_.tv_nsec = (delta_t.count() % 1000000) * 1000;
+  if (!driver_.queue_timeout(op)) {
+    op->timer_ = nullptr;
+    return false;
+  }
+  op_ = op;
+
+  return true;
+}
+
+void LodpUringDriver::Timer::stop() {
+  if (op_ == nullptr)
+    return;
+
+  /*
+   * The TimeoutOp is owned by the driver till the kernel posts the
+   * completion, so orphan it and ask the kernel to cancel the request.
+   */
+  op_->timer_ = nullptr;
+  driver_.queue_timeout_remove(op_);
+  op_ = nullptr;
+}
+
+const unsigned LodpUringDriver::kDefaultRingEntries;
+const unsigned LodpUringDriver::kDefaultNrRxBuffers;
+const unsigned LodpUringDriver::kDefaultNrTxBuffers;
+const size_t LodpUringDriver::kDefaultBufferSize;
+const size_t LodpUringDriver::kGroBufferSize;
+const uint16_t LodpUringDriver::kRxBufferGroup;
+const size_t LodpUringDriver::kMaxGsoLength;
+const size_t LodpUringDriver::kMaxGsoSegments;
+
+LodpUringDriver::LodpUringDriver(LodpEndpoint& endpoint,
+                                 const int fd,
+                                 const unsigned ring_entries,
+                                 const unsigned nr_rx_buffers,
+                                 const unsigned nr_tx_buffers,
+                                 const size_t buffer_size,
+                                 const bool use_gro) :
+    endpoint_(endpoint),
+    fd_(fd),
+    ring_entries_(ring_entries),
+    nr_rx_buffers_(nr_rx_buffers),
+    nr_tx_buffers_(nr_tx_buffers),
+    buffer_size_(buffer_size),
+    use_gro_(use_gro),
+    ring_fd_(-1),
+    sq_ring_ptr_(MAP_FAILED),
+    sq_ring_sz_(0),
+    cq_ring_ptr_(MAP_FAILED),
+    cq_ring_sz_(0),
+    sqes_(nullptr),
+    sqes_sz_(0),
+    sq_head_(nullptr),
+    sq_tail_(nullptr),
+    sq_mask_(nullptr),
+    sq_entries_(nullptr),
+    sq_array_(nullptr),
+    sqe_head_(0),
+    sqe_tail_(0),
+    cq_head_(nullptr),
+    cq_tail_(nullptr),
+    cq_mask_(nullptr),
+    cqes_(nullptr),
+    rx_ring_(nullptr),
+    rx_ring_sz_(0),
+    rx_stride_(0),
+    rx_msg_(),
+    recv_armed_(false),
+    tx_blocked_(false),
+    stats_() {
+  // Nothing to do
+}
+
+LodpUringDriver::~LodpUringDriver() {
+  teardown();
+}
+
+int LodpUringDriver::init() {
+  if (ring_fd_ != -1)
+    return kErrorInval;
+  if (fd_ < 0 || ring_entries_ == 0 || buffer_size_ == 0)
+    return kErrorInval;
+  if (nr_rx_buffers_ == 0 || nr_rx_buffers_ > 32768 ||
+      (nr_rx_buffers_ & (nr_rx_buffers_ - 1)) != 0)
+    return kErrorInval;
+  if (nr_tx_buffers_ == 0)
+    return kErrorInval;
+  if (use_gro_) {
+    if (buffer_size_ < kGroBufferSize)
+      return kErrorInval;
+    const int on = 1;
+    if (::setsockopt(fd_, SOL_UDP, UDP_GRO, &on, sizeof(on)) != 0)
+      return -errno;
+  }
+
+  // Create the ring
+  struct io_uring_params p;
+  ::std::memset(&p, 0, sizeof(p));
+  ring_fd_ = sys_io_uring_setup(ring_entries_, &p);
+  if (ring_fd_ < 0) {
+    int ret = -errno;
+    ring_fd_ = -1;
+    return ret;
+  }
+
+  // Map the SQ/CQ rings and the SQE array
+  sq_ring_sz_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_ring_sz_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cq_ring_sz_ > sq_ring_sz_)
+      sq_ring_sz_ = cq_ring_sz_;
+    cq_ring_sz_ = sq_ring_sz_;
+  }
+  sq_ring_ptr_ = ::mmap(nullptr, sq_ring_sz_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_,
+                        IORING_OFF_SQ_RING);
+  if (sq_ring_ptr_ == MAP_FAILED)
+    goto out_errno;
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    cq_ring_ptr_ = sq_ring_ptr_;
+  else {
+    cq_ring_ptr_ = ::mmap(nullptr, cq_ring_sz_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring_fd_,
+                          IORING_OFF_CQ_RING);
+    if (cq_ring_ptr_ == MAP_FAILED)
+      goto out_errno;
+  }
+  sqes_sz_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = static_cast<struct io_uring_sqe*>(::mmap(nullptr, sqes_sz_,
+                                                   PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE,
+                                                   ring_fd_,
+                                                   IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED) {
+    sqes_ = nullptr;
+    goto out_errno;
+  }
+
+  {
+    uint8_t* sq = static_cast<uint8_t*>(sq_ring_ptr_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_entries_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_entries);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sqe_head_ = sqe_tail_ = *sq_tail_;
+
+    uint8_t* cq = static_cast<uint8_t*>(cq_ring_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+  }
+
+  /*
+   * Setup the receive side.  Each provided buffer holds the
+   * io_uring_recvmsg_out header, the source address, and the payload, which
+   * is laid out by the kernel based off the rx_msg_ template.
+   */
+  rx_msg_.msg_namelen = sizeof(struct sockaddr_storage);
+  if (use_gro_)
+    rx_msg_.msg_controllen = CMSG_SPACE(sizeof(int));
+  rx_stride_ = sizeof(struct io_uring_recvmsg_out) + rx_msg_.msg_namelen +
+      rx_msg_.msg_controllen + buffer_size_;
+  rx_stride_ = (rx_stride_ + 63) & ~static_cast<size_t>(63);
+  rx_pool_.reset(new uint8_t[rx_stride_ * nr_rx_buffers_]);
+  rx_ring_sz_ = nr_rx_buffers_ * sizeof(struct io_uring_buf);
+  {
+    void* ptr = ::mmap(nullptr, rx_ring_sz_, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+      goto out_errno;
+    rx_ring_ = static_cast<struct io_uring_buf_ring*>(ptr);
+  }
+  {
+    struct io_uring_buf_reg reg;
+    ::std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(rx_ring_);
+    reg.ring_entries = nr_rx_buffers_;
+    reg.bgid = kRxBufferGroup;
+    if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg,
+                              1) < 0)
+      goto out_errno;
+  }
+  store_release(&rx_ring_->tail, static_cast<uint16_t>(0));
+  for (unsigned i = 0; i < nr_rx_buffers_; i++)
+    recycle_rx_buffer(static_cast<uint16_t>(i));
+
+  // Setup the transmit side
+  tx_pool_.resize(nr_tx_buffers_);
+  tx_free_.reserve(nr_tx_buffers_);
+  for (unsigned i = 0; i < nr_tx_buffers_; i++) {
+    TxBuffer& tx = tx_pool_[i];
+    tx.buf_.reset(new uint8_t[buffer_size_]);
+    tx.buf_sz_ = buffer_size_;
+    tx.nr_segments_ = 0;
+    ::std::memset(&tx.msg_, 0, sizeof(tx.msg_));
+    tx.msg_.msg_name = &tx.addr_;
+    tx.msg_.msg_iov = &tx.iov_;
+    tx.msg_.msg_iovlen = 1;
+    tx.iov_.iov_base = tx.buf_.get();
+    tx_free_.push_back(nr_tx_buffers_ - 1 - i);
+  }
+
+  if (!arm_recv()) {
+    teardown();
+    return kErrorAgain;
+  }
+
+  return flush();
+
+out_errno:
+  int ret = -errno;
+  teardown();
+  return ret;
+}
+
+int LodpUringDriver::sendto(const void* buf,
+                            const size_t buf_len,
+                            const struct sockaddr* addr,
+                            const socklen_t addr_len) {
+  if (buf == nullptr || addr == nullptr)
+    return kErrorInval;
+  if (addr_len > sizeof(struct sockaddr_storage))
+    return kErrorInval;
+  if (buf_len > buffer_size_)
+    return kErrorMsgSize;
+  if (ring_fd_ == -1)
+    return kErrorBadFD;
+
+  TxBuffer* tx = queue_send(buf, buf_len, addr, addr_len);
+  if (tx == nullptr)
+    return kErrorAgain;
+  tx->msg_.msg_control = nullptr;
+  tx->msg_.msg_controllen = 0;
+  tx->nr_segments_ = 1;
+
+  return kErrorOk;
+}
+
+int LodpUringDriver::sendto_gso(const void* buf,
+                                const size_t buf_len,
+                                const size_t segment_size,
+                                const struct sockaddr* addr,
+                                const socklen_t addr_len) {
+  if (buf == nullptr || addr == nullptr)
+    return kErrorInval;
+  if (addr_len > sizeof(struct sockaddr_storage))
+    return kErrorInval;
+  if (segment_size == 0 || segment_size > UINT16_MAX)
+    return kErrorInval;
+  if (buf_len <= segment_size)
+    return sendto(buf, buf_len, addr, addr_len);
+  if (buf_len > kMaxGsoLength ||
+      (buf_len + segment_size - 1) / segment_size > kMaxGsoSegments)
+    return kErrorMsgSize;
+  if (ring_fd_ == -1)
+    return kErrorBadFD;
+
+  TxBuffer* tx = queue_send(buf, buf_len, addr, addr_len);
+  if (tx == nullptr)
+    return kErrorAgain;
+
+  // Attach the UDP_SEGMENT control message
+  tx->msg_.msg_control = tx->cmsg_.buf_;
+  tx->msg_.msg_controllen = sizeof(tx->cmsg_.buf_);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&tx->msg_);
+  cmsg->cmsg_level = SOL_UDP;
+  cmsg->cmsg_type = UDP_SEGMENT;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  const uint16_t gso_size = static_cast<uint16_t>(segment_size);
+  ::std::memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+  tx->nr_segments_ = (buf_len + segment_size - 1) / segment_size;
+  stats_.tx_gso_packets_++;
+
+  return kErrorOk;
+}
+
+int LodpUringDriver::flush() {
+  if (ring_fd_ == -1)
+    return kErrorBadFD;
+
+  int ret = submit(0);
+  return ret < 0 ? ret : kErrorOk;
+}
+
+int LodpUringDriver::run_once(const ::std::chrono::microseconds& timeout) {
+  if (ring_fd_ == -1)
+    return kErrorBadFD;
+
+  /*
+   * Bound the wait with a IORING_OP_TIMEOUT that also completes as soon as
+   * any other request does, so that it never outlives this call by much.
+   */
+  unsigned wait_nr = 0;
+  if (timeout.count() > 0) {
+    TimeoutOp* op = alloc_timeout_op();
+    op->ts_.tv_sec = timeout.count() / 1000000;
+    op->ts_.tv_nsec = (timeout.count() % 1000000) * 1000;
+    if (queue_timeout(op)) {
+      sqes_[(sqe_tail_ - 1) & *sq_mask_].off = 1;
+      wait_nr = 1;
+    }
+  }
+
+  int ret = submit(wait_nr);
+  if (ret < 0)
+    return ret;
+
+  ret = reap_cqes();
+
+  // Retransmit the packets LodpSessions queued while the buffers were full
+  if (tx_blocked_ && !tx_free_.empty()) {
+    tx_blocked_ = false;
+    endpoint_.on_writable();
+  }
+
+  // Anything generated while processing packets goes out now
+  if (sqe_tail_ != sqe_head_) {
+    int sret = submit(0);
+    if (sret < 0)
+      return sret;
+  }
+
+  return ret;
+}
+
+LodpUringDriver::TxBuffer* LodpUringDriver::queue_send(const void* buf,
+                                                       const size_t buf_len,
+                                                       const struct sockaddr* addr,
+                                                       const socklen_t addr_len) {
+  if (tx_free_.empty()) {
+    stats_.tx_no_buffers_++;
+    tx_blocked_ = true;
+    return nullptr;
+  }
+  struct io_uring_sqe* sqe = get_sqe();
+  if (sqe == nullptr) {
+    stats_.tx_no_buffers_++;
+    tx_blocked_ = true;
+    return nullptr;
+  }
+
+  const uint32_t idx = tx_free_.back();
+  tx_free_.pop_back();
+  TxBuffer& tx = tx_pool_[idx];
+  if (buf_len > tx.buf_sz_) {
+    // GSO bursts are bigger than the normal buffers, grow the buffer
+    tx.buf_.reset(new uint8_t[buf_len]);
+    tx.buf_sz_ = buf_len;
+    tx.iov_.iov_base = tx.buf_.get();
+  }
+  ::std::memcpy(tx.buf_.get(), buf, buf_len);
+  ::std::memcpy(&tx.addr_, addr, addr_len);
+  tx.msg_.msg_namelen = addr_len;
+  tx.iov_.iov_len = buf_len;
+
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd_;
+  sqe->addr = reinterpret_cast<uint64_t>(&tx.msg_);
+  sqe->len = 1;
+  sqe->user_data = (static_cast<uint64_t>(idx) << 3) | kTagSend;
+
+  return &tx;
+}
+
+struct io_uring_sqe* LodpUringDriver::get_sqe() {
+  if (ring_fd_ == -1)
+    return nullptr;
+  if (sqe_tail_ - load_acquire(sq_head_) >= *sq_entries_) {
+    // The SQ is full, push what's there to the kernel and try again
+    if (submit(0) < 0)
+      return nullptr;
+    if (sqe_tail_ - load_acquire(sq_head_) >= *sq_entries_)
+      return nullptr;
+  }
+
+  struct io_uring_sqe* sqe = &sqes_[sqe_tail_ & *sq_mask_];
+  sqe_tail_++;
+  ::std::memset(sqe, 0, sizeof(*sqe));
+
+  return sqe;
+}
+
+unsigned LodpUringDriver::flush_sq() {
+  const unsigned to_submit = sqe_tail_ - sqe_head_;
+  if (to_submit == 0)
+    return 0;
+
+  unsigned tail = *sq_tail_;
+  while (sqe_head_ != sqe_tail_) {
+    sq_array_[tail & *sq_mask_] = sqe_head_ & *sq_mask_;
+    tail++;
+    sqe_head_++;
+  }
+  store_release(sq_tail_, tail);
+
+  return to_submit;
+}
+
+int LodpUringDriver::submit(const unsigned wait_nr) {
+  const unsigned to_submit = flush_sq();
+  if (to_submit == 0 && wait_nr == 0)
+    return 0;
+
+  const unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  for (;;) {
+    stats_.submits_++;
+    int ret = sys_io_uring_enter(ring_fd_, to_submit, wait_nr, flags);
+    if (ret >= 0)
+      return ret;
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EBUSY) {
+      // The CQ is backed up, the next run_once() will drain it
+      return 0;
+    }
+    return -errno;
+  }
+}
+
+bool LodpUringDriver::arm_recv() {
+  struct io_uring_sqe* sqe = get_sqe();
+  if (sqe == nullptr)
+    return false;
+
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = fd_;
+  sqe->addr = reinterpret_cast<uint64_t>(&rx_msg_);
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kRxBufferGroup;
+  sqe->user_data = kTagRecv;
+  recv_armed_ = true;
+
+  return true;
+}
+
+void LodpUringDriver::recycle_rx_buffer(const uint16_t bid) {
+  /*
+   * The kernel header declares bufs with __DECLARE_FLEX_ARRAY, which under a
+   * C++ compiler ends up offset by the size of a empty struct, so index the
+   * ring as a plain array (The ring header aliases the first entry).
+   */
+  const uint16_t tail = rx_ring_->tail;
+  struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(rx_ring_) +
+      (tail & (nr_rx_buffers_ - 1));
+  buf->addr = reinterpret_cast<uint64_t>(rx_pool_.get() + bid * rx_stride_);
+  buf->len = static_cast<uint32_t>(rx_stride_);
+  buf->bid = bid;
+  store_release(&rx_ring_->tail, static_cast<uint16_t>(tail + 1));
+}
+
+LodpUringDriver::TimeoutOp* LodpUringDriver::alloc_timeout_op() {
+  /*
+   * TimeoutOps are only recycled once the kernel posts their completion, so
+   * a stale IORING_OP_TIMEOUT_REMOVE can never match a request that reuses
+   * the op (It is submitted before the new request).
+   */
+  if (timeout_free_.empty()) {
+    TimeoutOp* op = new TimeoutOp;
+    op->in_flight_ = false;
+    timeout_ops_.push_back(::std::unique_ptr<TimeoutOp>(op));
+    timeout_free_.push_back(op);
+  }
+
+  TimeoutOp* op = timeout_free_.back();
+  SL_ASSERT(!op->in_flight_);
+  op->timer_ = nullptr;
+  return op;
+}
+
+bool LodpUringDriver::queue_timeout(TimeoutOp* op) {
+  struct io_uring_sqe* sqe = get_sqe();
+  if (sqe == nullptr)
+    return false;
+
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<uint64_t>(&op->ts_);
+  sqe->len = 1;
+  sqe->user_data = reinterpret_cast<uint64_t>(op) | kTagTimeout;
+  SL_ASSERT(timeout_free_.back() == op);
+  timeout_free_.pop_back();
+  op->in_flight_ = true;
+
+  return true;
+}
+
+void LodpUringDriver::queue_timeout_remove(TimeoutOp* op) {
+  struct io_uring_sqe* sqe = get_sqe();
+  if (sqe == nullptr) {
+    /*
+     * No way to cancel the request right now.  The TimeoutOp is already
+     * orphaned so the completion will be silently discarded when it happens.
+     */
+    return;
+  }
+
+  sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<uint64_t>(op) | kTagTimeout;
+  sqe->user_data = kTagTimeoutRemove;
+}
+
+int LodpUringDriver::reap_cqes() {
+  int nr_cqes = 0;
+  unsigned head = *cq_head_;
+
+  for (;;) {
+    const unsigned tail = load_acquire(cq_tail_);
+    if (head == tail)
+      break;
+
+    /*
+     * Copy the CQE and release the slot before processing it, since the
+     * handlers can end up submitting new requests.
+     */
+    const struct io_uring_cqe cqe = cqes_[head & *cq_mask_];
+    head++;
+    store_release(cq_head_, head);
+    nr_cqes++;
+
+    switch (cqe.user_data & kTagMask) {
+    case kTagRecv:
+      on_recv_cqe(&cqe);
+      break;
+    case kTagSend:
+      on_send_cqe(&cqe);
+      break;
+    case kTagTimeout:
+      on_timeout_cqe(&cqe);
+      break;
+    case kTagTimeoutRemove:
+      // Nothing to do, the TimeoutOp gets cleaned up on it's own completion
+      break;
+    default:
+      SL_ABORT("Unknown io_uring completion");
+    }
+  }
+
+  // If the multishot receive got terminated, rearm it
+  if (!recv_armed_)
+    arm_recv();
+
+  return nr_cqes;
+}
+
+void LodpUringDriver::on_recv_cqe(const struct io_uring_cqe* cqe) {
+  if (!(cqe->flags & IORING_CQE_F_MORE))
+    recv_armed_ = false;
+
+  if (cqe->res < 0) {
+    if (cqe->res == -ENOBUFS)
+      stats_.rx_no_buffers_++;
+    return;
+  }
+  if (!(cqe->flags & IORING_CQE_F_BUFFER))
+    return;
+
+  const uint16_t bid = static_cast<uint16_t>(cqe->flags >>
+                                             IORING_CQE_BUFFER_SHIFT);
+  uint8_t* buf = rx_pool_.get() + bid * rx_stride_;
+  const struct io_uring_recvmsg_out* out = reinterpret_cast<const struct
+      io_uring_recvmsg_out*>(buf);
+  const uint8_t* name = buf + sizeof(*out);
+  const uint8_t* payload = name + rx_msg_.msg_namelen + rx_msg_.msg_controllen;
+
+  if (out->flags & MSG_TRUNC) {
+    stats_.rx_truncated_++;
+  } else if (out->namelen <= rx_msg_.msg_namelen) {
+    const struct sockaddr* addr = reinterpret_cast<const struct
+        sockaddr*>(name);
+
+    // Look for the UDP_GRO segment size, if the datagrams were coalesced
+    size_t segment_size = 0;
+    if (use_gro_ && out->controllen > 0) {
+      struct msghdr msg;
+      ::std::memset(&msg, 0, sizeof(msg));
+      msg.msg_control = const_cast<uint8_t*>(name + rx_msg_.msg_namelen);
+      msg.msg_controllen = out->controllen;
+      for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+           cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+          int gso_size;
+          ::std::memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+          if (gso_size > 0)
+            segment_size = static_cast<size_t>(gso_size);
+          break;
+        }
+      }
+    }
+
+    if (segment_size > 0 && out->payloadlen > segment_size) {
+      stats_.rx_gro_packets_++;
+      stats_.rx_packets_ += (out->payloadlen + segment_size - 1) /
+          segment_size;
+      endpoint_.on_packets(payload, out->payloadlen, segment_size, addr,
+                           out->namelen);
+    } else {
+      stats_.rx_packets_++;
+      endpoint_.on_packet(payload, out->payloadlen, addr, out->namelen);
+    }
+  }
+
+  recycle_rx_buffer(bid);
+}
+
+void LodpUringDriver::on_send_cqe(const struct io_uring_cqe* cqe) {
+  const uint32_t idx = static_cast<uint32_t>(cqe->user_data >> 3);
+  SL_ASSERT(idx < tx_pool_.size());
+
+  if (cqe->res < 0)
+    stats_.tx_failed_ += tx_pool_[idx].nr_segments_;
+  else
+    stats_.tx_packets_ += tx_pool_[idx].nr_segments_;
+
+  tx_free_.push_back(idx);
+}
+
+void LodpUringDriver::on_timeout_cqe(const struct io_uring_cqe* cqe) {
+  TimeoutOp* op = reinterpret_cast<TimeoutOp*>(cqe->user_data & ~kTagMask);
+  SL_ASSERT(op->in_flight_);
+  op->in_flight_ = false;
+  timeout_free_.push_back(op);
+
+  Timer* timer = op->timer_;
+  op->timer_ = nullptr;
+
+  // Only expirations fire the timer, cancelations are silently discarded
+  if (timer != nullptr && cqe->res == -ETIME) {
+    timer->op_ = nullptr;
+    timer->fire();
+  }
+}
+
+void LodpUringDriver::teardown() {
+  // Closing the ring cancels all outstanding requests
+  if (ring_fd_ != -1) {
+    ::close(ring_fd_);
+    ring_fd_ = -1;
+  }
+
+  for (auto& op : timeout_ops_) {
+    if (op->timer_ != nullptr)
+      op->timer_->op_ = nullptr;
+  }
+  timeout_ops_.clear();
+  timeout_free_.clear();
+
+  if (rx_ring_ != nullptr) {
+    ::munmap(rx_ring_, rx_ring_sz_);
+    rx_ring_ = nullptr;
+  }
+  if (sqes_ != nullptr) {
+    ::munmap(sqes_, sqes_sz_);
+    sqes_ = nullptr;
+  }
+  if (cq_ring_ptr_ != MAP_FAILED && cq_ring_ptr_ != sq_ring_ptr_)
+    ::munmap(cq_ring_ptr_, cq_ring_sz_);
+  cq_ring_ptr_ = MAP_FAILED;
+  if (sq_ring_ptr_ != MAP_FAILED)
+    ::munmap(sq_ring_ptr_, sq_ring_sz_);
+  sq_ring_ptr_ = MAP_FAILED;
+
+  rx_pool_.reset();
+  tx_pool_.clear();
+  tx_free_.clear();
+  recv_armed_ = false;
+}
+
+} // namespace lodp
+} // namespace schwanenlied
@@ -0,0 +1,430 @@
+/**
+ * @file    lodp_uring_driver.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   LODP io_uring UDP driver
+ */
+
+/*
+ * Copyright (c) 2014, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_LODP_LODP_URING_DRIVER_H__
+#define SCHWANENLIED_LODP_LODP_URING_DRIVER_H__
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/lodp/lodp_endpoint.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+/**
+ * The LODP io_uring UDP driver
+ *
+ * This is an optional alternative to driving a LodpEndpoint from a generic
+ * event loop, for Linux systems with a sufficiently recent kernel (6.0 or
+ * later).  Instead of a syscall per packet, a single multishot recvmsg request
+ * is kept armed on the socket with a registered ring of provided buffers so
+ * incoming datagrams land directly in the driver's buffer pool, and outbound
+ * datagrams are queued as sendmsg requests that get submitted in one batch per
+ * event loop iteration.
+ *
+ * The driver owns none of the LODP state.  It is expected that the
+ * application's LodpCallbacks::sendto() implementation calls sendto() on the
+ * driver associated with the LodpEndpoint, and that the application calls
+ * run_once() in a loop (or flush() if it generated traffic outside of
+ * run_once()).
+ *
+ * When the transmit buffers run out, sendto() returns kErrorAgain and the
+ * LodpSession queues the packet.  run_once() calls LodpEndpoint::on_writable()
+ * once completed sends free up buffers again.
+ *
+ * UDP Generic Segmentation Offload is supported via sendto_gso() (For use with
+ * LodpCallbacks::sendto_gso()), and Generic Receive Offload can be enabled at
+ * construction time, in which case coalesced datagrams are passed to
+ * LodpEndpoint::on_packets().
+ *
+ * Like the rest of the library, the driver is not thread safe.
+ */
+class LodpUringDriver {
+  /** A in flight IORING_OP_TIMEOUT request */
+  struct TimeoutOp;
+
+ public:
+  /** LodpUringDriver statistics */
+  struct Stats {
+    /** @{ */
+    uint64_t rx_packets_;     /**< Datagrams passed to the LodpEndpoint */
+    uint64_t rx_truncated_;   /**< Datagrams that did not fit in a buffer */
+    uint64_t rx_no_buffers_;  /**< Times the provided buffer ring ran dry */
+    uint64_t rx_gro_packets_; /**< Coalesced (UDP_GRO) receives */
+    /** @} */
+
+    /** @{ */
+    uint64_t tx_packets_;     /**< Datagrams successfully sent */
+    uint64_t tx_failed_;      /**< Datagrams the kernel failed to send */
+    uint64_t tx_no_buffers_;  /**< sendto() calls rejected due to no buffers */
+    uint64_t tx_gso_packets_; /**< Segmented (UDP_SEGMENT) sends */
+    /** @} */
+
+    /** @{ */
+    uint64_t submits_;        /**< io_uring_enter() calls */
+    /** @} */
+  };
+
+  /**
+   * io_uring backed timer
+   *
+   * This provides the same interface as schwanenlied::Timer, except that the
+   * timer is implemented as a IORING_OP_TIMEOUT request on the driver's ring,
+   * and will fire from within LodpUringDriver::run_once().
+   */
+  class Timer {
+   public:
+    /**
+     * Create a timer with a given callback function.
+     *
+     * @param[in] driver      The LodpUringDriver the timer is scheduled on
+     * @param[in] callback_fn The function to call when the timer expires
+     */
+    Timer(LodpUringDriver& driver,
+          const ::std::function<void()> callback_fn);
+
+    ~Timer();
+
+    /** @{ */
+    /** Return the status of the timer */
+    const bool is_active() const { return op_ != nullptr; }
+    /** @} */
+
+    /** @{ */
+    /**
+     * Start the timer
+     *
+     * @param[in] delta_t The timer duration
+     *
+     * @returns true - The timer was schedule successfully
+     * @returns false - The timer failed to be scheduled (Eg: The driver is
+     *                  not initialized)
+     */
+    bool start(const ::std::chrono::microseconds& delta_t);
+
+    /** Stop the timer */
+    void stop();
+    /** @} */
+
+    /** @{ */
+    /**
+     * Invoke the timer callback function
+     *
+     * @note This does not change the status of the timer (scheduled/stopped)
+     */
+    void fire() const {
+      callback_fn_();
+    }
+    /** @} */
+
+   private:
+    Timer() = delete;
+    Timer(const Timer&) = delete;
+    void operator=(const Timer&) = delete;
+
+    LodpUringDriver& driver_;                   /**< The driver */
+    const ::std::function<void()> callback_fn_; /**< The timer callback */
+    TimeoutOp* op_;  /**< The in flight IORING_OP_TIMEOUT (if any) */
+
+    /** The driver completes the timer's requests */
+    friend LodpUringDriver;
+  };
+
+  /** The default number of submission queue entries */
+  static const unsigned kDefaultRingEntries = 256;
+  /** The default number of receive buffers (Must be a power of 2) */
+  static const unsigned kDefaultNrRxBuffers = 256;
+  /** The default number of transmit buffers */
+  static const unsigned kDefaultNrTxBuffers = 256;
+  /** The default size of each receive/transmit buffer's payload area */
+  static const size_t kDefaultBufferSize = 2048;
+  /** The receive buffer size required to use UDP_GRO */
+  static const size_t kGroBufferSize = 65535;
+
+  /**
+   * Create a io_uring UDP driver for a given LodpEndpoint and socket
+   *
+   * No system resources are allocated until init() is called.
+   *
+   * @param[in] endpoint      The LodpEndpoint that incoming packets are fed to
+   * @param[in] fd            The non-blocking UDP socket to service
+   * @param[in] ring_entries  The number of submission queue entries
+   * @param[in] nr_rx_buffers The number of receive buffers (Power of 2)
+   * @param[in] nr_tx_buffers The number of transmit buffers
+   * @param[in] buffer_size   The size of each buffer's payload area
+   * @param[in] use_gro       Enable UDP_GRO on the socket (buffer_size must be
+   *                          at least kGroBufferSize)
+   */
+  LodpUringDriver(LodpEndpoint& endpoint,
+                  const int fd,
+                  const unsigned ring_entries = kDefaultRingEntries,
+                  const unsigned nr_rx_buffers = kDefaultNrRxBuffers,
+                  const unsigned nr_tx_buffers = kDefaultNrTxBuffers,
+                  const size_t buffer_size = kDefaultBufferSize,
+                  const bool use_gro = false);
+
+  ~LodpUringDriver();
+
+  /** @{ */
+  /**
+   * Create the io_uring instance, register the buffer ring and arm the
+   * multishot receive
+   *
+   * @returns kErrorOk    - Success
+   * @returns kErrorInval - The driver was already initialized, or was created
+   *                        with invalid parameters
+   * @returns (Negative errno) - Enabling UDP_GRO failed
+   * @returns (Negative errno) - The kernel does not support the required
+   *                             io_uring features
+   */
+  int init();
+
+  /** Get the current LodpUringDriver Stats */
+  const struct Stats& stats() const { return stats_; }
+  /** @} */
+
+  /** @{ */
+  /**
+   * Queue a datagram for transmission
+   *
+   * This is intended to be called from LodpCallbacks::sendto().  The datagram
+   * is copied into a transmit buffer immediately, and will be handed to the
+   * kernel on the next flush() (run_once() will flush automatically).
+   *
+   * @param[in] buf       The packet to send
+   * @param[in] buf_len   The length of the packet
+   * @param[in] addr      The destination address/port
+   * @param[in] addr_len  The length of the sockaddr
+   *
+   * @returns kErrorOk      - The datagram was queued
+   * @returns kErrorInval   - The parameters are invalid
+   * @returns kErrorMsgSize - The datagram is larger than the buffer size
+   * @returns kErrorAgain   - No transmit buffers/submission entries available
+   */
+  int sendto(const void* buf,
+             const size_t buf_len,
+             const struct sockaddr* addr,
+             const socklen_t addr_len);
+
+  /**
+   * Queue a burst of equally sized datagrams for transmission
+   *
+   * This is intended to be called from LodpCallbacks::sendto_gso().  The
+   * burst is queued as a single sendmsg request with a UDP_SEGMENT control
+   * message, and the kernel splits it into segment_size datagrams.  Transmit
+   * buffers grow on demand to hold bursts larger than the buffer size.
+   *
+   * @param[in] buf           The packets to send
+   * @param[in] buf_len       The total length of the packets
+   * @param[in] segment_size  The length of each packet (The last packet may
+   *                          be shorter)
+   * @param[in] addr          The destination address/port
+   * @param[in] addr_len      The length of the sockaddr
+   *
+   * @returns kErrorOk      - The burst was queued
+   * @returns kErrorInval   - The parameters are invalid
+   * @returns kErrorMsgSize - The burst is larger than kMaxGsoLength, or has
+   *                          too many segments
+   * @returns kErrorAgain   - No transmit buffers/submission entries available
+   */
+  int sendto_gso(const void* buf,
+                 const size_t buf_len,
+                 const size_t segment_size,
+                 const struct sockaddr* addr,
+                 const socklen_t addr_len);
+
+  /**
+   * Submit all queued requests to the kernel without waiting
+   *
+   * @returns kErrorOk - Success
+   * @returns (Negative errno) - io_uring_enter() failed
+   */
+  int flush();
+
+  /**
+   * Run one iteration of the event loop
+   *
+   * This submits all queued requests, waits up to timeout for at least one
+   * completion, and processes every completion available (Incoming packets
+   * are passed to LodpEndpoint::on_packet(), timers fire).  Any packets
+   * transmitted as a result are submitted before returning.
+   *
+   * @param[in] timeout The maximum amount of time to block (0 to poll)
+   *
+   * @returns The number of completions processed
+   * @returns (Negative errno) - io_uring_enter() failed
+   */
+  int run_once(const ::std::chrono::microseconds& timeout);
+  /** @} */
+
+ private:
+  LodpUringDriver() = delete;
+  LodpUringDriver(const LodpUringDriver&) = delete;
+  void operator=(const LodpUringDriver&) = delete;
+
+  /** The provided buffer group ID used for receive buffers */
+  static const uint16_t kRxBufferGroup = 0;
+  /** The maximum length of a single UDP_SEGMENT send */
+  static const size_t kMaxGsoLength = 65507;
+  /** The maximum number of segments in a single UDP_SEGMENT send */
+  static const size_t kMaxGsoSegments = 64;
+
+  /** A transmit buffer */
+  struct TxBuffer {
+    struct msghdr msg_;               /**< The sendmsg() header */
+    struct iovec iov_;                /**< The payload vector */
+    struct sockaddr_storage addr_;    /**< The destination */
+    ::std::unique_ptr<uint8_t[]> buf_;  /**< The payload */
+    size_t buf_sz_;                   /**< The size of the payload buffer */
+    size_t nr_segments_;              /**< The number of datagrams queued */
+    /** The UDP_SEGMENT control message */
+    union {
+      char buf_[CMSG_SPACE(sizeof(uint16_t))];
+      struct cmsghdr align_;
+    } cmsg_;
+  };
+
+  /**
+   * Obtain a transmit buffer and SQE, and queue a sendmsg request
+   *
+   * @returns nullptr - No transmit buffers/submission entries available
+   * @returns (A pointer to the TxBuffer, with the payload and destination
+   *           filled in)
+   */
+  TxBuffer* queue_send(const void* buf,
+                       const size_t buf_len,
+                       const struct sockaddr* addr,
+                       const socklen_t addr_len);
+
+  /** @{ */
+  /** Obtain a zeroed submission queue entry, flushing the SQ if full */
+  struct io_uring_sqe* get_sqe();
+  /** Make all obtained submission queue entries visible to the kernel */
+  unsigned flush_sq();
+  /** Invoke io_uring_enter() */
+  int submit(const unsigned wait_nr);
+  /** (Re)arm the multishot recvmsg request */
+  bool arm_recv();
+  /** Hand a receive buffer back to the kernel */
+  void recycle_rx_buffer(const uint16_t bid);
+  /** Obtain a TimeoutOp, reusing a completed one if possible */
+  TimeoutOp* alloc_timeout_op();
+  /** Queue a IORING_OP_TIMEOUT */
+  bool queue_timeout(TimeoutOp* op);
+  /** Queue a IORING_OP_TIMEOUT_REMOVE */
+  void queue_timeout_remove(TimeoutOp* op);
+  /** Process all available completions */
+  int reap_cqes();
+  /** Process a multishot recvmsg completion */
+  void on_recv_cqe(const struct io_uring_cqe* cqe);
+  /** Process a sendmsg completion */
+  void on_send_cqe(const struct io_uring_cqe* cqe);
+  /** Process a IORING_OP_TIMEOUT completion */
+  void on_timeout_cqe(const struct io_uring_cqe* cqe);
+  /** Release all system resources */
+  void teardown();
+  /** @} */
+
+  // Configuration
+  /** @{ */
+  LodpEndpoint& endpoint_;        /**< The LodpEndpoint fed by the driver */
+  const int fd_;                  /**< The UDP socket */
+  const unsigned ring_entries_;   /**< The requested SQ size */
+  const unsigned nr_rx_buffers_;  /**< The number of receive buffers */
+  const unsigned nr_tx_buffers_;  /**< The number of transmit buffers */
+  const size_t buffer_size_;      /**< The size of each payload area */
+  const bool use_gro_;            /**< Enable UDP_GRO? */
+  /** @} */
+
+  // io_uring state
+  /** @{ */
+  int ring_fd_;               /**< The io_uring file descriptor */
+  void* sq_ring_ptr_;         /**< The SQ ring mapping */
+  size_t sq_ring_sz_;         /**< The size of the SQ ring mapping */
+  void* cq_ring_ptr_;         /**< The CQ ring mapping (may alias the SQ) */
+  size_t cq_ring_sz_;         /**< The size of the CQ ring mapping */
+  struct io_uring_sqe* sqes_; /**< The SQE array mapping */
+  size_t sqes_sz_;            /**< The size of the SQE array mapping */
+  unsigned* sq_head_;         /**< The SQ head (kernel owned) */
+  unsigned* sq_tail_;         /**< The SQ tail (user owned) */
+  unsigned* sq_mask_;         /**< The SQ index mask */
+  unsigned* sq_entries_;      /**< The SQ size */
+  unsigned* sq_array_;        /**< The SQ index array */
+  unsigned sqe_head_;         /**< The first SQE not yet published */
+  unsigned sqe_tail_;         /**< The next free SQE */
+  unsigned* cq_head_;         /**< The CQ head (user owned) */
+  unsigned* cq_tail_;         /**< The CQ tail (kernel owned) */
+  unsigned* cq_mask_;         /**< The CQ index mask */
+  struct io_uring_cqe* cqes_; /**< The CQE array */
+  /** @} */
+
+  // Receive state
+  /** @{ */
+  struct io_uring_buf_ring* rx_ring_; /**< The provided buffer ring */
+  size_t rx_ring_sz_;                 /**< The size of the buffer ring */
+  ::std::unique_ptr<uint8_t[]> rx_pool_;  /**< The receive buffer pool */
+  size_t rx_stride_;                  /**< The size of each receive buffer */
+  struct msghdr rx_msg_;              /**< The multishot recvmsg template */
+  bool recv_armed_;                   /**< Is the multishot recvmsg armed? */
+  /** @} */
+
+  // Transmit state
+  /** @{ */
+  ::std::vector<TxBuffer> tx_pool_;     /**< The transmit buffer pool */
+  ::std::vector<uint32_t> tx_free_;     /**< Free transmit buffer indexes */
+  bool tx_blocked_;                     /**< Was a send rejected (kErrorAgain)? */
+  /** @} */
+
+  /** @{ */
+  /** Every TimeoutOp, owned by the driver */
+  ::std::vector<::std::unique_ptr<TimeoutOp>> timeout_ops_;
+  /** TimeoutOps that are not in flight, and can be reused */
+  ::std::vector<TimeoutOp*> timeout_free_;
+  /** @} */
+
+  /** @{ */
+  struct Stats stats_;  /**< Various LodpUringDriver statistics */
+  /** @} */
+};
+
+} // namespace lodp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_LODP_LODP_URING_DRIVER_H__
@@ -0,0 +1,385 @@
+/*
+ * lodp_uring_driver_test.cc: LODP io_uring driver test
+ *
+ * Copyright (c) 2014, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+
+#include "schwanenlied/lodp/lodp_endpoint.h"
+#include "schwanenlied/lodp/lodp_session.h"
+#include "schwanenlied/lodp/lodp_uring_driver.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+class LodpUringDriverTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    client_fd_ = open_socket(client_addr_);
+    server_fd_ = open_socket(server_addr_);
+  };
+  virtual void TearDown() {
+    if (client_fd_ != -1)
+      ::close(client_fd_);
+    if (server_fd_ != -1)
+      ::close(server_fd_);
+  };
+
+  static int open_socket(struct sockaddr_in& addr) {
+    int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+      return -1;
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    ::std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    socklen_t addr_len = sizeof(addr);
+    if (::bind(fd, reinterpret_cast<struct sockaddr*>(&addr),
+               sizeof(addr)) != 0 ||
+        ::getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                      &addr_len) != 0) {
+      ::close(fd);
+      return -1;
+    }
+
+    return fd;
+  }
+
+  int client_fd_;
+  int server_fd_;
+  struct sockaddr_in client_addr_;
+  struct sockaddr_in server_addr_;
+};
+
+// A callback class that pushes packets through the io_uring drivers, and
+// implements a echo server on the responder end.
+class UringTestCallbacks : public LodpCallbacks {
+ public:
+  UringTestCallbacks() :
+      client_endpoint_(nullptr),
+      server_endpoint_(nullptr),
+      client_driver_(nullptr),
+      server_driver_(nullptr),
+      client_session_(nullptr),
+      server_session_(nullptr),
+      connected_(false),
+      pad_to_mtu_(false),
+      rx_bytes_(0) {}
+
+  int sendto(LodpEndpoint& endpoint,
+             const void* buf,
+             const size_t buf_len,
+             const struct sockaddr* addr,
+             const socklen_t addr_len) override {
+    if (&endpoint == client_endpoint_)
+      return client_driver_->sendto(buf, buf_len, addr, addr_len);
+    else if (&endpoint == server_endpoint_)
+      return server_driver_->sendto(buf, buf_len, addr, addr_len);
+    ADD_FAILURE(); // WTF endpoint is this?
+    return -1;
+  }
+
+  int sendto_gso(LodpEndpoint& endpoint,
+                 const void* buf,
+                 const size_t buf_len,
+                 const size_t segment_size,
+                 const struct sockaddr* addr,
+                 const socklen_t addr_len) override {
+    if (&endpoint == client_endpoint_)
+      return client_driver_->sendto_gso(buf, buf_len, segment_size, addr,
+                                        addr_len);
+    else if (&endpoint == server_endpoint_)
+      return server_driver_->sendto_gso(buf, buf_len, segment_size, addr,
+                                        addr_len);
+    ADD_FAILURE(); // WTF endpoint is this?
+    return -1;
+  }
+
+  size_t pad_size(const LodpSession& session,
+                  const size_t available) override {
+    return pad_to_mtu_ ? available : 0;
+  }
+
+  bool should_accept(const LodpEndpoint& endpoint,
+                     const struct sockaddr* addr,
+                     const socklen_t addr_len) override {
+    EXPECT_EQ(server_endpoint_, &endpoint);
+    return server_session_ == nullptr;
+  }
+
+  void on_accept(LodpEndpoint& endpoint,
+                 LodpSession* session,
+                 const struct sockaddr* addr,
+                 const socklen_t addr_len) override {
+    EXPECT_EQ(server_endpoint_, &endpoint);
+    server_session_ = session;
+  }
+
+  void on_connect(LodpSession& session,
+                  const int status) override {
+    EXPECT_EQ(client_session_, &session);
+    EXPECT_EQ(kErrorOk, status);
+    connected_ = status == kErrorOk;
+  }
+
+  void on_recv(LodpSession& session,
+               const void* buf,
+               const size_t buf_len) override {
+    const uint8_t* ptr = static_cast<const uint8_t*>(buf);
+    for (size_t i = 0; i < buf_len; i++)
+      ASSERT_TRUE(ptr[i] == static_cast<uint8_t>(i));
+
+    if (&session == server_session_)
+      ASSERT_EQ(kErrorOk, server_session_->send(buf, buf_len));
+    else
+      rx_bytes_ += buf_len;
+  }
+
+  void on_rekey_needed(LodpSession& session) override {}
+
+  void on_rekey(LodpSession& session,
+                const int status) override {}
+
+  void on_close(const LodpSession& session) override {
+    if (&session == client_session_)
+      client_session_ = nullptr;
+    else if (&session == server_session_)
+      server_session_ = nullptr;
+  }
+
+  LodpEndpoint* client_endpoint_;
+  LodpEndpoint* server_endpoint_;
+  LodpUringDriver* client_driver_;
+  LodpUringDriver* server_driver_;
+  LodpSession* client_session_;
+  LodpSession* server_session_;
+  bool connected_;
+  bool pad_to_mtu_;
+  size_t rx_bytes_;
+};
+
+// Handshake and exchange data over real loopback sockets
+TEST_F(LodpUringDriverTest, LoopbackTest) {
+  ASSERT_NE(-1, client_fd_);
+  ASSERT_NE(-1, server_fd_);
+
+  crypto::Random rng;
+  UringTestCallbacks cbs;
+
+  LodpEndpoint client(rng, cbs, nullptr, false);
+  const uint8_t node_id[] = { 'T', 'e', 's', 't', 'N', 'o', 'd', 'e' };
+  crypto::Curve25519::PrivateKey server_priv_key(rng);
+  crypto::Curve25519::PublicKey server_pub_key(server_priv_key);
+  LodpEndpoint server(rng, cbs, nullptr, false, server_priv_key, node_id,
+                      sizeof(node_id));
+  LodpUringDriver client_driver(client, client_fd_);
+  LodpUringDriver server_driver(server, server_fd_);
+  cbs.client_endpoint_ = &client;
+  cbs.server_endpoint_ = &server;
+  cbs.client_driver_ = &client_driver;
+  cbs.server_driver_ = &server_driver;
+
+  // Old kernels and seccomp sandboxes may not provide io_uring
+  if (client_driver.init() != kErrorOk) {
+    ::std::cerr << "io_uring unavailable, skipping" << ::std::endl;
+    return;
+  }
+  ASSERT_EQ(kErrorOk, server_driver.init());
+
+  // Handshake
+  int ret = client.connect(nullptr, server_pub_key, node_id, sizeof(node_id),
+                           reinterpret_cast<sockaddr*>(&server_addr_),
+                           sizeof(server_addr_), cbs.client_session_);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(kErrorOk, cbs.client_session_->handshake());
+  const ::std::chrono::milliseconds poll_interval(10);
+  for (int i = 0; i < 100 && !cbs.connected_; i++) {
+    ASSERT_LE(0, client_driver.run_once(poll_interval));
+    ASSERT_LE(0, server_driver.run_once(::std::chrono::microseconds(0)));
+  }
+  ASSERT_TRUE(cbs.connected_);
+  ASSERT_NE(nullptr, cbs.server_session_);
+
+  // Send a burst of data, and wait for the echo
+  uint8_t buf[1500];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+  size_t tx_bytes = 0;
+  for (size_t sz = 0; sz < cbs.client_session_->mtu(); sz += 64) {
+    ASSERT_EQ(kErrorOk, cbs.client_session_->send(buf, sz));
+    tx_bytes += sz;
+  }
+  for (int i = 0; i < 100 && cbs.rx_bytes_ < tx_bytes; i++) {
+    ASSERT_LE(0, server_driver.run_once(poll_interval));
+    ASSERT_LE(0, client_driver.run_once(::std::chrono::microseconds(0)));
+  }
+  ASSERT_EQ(tx_bytes, cbs.rx_bytes_);
+  ASSERT_EQ(0u, client_driver.stats().rx_truncated_);
+  ASSERT_EQ(0u, client_driver.stats().tx_failed_);
+  ASSERT_LT(0u, server_driver.stats().rx_packets_);
+
+  // Close the client session, and wait for the server to see the shutdown
+  cbs.client_session_->close();
+  ASSERT_EQ(nullptr, cbs.client_session_);
+  ASSERT_EQ(kErrorOk, client_driver.flush());
+  for (int i = 0; i < 100 && cbs.server_session_ != nullptr; i++)
+    ASSERT_LE(0, server_driver.run_once(poll_interval));
+  ASSERT_EQ(nullptr, cbs.server_session_);
+}
+
+// Send a MTU padded burst with UDP_SEGMENT, and receive it with UDP_GRO
+TEST_F(LodpUringDriverTest, GsoTest) {
+  ASSERT_NE(-1, client_fd_);
+  ASSERT_NE(-1, server_fd_);
+
+  crypto::Random rng;
+  UringTestCallbacks cbs;
+  cbs.pad_to_mtu_ = true;
+
+  LodpEndpoint client(rng, cbs, nullptr, false);
+  const uint8_t node_id[] = { 'T', 'e', 's', 't', 'N', 'o', 'd', 'e' };
+  crypto::Curve25519::PrivateKey server_priv_key(rng);
+  crypto::Curve25519::PublicKey server_pub_key(server_priv_key);
+  LodpEndpoint server(rng, cbs, nullptr, false, server_priv_key, node_id,
+                      sizeof(node_id));
+  LodpUringDriver client_driver(client, client_fd_);
+  LodpUringDriver server_driver(server, server_fd_,
+                                LodpUringDriver::kDefaultRingEntries, 16,
+                                LodpUringDriver::kDefaultNrTxBuffers,
+                                LodpUringDriver::kGroBufferSize, true);
+  cbs.client_endpoint_ = &client;
+  cbs.server_endpoint_ = &server;
+  cbs.client_driver_ = &client_driver;
+  cbs.server_driver_ = &server_driver;
+
+  // Old kernels and seccomp sandboxes may not provide io_uring/UDP_GRO
+  if (client_driver.init() != kErrorOk || server_driver.init() != kErrorOk) {
+    ::std::cerr << "io_uring/UDP_GRO unavailable, skipping" << ::std::endl;
+    return;
+  }
+
+  int ret = client.connect(nullptr, server_pub_key, node_id, sizeof(node_id),
+                           reinterpret_cast<sockaddr*>(&server_addr_),
+                           sizeof(server_addr_), cbs.client_session_);
+  ASSERT_EQ(kErrorOk, ret);
+  ASSERT_EQ(kErrorOk, cbs.client_session_->handshake());
+  const ::std::chrono::milliseconds poll_interval(10);
+  for (int i = 0; i < 100 && !cbs.connected_; i++) {
+    ASSERT_LE(0, client_driver.run_once(poll_interval));
+    ASSERT_LE(0, server_driver.run_once(::std::chrono::microseconds(0)));
+  }
+  ASSERT_TRUE(cbs.connected_);
+
+  // Send a burst, which goes out as one UDP_SEGMENT sendmsg
+  uint8_t buf[1500];
+  for (size_t i = 0; i < sizeof(buf); i++)
+    buf[i] = static_cast<uint8_t>(i);
+  struct iovec iov[32];
+  size_t tx_bytes = 0;
+  for (size_t i = 0; i < sizeof(iov) / sizeof(iov[0]); i++) {
+    iov[i].iov_base = buf;
+    iov[i].iov_len = i * 32;
+    tx_bytes += iov[i].iov_len;
+  }
+  const uint64_t tx_packets = client_driver.stats().tx_packets_;
+  ASSERT_EQ(kErrorOk, cbs.client_session_->send_burst(iov, 32));
+  ASSERT_EQ(1u, client_driver.stats().tx_gso_packets_);
+  for (int i = 0; i < 100 && cbs.rx_bytes_ < tx_bytes; i++) {
+    ASSERT_LE(0, client_driver.run_once(::std::chrono::microseconds(0)));
+    ASSERT_LE(0, server_driver.run_once(poll_interval));
+  }
+  ASSERT_EQ(tx_bytes, cbs.rx_bytes_);
+  ASSERT_LE(0, client_driver.run_once(::std::chrono::microseconds(0)));
+  ASSERT_EQ(tx_packets + 32, client_driver.stats().tx_packets_);
+  ASSERT_EQ(0u, server_driver.stats().rx_truncated_);
+  ASSERT_LE(32u, server_driver.stats().rx_packets_);
+  ASSERT_LE(1u, server_driver.stats().rx_gro_packets_);
+
+  cbs.client_session_->close();
+  ASSERT_EQ(kErrorOk, client_driver.flush());
+  for (int i = 0; i < 100 && cbs.server_session_ != nullptr; i++)
+    ASSERT_LE(0, server_driver.run_once(poll_interval));
+  ASSERT_EQ(nullptr, cbs.server_session_);
+}
+
+// Ensure that timers fire, and that stopped timers do not
+TEST_F(LodpUringDriverTest, TimerTest) {
+  ASSERT_NE(-1, client_fd_);
+
+  crypto::Random rng;
+  UringTestCallbacks cbs;
+  LodpEndpoint client(rng, cbs, nullptr, false);
+  LodpUringDriver driver(client, client_fd_);
+
+  // Timers can not be started before the ring exists
+  int fired = 0, canceled = 0;
+  LodpUringDriver::Timer t_early(driver, [&canceled]() { canceled++; });
+  ASSERT_FALSE(t_early.start(::std::chrono::milliseconds(1)));
+  ASSERT_FALSE(t_early.is_active());
+
+  if (driver.init() != kErrorOk) {
+    ::std::cerr << "io_uring unavailable, skipping" << ::std::endl;
+    return;
+  }
+
+  LodpUringDriver::Timer t(driver, [&fired]() { fired++; });
+  LodpUringDriver::Timer t_stopped(driver, [&canceled]() { canceled++; });
+  const ::std::chrono::milliseconds interval(20);
+  ASSERT_TRUE(t.start(interval));
+  ASSERT_TRUE(t_stopped.start(interval));
+  ASSERT_TRUE(t.is_active());
+  t_stopped.stop();
+  ASSERT_FALSE(t_stopped.is_active());
+
+  auto start = ::std::chrono::steady_clock::now();
+  for (int i = 0; i < 100 && fired == 0; i++)
+    ASSERT_LE(0, driver.run_once(::std::chrono::milliseconds(10)));
+  ASSERT_TRUE(::std::chrono::steady_clock::now() - start >= interval);
+  ASSERT_EQ(1, fired);
+  ASSERT_EQ(0, canceled);
+  ASSERT_FALSE(t.is_active());
+
+  // Restarting reuses the completed requests, and only the last start fires
+  for (int i = 0; i < 10; i++) {
+    ASSERT_TRUE(t.start(interval));
+    ASSERT_LE(0, driver.run_once(::std::chrono::microseconds(0)));
+  }
+  for (int i = 0; i < 100 && fired == 1; i++)
+    ASSERT_LE(0, driver.run_once(::std::chrono::milliseconds(10)));
+  ASSERT_EQ(2, fired);
+  ASSERT_EQ(0, canceled);
+}
+
+} // namespace lodp
+} // namespace schwanenlied
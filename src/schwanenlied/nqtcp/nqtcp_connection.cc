@@ -0,0 +1,1043 @@
+/**
+ * @file    nqtcp_connection.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   NQTCP connection (IMPLEMENTATION)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "schwanenlied/nqtcp/nqtcp_connection.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+const uint32_t NqtcpConnection::kDefaultWeight;
+const uint32_t NqtcpConnection::kMaxWeight;
+const size_t NqtcpConnection::kMaxOverhead;
+const size_t NqtcpConnection::kMaxSackBytes;
+const size_t NqtcpConnection::kMaxWindowUpdates;
+const size_t NqtcpConnection::kReorderingThreshold;
+
+namespace {
+
+/** The maximum RTO backoff exponent */
+const unsigned kMaxRtoBackoff = 16;
+
+/** The number of recoveries a grown RACK reordering window persists for */
+const unsigned kReoWndPersist = 16;
+
+/** The minimum number of RTTs a receive buffer has to be idle to shrink */
+const unsigned kRecvIdleRtts = 4;
+
+/** Round a duration up to the Timer resolution */
+::std::chrono::milliseconds to_timer_ms(const Clock::duration& d) {
+  if (d <= Clock::duration::zero())
+    return ::std::chrono::milliseconds(0);
+
+  ::std::chrono::milliseconds ms =
+      ::std::chrono::duration_cast<::std::chrono::milliseconds>(d);
+  if (ms < d)
+    ms += ::std::chrono::milliseconds(1);
+  return ms;
+}
+
+/**
+ * Expand a truncated 32 bit packet number to the 64 bit one closest to a
+ * reference point (The next expected packet number).
+ */
+uint64_t expand_pn(const uint64_t reference,
+                   const uint32_t truncated) {
+  const uint64_t kWindow = static_cast<uint64_t>(1) << 32;
+  const uint64_t kHalfWindow = kWindow / 2;
+
+  uint64_t candidate = (reference & ~(kWindow - 1)) | truncated;
+  if (candidate + kHalfWindow <= reference)
+    candidate += kWindow;
+  else if (candidate > reference + kHalfWindow && candidate >= kWindow)
+    candidate -= kWindow;
+
+  return candidate;
+}
+
+} // namespace
+
+NqtcpConnection::NqtcpConnection(NqtcpCallbacks& callbacks,
+                                 const uint32_t connection_id,
+                                 const bool is_initiator,
+                                 const NqtcpConfig& config,
+                                 Clock& clock) :
+    callbacks_(callbacks),
+    config_(config),
+    clock_(clock),
+    connection_id_(connection_id),
+    is_initiator_(is_initiator),
+    ctxt_(nullptr),
+    reset_(false),
+    next_stream_id_(is_initiator ? 1 : 2),
+    peer_next_stream_id_(is_initiator ? 2 : 1),
+    nr_peer_streams_(0),
+    virtual_time_(0),
+    recv_autotuned_(0),
+    idle_timer_(new Timer([this]() { on_idle_timer(); }, clock)),
+    sent_(2 * config.max_inflight_),
+    inflight_count_(0),
+    rack_next_(0),
+    bytes_in_flight_(0),
+    largest_acked_(0),
+    peer_receive_window_(config.receive_window_),
+    rx_cumulative_(0),
+    ack_pending_(false),
+    ack_now_(false),
+    rx_unacked_(0),
+    ack_timer_(new Timer([this]() { on_ack_timer(); }, clock)),
+    srtt_(0),
+    rttvar_(0),
+    min_rtt_(0),
+    rack_rtt_(0),
+    rack_pending_(false),
+    reordering_seen_(false),
+    reo_wnd_mult_(1),
+    reo_wnd_persist_(0),
+    reo_wnd_round_(0),
+    in_recovery_(false),
+    recovery_end_(0),
+    tlp_outstanding_(false),
+    tlp_end_(0),
+    rto_backoff_(0),
+    timer_mode_(TimerMode::kNONE),
+    loss_timer_(new Timer([this]() { on_loss_timer(); }, clock)) {
+  SL_ASSERT(config_.max_payload_ > 0);
+  SL_ASSERT(config_.max_inflight_ > 0);
+  SL_ASSERT(config_.ack_frequency_ > 0);
+}
+
+NqtcpConnection::~NqtcpConnection() {
+  loss_timer_->stop();
+  ack_timer_->stop();
+  idle_timer_->stop();
+}
+
+Clock::duration NqtcpConnection::rto() const {
+  Clock::duration rto = config_.initial_rto_;
+  if (srtt_ != Clock::duration::zero())
+    rto = srtt_ + ::std::max<Clock::duration>(4 * rttvar_,
+                                              ::std::chrono::milliseconds(1));
+  rto = ::std::max<Clock::duration>(rto, config_.min_rto_);
+  for (unsigned i = 0; i < rto_backoff_ && rto < config_.max_rto_; i++)
+    rto *= 2;
+
+  return ::std::min<Clock::duration>(rto, config_.max_rto_);
+}
+
+Clock::duration NqtcpConnection::pto() const {
+  // RFC 8985 7.2, with the allowance for the peer delaying the ACK made
+  // regardless of the number of packets in flight, since the peer only
+  // acknowledges every ack_frequency_ packets immediately
+  if (srtt_ == Clock::duration::zero())
+    return config_.initial_rto_;
+
+  return 2 * srtt_ + config_.max_ack_delay_;
+}
+
+Clock::duration NqtcpConnection::reo_wnd() const {
+  // RFC 8985 6.2 Step 4
+  if (!reordering_seen_ &&
+      (in_recovery_ || scoreboard_.total() >= kReorderingThreshold))
+    return Clock::duration::zero();
+
+  return ::std::min<Clock::duration>(min_rtt_ / 4 * reo_wnd_mult_, srtt_);
+}
+
+uint32_t NqtcpConnection::receive_window() const {
+  const uint64_t window = static_cast<uint64_t>(config_.receive_window_) +
+      recv_autotuned_;
+  return static_cast<uint32_t>(::std::min<uint64_t>(
+      window, ::std::numeric_limits<uint32_t>::max()));
+}
+
+int NqtcpConnection::open_stream(uint32_t& stream_id,
+                                 const uint32_t weight) {
+  if (reset_)
+    return kErrorConnAborted;
+  if (weight == 0 || weight > kMaxWeight)
+    return kErrorInval;
+  if (streams_.size() - nr_peer_streams_ >= config_.max_streams_)
+    return kErrorTooManyStreams;
+
+  stream_id = next_stream_id_;
+  next_stream_id_ += 2;
+  streams_[stream_id] = ::std::unique_ptr<NqtcpStream>(
+      new NqtcpStream(stream_id, weight, config_.send_buffer_size_,
+                      config_.recv_buffer_size_, config_.recv_buffer_size_));
+  streams_[stream_id]->start_rcv_epoch(clock_.now());
+
+  return kErrorOk;
+}
+
+int NqtcpConnection::set_weight(const uint32_t stream_id,
+                                const uint32_t weight) {
+  if (reset_)
+    return kErrorConnAborted;
+  if (weight == 0 || weight > kMaxWeight)
+    return kErrorInval;
+  NqtcpStream* stream = find_stream(stream_id);
+  if (stream == nullptr)
+    return kErrorNoStream;
+
+  // Takes effect from the next packet the stream sends
+  stream->set_weight(weight);
+
+  return kErrorOk;
+}
+
+int NqtcpConnection::send(const uint32_t stream_id,
+                          const void* buf,
+                          const size_t len,
+                          size_t& written) {
+  written = 0;
+  if (reset_)
+    return kErrorConnAborted;
+  if (buf == nullptr && len > 0)
+    return kErrorInval;
+  NqtcpStream* stream = find_stream(stream_id);
+  if (stream == nullptr)
+    return kErrorNoStream;
+  if (stream->is_shutdown())
+    return kErrorStreamShutdown;
+  if (len == 0)
+    return kErrorOk;
+
+  written = stream->write(static_cast<const uint8_t*>(buf), len);
+  if (written < len)
+    blocked_.insert(stream_id);
+  if (written == 0)
+    return kErrorAgain;
+
+  schedule(stream);
+  flush();
+
+  return kErrorOk;
+}
+
+int NqtcpConnection::shutdown(const uint32_t stream_id) {
+  if (reset_)
+    return kErrorConnAborted;
+  NqtcpStream* stream = find_stream(stream_id);
+  if (stream == nullptr)
+    return kErrorNoStream;
+
+  stream->shutdown();
+  schedule(stream);
+  flush();
+
+  return kErrorOk;
+}
+
+int NqtcpConnection::recv(const uint32_t stream_id,
+                          void* buf,
+                          const size_t len,
+                          size_t& read) {
+  read = 0;
+  if (reset_)
+    return kErrorConnAborted;
+  if (buf == nullptr && len > 0)
+    return kErrorInval;
+  NqtcpStream* stream = find_stream(stream_id);
+  if (stream == nullptr)
+    return kErrorNoStream;
+
+  const size_t charge = recv_charge(*stream);
+  read = stream->read(static_cast<uint8_t*>(buf), len);
+  recv_autotuned_ = recv_autotuned_ - charge + recv_charge(*stream);
+  if (read == 0) {
+    if (!stream->is_eof())
+      return kErrorAgain;
+    reap_streams();
+    return kErrorOk;
+  }
+
+  // Open the window if enough space was freed up (or it grew)
+  autotune(stream);
+  if (stream->needs_window_update())
+    flush();
+
+  return kErrorOk;
+}
+
+void NqtcpConnection::reset() {
+  if (reset_)
+    return;
+
+  send_rst();
+  reset_ = true;
+  loss_timer_->stop();
+  ack_timer_->stop();
+  idle_timer_->stop();
+}
+
+int NqtcpConnection::on_packet(const void* buf,
+                               const size_t len) {
+  if (reset_)
+    return kErrorConnAborted;
+  if (buf == nullptr)
+    return kErrorBadPacketFormat;
+
+  packet::Packet pkt;
+  if (!pkt.ParseFromArray(buf, static_cast<int>(len)))
+    return kErrorBadPacketFormat;
+  if (!pkt.has_connection_id() || pkt.connection_id() != connection_id_)
+    return kErrorBadPacketFormat;
+  stats_.rx_packets_++;
+
+  if (pkt.flags() & packet::Packet::RST) {
+    reset_ = true;
+    loss_timer_->stop();
+    ack_timer_->stop();
+    idle_timer_->stop();
+    callbacks_.on_reset(*this);
+    return kErrorOk;
+  }
+
+  if (pkt.has_receive_window())
+    peer_receive_window_ = pkt.receive_window();
+
+  // Acknowledgements
+  const Clock::time_point now = clock_.now();
+  if (pkt.flags() & packet::Packet::ACK) {
+    const int ret = on_ack(pkt, now);
+    if (ret == kErrorProtocol) {
+      abort();
+      return ret;
+    } else if (ret != kErrorOk)
+      return ret;
+  }
+
+  // Flow control updates
+  for (int i = 0; i < pkt.stream_windows_size(); i++) {
+    const packet::StreamWindow& window = pkt.stream_windows(i);
+    NqtcpStream* stream = find_stream(window.stream_id());
+    if (stream != nullptr && stream->set_peer_max_offset(window.max_offset()))
+      schedule(stream);
+  }
+
+  // Stream data
+  if (pkt.has_sequence_number()) {
+    const uint64_t pn = expand_pn(rx_cumulative_, pkt.sequence_number());
+    ack_pending_ = true;
+    if (++rx_unacked_ >= config_.ack_frequency_)
+      ack_now_ = true;
+    if (pn < rx_cumulative_ || rx_ranges_.contains(pn)) {
+      stats_.rx_duplicates_++;
+      ack_now_ = true;
+    } else {
+      // Out of order, or there are holes (that this may have filled)
+      if (pn != rx_cumulative_ || !rx_ranges_.empty())
+        ack_now_ = true;
+      rx_ranges_.add(pn, pn + 1);
+      const auto& front = *rx_ranges_.ranges().begin();
+      if (front.first <= rx_cumulative_) {
+        rx_cumulative_ = front.second;
+        rx_ranges_.erase_below(rx_cumulative_);
+      }
+
+      if (pkt.has_stream_id()) {
+        NqtcpStream* stream = nullptr;
+        int ret = peer_stream(pkt.stream_id(), stream);
+        if (ret == kErrorOk && stream != nullptr) {
+          const size_t readable = stream->readable();
+          const bool had_fin = stream->has_peer_fin();
+          const size_t charge = recv_charge(*stream);
+          const ::std::string& payload = pkt.payload();
+          stats_.rx_bytes_ += payload.size();
+          ret = stream->on_data(pkt.stream_offset(),
+                                reinterpret_cast<const uint8_t*>(
+                                    payload.data()),
+                                payload.size(),
+                                pkt.flags() & packet::Packet::FIN);
+          recv_autotuned_ = recv_autotuned_ - charge + recv_charge(*stream);
+          if (ret == kErrorOk && (stream->readable() > readable ||
+                                  stream->has_peer_fin() != had_fin))
+            callbacks_.on_readable(*this, pkt.stream_id());
+        }
+        if (ret != kErrorOk) {
+          abort();
+          return ret;
+        }
+        if (reset_)
+          return kErrorOk;
+      }
+    }
+  }
+
+  // Anything sent by flush() carries the ACK
+  flush();
+  if (ack_pending_ && !reset_) {
+    if (ack_now_)
+      send_ack();
+    else if (!ack_timer_->is_active())
+      ack_timer_->start(config_.max_ack_delay_);
+  }
+
+  // Tell the application about send buffer space
+  for (auto it = blocked_.begin(); it != blocked_.end() && !reset_; ) {
+    NqtcpStream* stream = find_stream(*it);
+    if (stream == nullptr || stream->send_space() > 0) {
+      const uint32_t stream_id = *it;
+      it = blocked_.erase(it);
+      if (stream != nullptr)
+        callbacks_.on_writable(*this, stream_id);
+    } else
+      ++it;
+  }
+
+  reap_streams();
+
+  return kErrorOk;
+}
+
+NqtcpStream* NqtcpConnection::find_stream(const uint32_t stream_id) const {
+  auto it = streams_.find(stream_id);
+  return it != streams_.end() ? it->second.get() : nullptr;
+}
+
+int NqtcpConnection::peer_stream(const uint32_t stream_id,
+                                 NqtcpStream*& stream) {
+  stream = find_stream(stream_id);
+  if (stream != nullptr)
+    return kErrorOk;
+  if (stream_id == 0)
+    return kErrorProtocol;
+
+  // One of ours, that is either forgotten or was never opened
+  const bool is_local = ((stream_id & 1) == 1) == is_initiator_;
+  if (is_local)
+    return stream_id < next_stream_id_ ? kErrorOk : kErrorProtocol;
+
+  // A forgotten peer stream
+  if (stream_id < peer_next_stream_id_)
+    return kErrorOk;
+
+  // Open every peer stream up to stream_id (The packets for the lower ones
+  // were reordered or lost)
+  const size_t nr_new = (stream_id - peer_next_stream_id_) / 2 + 1;
+  if (nr_peer_streams_ + nr_new > config_.max_streams_)
+    return kErrorTooManyStreams;
+  const Clock::time_point now = clock_.now();
+  for (uint32_t id = peer_next_stream_id_; id <= stream_id; id += 2) {
+    streams_[id] = ::std::unique_ptr<NqtcpStream>(
+        new NqtcpStream(id, kDefaultWeight, config_.send_buffer_size_,
+                        config_.recv_buffer_size_,
+                        config_.recv_buffer_size_));
+    streams_[id]->start_rcv_epoch(now);
+  }
+  nr_peer_streams_ += nr_new;
+  peer_next_stream_id_ = stream_id + 2;
+  stream = find_stream(stream_id);
+
+  return kErrorOk;
+}
+
+void NqtcpConnection::reap_streams() {
+  for (auto it = streams_.begin(); it != streams_.end(); ) {
+    NqtcpStream* stream = it->second.get();
+    if (!stream->is_finished()) {
+      ++it;
+      continue;
+    }
+
+    if (stream->is_scheduled())
+      active_.erase(::std::make_pair(stream->vtime(), stream->id()));
+    blocked_.erase(stream->id());
+    recv_autotuned_ -= recv_charge(*stream);
+    if (((stream->id() & 1) == 1) != is_initiator_)
+      nr_peer_streams_--;
+    it = streams_.erase(it);
+  }
+}
+
+void NqtcpConnection::autotune(NqtcpStream* stream) {
+  // Measure over (at least) a RTT
+  if (srtt_ == Clock::duration::zero())
+    return;
+  const Clock::time_point now = clock_.now();
+  const Clock::duration elapsed = now - stream->rcv_epoch();
+  if (elapsed < srtt_)
+    return;
+
+  // Allow for twice what was read per RTT, so that the peer can keep
+  // increasing it's sending rate without being limited by the window
+  const uint64_t per_rtt = stream->rcv_epoch_read() * srtt_.count() /
+      elapsed.count();
+  const uint64_t target = 2 * per_rtt;
+  stream->start_rcv_epoch(now);
+  const size_t window = stream->recv_window();
+  if (target <= window || recv_autotuned_ >= config_.recv_autotune_limit_)
+    return;
+
+  // The new window only adds to the charge past the existing commitment
+  const size_t charge = recv_charge(*stream);
+  const size_t grow = static_cast<size_t>(::std::min<uint64_t>(
+      target - window, config_.recv_autotune_limit_ - recv_autotuned_));
+  stream->set_recv_window(window + grow);
+  recv_autotuned_ = recv_autotuned_ - charge + recv_charge(*stream);
+  if (!idle_timer_->is_active())
+    idle_timer_->start(config_.recv_idle_timeout_);
+}
+
+void NqtcpConnection::on_idle_timer() {
+  const Clock::time_point now = clock_.now();
+  const Clock::duration idle = ::std::max<Clock::duration>(
+      config_.recv_idle_timeout_, kRecvIdleRtts * srtt_);
+
+  // A stream's measurement period restarts on every read more than a RTT
+  // after it started, so a old one means that the stream was not read since.
+  // The credit the peer was already granted stays charged until it is used
+  // and read, since the receive buffer grows back to hold it.
+  bool grown = false;
+  for (auto it = streams_.begin(); it != streams_.end(); ++it) {
+    NqtcpStream* stream = it->second.get();
+    if (stream->recv_window() <= config_.recv_buffer_size_)
+      continue;
+    if (stream->readable() == 0 && now - stream->rcv_epoch() >= idle) {
+      const size_t charge = recv_charge(*stream);
+      stream->set_recv_window(config_.recv_buffer_size_);
+      recv_autotuned_ = recv_autotuned_ - charge + recv_charge(*stream);
+    } else
+      grown = true;
+  }
+
+  if (grown)
+    idle_timer_->start(config_.recv_idle_timeout_);
+}
+
+size_t NqtcpConnection::recv_charge(const NqtcpStream& stream) const {
+  return stream.recv_commitment() - config_.recv_buffer_size_ +
+      stream.out_of_order_bytes();
+}
+
+void NqtcpConnection::schedule(NqtcpStream* stream) {
+  if (stream->is_scheduled() || !stream->has_pending())
+    return;
+
+  // A stream that was idle starts at the current virtual time, so it can not
+  // bank credit while idle
+  stream->set_vtime(::std::max(stream->vtime(), virtual_time_));
+  active_.insert(::std::make_pair(stream->vtime(), stream->id()));
+  stream->set_scheduled(true);
+}
+
+NqtcpStream* NqtcpConnection::next_stream() {
+  while (!active_.empty()) {
+    const uint32_t stream_id = active_.begin()->second;
+    active_.erase(active_.begin());
+    NqtcpStream* stream = find_stream(stream_id);
+    if (stream == nullptr)
+      continue;
+    stream->set_scheduled(false);
+    if (stream->has_pending())
+      return stream;
+  }
+
+  return nullptr;
+}
+
+void NqtcpConnection::flush() {
+  while (!reset_ && inflight_count_ < config_.max_inflight_ &&
+         window_allows()) {
+    if (!send_next_packet())
+      break;
+  }
+
+  update_loss_timer();
+}
+
+bool NqtcpConnection::window_allows() const {
+  return bytes_in_flight_ == 0 ||
+      bytes_in_flight_ + config_.max_payload_ <= peer_receive_window_;
+}
+
+bool NqtcpConnection::send_next_packet() {
+  packet::Packet pkt;
+  SentPacket sent = SentPacket();
+
+  // Pick the stream to serve with WFQ, and charge it for the packet
+  NqtcpStream* stream = next_stream();
+  if (stream != nullptr) {
+    uint64_t offset = 0;
+    size_t len = 0;
+    bool fin = false, retransmit = false;
+    const bool ok = stream->next_chunk(config_.max_payload_, offset, len,
+                                       fin, retransmit);
+    SL_ASSERT(ok);
+    virtual_time_ = stream->vtime();
+    stream->set_vtime(stream->vtime() + ::std::max<uint64_t>(len, 1) *
+                      kMaxWeight / stream->weight());
+    schedule(stream);
+
+    pkt.set_stream_id(stream->id());
+    pkt.set_stream_offset(offset);
+    ::std::string* payload = pkt.mutable_payload();
+    payload->resize(len);
+    if (len > 0)
+      stream->copy(reinterpret_cast<uint8_t*>(&(*payload)[0]), offset, len);
+    if (fin)
+      pkt.set_flags(packet::Packet::FIN);
+
+    sent.stream_id_ = stream->id();
+    sent.offset_ = offset;
+    sent.len_ = static_cast<uint32_t>(len);
+    sent.fin_ = fin;
+    if (retransmit)
+      stats_.tx_retransmitted_bytes_ += len;
+  }
+  sent.window_update_ = fill_window_updates(pkt);
+  if (stream == nullptr && !sent.window_update_)
+    return false;
+
+  send_tracked(pkt, sent);
+
+  return true;
+}
+
+void NqtcpConnection::send_tracked(packet::Packet& pkt,
+                                   const SentPacket& sent) {
+  const Clock::time_point now = clock_.now();
+  if (inflight_count_ == 0)
+    rto_base_ = now;
+  last_sent_ = now;
+
+  pkt.set_sequence_number(static_cast<uint32_t>(sent_.end()));
+  fill_ack(pkt);
+  transmit(pkt);
+
+  SentPacket& entry = sent_.push_back();
+  entry = sent;
+  entry.sent_ = now;
+  entry.inflight_ = true;
+  entry.acked_ = false;
+  inflight_count_++;
+  bytes_in_flight_ += sent.len_;
+  stats_.tx_bytes_ += sent.len_;
+}
+
+void NqtcpConnection::fill_ack(packet::Packet& pkt) {
+  pkt.set_connection_id(connection_id_);
+  pkt.set_receive_window(receive_window());
+  if (rx_cumulative_ == 0 && rx_ranges_.empty())
+    return;
+
+  pkt.set_flags(pkt.flags() | packet::Packet::ACK);
+  pkt.set_acknowledgment_number(static_cast<uint32_t>(rx_cumulative_));
+
+  // The ranges above the cumulative ACK, most recent first
+  if (!rx_ranges_.empty())
+    SackCodec::encode(rx_cumulative_, rx_ranges_, kMaxSackBytes,
+                      *pkt.mutable_sack_vector());
+  ack_pending_ = false;
+  ack_now_ = false;
+  rx_unacked_ = 0;
+  ack_timer_->stop();
+}
+
+bool NqtcpConnection::fill_window_updates(packet::Packet& pkt) {
+  size_t n = 0;
+  for (auto it = streams_.begin();
+       it != streams_.end() && n < kMaxWindowUpdates; ++it) {
+    NqtcpStream* stream = it->second.get();
+    if (!stream->needs_window_update())
+      continue;
+
+    packet::StreamWindow* window = pkt.add_stream_windows();
+    window->set_stream_id(stream->id());
+    window->set_max_offset(stream->max_offset());
+    stream->set_window_advertised();
+    n++;
+  }
+
+  return n > 0;
+}
+
+void NqtcpConnection::transmit(const packet::Packet& pkt) {
+  ::std::string buf;
+  const bool ok = pkt.SerializeToString(&buf);
+  SL_ASSERT(ok);
+
+  stats_.tx_packets_++;
+  callbacks_.send_packet(*this, reinterpret_cast<const uint8_t*>(buf.data()),
+                         buf.size());
+}
+
+void NqtcpConnection::send_ack() {
+  packet::Packet pkt;
+  fill_ack(pkt);
+  transmit(pkt);
+  stats_.tx_acks_++;
+}
+
+void NqtcpConnection::on_ack_timer() {
+  if (reset_ || !ack_pending_)
+    return;
+
+  send_ack();
+  stats_.tx_delayed_acks_++;
+}
+
+void NqtcpConnection::send_rst() {
+  packet::Packet pkt;
+  pkt.set_connection_id(connection_id_);
+  pkt.set_flags(packet::Packet::RST);
+  transmit(pkt);
+}
+
+void NqtcpConnection::abort() {
+  send_rst();
+  reset_ = true;
+  loss_timer_->stop();
+  ack_timer_->stop();
+  idle_timer_->stop();
+  callbacks_.on_reset(*this);
+}
+
+int NqtcpConnection::on_ack(const packet::Packet& pkt,
+                            const Clock::time_point& now) {
+  if (!pkt.has_acknowledgment_number())
+    return kErrorBadPacketFormat;
+  const ::std::string& sack = pkt.sack_vector();
+  if (sack.size() > kMaxSackBytes)
+    return kErrorBadPacketFormat;
+
+  const uint64_t next_pn = sent_.end();
+  const uint64_t cumulative = expand_pn(next_pn, pkt.acknowledgment_number());
+  if (cumulative > next_pn)
+    return kErrorProtocol;
+  ::std::vector<RangeSet::Range> ranges;
+  const int ret = SackCodec::decode(cumulative, next_pn,
+                                    reinterpret_cast<const uint8_t*>(
+                                        sack.data()),
+                                    sack.size(), ranges);
+  if (ret != kErrorOk)
+    return ret;
+  if (sent_.empty())
+    return kErrorOk;
+
+  // Process the cumulative ACK and the SACK ranges.  Only the parts of each
+  // range that are not on the scoreboard yet are looked at, so the cost does
+  // not depend on how many packets were acknowledged by earlier ACKs.
+  const uint64_t base = sent_.base();
+  const uint64_t prev_largest_acked = largest_acked_;
+  ranges.push_back(::std::make_pair(base, cumulative));
+  ::std::vector<RangeSet::Range> newly_acked;
+  for (const auto& range : ranges) {
+    const uint64_t start = ::std::max(range.first, base);
+    if (start < range.second)
+      scoreboard_.add(start, range.second, newly_acked);
+  }
+  uint64_t largest_newly_acked = 0;
+  for (const auto& range : newly_acked) {
+    for (uint64_t pn = range.first; pn < range.second; pn++) {
+      SentPacket& sent = sent_[pn];
+      SL_ASSERT(!sent.acked_);
+
+      // A packet sent before one that was already acknowledged arrived (or
+      // was acknowledged) out of order.  If it was declared lost, the
+      // reordering window was too small (RFC 8985 6.2 Step 4, with this
+      // standing in for a DSACK).
+      if (pn + 1 < prev_largest_acked)
+        reordering_seen_ = true;
+      if (!sent.inflight_) {
+        stats_.spurious_losses_++;
+        if (reo_wnd_round_ <= prev_largest_acked) {
+          reo_wnd_mult_++;
+          reo_wnd_round_ = next_pn;
+        }
+        reo_wnd_persist_ = kReoWndPersist;
+      }
+
+      on_packet_acked(sent);
+    }
+    largest_newly_acked = ::std::max(largest_newly_acked, range.second - 1);
+  }
+  if (newly_acked.empty())
+    return kErrorOk;
+
+  // Sample the RTT off the largest newly acknowledged packet, which is also
+  // the most recently sent one, since packet numbers are never reused
+  if (largest_newly_acked >= largest_acked_) {
+    largest_acked_ = largest_newly_acked + 1;
+    rack_rtt_ = now - sent_[largest_newly_acked].sent_;
+    on_rtt_sample(rack_rtt_);
+  }
+  if (tlp_outstanding_ && largest_acked_ > tlp_end_)
+    tlp_outstanding_ = false;
+
+  // Recovery ends once a packet sent after the loss was detected is
+  // acknowledged, or there is nothing left in flight
+  detect_losses(now);
+  if (in_recovery_ &&
+      (largest_acked_ > recovery_end_ || inflight_count_ == 0)) {
+    in_recovery_ = false;
+    if (reo_wnd_persist_ > 0 && --reo_wnd_persist_ == 0)
+      reo_wnd_mult_ = 1;
+  }
+  trim_sent(now);
+  rto_backoff_ = 0;
+  rto_base_ = now;
+  update_loss_timer();
+
+  return kErrorOk;
+}
+
+void NqtcpConnection::on_packet_acked(SentPacket& sent) {
+  if (sent.inflight_) {
+    inflight_count_--;
+    bytes_in_flight_ -= sent.len_;
+    sent.inflight_ = false;
+  }
+  sent.acked_ = true;
+
+  if (sent.stream_id_ != 0) {
+    NqtcpStream* stream = find_stream(sent.stream_id_);
+    if (stream != nullptr)
+      stream->on_acked(sent.offset_, sent.len_, sent.fin_);
+  }
+}
+
+void NqtcpConnection::on_packet_lost(SentPacket& sent) {
+  SL_ASSERT(sent.inflight_);
+
+  inflight_count_--;
+  bytes_in_flight_ -= sent.len_;
+  sent.inflight_ = false;
+  stats_.lost_packets_++;
+  if (!in_recovery_) {
+    in_recovery_ = true;
+    recovery_end_ = sent_.end();
+  }
+
+  if (sent.stream_id_ != 0) {
+    NqtcpStream* stream = find_stream(sent.stream_id_);
+    if (stream != nullptr) {
+      stream->on_lost(sent.offset_, sent.len_, sent.fin_);
+      schedule(stream);
+    }
+  }
+  if (sent.window_update_) {
+    for (auto& entry : streams_)
+      entry.second->force_window_update();
+  }
+}
+
+void NqtcpConnection::detect_losses(const Clock::time_point& now) {
+  // Packets are sent in packet number order, so the scan can stop at the
+  // first packet whose reordering window has not expired yet, and the next
+  // scan can resume from there.  Acknowledged packets are skipped a range at
+  // a time with the scoreboard.
+  const Clock::duration window = rack_rtt_ + reo_wnd();
+  rack_pending_ = false;
+  uint64_t pn = ::std::max(rack_next_, sent_.base());
+  for (;;) {
+    pn = scoreboard_.next_missing(pn);
+    if (pn + 1 >= largest_acked_)
+      break;
+
+    SentPacket& sent = sent_[pn];
+    if (sent.inflight_) {
+      const Clock::time_point deadline = sent.sent_ + window;
+      if (deadline > now) {
+        rack_deadline_ = deadline;
+        rack_pending_ = true;
+        break;
+      }
+      on_packet_lost(sent);
+    }
+    pn++;
+  }
+  rack_next_ = pn;
+}
+
+void NqtcpConnection::trim_sent(const Clock::time_point& now) {
+  // Lost packets are kept for a RTT past their loss being declared, so that
+  // a late acknowledgement can be recognized as a spurious loss
+  const Clock::duration keep = rack_rtt_ + reo_wnd() + srtt_;
+  const uint64_t base = sent_.base();
+  while (!sent_.empty()) {
+    const SentPacket& sent = sent_.front();
+    if (sent.inflight_ || (!sent.acked_ && sent.sent_ + keep > now))
+      break;
+    sent_.pop_front();
+  }
+  if (sent_.base() != base)
+    scoreboard_.erase_below(sent_.base());
+}
+
+void NqtcpConnection::on_rtt_sample(const Clock::duration& rtt) {
+  if (min_rtt_ == Clock::duration::zero() || rtt < min_rtt_)
+    min_rtt_ = rtt;
+
+  // RFC 6298
+  if (srtt_ == Clock::duration::zero()) {
+    srtt_ = rtt;
+    rttvar_ = rtt / 2;
+  } else {
+    const Clock::duration delta = srtt_ > rtt ? srtt_ - rtt : rtt - srtt_;
+    rttvar_ = (3 * rttvar_ + delta) / 4;
+    srtt_ = (7 * srtt_ + rtt) / 8;
+  }
+}
+
+void NqtcpConnection::update_loss_timer() {
+  if (reset_ || inflight_count_ == 0) {
+    loss_timer_->stop();
+    timer_mode_ = TimerMode::kNONE;
+    return;
+  }
+
+  // The RACK reordering window, a tail loss probe (RFC 8985 7.2, only when
+  // not recovering from loss, and with at most 1 probe outstanding), or the
+  // retransmission timeout, whichever is first
+  TimerMode mode = TimerMode::kRTO;
+  Clock::time_point deadline = rto_base_ + rto();
+  if (rack_pending_ && rack_deadline_ < deadline) {
+    mode = TimerMode::kREORDER;
+    deadline = rack_deadline_;
+  } else if (!in_recovery_ && !tlp_outstanding_ &&
+             last_sent_ + pto() < deadline) {
+    mode = TimerMode::kPROBE;
+    deadline = last_sent_ + pto();
+  }
+
+  if (timer_mode_ == mode && timer_deadline_ == deadline &&
+      loss_timer_->is_active())
+    return;
+  timer_mode_ = mode;
+  timer_deadline_ = deadline;
+  loss_timer_->start(to_timer_ms(deadline - clock_.now()));
+}
+
+void NqtcpConnection::on_loss_timer() {
+  if (reset_ || inflight_count_ == 0)
+    return;
+
+  const TimerMode mode = timer_mode_;
+  timer_mode_ = TimerMode::kNONE;
+  switch (mode) {
+  case TimerMode::kREORDER: {
+    const Clock::time_point now = clock_.now();
+    detect_losses(now);
+    trim_sent(now);
+    break;
+  }
+  case TimerMode::kPROBE:
+    send_probe();
+    break;
+  case TimerMode::kRTO:
+    on_rto();
+    break;
+  case TimerMode::kNONE:
+    break;
+  }
+
+  flush();
+}
+
+void NqtcpConnection::send_probe() {
+  // RFC 8985 7.3, the probe is exempt from max_inflight_
+  stats_.tlp_probes_++;
+  tlp_outstanding_ = true;
+  tlp_end_ = sent_.end();
+  rto_base_ = clock_.now();
+  if (window_allows() && send_next_packet())
+    return;
+
+  // Nothing new to send, so send the newest packet's data again
+  uint64_t pn = sent_.end();
+  while (pn > sent_.base() && !sent_[pn - 1].inflight_)
+    pn--;
+  SL_ASSERT(pn > sent_.base());
+  const SentPacket last = sent_[pn - 1];
+  NqtcpStream* stream = last.stream_id_ != 0 ?
+      find_stream(last.stream_id_) : nullptr;
+  if (stream != nullptr) {
+    // Anything that was acknowledged since (by a earlier probe) is gone
+    const uint64_t end = last.offset_ + last.len_;
+    const uint64_t offset = ::std::max(last.offset_, stream->send_base());
+    if (offset < end || last.fin_) {
+      const size_t len = offset < end ? static_cast<size_t>(end - offset) : 0;
+      packet::Packet pkt;
+      pkt.set_stream_id(last.stream_id_);
+      pkt.set_stream_offset(offset);
+      ::std::string* payload = pkt.mutable_payload();
+      payload->resize(len);
+      if (len > 0)
+        stream->copy(reinterpret_cast<uint8_t*>(&(*payload)[0]), offset, len);
+      if (last.fin_)
+        pkt.set_flags(packet::Packet::FIN);
+
+      SentPacket sent = SentPacket();
+      sent.stream_id_ = last.stream_id_;
+      sent.offset_ = offset;
+      sent.len_ = static_cast<uint32_t>(len);
+      sent.fin_ = last.fin_;
+      sent.window_update_ = fill_window_updates(pkt);
+      stats_.tx_retransmitted_bytes_ += len;
+      send_tracked(pkt, sent);
+      return;
+    }
+  }
+
+  // The newest packet only carried window updates
+  for (auto& entry : streams_)
+    entry.second->force_window_update();
+  send_next_packet();
+}
+
+void NqtcpConnection::on_rto() {
+  // Everything in flight is presumed lost
+  stats_.rto_expirations_++;
+  for (uint64_t pn = sent_.base(); pn < sent_.end(); pn++) {
+    SentPacket& sent = sent_[pn];
+    if (sent.inflight_)
+      on_packet_lost(sent);
+  }
+  trim_sent(clock_.now());
+  tlp_outstanding_ = false;
+  rack_pending_ = false;
+  rack_next_ = sent_.end();
+  if (rto_backoff_ < kMaxRtoBackoff)
+    rto_backoff_++;
+  rto_base_ = clock_.now();
+}
+
+} // namespace nqtcp
+} // namespace schwanenlied
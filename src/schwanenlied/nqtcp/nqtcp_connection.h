@@ -0,0 +1,702 @@
+/**
+ * @file    nqtcp_connection.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   NQTCP connection
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_NQTCP_NQTCP_CONNECTION_H__
+#define SCHWANENLIED_NQTCP_NQTCP_CONNECTION_H__
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/clock.h"
+#include "schwanenlied/timer.h"
+#include "schwanenlied/nqtcp/nqtcp_errors.h"
+#include "schwanenlied/nqtcp/nqtcp_range_set.h"
+#include "schwanenlied/nqtcp/nqtcp_sack.h"
+#include "schwanenlied/nqtcp/nqtcp_sent_ring.h"
+#include "schwanenlied/nqtcp/nqtcp_stream.h"
+
+// Autogenerated Protocol Buffers Header
+#include "nqtcp.pb.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+class NqtcpConnection;
+
+/**
+ * The NQTCP Callback interface
+ *
+ * NQTCP does not do any I/O of it's own.  Packets are handed to send_packet()
+ * (Eg: to be sent with lodp::LodpSession::send()), and the application feeds
+ * received packets (Eg: from lodp::LodpCallbacks::on_recv()) to
+ * NqtcpConnection::on_packet().
+ */
+class NqtcpCallbacks {
+ public:
+  virtual ~NqtcpCallbacks() {}
+
+  /**
+   * Transmit a packet to the peer
+   *
+   * Failure is treated like the packet being lost in transit.
+   *
+   * @param[in] conn  The NqtcpConnection sending the packet
+   * @param[in] buf   The packet
+   * @param[in] len   The length of the packet
+   *
+   * @returns kErrorOk  - Success
+   * @returns (Anything else) - The packet was not transmitted
+   */
+  virtual int send_packet(NqtcpConnection& conn,
+                          const uint8_t* buf,
+                          const size_t len) = 0;
+
+  /**
+   * Data (or the end of the stream) is available to
+   * NqtcpConnection::recv()
+   *
+   * This is also how the application learns of streams opened by the peer.
+   *
+   * @param[in] conn      The NqtcpConnection
+   * @param[in] stream_id The stream with data
+   */
+  virtual void on_readable(NqtcpConnection& conn,
+                           const uint32_t stream_id) = 0;
+
+  /**
+   * Space is available in the send buffer of a stream that a
+   * NqtcpConnection::send() call previously could not entirely buffer
+   *
+   * @param[in] conn      The NqtcpConnection
+   * @param[in] stream_id The stream with space
+   */
+  virtual void on_writable(NqtcpConnection& conn,
+                           const uint32_t stream_id) = 0;
+
+  /**
+   * The connection was reset
+   *
+   * Either the peer sent a RST, or the peer violated the protocol (in which
+   * case a RST is sent to the peer).  All further calls to the
+   * NqtcpConnection will fail with kErrorConnAborted.
+   *
+   * @param[in] conn  The NqtcpConnection
+   */
+  virtual void on_reset(NqtcpConnection& conn) = 0;
+};
+
+/** NqtcpConnection tunables */
+struct NqtcpConfig {
+  NqtcpConfig() :
+      max_payload_(1024),
+      send_buffer_size_(64 * 1024),
+      recv_buffer_size_(64 * 1024),
+      receive_window_(256 * 1024),
+      recv_autotune_limit_(4 * 1024 * 1024),
+      recv_idle_timeout_(::std::chrono::milliseconds(5000)),
+      max_streams_(64),
+      max_inflight_(64),
+      ack_frequency_(2),
+      max_ack_delay_(::std::chrono::milliseconds(25)),
+      initial_rto_(::std::chrono::milliseconds(1000)),
+      min_rto_(::std::chrono::milliseconds(200)),
+      max_rto_(::std::chrono::milliseconds(60000)) {}
+
+  /**
+   * The maximum number of stream bytes per packet
+   *
+   * max_payload_ + NqtcpConnection::kMaxOverhead must not exceed the
+   * lodp::LodpSession::mtu() of the underlying transport.
+   */
+  size_t max_payload_;
+  /** @{ */
+  /** The size of each stream's send buffer in bytes */
+  size_t send_buffer_size_;
+  /**
+   * The size of each stream's receive buffer (and flow control window) in
+   * bytes
+   *
+   * This is also the initial window assumed for the peer's streams, so both
+   * sides must use the same value.
+   */
+  size_t recv_buffer_size_;
+  /**
+   * The maximum number of stream bytes the peer may have unacknowledged
+   * (Before receive buffer autotuning)
+   */
+  uint32_t receive_window_;
+  /**
+   * The total amount of memory receive buffer autotuning may add on top of
+   * recv_buffer_size_ per stream, across all streams (0 disables autotuning)
+   */
+  size_t recv_autotune_limit_;
+  /**
+   * How long a stream's receive buffer has to go unread before it is shrunk
+   * back to recv_buffer_size_ (At least 4 RTTs are used regardless)
+   */
+  ::std::chrono::milliseconds recv_idle_timeout_;
+  /**
+   * The maximum number of concurrent streams opened by the peer
+   *
+   * The peer exceeding this is a protocol violation, so both sides must use
+   * the same value.
+   */
+  size_t max_streams_;
+  /** @} */
+
+  /**
+   * The maximum number of unacknowledged packets
+   *
+   * This is a fixed cap, congestion control is left to the application.
+   */
+  size_t max_inflight_;
+
+  /** @{ */
+  /**
+   * The number of packets received before a ACK is sent without waiting for
+   * max_ack_delay_ (1 acknowledges every packet immediately)
+   */
+  size_t ack_frequency_;
+  /**
+   * The maximum time a ACK is delayed by
+   *
+   * The peer allows for this in it's tail loss probe timeout, so both sides
+   * must use the same value.
+   */
+  ::std::chrono::milliseconds max_ack_delay_;
+  /** @} */
+
+  /** @{ */
+  ::std::chrono::milliseconds initial_rto_; /**< The RTO before any RTT samples */
+  ::std::chrono::milliseconds min_rto_;     /**< The minimum RTO */
+  ::std::chrono::milliseconds max_rto_;     /**< The maximum (backed off) RTO */
+  /** @} */
+};
+
+/** NqtcpConnection statistics */
+struct NqtcpStats {
+  NqtcpStats() :
+      tx_packets_(0),
+      tx_acks_(0),
+      tx_delayed_acks_(0),
+      tx_bytes_(0),
+      tx_retransmitted_bytes_(0),
+      rx_packets_(0),
+      rx_duplicates_(0),
+      rx_bytes_(0),
+      lost_packets_(0),
+      spurious_losses_(0),
+      tlp_probes_(0),
+      rto_expirations_(0) {}
+
+  /** @{ */
+  uint64_t tx_packets_;   /**< Packets sent (Including ACKs) */
+  uint64_t tx_acks_;      /**< ACK only packets sent */
+  uint64_t tx_delayed_acks_;  /**< ACK only packets sent by the ACK timer */
+  uint64_t tx_bytes_;     /**< Stream bytes sent (Including retransmissions) */
+  uint64_t tx_retransmitted_bytes_; /**< Stream bytes retransmitted */
+  /** @} */
+
+  /** @{ */
+  uint64_t rx_packets_;   /**< Packets received */
+  uint64_t rx_duplicates_;  /**< Duplicate packets received */
+  uint64_t rx_bytes_;     /**< Stream bytes received (Including duplicates) */
+  /** @} */
+
+  /** @{ */
+  uint64_t lost_packets_; /**< Packets declared lost */
+  uint64_t spurious_losses_;  /**< Lost packets that were acknowledged later */
+  uint64_t tlp_probes_;   /**< Tail loss probes sent */
+  uint64_t rto_expirations_;  /**< Retransmission timeouts */
+  /** @} */
+};
+
+/**
+ * A Not-Quite TCP connection
+ *
+ * A NqtcpConnection multiplexes independent bidirectional streams over a
+ * single datagram transport (Intended to be a lodp::LodpSession).  Every
+ * packet that carries stream data (or flow control updates) is assigned a new
+ * packet number, and loss detection/retransmission is done in terms of
+ * packets, while each stream has it's own offset space and flow control
+ * window.  A lost packet only holds up delivery on the stream that it carried
+ * data for, so streams do not suffer from head of line blocking behind each
+ * other.
+ *
+ * When more than one stream has data to send, the next packet is allocated
+ * using weighted fair queueing (start time fair queueing over stream bytes),
+ * so a stream that is idle most of the time (Eg: interactive traffic) is
+ * served ahead of streams that have been sending continuously (Eg: bulk
+ * transfers), and backlogged streams share the link in proportion to their
+ * weights.  Retransmissions are charged to the stream they belong to.
+ *
+ * Streams are opened implicitly by sending on them.  The initiator uses odd
+ * stream IDs, and the responder uses even stream IDs, so both sides can open
+ * streams without coordination.
+ *
+ * Loss detection is time based (RACK-TLP, RFC 8985).  Each packet's send time
+ * is kept, and a packet is lost once a packet sent after it has been
+ * acknowledged, and more than a RTT plus a reordering window has passed since
+ * it was sent.  The reordering window starts out as a quarter of the minimum
+ * RTT (0 while recovering from loss, or once kReorderingThreshold packets
+ * were acknowledged out of order, until reordering has been observed), and
+ * grows when a packet declared lost turns out to have been delivered.  When
+ * the tail of a burst is lost, and there is nothing later to acknowledge, a
+ * Tail Loss Probe (new data, or the most recently sent data again) is sent
+ * after 2 RTTs, so that the loss is detected by RACK instead of by the
+ * (exponentially backed off) retransmission timeout.
+ *
+ * The receive buffers are autotuned (Dynamic Right Sizing, as in Linux's
+ * tcp_rcv_space_adjust()).  Once per RTT, the amount of data the application
+ * read from a stream is measured, and if twice that exceeds the stream's
+ * receive window, the window (and the BipBuffer backing it) is grown to match,
+ * so that the peer is not limited by the window while it's sending rate
+ * increases.  Growth is limited by NqtcpConfig::recv_autotune_limit_ across
+ * all streams, and the receive_window advertised for the connection grows by
+ * the same amount.  Streams that are not read for
+ * NqtcpConfig::recv_idle_timeout_ shrink back to
+ * NqtcpConfig::recv_buffer_size_.
+ *
+ * All of the receive buffer memory past NqtcpConfig::recv_buffer_size_ per
+ * stream is charged against the limit: the flow control credit granted to the
+ * peer (Which stays charged after a shrink, until the peer uses it and the
+ * application reads it), and out of order data.  Autotuning never grows the
+ * charge past the limit.  Out of order data is not refused (It was already
+ * acknowledged), so it alone can take the charge past the limit, by at most
+ * the credit the peer holds on each stream, and no further growth happens
+ * until it drops back below.
+ *
+ * ACKs are piggybacked on outgoing packets whenever possible.  Otherwise a ACK
+ * only packet is sent once NqtcpConfig::ack_frequency_ packets have been
+ * received, or NqtcpConfig::max_ack_delay_ after the first unacknowledged
+ * packet, whichever comes first.  Packets that arrive out of order (or
+ * duplicated), and every packet while there are holes in what was received,
+ * are acknowledged immediately so that the sender's loss detection is not
+ * delayed.
+ */
+class NqtcpConnection {
+ public:
+  /** The default stream scheduling weight */
+  static const uint32_t kDefaultWeight = 16;
+  /** The maximum stream scheduling weight */
+  static const uint32_t kMaxWeight = 256;
+  /** The maximum packet overhead on top of NqtcpConfig::max_payload_ */
+  static const size_t kMaxOverhead = 384;
+  /** The maximum length of a sack_vector in bytes (See SackCodec) */
+  static const size_t kMaxSackBytes = 128;
+  /** The maximum number of stream flow control updates per packet */
+  static const size_t kMaxWindowUpdates = 8;
+  /**
+   * The number of packets acknowledged out of order before RACK's reordering
+   * window is disabled (Until reordering has been observed)
+   */
+  static const size_t kReorderingThreshold = 3;
+
+  /**
+   * Create a NqtcpConnection
+   *
+   * @param[in] callbacks     The NqtcpCallbacks instance
+   * @param[in] connection_id The connection ID (Must match the peer's)
+   * @param[in] is_initiator  Is this the initiator side of the connection?
+   * @param[in] config        The tunables
+   * @param[in] clock         The Clock used for timing and Timers
+   */
+  NqtcpConnection(NqtcpCallbacks& callbacks,
+                  const uint32_t connection_id,
+                  const bool is_initiator,
+                  const NqtcpConfig& config = NqtcpConfig(),
+                  Clock& clock = Clock::system());
+
+  ~NqtcpConnection();
+
+  /** @{ */
+  /** Get the user defined context handle */
+  void* context() const { return ctxt_; }
+  /** Set the user defined context handle */
+  void set_context(void* ctxt) { ctxt_ = ctxt; }
+  /** @} */
+
+  /** @{ */
+  /** Get the connection ID */
+  uint32_t connection_id() const { return connection_id_; }
+  /** Is the connection reset? */
+  bool is_reset() const { return reset_; }
+  /** Get the tunables */
+  const NqtcpConfig& config() const { return config_; }
+  /** Get the statistics */
+  const NqtcpStats& stats() const { return stats_; }
+  /** Get the number of open streams */
+  size_t nr_streams() const { return streams_.size(); }
+  /** Get the number of unacknowledged packets */
+  size_t nr_inflight() const { return inflight_count_; }
+  /** Get the smoothed RTT (0 if there are no samples yet) */
+  Clock::duration srtt() const { return srtt_; }
+  /** Get the minimum RTT (0 if there are no samples yet) */
+  Clock::duration min_rtt() const { return min_rtt_; }
+  /** Get the current (backed off) retransmission timeout */
+  Clock::duration rto() const;
+  /** Get the current tail loss probe timeout */
+  Clock::duration pto() const;
+  /** Get the current RACK reordering window */
+  Clock::duration reo_wnd() const;
+  /** Get the receive_window advertised to the peer */
+  uint32_t receive_window() const;
+  /** @} */
+
+  /** @{ */
+  /**
+   * Open a new stream
+   *
+   * @param[out] stream_id  The new stream's ID
+   * @param[in] weight      The scheduling weight (1 -> kMaxWeight)
+   *
+   * @returns kErrorOk            - Success
+   * @returns kErrorInval         - The weight is invalid
+   * @returns kErrorConnAborted   - The connection is reset
+   */
+  int open_stream(uint32_t& stream_id,
+                  const uint32_t weight = kDefaultWeight);
+
+  /**
+   * Change a stream's scheduling weight
+   *
+   * @param[in] stream_id The stream
+   * @param[in] weight    The scheduling weight (1 -> kMaxWeight)
+   *
+   * @returns kErrorOk            - Success
+   * @returns kErrorInval         - The weight is invalid
+   * @returns kErrorNoStream      - There is no such stream
+   * @returns kErrorConnAborted   - The connection is reset
+   */
+  int set_weight(const uint32_t stream_id,
+                 const uint32_t weight);
+
+  /**
+   * Send data on a stream
+   *
+   * As much data as fits in the stream's send buffer is buffered, and if not
+   * everything fit, on_writable() is called once there is space again.
+   *
+   * @param[in] stream_id The stream
+   * @param[in] buf       The data
+   * @param[in] len       The length of the data
+   * @param[out] written  The amount of data buffered
+   *
+   * @returns kErrorOk              - Success (Possibly with a partial write)
+   * @returns kErrorAgain           - The send buffer is full
+   * @returns kErrorInval           - The parameters are invalid
+   * @returns kErrorNoStream        - There is no such stream
+   * @returns kErrorStreamShutdown  - The stream was shut down
+   * @returns kErrorConnAborted     - The connection is reset
+   */
+  int send(const uint32_t stream_id,
+           const void* buf,
+           const size_t len,
+           size_t& written);
+
+  /**
+   * Shut down the sending side of a stream
+   *
+   * The FIN is sent after all of the buffered data.
+   *
+   * @param[in] stream_id The stream
+   *
+   * @returns kErrorOk            - Success
+   * @returns kErrorNoStream      - There is no such stream
+   * @returns kErrorConnAborted   - The connection is reset
+   */
+  int shutdown(const uint32_t stream_id);
+
+  /**
+   * Receive data from a stream
+   *
+   * Once both sides have shut down the stream, all data has been
+   * acknowledged, and everything was read, the stream is forgotten and
+   * subsequent calls return kErrorNoStream.
+   *
+   * @param[in] stream_id The stream
+   * @param[out] buf      The destination
+   * @param[in] len       The size of the destination
+   * @param[out] read     The amount of data read (0 on end of stream)
+   *
+   * @returns kErrorOk            - Success
+   * @returns kErrorAgain         - No data is available
+   * @returns kErrorInval         - The parameters are invalid
+   * @returns kErrorNoStream      - There is no such stream
+   * @returns kErrorConnAborted   - The connection is reset
+   */
+  int recv(const uint32_t stream_id,
+           void* buf,
+           const size_t len,
+           size_t& read);
+
+  /**
+   * Reset the connection
+   *
+   * A RST is sent to the peer, and all further calls will fail with
+   * kErrorConnAborted.  on_reset() is not called.
+   */
+  void reset();
+
+  /**
+   * Process a packet received from the peer
+   *
+   * @param[in] buf The packet
+   * @param[in] len The length of the packet
+   *
+   * @returns kErrorOk              - Success
+   * @returns kErrorBadPacketFormat - The packet is malformed, or is for a
+   *                                  different connection
+   * @returns kErrorFlowControl     - The peer violated flow control (The
+   *                                  connection is reset)
+   * @returns kErrorProtocol        - The peer violated the protocol (The
+   *                                  connection is reset)
+   * @returns kErrorTooManyStreams  - The peer opened too many streams (The
+   *                                  connection is reset)
+   * @returns kErrorConnAborted     - The connection is reset
+   */
+  int on_packet(const void* buf,
+                const size_t len);
+  /** @} */
+
+ private:
+  NqtcpConnection() = delete;
+  NqtcpConnection(const NqtcpConnection&) = delete;
+  void operator=(const NqtcpConnection&) = delete;
+
+  /** The event the loss detection Timer is armed for */
+  enum class TimerMode {
+    kNONE,      /**< Not armed */
+    kREORDER,   /**< The RACK reordering window of a packet expires */
+    kPROBE,     /**< A tail loss probe is due */
+    kRTO        /**< The retransmission timeout expires */
+  };
+
+  /** @{ */
+  /** Look up a stream */
+  NqtcpStream* find_stream(const uint32_t stream_id) const;
+
+  /**
+   * Look up (or implicitly open) a stream that the peer sent data on
+   *
+   * @param[in] stream_id The stream
+   * @param[out] stream   The stream (nullptr if it was already forgotten)
+   *
+   * @returns kErrorOk              - Success
+   * @returns kErrorProtocol        - The stream ID is invalid
+   * @returns kErrorTooManyStreams  - The peer opened too many streams
+   */
+  int peer_stream(const uint32_t stream_id,
+                  NqtcpStream*& stream);
+
+  /** Forget finished streams */
+  void reap_streams();
+  /** @} */
+
+  /** @{ */
+  /**
+   * Grow a stream's receive window if the application read close to a
+   * window's worth of data from it over the last RTT
+   */
+  void autotune(NqtcpStream* stream);
+
+  /** The receive buffer idle timer callback */
+  void on_idle_timer();
+
+  /**
+   * Return the receive buffer memory a stream holds on top of
+   * NqtcpConfig::recv_buffer_size_ (The receive buffer commitment past the
+   * initial size, and the out of order data)
+   */
+  size_t recv_charge(const NqtcpStream& stream) const;
+  /** @} */
+
+  /** @{ */
+  /** Add a stream with pending data to the scheduler */
+  void schedule(NqtcpStream* stream);
+  /** Remove and return the next stream to be served (or nullptr) */
+  NqtcpStream* next_stream();
+  /** @} */
+
+  /** @{ */
+  /** Transmit as much as allowed */
+  void flush();
+
+  /** Return if the peer's receive_window allows another full packet */
+  bool window_allows() const;
+
+  /**
+   * Send the next packet with stream data (or window updates) if any
+   *
+   * @returns true  - A packet was sent
+   * @returns false - There was nothing to send
+   */
+  bool send_next_packet();
+
+  /** Assign a packet number to a packet and send it */
+  void send_tracked(packet::Packet& pkt,
+                    const SentPacket& sent);
+
+  /** Populate the acknowledgement fields of a packet */
+  void fill_ack(packet::Packet& pkt);
+
+  /** Populate the stream window fields of a packet */
+  bool fill_window_updates(packet::Packet& pkt);
+
+  /** Serialize and send a packet */
+  void transmit(const packet::Packet& pkt);
+
+  /** Send a ACK only packet */
+  void send_ack();
+
+  /** The delayed ACK timer callback */
+  void on_ack_timer();
+
+  /** Send a RST */
+  void send_rst();
+
+  /** Reset the connection because the peer violated the protocol */
+  void abort();
+  /** @} */
+
+  /** @{ */
+  /** Process the acknowledgment fields of a packet */
+  int on_ack(const packet::Packet& pkt,
+             const Clock::time_point& now);
+
+  /** Mark a SentPacket as acknowledged */
+  void on_packet_acked(SentPacket& sent);
+
+  /** Mark a SentPacket as lost */
+  void on_packet_lost(SentPacket& sent);
+
+  /**
+   * Declare packets sent before the most recently sent acknowledged packet
+   * lost if their reordering window has expired (RACK)
+   */
+  void detect_losses(const Clock::time_point& now);
+
+  /** Discard the front of sent_ that is no longer of interest */
+  void trim_sent(const Clock::time_point& now);
+
+  /** Update the RTT estimate */
+  void on_rtt_sample(const Clock::duration& rtt);
+
+  /** (Re)arm or stop the loss detection timer */
+  void update_loss_timer();
+
+  /** The loss detection timer callback */
+  void on_loss_timer();
+
+  /** Send a tail loss probe */
+  void send_probe();
+
+  /** Handle the retransmission timeout */
+  void on_rto();
+  /** @} */
+
+  NqtcpCallbacks& callbacks_;   /**< The callback interface */
+  const NqtcpConfig config_;    /**< The tunables */
+  Clock& clock_;                /**< The Clock */
+  const uint32_t connection_id_;  /**< The connection ID */
+  const bool is_initiator_;     /**< Is this the initiator side? */
+  void* ctxt_;                  /**< The user defined context handle */
+  bool reset_;                  /**< The connection is reset */
+  NqtcpStats stats_;            /**< The statistics */
+
+  /** @{ */
+  ::std::map<uint32_t, ::std::unique_ptr<NqtcpStream>> streams_; /**< Streams */
+  uint32_t next_stream_id_;     /**< The next local stream ID */
+  uint32_t peer_next_stream_id_;  /**< The next unseen peer stream ID */
+  size_t nr_peer_streams_;      /**< The number of open peer streams */
+  ::std::set<::std::pair<uint64_t, uint32_t>> active_;  /**< The scheduler */
+  uint64_t virtual_time_;       /**< The WFQ virtual time */
+  ::std::set<uint32_t> blocked_;  /**< Streams waiting for on_writable() */
+  size_t recv_autotuned_;       /**< Sum of recv_charge() over streams_ */
+  ::std::unique_ptr<Timer> idle_timer_; /**< The receive buffer idle timer */
+  /** @} */
+
+  /** @{ */
+  SentRing sent_;               /**< Sent packets, by packet number */
+  size_t inflight_count_;       /**< Entries in sent_ that are in flight */
+  RangeSet scoreboard_;         /**< Acknowledged packets in sent_ */
+  uint64_t rack_next_;          /**< The oldest packet RACK has to look at */
+  size_t bytes_in_flight_;      /**< Stream bytes in flight */
+  uint64_t largest_acked_;      /**< The largest acknowledged packet + 1 */
+  Clock::time_point last_sent_; /**< When the newest packet was sent */
+  uint32_t peer_receive_window_;  /**< The peer's receive_window */
+  /** @} */
+
+  /** @{ */
+  RangeSet rx_ranges_;          /**< Received packet numbers */
+  uint64_t rx_cumulative_;      /**< All packets below this were received */
+  bool ack_pending_;            /**< A ACK needs to be sent */
+  bool ack_now_;                /**< The ACK should not be delayed */
+  size_t rx_unacked_;           /**< Packets received since the last ACK */
+  ::std::unique_ptr<Timer> ack_timer_;  /**< The delayed ACK timer */
+  /** @} */
+
+  /** @{ */
+  Clock::duration srtt_;        /**< The smoothed RTT */
+  Clock::duration rttvar_;      /**< The RTT variation */
+  Clock::duration min_rtt_;     /**< The minimum RTT */
+  /** @} */
+
+  /** @{ */
+  Clock::duration rack_rtt_;    /**< The newest acknowledged packet's RTT */
+  Clock::time_point rack_deadline_; /**< The next reordering window expiry */
+  bool rack_pending_;           /**< rack_deadline_ is valid */
+  bool reordering_seen_;        /**< Packets were acknowledged out of order */
+  unsigned reo_wnd_mult_;       /**< The reordering window multiplier */
+  unsigned reo_wnd_persist_;    /**< Recoveries until reo_wnd_mult_ resets */
+  uint64_t reo_wnd_round_;      /**< reo_wnd_mult_ grows once per round trip */
+  bool in_recovery_;            /**< Recovering from loss */
+  uint64_t recovery_end_;       /**< Recovery ends when this is acknowledged */
+  bool tlp_outstanding_;        /**< A tail loss probe was sent */
+  uint64_t tlp_end_;            /**< The probe ends when this is acknowledged */
+  unsigned rto_backoff_;        /**< The RTO backoff exponent */
+  Clock::time_point rto_base_;  /**< The RTO is relative to this */
+  TimerMode timer_mode_;        /**< What loss_timer_ is armed for */
+  Clock::time_point timer_deadline_;  /**< When loss_timer_ fires */
+  ::std::unique_ptr<Timer> loss_timer_; /**< The loss detection timer */
+  /** @} */
+};
+
+} // namespace nqtcp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_NQTCP_NQTCP_CONNECTION_H__
@@ -0,0 +1,72 @@
+/**
+ * @file    nqtcp_errors.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   NQTCP error codes
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_NQTCP_NQTCP_ERRORS_H__
+#define SCHWANENLIED_NQTCP_NQTCP_ERRORS_H__
+
+namespace schwanenlied {
+namespace nqtcp {
+
+/**
+ * The base offset of all NQTCP specific errors
+ *
+ * See lodp::kErrorOffset, NQTCP uses the next unused portion of the return
+ * code space so that it's errors can be propagated through LODP callbacks.
+ */
+const int kErrorOffset = 0x0030000;
+
+/** @{ */
+/** No such stream */
+const int kErrorNoStream = -(kErrorOffset | 1);
+/** The sending side of the stream has been shut down */
+const int kErrorStreamShutdown = -(kErrorOffset | 2);
+/** Too many concurrent streams */
+const int kErrorTooManyStreams = -(kErrorOffset | 3);
+/** @} */
+
+/** @{ */
+/** Packet is not a protobuf, or is for a different connection */
+const int kErrorBadPacketFormat = -(kErrorOffset | 10);
+/** @} */
+
+/** @{ */
+/** Protocol error */
+const int kErrorProtocol = -(kErrorOffset | 20);
+/** The peer sent more than the flow control window allowed */
+const int kErrorFlowControl = -(kErrorOffset | 21);
+/** @} */
+
+} // namespace nqtcp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_NQTCP_NQTCP_ERRORS_H__
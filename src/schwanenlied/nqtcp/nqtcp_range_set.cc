@@ -0,0 +1,141 @@
+/**
+ * @file    nqtcp_range_set.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   NQTCP set of disjoint ranges (IMPLEMENTATION)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iterator>
+
+#include "schwanenlied/nqtcp/nqtcp_range_set.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+void RangeSet::add(uint64_t start,
+                   uint64_t end) {
+  if (start >= end)
+    return;
+
+  // Absorb the range that starts at or before start, if it touches
+  auto it = ranges_.upper_bound(start);
+  if (it != ranges_.begin()) {
+    auto prev = ::std::prev(it);
+    if (prev->second >= start) {
+      if (prev->second >= end)
+        return;
+      start = prev->first;
+      total_ -= prev->second - prev->first;
+      ranges_.erase(prev);
+    }
+  }
+
+  // Absorb every range that starts within [start, end]
+  it = ranges_.lower_bound(start);
+  while (it != ranges_.end() && it->first <= end) {
+    if (it->second > end)
+      end = it->second;
+    total_ -= it->second - it->first;
+    it = ranges_.erase(it);
+  }
+
+  ranges_[start] = end;
+  total_ += end - start;
+}
+
+void RangeSet::add(const uint64_t start,
+                   const uint64_t end,
+                   ::std::vector<Range>& added) {
+  if (start >= end)
+    return;
+
+  // Walk the holes in [start, end)
+  uint64_t pos = next_missing(start);
+  for (auto it = ranges_.lower_bound(pos);
+       pos < end && it != ranges_.end() && it->first < end; ++it) {
+    added.push_back(::std::make_pair(pos, it->first));
+    pos = it->second;
+  }
+  if (pos < end)
+    added.push_back(::std::make_pair(pos, end));
+
+  add(start, end);
+}
+
+void RangeSet::subtract(const uint64_t start,
+                        const uint64_t end) {
+  if (start >= end || ranges_.empty())
+    return;
+
+  // Split the range that starts before start, if it overlaps
+  auto it = ranges_.lower_bound(start);
+  if (it != ranges_.begin()) {
+    auto prev = ::std::prev(it);
+    if (prev->second > start) {
+      const uint64_t prev_end = prev->second;
+      total_ -= prev_end - start;
+      prev->second = start;
+      if (prev_end > end) {
+        ranges_[end] = prev_end;
+        total_ += prev_end - end;
+        return;
+      }
+    }
+  }
+
+  // Remove/trim every range that starts within [start, end)
+  while (it != ranges_.end() && it->first < end) {
+    const uint64_t it_end = it->second;
+    total_ -= it_end - it->first;
+    it = ranges_.erase(it);
+    if (it_end > end) {
+      ranges_[end] = it_end;
+      total_ += it_end - end;
+      break;
+    }
+  }
+}
+
+bool RangeSet::contains(const uint64_t v) const {
+  auto it = ranges_.upper_bound(v);
+  if (it == ranges_.begin())
+    return false;
+  return ::std::prev(it)->second > v;
+}
+
+uint64_t RangeSet::next_missing(const uint64_t v) const {
+  auto it = ranges_.upper_bound(v);
+  if (it == ranges_.begin())
+    return v;
+  --it;
+  return it->second > v ? it->second : v;
+}
+
+} // namespace nqtcp
+} // namespace schwanenlied
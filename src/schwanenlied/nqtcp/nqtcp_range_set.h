@@ -0,0 +1,133 @@
+/**
+ * @file    nqtcp_range_set.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   NQTCP set of disjoint ranges
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_NQTCP_NQTCP_RANGE_SET_H__
+#define SCHWANENLIED_NQTCP_NQTCP_RANGE_SET_H__
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "schwanenlied/common.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+/**
+ * A set of disjoint half open [start, end) ranges of uint64_t
+ *
+ * This is used to track received packet numbers, and acknowledged/lost stream
+ * offsets.  Adjacent and overlapping ranges are merged, so the storage is
+ * proportional to the number of holes, not the number of values.
+ */
+class RangeSet {
+ public:
+  /** The underlying storage (start -> end) */
+  typedef ::std::map<uint64_t, uint64_t> Map;
+  /** A [start, end) range */
+  typedef ::std::pair<uint64_t, uint64_t> Range;
+
+  RangeSet() : total_(0) {}
+
+  /** @{ */
+  /** Return if the RangeSet is empty */
+  bool empty() const { return ranges_.empty(); }
+  /** Return the number of disjoint ranges */
+  size_t size() const { return ranges_.size(); }
+  /** Return the number of values in the RangeSet */
+  uint64_t total() const { return total_; }
+  /** Return the ranges, ordered by start */
+  const Map& ranges() const { return ranges_; }
+  /** @} */
+
+  /** @{ */
+  /**
+   * Add a range
+   *
+   * @param[in] start The start of the range
+   * @param[in] end   The end of the range (exclusive)
+   */
+  void add(const uint64_t start,
+           const uint64_t end);
+
+  /**
+   * Add a range, and report the parts of it that were not present
+   *
+   * This is O(log n) in the number of ranges, plus the number of ranges that
+   * the new range overlaps.
+   *
+   * @param[in] start   The start of the range
+   * @param[in] end     The end of the range (exclusive)
+   * @param[out] added  The newly added ranges are appended to this, in order
+   */
+  void add(const uint64_t start,
+           const uint64_t end,
+           ::std::vector<Range>& added);
+
+  /**
+   * Remove a range
+   *
+   * @param[in] start The start of the range
+   * @param[in] end   The end of the range (exclusive)
+   */
+  void subtract(const uint64_t start,
+                const uint64_t end);
+
+  /** Remove every value below v */
+  void erase_below(const uint64_t v) { subtract(0, v); }
+
+  /** Remove everything */
+  void clear() {
+    ranges_.clear();
+    total_ = 0;
+  }
+
+  /** Return if v is in the RangeSet */
+  bool contains(const uint64_t v) const;
+
+  /** Return the smallest value >= v that is not in the RangeSet */
+  uint64_t next_missing(const uint64_t v) const;
+  /** @} */
+
+ private:
+  RangeSet(const RangeSet&) = delete;
+  void operator=(const RangeSet&) = delete;
+
+  Map ranges_;      /**< The ranges */
+  uint64_t total_;  /**< The number of values */
+};
+
+} // namespace nqtcp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_NQTCP_NQTCP_RANGE_SET_H__
@@ -0,0 +1,120 @@
+/*
+ * nqtcp_range_set_test.cc: NQTCP RangeSet tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <vector>
+
+#include "schwanenlied/nqtcp/nqtcp_range_set.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+class RangeSetTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {};
+  virtual void TearDown() {};
+};
+
+TEST_F(RangeSetTest, AddSubtract) {
+  RangeSet set;
+  ASSERT_TRUE(set.empty());
+
+  // Disjoint, adjacent and overlapping ranges
+  set.add(10, 20);
+  set.add(30, 40);
+  set.add(20, 25);
+  set.add(5, 5);
+  ASSERT_EQ(2u, set.size());
+  ASSERT_EQ(25u, set.total());
+  set.add(24, 31);
+  ASSERT_EQ(1u, set.size());
+  ASSERT_EQ(30u, set.total());
+  set.add(0, 100);
+  ASSERT_EQ(1u, set.size());
+  ASSERT_EQ(100u, set.total());
+
+  // Punch holes
+  set.subtract(10, 20);
+  set.subtract(50, 60);
+  ASSERT_EQ(3u, set.size());
+  ASSERT_EQ(80u, set.total());
+  ASSERT_TRUE(set.contains(9));
+  ASSERT_FALSE(set.contains(10));
+  ASSERT_FALSE(set.contains(19));
+  ASSERT_TRUE(set.contains(20));
+  ASSERT_TRUE(set.contains(99));
+  ASSERT_FALSE(set.contains(100));
+
+  // Subtract across multiple ranges
+  set.subtract(5, 55);
+  ASSERT_EQ(2u, set.size());
+  ASSERT_EQ(45u, set.total());
+  ASSERT_EQ(0u, set.ranges().begin()->first);
+  ASSERT_EQ(5u, set.ranges().begin()->second);
+
+  set.erase_below(70);
+  ASSERT_EQ(1u, set.size());
+  ASSERT_EQ(70u, set.ranges().begin()->first);
+  ASSERT_EQ(30u, set.total());
+  set.clear();
+  ASSERT_TRUE(set.empty());
+  ASSERT_EQ(0u, set.total());
+}
+
+TEST_F(RangeSetTest, AddReport) {
+  RangeSet set;
+  set.add(10, 20);
+  set.add(30, 40);
+  ASSERT_EQ(5u, set.next_missing(5));
+  ASSERT_EQ(20u, set.next_missing(10));
+  ASSERT_EQ(20u, set.next_missing(19));
+  ASSERT_EQ(20u, set.next_missing(20));
+  ASSERT_EQ(40u, set.next_missing(35));
+
+  // Only the holes are reported
+  ::std::vector<RangeSet::Range> added;
+  set.add(15, 50, added);
+  ASSERT_EQ(2u, added.size());
+  ASSERT_EQ(RangeSet::Range(20, 30), added[0]);
+  ASSERT_EQ(RangeSet::Range(40, 50), added[1]);
+  ASSERT_EQ(1u, set.size());
+  ASSERT_EQ(40u, set.total());
+
+  added.clear();
+  set.add(12, 48, added);
+  ASSERT_TRUE(added.empty());
+  set.add(0, 60, added);
+  ASSERT_EQ(2u, added.size());
+  ASSERT_EQ(RangeSet::Range(0, 10), added[0]);
+  ASSERT_EQ(RangeSet::Range(50, 60), added[1]);
+  ASSERT_EQ(60u, set.total());
+}
+
+} // namespace nqtcp
+} // namespace schwanenlied
@@ -0,0 +1,233 @@
+/**
+ * @file    nqtcp_sack.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   NQTCP selective acknowledgement encoding (IMPLEMENTATION)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+
+#include "schwanenlied/nqtcp/nqtcp_errors.h"
+#include "schwanenlied/nqtcp/nqtcp_sack.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+const uint64_t SackCodec::kMaxBitmapBits;
+
+namespace {
+
+size_t varint_len(uint64_t v) {
+  size_t n = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+void put_varint(::std::string& buf,
+                uint64_t v) {
+  while (v >= 0x80) {
+    buf.push_back(static_cast<char>((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  buf.push_back(static_cast<char>(v));
+}
+
+bool get_varint(const uint8_t*& p,
+                const uint8_t* end,
+                uint64_t& v) {
+  v = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (p == end)
+      return false;
+    const uint8_t b = *p++;
+    v |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if ((b & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+} // namespace
+
+void SackCodec::encode(const uint64_t cumulative,
+                       const RangeSet& received,
+                       const size_t max_len,
+                       ::std::string& out) {
+  out.clear();
+  if (received.empty())
+    return;
+
+  const RangeSet::Map& ranges = received.ranges();
+  const uint64_t floor = cumulative + 1;
+  SL_ASSERT(ranges.begin()->first >= floor);
+  uint64_t cursor = ranges.rbegin()->second;
+  put_varint(out, cursor - cumulative);
+  if (out.size() > max_len) {
+    out.clear();
+    return;
+  }
+
+  ::std::string block;
+  auto it = ranges.rbegin();
+  while (it != ranges.rend()) {
+    // Find the bitmap (starting at the cursor, and ending at the bottom of a
+    // range) that fits and saves the most over encoding the same ranges as
+    // runs
+    const size_t remaining = max_len - out.size();
+    uint64_t bits = 0;
+    size_t saving = 0;
+    size_t run_cost = 0;
+    uint64_t c = cursor;
+    for (auto j = it; j != ranges.rend(); ++j) {
+      const uint64_t start = j->first;
+      const uint64_t end = ::std::min(j->second, cursor);
+      if (cursor - start > kMaxBitmapBits)
+        break;
+      run_cost += varint_len((c - end) << 1) + varint_len(end - start - 1);
+      c = start;
+
+      const uint64_t nr_bits = (cursor - start + 7) & ~static_cast<uint64_t>(7);
+      if (cursor - floor < nr_bits)
+        break;
+      const size_t bitmap_cost = varint_len(((nr_bits / 8 - 1) << 1) | 1) +
+          nr_bits / 8;
+      if (bitmap_cost > remaining)
+        break;
+      if (run_cost > bitmap_cost + saving) {
+        saving = run_cost - bitmap_cost;
+        bits = nr_bits;
+      }
+    }
+
+    block.clear();
+    auto next = it;
+    uint64_t next_cursor;
+    if (bits > 0) {
+      put_varint(block, ((bits / 8 - 1) << 1) | 1);
+      const size_t hdr_len = block.size();
+      block.resize(hdr_len + bits / 8, '\0');
+      next_cursor = cursor - bits;
+      for (; next != ranges.rend() && next->second > next_cursor; ++next) {
+        const uint64_t start = ::std::max(next->first, next_cursor);
+        const uint64_t end = ::std::min(next->second, cursor);
+        for (uint64_t pn = start; pn < end; pn++) {
+          const uint64_t i = cursor - 1 - pn;
+          block[hdr_len + i / 8] |= static_cast<char>(1 << (i % 8));
+        }
+        // The bottom of the bitmap can split a range
+        if (next->first < next_cursor)
+          break;
+      }
+    } else {
+      const uint64_t end = ::std::min(it->second, cursor);
+      put_varint(block, (cursor - end) << 1);
+      put_varint(block, end - it->first - 1);
+      next_cursor = it->first;
+      ++next;
+    }
+
+    // Leave out whatever does not fit
+    if (out.size() + block.size() > max_len)
+      break;
+    out += block;
+    cursor = next_cursor;
+    it = next;
+  }
+}
+
+int SackCodec::decode(const uint64_t cumulative,
+                      const uint64_t limit,
+                      const uint8_t* buf,
+                      const size_t len,
+                      ::std::vector<RangeSet::Range>& ranges) {
+  SL_ASSERT(cumulative <= limit);
+  if (len == 0)
+    return kErrorOk;
+
+  const uint8_t* p = buf;
+  const uint8_t* end = buf + len;
+  const uint64_t floor = cumulative + 1;
+  uint64_t top;
+  if (!get_varint(p, end, top) || top < 2)
+    return kErrorBadPacketFormat;
+  if (top > limit - cumulative)
+    return kErrorProtocol;
+
+  uint64_t cursor = cumulative + top;
+  while (p != end) {
+    uint64_t h;
+    if (!get_varint(p, end, h))
+      return kErrorBadPacketFormat;
+
+    if (h & 1) {
+      // Bitmap
+      const uint64_t nr_bytes = (h >> 1) + 1;
+      if (nr_bytes > static_cast<uint64_t>(end - p) ||
+          nr_bytes > (cursor - floor) / 8)
+        return kErrorBadPacketFormat;
+      const uint64_t nr_bits = nr_bytes * 8;
+      uint64_t run_end = 0;
+      for (uint64_t i = 0; i < nr_bits; i++) {
+        const uint64_t pn = cursor - 1 - i;
+        const bool is_set = (p[i / 8] >> (i % 8)) & 1;
+        if (is_set && run_end == 0)
+          run_end = pn + 1;
+        else if (!is_set && run_end != 0) {
+          ranges.push_back(::std::make_pair(pn + 1, run_end));
+          run_end = 0;
+        }
+      }
+      cursor -= nr_bits;
+      if (run_end != 0)
+        ranges.push_back(::std::make_pair(cursor, run_end));
+      p += nr_bytes;
+    } else {
+      // Run
+      const uint64_t gap = h >> 1;
+      uint64_t n;
+      if (!get_varint(p, end, n))
+        return kErrorBadPacketFormat;
+      if (gap > cursor - floor)
+        return kErrorBadPacketFormat;
+      cursor -= gap;
+      if (n >= cursor - floor)
+        return kErrorBadPacketFormat;
+      ranges.push_back(::std::make_pair(cursor - n - 1, cursor));
+      cursor -= n + 1;
+    }
+  }
+
+  return kErrorOk;
+}
+
+} // namespace nqtcp
+} // namespace schwanenlied
@@ -0,0 +1,119 @@
+/**
+ * @file    nqtcp_sack.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   NQTCP selective acknowledgement encoding
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_NQTCP_NQTCP_SACK_H__
+#define SCHWANENLIED_NQTCP_NQTCP_SACK_H__
+
+#include <string>
+#include <vector>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/nqtcp/nqtcp_range_set.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+/**
+ * The sack_vector codec
+ *
+ * sack_vector describes the packets received above the cumulative
+ * acknowledgment (The first missing packet number), from the highest one
+ * down, as a sequence of [LEB128](https://en.wikipedia.org/wiki/LEB128)
+ * varints:
+ *
+ *     top                      Highest received packet number + 1 - cumulative
+ *     block*
+ *
+ * Each block starts with a header varint h, and describes the packets
+ * immediately below a cursor, which starts at the top:
+ *
+ *  * Run (h & 1 == 0):  (h >> 1) missing packets, followed by a varint n,
+ *    and (n + 1) received packets.
+ *  * Bitmap (h & 1 == 1):  (h >> 1) + 1 bytes follow, with bit i (LSB first)
+ *    set if packet cursor - 1 - i was received.
+ *
+ * Blocks may not extend down to the cumulative acknowledgment.  The encoder
+ * picks a bitmap wherever it is smaller than the equivalent runs (Eg: where
+ * every other packet was lost), and stops once the next block would exceed
+ * the size limit, so the ranges closest to the cumulative acknowledgment are
+ * the ones that are left out.
+ */
+class SackCodec {
+ public:
+  /** The maximum number of packets covered by one bitmap block */
+  static const uint64_t kMaxBitmapBits = 512;
+
+  /**
+   * Encode the received packets
+   *
+   * @param[in] cumulative  The cumulative acknowledgment
+   * @param[in] received    The received packet numbers above cumulative
+   * @param[in] max_len     The maximum length of the encoding
+   * @param[out] out        The encoding (Empty if received is)
+   */
+  static void encode(const uint64_t cumulative,
+                     const RangeSet& received,
+                     const size_t max_len,
+                     ::std::string& out);
+
+  /**
+   * Decode the received packets
+   *
+   * @param[in] cumulative  The cumulative acknowledgment
+   * @param[in] limit       The next packet number that will be sent
+   * @param[in] buf         The encoding
+   * @param[in] len         The length of the encoding
+   * @param[out] ranges     The received ranges are appended to this, from the
+   *                        highest down
+   *
+   * @returns kErrorOk              - Success
+   * @returns kErrorBadPacketFormat - The encoding is malformed
+   * @returns kErrorProtocol        - A packet that was never sent is
+   *                                  acknowledged
+   */
+  static int decode(const uint64_t cumulative,
+                    const uint64_t limit,
+                    const uint8_t* buf,
+                    const size_t len,
+                    ::std::vector<RangeSet::Range>& ranges);
+
+ private:
+  SackCodec() = delete;
+  SackCodec(const SackCodec&) = delete;
+  void operator=(const SackCodec&) = delete;
+};
+
+} // namespace nqtcp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_NQTCP_NQTCP_SACK_H__
@@ -0,0 +1,175 @@
+/*
+ * nqtcp_sack_test.cc: NQTCP selective acknowledgement encoding tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string>
+#include <vector>
+
+#include "schwanenlied/nqtcp/nqtcp_errors.h"
+#include "schwanenlied/nqtcp/nqtcp_sack.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+class SackCodecTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {};
+  virtual void TearDown() {};
+
+  // Encode and decode, and return the decoded ranges as a RangeSet
+  static void round_trip(const uint64_t cumulative,
+                         const RangeSet& received,
+                         const size_t max_len,
+                         ::std::string& encoded,
+                         RangeSet& decoded) {
+    SackCodec::encode(cumulative, received, max_len, encoded);
+    ASSERT_GE(max_len, encoded.size());
+    ::std::vector<RangeSet::Range> ranges;
+    ASSERT_EQ(kErrorOk, SackCodec::decode(
+        cumulative, received.ranges().rbegin()->second,
+        reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size(),
+        ranges));
+    for (size_t i = 0; i < ranges.size(); i++) {
+      ASSERT_LT(ranges[i].first, ranges[i].second);
+      if (i > 0) {
+        ASSERT_LE(ranges[i].second, ranges[i - 1].first);
+      }
+      decoded.add(ranges[i].first, ranges[i].second);
+    }
+  }
+
+  static int decode(const ::std::string& buf) {
+    ::std::vector<RangeSet::Range> ranges;
+    return SackCodec::decode(1000, 2000,
+                             reinterpret_cast<const uint8_t*>(buf.data()),
+                             buf.size(), ranges);
+  }
+};
+
+TEST_F(SackCodecTest, RoundTrip) {
+  // A mix of long runs, long holes, and dense loss, at a large offset
+  uint32_t lcg = 1;
+  for (int iter = 0; iter < 64; iter++) {
+    const uint64_t cumulative = (static_cast<uint64_t>(iter) << 33) + iter;
+    RangeSet received;
+    uint64_t pn = cumulative + 1;
+    for (int i = 0; i < 200; i++) {
+      lcg = lcg * 1103515245 + 12345;
+      const unsigned r = lcg >> 16;
+      const uint64_t len = (r & 3) == 0 ? (r >> 2) % 300 + 1 : 1;
+      const uint64_t gap = (r & 12) == 0 ? (r >> 4) % 1000 + 1 : 1;
+      received.add(pn, pn + len);
+      pn += len + gap;
+    }
+
+    ::std::string encoded;
+    RangeSet decoded;
+    round_trip(cumulative, received, 64 * 1024, encoded, decoded);
+    ASSERT_EQ(received.ranges(), decoded.ranges());
+  }
+
+  // Nothing received
+  RangeSet received;
+  ::std::string encoded("junk");
+  SackCodec::encode(10, received, 128, encoded);
+  ASSERT_TRUE(encoded.empty());
+}
+
+TEST_F(SackCodecTest, Compact) {
+  // Every other packet lost, over 2000 packets
+  const uint64_t cumulative = 5000;
+  RangeSet received;
+  for (uint64_t pn = cumulative + 1; pn < cumulative + 2000; pn += 2)
+    received.add(pn, pn + 1);
+
+  // 16 (start, end) pairs of 32 bit packet numbers used to report 16 packets
+  // in 128 bytes, bitmaps cover almost 1000 (Half of which were received)
+  ::std::string encoded;
+  RangeSet decoded;
+  round_trip(cumulative, received, 128, encoded, decoded);
+  ASSERT_LT(450u, decoded.total());
+  ASSERT_EQ(received.ranges().rbegin()->second,
+            decoded.ranges().rbegin()->second);
+  for (const auto& range : decoded.ranges())
+    ASSERT_TRUE(received.contains(range.first));
+
+  // Sparse losses are encoded as runs
+  received.clear();
+  received.add(cumulative + 1, cumulative + 10000);
+  received.add(cumulative + 20000, cumulative + 30000);
+  decoded.clear();
+  round_trip(cumulative, received, 128, encoded, decoded);
+  ASSERT_GE(12u, encoded.size());
+  ASSERT_EQ(received.ranges(), decoded.ranges());
+}
+
+TEST_F(SackCodecTest, Truncate) {
+  const uint64_t cumulative = 0;
+  RangeSet received;
+  for (uint64_t pn = 1; pn < 100000; pn += 1000)
+    received.add(pn, pn + 10);
+
+  // The ranges closest to the cumulative acknowledgment are left out
+  ::std::string encoded;
+  RangeSet decoded;
+  round_trip(cumulative, received, 16, encoded, decoded);
+  ASSERT_LT(0u, decoded.size());
+  ASSERT_GT(received.size(), decoded.size());
+  auto it = received.ranges().rbegin();
+  for (auto d = decoded.ranges().rbegin(); d != decoded.ranges().rend();
+       ++d, ++it)
+    ASSERT_EQ(*it, *d);
+}
+
+TEST_F(SackCodecTest, Malformed) {
+  // Cumulative 1000, limit 2000
+  ASSERT_EQ(kErrorOk, decode(::std::string("\x0a\x00\x00", 3)));
+  ASSERT_EQ(kErrorOk, decode(::std::string("\x11\x01\x55", 3)));
+
+  // Truncated varints
+  ASSERT_EQ(kErrorBadPacketFormat, decode("\x80"));
+  ASSERT_EQ(kErrorBadPacketFormat, decode(::std::string("\x0a\x00", 2)));
+  ASSERT_EQ(kErrorBadPacketFormat, decode(::std::string("\x0a\x00\x80", 3)));
+
+  // Top too small, or beyond what was sent
+  ASSERT_EQ(kErrorBadPacketFormat, decode("\x01"));
+  ASSERT_EQ(kErrorProtocol, decode("\xe9\x07"));
+
+  // Runs and bitmaps that extend to the cumulative acknowledgment
+  ASSERT_EQ(kErrorBadPacketFormat, decode(::std::string("\x0a\x00\x09", 3)));
+  ASSERT_EQ(kErrorBadPacketFormat, decode(::std::string("\x0a\x12\x00", 3)));
+  ASSERT_EQ(kErrorBadPacketFormat, decode(::std::string("\x0a\x03\xff\xff",
+                                                        4)));
+
+  // Bitmap longer than the buffer
+  ASSERT_EQ(kErrorBadPacketFormat, decode(::std::string("\x11\x03\xff", 3)));
+}
+
+} // namespace nqtcp
+} // namespace schwanenlied
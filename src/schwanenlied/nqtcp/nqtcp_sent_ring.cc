@@ -0,0 +1,70 @@
+/**
+ * @file    nqtcp_sent_ring.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   NQTCP in-flight packet ring (IMPLEMENTATION)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "schwanenlied/nqtcp/nqtcp_sent_ring.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+SentRing::SentRing(const size_t capacity) :
+    base_(0),
+    end_(0) {
+  size_t sz = 1;
+  while (sz < capacity)
+    sz <<= 1;
+  ring_.resize(sz);
+  mask_ = sz - 1;
+}
+
+SentPacket& SentRing::push_back() {
+  if (size() == ring_.size())
+    grow();
+
+  SentPacket& ret = ring_[end_ & mask_];
+  end_++;
+  ret = SentPacket();
+
+  return ret;
+}
+
+void SentRing::grow() {
+  ::std::vector<SentPacket> ring(ring_.size() * 2);
+  const uint64_t mask = ring.size() - 1;
+  for (uint64_t pn = base_; pn < end_; pn++)
+    ring[pn & mask] = ring_[pn & mask_];
+  ring_.swap(ring);
+  mask_ = mask;
+}
+
+} // namespace nqtcp
+} // namespace schwanenlied
@@ -0,0 +1,141 @@
+/**
+ * @file    nqtcp_sent_ring.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   NQTCP in-flight packet ring
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_NQTCP_NQTCP_SENT_RING_H__
+#define SCHWANENLIED_NQTCP_NQTCP_SENT_RING_H__
+
+#include <vector>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/clock.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+/**
+ * The bookkeeping for a packet that was sent with a packet number
+ *
+ * The packet number is implied by the position in the SentRing, so this is
+ * kept as small as possible.
+ */
+struct SentPacket {
+  Clock::time_point sent_;  /**< The time the packet was sent */
+  uint64_t offset_;         /**< The stream offset of the payload */
+  uint32_t stream_id_;      /**< The stream ID (0 = No stream data) */
+  uint32_t len_;            /**< The length of the payload */
+  bool fin_;                /**< Did the packet carry a FIN? */
+  bool window_update_;      /**< Did the packet carry window updates? */
+  bool inflight_;           /**< Neither acknowledged nor lost yet */
+  bool acked_;              /**< Acknowledged (Lost if !inflight_ && !acked_) */
+};
+
+/**
+ * A ring of SentPackets indexed by packet number
+ *
+ * Packet numbers are assigned sequentially and are never reused, so the
+ * packets from the oldest one that is still of interest to the newest one
+ * sent form a contiguous window.  The window is stored in a power of 2 sized
+ * ring (which grows when needed), so looking up a packet number is a mask
+ * and a index, and the entries are contiguous in memory for the loss
+ * detection scans.
+ */
+class SentRing {
+ public:
+  /**
+   * Create a SentRing
+   *
+   * @param[in] capacity  The initial capacity (Rounded up to a power of 2)
+   */
+  explicit SentRing(const size_t capacity);
+
+  /** @{ */
+  /** Return the packet number of the oldest entry */
+  uint64_t base() const { return base_; }
+  /** Return the packet number that the next entry will have */
+  uint64_t end() const { return end_; }
+  /** Return the number of entries */
+  size_t size() const { return static_cast<size_t>(end_ - base_); }
+  /** Return if the SentRing is empty */
+  bool empty() const { return base_ == end_; }
+  /** Return the number of entries that fit without growing */
+  size_t capacity() const { return ring_.size(); }
+  /** @} */
+
+  /** @{ */
+  /** Return the entry for a packet number in [base(), end()) */
+  SentPacket& operator[](const uint64_t pn) {
+    SL_ASSERT(pn >= base_ && pn < end_);
+    return ring_[pn & mask_];
+  }
+  /** Return the entry for a packet number in [base(), end()) */
+  const SentPacket& operator[](const uint64_t pn) const {
+    SL_ASSERT(pn >= base_ && pn < end_);
+    return ring_[pn & mask_];
+  }
+  /** Return the oldest entry */
+  SentPacket& front() { return (*this)[base_]; }
+  /** Return the newest entry */
+  SentPacket& back() { return (*this)[end_ - 1]; }
+
+  /**
+   * Append a entry
+   *
+   * @returns The entry for packet number end() (prior to the call)
+   */
+  SentPacket& push_back();
+
+  /** Remove the oldest entry */
+  void pop_front() {
+    SL_ASSERT(!empty());
+    base_++;
+  }
+  /** @} */
+
+ private:
+  SentRing() = delete;
+  SentRing(const SentRing&) = delete;
+  void operator=(const SentRing&) = delete;
+
+  /** Double the capacity */
+  void grow();
+
+  ::std::vector<SentPacket> ring_;  /**< The storage */
+  uint64_t mask_;   /**< ring_.size() - 1 */
+  uint64_t base_;   /**< The oldest packet number */
+  uint64_t end_;    /**< The newest packet number + 1 */
+};
+
+} // namespace nqtcp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_NQTCP_NQTCP_SENT_RING_H__
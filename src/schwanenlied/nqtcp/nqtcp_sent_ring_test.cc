@@ -0,0 +1,84 @@
+/*
+ * nqtcp_sent_ring_test.cc: NQTCP in-flight packet ring tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "schwanenlied/nqtcp/nqtcp_sent_ring.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+class SentRingTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {};
+  virtual void TearDown() {};
+};
+
+TEST_F(SentRingTest, PushPop) {
+  SentRing ring(3);
+  ASSERT_EQ(4u, ring.capacity());
+  ASSERT_TRUE(ring.empty());
+
+  // Fill it, and slide the window past the end of the storage
+  for (uint32_t i = 0; i < 4; i++)
+    ring.push_back().stream_id_ = i;
+  ASSERT_EQ(4u, ring.size());
+  ASSERT_EQ(4u, ring.capacity());
+  ring.pop_front();
+  ring.pop_front();
+  ring.push_back().stream_id_ = 4;
+  ring.push_back().stream_id_ = 5;
+  ASSERT_EQ(4u, ring.capacity());
+  ASSERT_EQ(2u, ring.base());
+  ASSERT_EQ(6u, ring.end());
+  for (uint64_t pn = ring.base(); pn < ring.end(); pn++)
+    ASSERT_EQ(pn, ring[pn].stream_id_);
+
+  // Grow it while it wraps around
+  for (uint32_t i = 6; i < 11; i++)
+    ring.push_back().stream_id_ = i;
+  ASSERT_EQ(16u, ring.capacity());
+  ASSERT_EQ(9u, ring.size());
+  for (uint64_t pn = ring.base(); pn < ring.end(); pn++)
+    ASSERT_EQ(pn, ring[pn].stream_id_);
+  ASSERT_EQ(2u, ring.front().stream_id_);
+  ASSERT_EQ(10u, ring.back().stream_id_);
+
+  // New entries are cleared
+  SentPacket& sent = ring.push_back();
+  ASSERT_EQ(0u, sent.stream_id_);
+  ASSERT_FALSE(sent.inflight_);
+
+  while (!ring.empty())
+    ring.pop_front();
+  ASSERT_EQ(12u, ring.base());
+  ASSERT_EQ(12u, ring.end());
+}
+
+} // namespace nqtcp
+} // namespace schwanenlied
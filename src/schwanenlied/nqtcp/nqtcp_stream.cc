@@ -0,0 +1,353 @@
+/**
+ * @file    nqtcp_stream.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   NQTCP stream (IMPLEMENTATION)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <iterator>
+
+#include "schwanenlied/nqtcp/nqtcp_errors.h"
+#include "schwanenlied/nqtcp/nqtcp_stream.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+NqtcpStream::NqtcpStream(const uint32_t id,
+                         const uint32_t weight,
+                         const size_t send_buffer_size,
+                         const size_t recv_buffer_size,
+                         const uint64_t peer_max_offset) :
+    id_(id),
+    weight_(weight),
+    vtime_(0),
+    scheduled_(false),
+    send_buf_(new BipBuffer(send_buffer_size)),
+    send_base_(0),
+    send_next_(0),
+    peer_max_offset_(peer_max_offset),
+    fin_offset_(0),
+    shutdown_(false),
+    fin_sent_(false),
+    fin_lost_(false),
+    fin_acked_(false),
+    recv_buf_(new BipBuffer(recv_buffer_size)),
+    read_offset_(0),
+    recv_offset_(0),
+    recv_highest_(0),
+    out_of_order_bytes_(0),
+    recv_window_(recv_buffer_size),
+    max_offset_(recv_buffer_size),
+    advertised_max_offset_(recv_buffer_size),
+    peer_fin_offset_(0),
+    peer_fin_(false),
+    eof_read_(false),
+    rcv_epoch_offset_(0) {
+  SL_ASSERT(weight > 0);
+}
+
+size_t NqtcpStream::write(const uint8_t* buf,
+                          const size_t len) {
+  SL_ASSERT(!shutdown_);
+
+  return send_buf_->push_back(buf, ::std::min(len, send_space()));
+}
+
+void NqtcpStream::shutdown() {
+  if (shutdown_)
+    return;
+
+  shutdown_ = true;
+  fin_offset_ = send_base_ + send_buf_->size();
+}
+
+bool NqtcpStream::has_pending() const {
+  if (!lost_.empty() || fin_lost_)
+    return true;
+
+  const uint64_t limit = ::std::min(send_base_ + send_buf_->size(),
+                                    peer_max_offset_);
+  if (send_next_ < limit)
+    return true;
+
+  return shutdown_ && !fin_sent_ && send_next_ == fin_offset_;
+}
+
+bool NqtcpStream::next_chunk(const size_t max_len,
+                             uint64_t& offset,
+                             size_t& len,
+                             bool& fin,
+                             bool& retransmit) {
+  SL_ASSERT(max_len > 0);
+
+  retransmit = !lost_.empty() || fin_lost_;
+
+  // Retransmissions first
+  if (!lost_.empty()) {
+    const auto& range = *lost_.ranges().begin();
+    offset = range.first;
+    len = static_cast<size_t>(::std::min<uint64_t>(range.second - offset,
+                                                   max_len));
+    lost_.subtract(offset, offset + len);
+    fin = fin_lost_ && offset + len == fin_offset_;
+    if (fin)
+      fin_lost_ = false;
+    return true;
+  }
+  if (fin_lost_) {
+    offset = fin_offset_;
+    len = 0;
+    fin = true;
+    fin_lost_ = false;
+    return true;
+  }
+
+  // New data, limited by the peer's window
+  const uint64_t limit = ::std::min(send_base_ + send_buf_->size(),
+                                    peer_max_offset_);
+  if (send_next_ < limit) {
+    offset = send_next_;
+    len = static_cast<size_t>(::std::min<uint64_t>(limit - offset, max_len));
+    send_next_ += len;
+  } else if (shutdown_ && !fin_sent_ && send_next_ == fin_offset_) {
+    offset = send_next_;
+    len = 0;
+  } else
+    return false;
+
+  fin = shutdown_ && !fin_sent_ && send_next_ == fin_offset_;
+  if (fin)
+    fin_sent_ = true;
+
+  return true;
+}
+
+void NqtcpStream::copy(uint8_t* buf,
+                       const uint64_t offset,
+                       const size_t len) const {
+  SL_ASSERT(offset >= send_base_);
+
+  send_buf_->copy(buf, len, static_cast<size_t>(offset - send_base_));
+}
+
+size_t NqtcpStream::on_acked(const uint64_t offset,
+                             const size_t len,
+                             const bool fin) {
+  if (fin) {
+    fin_acked_ = true;
+    fin_lost_ = false;
+  }
+  if (len == 0 || offset + len <= send_base_)
+    return 0;
+
+  acked_.add(offset, offset + len);
+  lost_.subtract(offset, offset + len);
+
+  // Release the contiguously acknowledged data
+  const auto& front = *acked_.ranges().begin();
+  if (front.first > send_base_)
+    return 0;
+  const uint64_t end = front.second;
+  const size_t freed = static_cast<size_t>(end - send_base_);
+  send_buf_->pop_front(freed);
+  send_base_ = end;
+  acked_.erase_below(end);
+
+  return freed;
+}
+
+void NqtcpStream::on_lost(const uint64_t offset,
+                          const size_t len,
+                          const bool fin) {
+  if (fin && !fin_acked_)
+    fin_lost_ = true;
+
+  // Only retransmit what has not been acknowledged since
+  uint64_t start = ::std::max(offset, send_base_);
+  const uint64_t end = offset + len;
+  for (const auto& range : acked_.ranges()) {
+    if (start >= end || range.first >= end)
+      break;
+    if (range.second <= start)
+      continue;
+    if (range.first > start)
+      lost_.add(start, range.first);
+    start = range.second;
+  }
+  if (start < end)
+    lost_.add(start, end);
+}
+
+bool NqtcpStream::set_peer_max_offset(const uint64_t max_offset) {
+  if (max_offset <= peer_max_offset_)
+    return false;
+
+  peer_max_offset_ = max_offset;
+  return true;
+}
+
+int NqtcpStream::on_data(const uint64_t offset,
+                         const uint8_t* buf,
+                         const size_t len,
+                         const bool fin) {
+  const uint64_t end = offset + len;
+  if (end < offset || end > max_offset())
+    return kErrorFlowControl;
+  if (peer_fin_ && (end > peer_fin_offset_ ||
+                    (fin && end != peer_fin_offset_)))
+    return kErrorProtocol;
+  if (fin) {
+    if (end < recv_highest_)
+      return kErrorProtocol;
+    peer_fin_ = true;
+    peer_fin_offset_ = end;
+  }
+  recv_highest_ = ::std::max(recv_highest_, end);
+
+  if (end <= recv_offset_)
+    return kErrorOk;  // Duplicate
+
+  if (offset <= recv_offset_) {
+    const size_t skip = static_cast<size_t>(recv_offset_ - offset);
+    push_recv(buf + skip, len - skip);
+    recv_offset_ = end;
+    drain_out_of_order();
+  } else if (len > 0)
+    add_out_of_order(offset, buf, len);
+
+  return kErrorOk;
+}
+
+size_t NqtcpStream::read(uint8_t* buf,
+                         const size_t len) {
+  const size_t to_read = ::std::min(len, recv_buf_->size());
+  if (to_read == 0) {
+    eof_read_ = is_eof();
+    return 0;
+  }
+  recv_buf_->copy(buf, to_read);
+  recv_buf_->pop_front(to_read);
+  read_offset_ += to_read;
+  max_offset_ = ::std::max(max_offset_, read_offset_ + recv_window_);
+
+  return to_read;
+}
+
+bool NqtcpStream::needs_window_update() const {
+  // Nothing more will be sent, so the window is irrelevant
+  if (peer_fin_)
+    return false;
+
+  // Advertise once at least half of the window has opened up
+  return max_offset() - advertised_max_offset_ >= recv_window_ / 2;
+}
+
+void NqtcpStream::set_recv_window(const size_t window) {
+  SL_ASSERT(window > 0);
+
+  recv_window_ = window;
+  max_offset_ = ::std::max(max_offset_, read_offset_ + recv_window_);
+  recv_buf_->resize(::std::max(recv_window_, recv_buf_->size()));
+}
+
+void NqtcpStream::add_out_of_order(const uint64_t offset,
+                                   const uint8_t* buf,
+                                   const size_t len) {
+  SL_ASSERT(offset > recv_offset_);
+
+  uint64_t start = offset;
+  const uint64_t end = offset + len;
+
+  // Skip what the segment below already covers
+  auto it = out_of_order_.upper_bound(start);
+  if (it != out_of_order_.begin()) {
+    auto prev = ::std::prev(it);
+    start = ::std::max(start, prev->first + prev->second.size());
+  }
+
+  // Fill in the holes between the segments above, merging adjacent ones
+  while (start < end) {
+    const uint64_t hole_end = (it == out_of_order_.end()) ? end :
+        ::std::min(end, it->first);
+    if (start < hole_end) {
+      const char* p = reinterpret_cast<const char*>(buf + (start - offset));
+      const size_t hole_len = static_cast<size_t>(hole_end - start);
+      auto prev = (it == out_of_order_.begin()) ? out_of_order_.end() :
+          ::std::prev(it);
+      if (prev != out_of_order_.end() &&
+          prev->first + prev->second.size() == start)
+        prev->second.append(p, hole_len);
+      else
+        prev = out_of_order_.emplace_hint(it, start,
+                                          ::std::string(p, hole_len));
+      out_of_order_bytes_ += hole_len;
+      if (it != out_of_order_.end() && hole_end == it->first) {
+        prev->second.append(it->second);
+        it = out_of_order_.erase(it);
+        start = prev->first + prev->second.size();
+        continue;
+      }
+      start = hole_end;
+    }
+    if (it == out_of_order_.end())
+      break;
+    start = ::std::max(start, it->first + it->second.size());
+    ++it;
+  }
+}
+
+void NqtcpStream::drain_out_of_order() {
+  auto it = out_of_order_.begin();
+  while (it != out_of_order_.end() && it->first <= recv_offset_) {
+    const uint64_t end = it->first + it->second.size();
+    if (end > recv_offset_) {
+      const size_t skip = static_cast<size_t>(recv_offset_ - it->first);
+      push_recv(reinterpret_cast<const uint8_t*>(it->second.data()) + skip,
+                it->second.size() - skip);
+      recv_offset_ = end;
+    }
+    out_of_order_bytes_ -= it->second.size();
+    it = out_of_order_.erase(it);
+  }
+}
+
+void NqtcpStream::push_recv(const uint8_t* buf,
+                            const size_t len) {
+  // The window was shrunk after the peer was allowed to send this, so grow
+  // the buffer back to what was allowed
+  if (recv_buf_->max_size() - recv_buf_->size() < len)
+    recv_buf_->resize(static_cast<size_t>(max_offset_ - read_offset_));
+
+  const size_t copied = recv_buf_->push_back(buf, len);
+  SL_ASSERT(copied == len);
+}
+
+} // namespace nqtcp
+} // namespace schwanenlied
@@ -0,0 +1,358 @@
+/**
+ * @file    nqtcp_stream.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   NQTCP stream
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_NQTCP_NQTCP_STREAM_H__
+#define SCHWANENLIED_NQTCP_NQTCP_STREAM_H__
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/bip_buffer.h"
+#include "schwanenlied/clock.h"
+#include "schwanenlied/nqtcp/nqtcp_range_set.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+/**
+ * A NQTCP stream
+ *
+ * Each stream is a independent bidirectional byte stream with it's own offset
+ * space and flow control window.  This is the buffering and bookkeeping half
+ * of a stream, NqtcpConnection handles everything that involves packets.
+ *
+ * The send side keeps every byte from the lowest unacknowledged offset onward
+ * in a BipBuffer, so that lost ranges can be retransmitted.  The receive side
+ * keeps in order data that has not been read by the application in a
+ * BipBuffer (which doubles as the flow control window), and out of order data
+ * separately until the hole in front of it is filled.  Out of order data is
+ * trimmed against what is already held, so each byte is stored at most once,
+ * and together with the in order data never exceeds the flow control credit
+ * granted to the peer (max_offset() - the read offset).  The receive window
+ * (and the BipBuffer with it) can be resized by NqtcpConnection's receive
+ * buffer autotuning, but the flow control limit never moves backwards.
+ */
+class NqtcpStream {
+ public:
+  /**
+   * Create a NqtcpStream
+   *
+   * @param[in] id                The stream ID
+   * @param[in] weight            The scheduling weight
+   * @param[in] send_buffer_size  The size of the send buffer in bytes
+   * @param[in] recv_buffer_size  The size of the receive buffer (and window)
+   *                              in bytes
+   * @param[in] peer_max_offset   The initial flow control limit of the peer
+   */
+  NqtcpStream(const uint32_t id,
+              const uint32_t weight,
+              const size_t send_buffer_size,
+              const size_t recv_buffer_size,
+              const uint64_t peer_max_offset);
+
+  /** @{ */
+  /** Return the stream ID */
+  uint32_t id() const { return id_; }
+  /** Return the scheduling weight */
+  uint32_t weight() const { return weight_; }
+  /** Set the scheduling weight */
+  void set_weight(const uint32_t weight) { weight_ = weight; }
+  /** Return the weighted fair queueing virtual time (See NqtcpConnection) */
+  uint64_t vtime() const { return vtime_; }
+  /** Set the weighted fair queueing virtual time */
+  void set_vtime(const uint64_t vtime) { vtime_ = vtime; }
+  /** Return if the stream is in the scheduler */
+  bool is_scheduled() const { return scheduled_; }
+  /** Set if the stream is in the scheduler */
+  void set_scheduled(const bool scheduled) { scheduled_ = scheduled; }
+  /** @} */
+
+  /** @{ */
+  /** Return the amount of free space in the send buffer */
+  size_t send_space() const {
+    return send_buf_->max_size() - send_buf_->size();
+  }
+  /** Return if the sending side has been shut down */
+  bool is_shutdown() const { return shutdown_; }
+  /** Return the lowest unacknowledged offset */
+  uint64_t send_base() const { return send_base_; }
+
+  /**
+   * Append data to the send buffer
+   *
+   * @param[in] buf The data
+   * @param[in] len The length of the data
+   *
+   * @returns The amount of data appended
+   */
+  size_t write(const uint8_t* buf,
+               const size_t len);
+
+  /** Shut down the sending side (FIN after the buffered data) */
+  void shutdown();
+
+  /** Return if next_chunk() would return something */
+  bool has_pending() const;
+
+  /**
+   * Get the next range of data to transmit
+   *
+   * Lost data is returned before new data, and new data is limited by the
+   * peer's flow control window.
+   *
+   * @param[in] max_len     The maximum length of the range
+   * @param[out] offset     The offset of the range
+   * @param[out] len        The length of the range (0 for a bare FIN)
+   * @param[out] fin        Set if the range ends the stream
+   * @param[out] retransmit Set if the range is a retransmission
+   *
+   * @returns true  - A range was returned
+   * @returns false - There is nothing to transmit
+   */
+  bool next_chunk(const size_t max_len,
+                  uint64_t& offset,
+                  size_t& len,
+                  bool& fin,
+                  bool& retransmit);
+
+  /**
+   * Copy a range of data that was returned from next_chunk()
+   *
+   * @param[out] buf  The destination
+   * @param[in] offset  The offset of the range
+   * @param[in] len     The length of the range
+   */
+  void copy(uint8_t* buf,
+            const uint64_t offset,
+            const size_t len) const;
+
+  /**
+   * Mark a transmitted range as acknowledged
+   *
+   * @returns The number of bytes freed in the send buffer
+   */
+  size_t on_acked(const uint64_t offset,
+                  const size_t len,
+                  const bool fin);
+
+  /** Mark a transmitted range as lost (It will be retransmitted) */
+  void on_lost(const uint64_t offset,
+               const size_t len,
+               const bool fin);
+
+  /** Return the peer's flow control limit */
+  uint64_t peer_max_offset() const { return peer_max_offset_; }
+
+  /**
+   * Raise the peer's flow control limit
+   *
+   * @returns true  - The limit was raised
+   * @returns false - The limit was unchanged (stale update)
+   */
+  bool set_peer_max_offset(const uint64_t max_offset);
+  /** @} */
+
+  /** @{ */
+  /** Return the amount of data that can be read */
+  size_t readable() const { return recv_buf_->size(); }
+  /** Return the amount of out of order data held */
+  size_t out_of_order_bytes() const { return out_of_order_bytes_; }
+  /** Return the amount of received data held (In order and out of order) */
+  size_t recv_buffered() const {
+    return recv_buf_->size() + out_of_order_bytes_;
+  }
+  /** Return if the peer's FIN has been received, and all data was read */
+  bool is_eof() const {
+    return peer_fin_ && read_offset_ == peer_fin_offset_;
+  }
+  /** Return if the peer's FIN has been received */
+  bool has_peer_fin() const { return peer_fin_; }
+
+  /**
+   * Process received data
+   *
+   * @param[in] offset  The offset of the data
+   * @param[in] buf     The data
+   * @param[in] len     The length of the data
+   * @param[in] fin     Set if the data ends the stream
+   *
+   * @returns kErrorOk           - Success
+   * @returns kErrorFlowControl  - The data exceeds the flow control window
+   * @returns kErrorProtocol     - The data is inconsistent with the FIN
+   */
+  int on_data(const uint64_t offset,
+              const uint8_t* buf,
+              const size_t len,
+              const bool fin);
+
+  /**
+   * Read in order data
+   *
+   * Reading nothing once is_eof() is how the application is considered to
+   * have seen the end of the stream.
+   *
+   * @param[out] buf  The destination
+   * @param[in] len   The size of the destination
+   *
+   * @returns The amount of data read
+   */
+  size_t read(uint8_t* buf,
+              const size_t len);
+
+  /** Return the flow control limit for the peer */
+  uint64_t max_offset() const { return max_offset_; }
+
+  /** Return if the flow control limit should be advertised to the peer */
+  bool needs_window_update() const;
+
+  /** Note that the current flow control limit was advertised */
+  void set_window_advertised() { advertised_max_offset_ = max_offset(); }
+
+  /** Force the flow control limit to be advertised again */
+  void force_window_update() { advertised_max_offset_ = 0; }
+  /** @} */
+
+  /** @{ */
+  /** Return the size of the receive window */
+  size_t recv_window() const { return recv_window_; }
+
+  /**
+   * Return the most in order data the receive buffer may have to hold
+   *
+   * This is the receive window, or the flow control credit already granted to
+   * the peer if the window was shrunk since.  The receive buffer never grows
+   * past this.
+   */
+  size_t recv_commitment() const {
+    return ::std::max<size_t>(recv_window_,
+                              static_cast<size_t>(max_offset_ - read_offset_));
+  }
+
+  /**
+   * Resize the receive window (and the receive buffer)
+   *
+   * When shrinking, data that the peer was already allowed to send is still
+   * accepted, and grows the receive buffer again as it arrives.
+   *
+   * @param[in] window  The new size of the receive window in bytes
+   */
+  void set_recv_window(const size_t window);
+
+  /** Return when the current autotuning measurement period started */
+  const Clock::time_point& rcv_epoch() const { return rcv_epoch_; }
+  /** Return the amount of data read in the current measurement period */
+  uint64_t rcv_epoch_read() const { return read_offset_ - rcv_epoch_offset_; }
+
+  /** Start a new autotuning measurement period */
+  void start_rcv_epoch(const Clock::time_point& now) {
+    rcv_epoch_ = now;
+    rcv_epoch_offset_ = read_offset_;
+  }
+  /** @} */
+
+  /**
+   * Return if both directions are done (Including the application having
+   * read the end of the stream), and the stream can be forgotten
+   */
+  bool is_finished() const {
+    return shutdown_ && fin_acked_ && send_buf_->empty() && eof_read_;
+  }
+
+ private:
+  NqtcpStream() = delete;
+  NqtcpStream(const NqtcpStream&) = delete;
+  void operator=(const NqtcpStream&) = delete;
+
+  /**
+   * Store the parts of a out of order segment that are not already held
+   *
+   * @param[in] offset  The offset of the segment (> recv_offset_)
+   * @param[in] buf     The data
+   * @param[in] len     The length of the data
+   */
+  void add_out_of_order(const uint64_t offset,
+                        const uint8_t* buf,
+                        const size_t len);
+
+  /** Move out of order data that is now in order into the receive buffer */
+  void drain_out_of_order();
+
+  /** Append in order data to the receive buffer */
+  void push_recv(const uint8_t* buf,
+                 const size_t len);
+
+  const uint32_t id_;       /**< The stream ID */
+  uint32_t weight_;         /**< The scheduling weight */
+  uint64_t vtime_;          /**< The WFQ virtual time */
+  bool scheduled_;          /**< In the scheduler? */
+
+  /** @{ */
+  ::std::unique_ptr<BipBuffer> send_buf_; /**< [send_base_, write offset) */
+  uint64_t send_base_;      /**< The lowest unacknowledged offset */
+  uint64_t send_next_;      /**< The next never transmitted offset */
+  uint64_t peer_max_offset_;  /**< The peer's flow control limit */
+  RangeSet acked_;          /**< Acknowledged ranges above send_base_ */
+  RangeSet lost_;           /**< Ranges pending retransmission */
+  uint64_t fin_offset_;     /**< The final offset (If shutdown_) */
+  bool shutdown_;           /**< The sending side is shut down */
+  bool fin_sent_;           /**< The FIN was transmitted */
+  bool fin_lost_;           /**< The FIN needs to be retransmitted */
+  bool fin_acked_;          /**< The FIN was acknowledged */
+  /** @} */
+
+  /** @{ */
+  ::std::unique_ptr<BipBuffer> recv_buf_; /**< [read_offset_, recv_offset_) */
+  uint64_t read_offset_;    /**< The offset of the next byte to be read */
+  uint64_t recv_offset_;    /**< The offset of the next in order byte */
+  uint64_t recv_highest_;   /**< The highest received offset + 1 */
+  /** Out of order data (Disjoint, non-adjacent segments) */
+  ::std::map<uint64_t, ::std::string> out_of_order_;
+  size_t out_of_order_bytes_; /**< The amount of data in out_of_order_ */
+  size_t recv_window_;      /**< The receive window size */
+  uint64_t max_offset_;     /**< The flow control limit */
+  uint64_t advertised_max_offset_;  /**< The last advertised max_offset() */
+  uint64_t peer_fin_offset_;  /**< The final offset (If peer_fin_) */
+  bool peer_fin_;           /**< The peer's FIN was received */
+  bool eof_read_;           /**< The application read the end of stream */
+  Clock::time_point rcv_epoch_; /**< The autotuning measurement period start */
+  uint64_t rcv_epoch_offset_; /**< read_offset_ at rcv_epoch_ */
+  /** @} */
+};
+
+} // namespace nqtcp
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_NQTCP_NQTCP_STREAM_H__
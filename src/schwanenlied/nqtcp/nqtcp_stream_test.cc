@@ -0,0 +1,103 @@
+/*
+ * nqtcp_stream_test.cc: NqtcpStream tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+
+#include "schwanenlied/nqtcp/nqtcp_errors.h"
+#include "schwanenlied/nqtcp/nqtcp_stream.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+class NqtcpStreamTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    for (size_t i = 0; i < sizeof(data_); i++)
+      data_[i] = static_cast<uint8_t>(i * 7 + (i >> 8));
+  };
+  virtual void TearDown() {};
+
+  int on_data(NqtcpStream& stream,
+              const uint64_t start,
+              const uint64_t end) {
+    return stream.on_data(start, data_ + start,
+                          static_cast<size_t>(end - start), false);
+  }
+
+  uint8_t data_[4096];
+};
+
+TEST_F(NqtcpStreamTest, OutOfOrder) {
+  NqtcpStream stream(1, 1, 4096, sizeof(data_), 4096);
+
+  // Overlapping segments only store the bytes that are missing
+  ASSERT_EQ(kErrorOk, on_data(stream, 100, 200));
+  ASSERT_EQ(kErrorOk, on_data(stream, 150, 300));
+  ASSERT_EQ(200u, stream.out_of_order_bytes());
+  ASSERT_EQ(kErrorOk, on_data(stream, 50, 400));
+  ASSERT_EQ(350u, stream.out_of_order_bytes());
+
+  // Resends (Eg: Tail loss probes) do not grow the out of order data
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(kErrorOk, on_data(stream, 1000, 2000));
+    ASSERT_EQ(kErrorOk, on_data(stream, 1500, 2000));
+  }
+  ASSERT_EQ(1350u, stream.out_of_order_bytes());
+
+  // Nor does re-segmenting the same range, and a segment that bridges two
+  // others only fills the hole between them
+  for (uint64_t off = 2500; off < 3000; off += 10)
+    ASSERT_EQ(kErrorOk, on_data(stream, off, off + 5));
+  ASSERT_EQ(1600u, stream.out_of_order_bytes());
+  ASSERT_EQ(kErrorOk, on_data(stream, 2500, 3000));
+  ASSERT_EQ(kErrorOk, on_data(stream, 1800, 2600));
+  ASSERT_EQ(kErrorOk, on_data(stream, 350, 1200));
+  ASSERT_EQ(2950u, stream.out_of_order_bytes());
+  ASSERT_EQ(0u, stream.readable());
+
+  // Everything stays within the flow control credit
+  ASSERT_EQ(kErrorFlowControl, on_data(stream, 3000, sizeof(data_) + 1));
+  ASSERT_GE(stream.max_offset(), stream.recv_buffered());
+
+  // Filling the hole makes everything in order
+  ASSERT_EQ(kErrorOk, on_data(stream, 0, 40));
+  ASSERT_EQ(40u, stream.readable());
+  ASSERT_EQ(2990u, stream.recv_buffered());
+  ASSERT_EQ(kErrorOk, on_data(stream, 40, 50));
+  ASSERT_EQ(3000u, stream.readable());
+  ASSERT_EQ(0u, stream.out_of_order_bytes());
+
+  uint8_t buf[sizeof(data_)];
+  ASSERT_EQ(3000u, stream.read(buf, sizeof(buf)));
+  ASSERT_EQ(0, ::std::memcmp(data_, buf, 3000));
+}
+
+} // namespace nqtcp
+} // namespace schwanenlied
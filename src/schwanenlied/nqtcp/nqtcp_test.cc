@@ -0,0 +1,671 @@
+/*
+ * nqtcp_test.cc: NQTCP tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "schwanenlied/sim_clock.h"
+#include "schwanenlied/nqtcp/nqtcp_connection.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+namespace nqtcp {
+
+class NqtcpTest : public ::testing::Test {
+ protected:
+  // One side of a connection over a simulated link (with a fixed delay, and
+  // programmable drop and extra delay policies), that reads everything as
+  // soon as it arrives and writes everything queued via write() as fast as
+  // possible.
+  class Peer : public NqtcpCallbacks {
+   public:
+    Peer(NqtcpTest& test,
+         const bool is_initiator,
+         const NqtcpConfig& config) :
+        test_(test),
+        other_(nullptr),
+        conn_(new NqtcpConnection(*this, 0xdeadbeef, is_initiator, config,
+                                  test.clock_)),
+        tx_packets_(0),
+        nr_resets_(0) {}
+
+    int send_packet(NqtcpConnection& conn,
+                    const uint8_t* buf,
+                    const size_t len) override {
+      packet::Packet pkt;
+      EXPECT_TRUE(pkt.ParseFromArray(buf, static_cast<int>(len)));
+      EXPECT_GE(conn.config().max_payload_ + NqtcpConnection::kMaxOverhead,
+                len);
+      tx_packets_++;
+      if (drop_ && drop_(pkt))
+        return kErrorOk;
+
+      Peer* other = other_;
+      const ::std::string data(reinterpret_cast<const char*>(buf), len);
+      const Clock::duration delay = test_.delay_ +
+          (jitter_ ? jitter_(pkt) : Clock::duration::zero());
+      test_.clock_.schedule(delay, [other, data]() {
+        if (!other->conn_->is_reset())
+          other->conn_->on_packet(data.data(), data.size());
+      });
+      return kErrorOk;
+    }
+
+    void on_readable(NqtcpConnection& conn,
+                     const uint32_t stream_id) override {
+      uint8_t buf[4096];
+      size_t read = 0;
+      while (conn.recv(stream_id, buf, sizeof(buf), read) == kErrorOk) {
+        if (read == 0) {
+          eof_.insert(stream_id);
+          break;
+        }
+        if (rx_.count(stream_id) == 0)
+          rx_time_[stream_id] = test_.clock_.now();
+        rx_[stream_id].append(reinterpret_cast<const char*>(buf), read);
+      }
+    }
+
+    void on_writable(NqtcpConnection& conn,
+                     const uint32_t stream_id) override {
+      pump(stream_id);
+    }
+
+    void on_reset(NqtcpConnection& conn) override {
+      nr_resets_++;
+    }
+
+    // Queue data, and optionally a FIN
+    void write(const uint32_t stream_id,
+               const ::std::string& data,
+               const bool fin) {
+      tx_[stream_id] += data;
+      if (fin)
+        fin_.insert(stream_id);
+      pump(stream_id);
+    }
+
+    void pump(const uint32_t stream_id) {
+      ::std::string& data = tx_[stream_id];
+      while (!data.empty()) {
+        size_t written = 0;
+        if (conn_->send(stream_id, data.data(), data.size(), written) !=
+            kErrorOk)
+          break;
+        data.erase(0, written);
+      }
+      if (data.empty() && fin_.erase(stream_id) > 0) {
+        ASSERT_EQ(kErrorOk, conn_->shutdown(stream_id));
+      }
+    }
+
+    NqtcpTest& test_;
+    Peer* other_;
+    ::std::unique_ptr<NqtcpConnection> conn_;
+    ::std::function<bool(const packet::Packet&)> drop_;
+    ::std::function<Clock::duration(const packet::Packet&)> jitter_;
+    ::std::map<uint32_t, ::std::string> tx_;
+    ::std::set<uint32_t> fin_;
+    ::std::map<uint32_t, ::std::string> rx_;
+    ::std::map<uint32_t, Clock::time_point> rx_time_;
+    ::std::set<uint32_t> eof_;
+    uint64_t tx_packets_;
+    int nr_resets_;
+  };
+
+  virtual void SetUp() {
+    delay_ = ::std::chrono::milliseconds(10);
+  }
+
+  virtual void TearDown() {
+    initiator_.reset();
+    responder_.reset();
+  }
+
+  void connect(const NqtcpConfig& config = NqtcpConfig()) {
+    initiator_.reset(new Peer(*this, true, config));
+    responder_.reset(new Peer(*this, false, config));
+    initiator_->other_ = responder_.get();
+    responder_->other_ = initiator_.get();
+  }
+
+  static ::std::string pattern(const size_t len,
+                               const uint8_t seed) {
+    ::std::string ret(len, '\0');
+    for (size_t i = 0; i < len; i++)
+      ret[i] = static_cast<char>(seed + i * 7 + (i >> 8));
+    return ret;
+  }
+
+  SimClock clock_;
+  Clock::duration delay_;
+  ::std::unique_ptr<Peer> initiator_;
+  ::std::unique_ptr<Peer> responder_;
+};
+
+TEST_F(NqtcpTest, StreamTest) {
+  NqtcpConfig config;
+  connect(config);
+  NqtcpConnection& client = *initiator_->conn_;
+  NqtcpConnection& server = *responder_->conn_;
+
+  // Stream IDs are odd for the initiator, and even for the responder
+  uint32_t id1 = 0, id2 = 0;
+  ASSERT_EQ(kErrorOk, client.open_stream(id1));
+  ASSERT_EQ(1u, id1);
+  ASSERT_EQ(kErrorOk, server.open_stream(id2));
+  ASSERT_EQ(2u, id2);
+
+  // Send more than the send buffer and window in both directions at once
+  const ::std::string up = pattern(5 * config.send_buffer_size_ + 123, 1);
+  const ::std::string down = pattern(3 * config.recv_buffer_size_ + 7, 2);
+  initiator_->write(id1, up, true);
+  responder_->write(id2, down, true);
+  clock_.run();
+
+  ASSERT_EQ(up, responder_->rx_[id1]);
+  ASSERT_EQ(down, initiator_->rx_[id2]);
+  ASSERT_EQ(1u, responder_->eof_.count(id1));
+  ASSERT_EQ(1u, initiator_->eof_.count(id2));
+  ASSERT_EQ(0u, client.stats().lost_packets_);
+  ASSERT_EQ(0u, client.stats().tx_retransmitted_bytes_);
+
+  // The peer's shutdown of it's own stream is all that is left
+  ASSERT_EQ(2u, client.nr_streams());
+  ASSERT_EQ(kErrorOk, server.shutdown(id1));
+  ASSERT_EQ(kErrorOk, client.shutdown(id2));
+  clock_.run();
+  ASSERT_EQ(0u, client.nr_streams());
+  ASSERT_EQ(0u, server.nr_streams());
+  ASSERT_EQ(0u, client.nr_inflight());
+  ASSERT_EQ(0u, server.nr_inflight());
+  ASSERT_LT(Clock::duration::zero(), client.srtt());
+  size_t written;
+  ASSERT_EQ(kErrorNoStream, client.send(id1, "x", 1, written));
+}
+
+TEST_F(NqtcpTest, LossTest) {
+  NqtcpConfig config;
+  connect(config);
+  NqtcpConnection& client = *initiator_->conn_;
+
+  // Drop every 7th packet in both directions, and the tail
+  uint64_t n = 0;
+  auto drop = [&n](const packet::Packet& pkt) { return ++n % 7 == 0; };
+  initiator_->drop_ = drop;
+  responder_->drop_ = drop;
+
+  uint32_t id;
+  ASSERT_EQ(kErrorOk, client.open_stream(id));
+  const ::std::string data = pattern(300 * 1024, 3);
+  initiator_->write(id, data, true);
+  clock_.run();
+
+  ASSERT_EQ(data, responder_->rx_[id]);
+  ASSERT_EQ(1u, responder_->eof_.count(id));
+  ASSERT_LT(0u, client.stats().lost_packets_);
+  ASSERT_LT(0u, client.stats().tx_retransmitted_bytes_);
+  ASSERT_EQ(0u, client.nr_inflight());
+}
+
+TEST_F(NqtcpTest, LargeWindowTest) {
+  NqtcpConfig config;
+  config.send_buffer_size_ = 4 * 1024 * 1024;
+  config.recv_buffer_size_ = 4 * 1024 * 1024;
+  config.receive_window_ = 8 * 1024 * 1024;
+  config.max_inflight_ = 4096;
+  connect(config);
+  NqtcpConnection& client = *initiator_->conn_;
+
+  // Thousands of packets in flight, with scattered losses in both directions
+  uint64_t n = 0;
+  auto drop = [&n](const packet::Packet& pkt) { return ++n % 97 == 0; };
+  initiator_->drop_ = drop;
+  responder_->drop_ = drop;
+
+  uint32_t id;
+  ASSERT_EQ(kErrorOk, client.open_stream(id));
+  const ::std::string data = pattern(config.send_buffer_size_, 10);
+  initiator_->write(id, data, true);
+  ASSERT_EQ(config.max_inflight_, client.nr_inflight());
+  clock_.run();
+
+  ASSERT_EQ(data, responder_->rx_[id]);
+  ASSERT_EQ(1u, responder_->eof_.count(id));
+  ASSERT_LT(0u, client.stats().lost_packets_);
+  ASSERT_EQ(0u, client.stats().rto_expirations_);
+  ASSERT_EQ(0u, client.nr_inflight());
+}
+
+TEST_F(NqtcpTest, AutotuneTest) {
+  delay_ = ::std::chrono::milliseconds(50);
+  NqtcpConfig config;
+  config.send_buffer_size_ = 4 * 1024 * 1024;
+  config.max_inflight_ = 4096;
+  const size_t limit = config.recv_autotune_limit_;
+  const ::std::string data = pattern(config.send_buffer_size_, 11);
+
+  // A bulk transfer over a long RTT, without and with autotuning
+  uint32_t id = 0;
+  Clock::duration elapsed[2];
+  for (int i = 0; i < 2; i++) {
+    config.recv_autotune_limit_ = i == 0 ? 0 : limit;
+    connect(config);
+    NqtcpConnection& client = *initiator_->conn_;
+    NqtcpConnection& server = *responder_->conn_;
+
+    ASSERT_EQ(kErrorOk, client.open_stream(id));
+    const Clock::time_point start = clock_.now();
+    initiator_->write(id, data, false);
+    while (responder_->rx_[id].size() < data.size() && clock_.step())
+      ASSERT_GE(config.receive_window_ + config.recv_autotune_limit_,
+                server.receive_window());
+    ASSERT_EQ(data, responder_->rx_[id]);
+    elapsed[i] = clock_.now() - start;
+
+    // The window grew, but not past the limit
+    if (i == 0) {
+      ASSERT_EQ(config.receive_window_, server.receive_window());
+    } else {
+      ASSERT_LT(config.receive_window_ + 4 * config.recv_buffer_size_,
+                server.receive_window());
+      ASSERT_GE(config.receive_window_ + limit, server.receive_window());
+    }
+
+    // And shrinks back once the stream is idle, but the credit that the peer
+    // was already granted stays charged
+    clock_.run();
+    if (i == 0) {
+      ASSERT_EQ(config.receive_window_, server.receive_window());
+    } else {
+      ASSERT_LT(config.receive_window_ + 4 * config.recv_buffer_size_,
+                server.receive_window());
+      ASSERT_GE(config.receive_window_ + limit, server.receive_window());
+    }
+    ASSERT_EQ(0u, client.stats().lost_packets_);
+  }
+  ASSERT_LT(4 * elapsed[1], elapsed[0]);
+
+  // The charge is released as the peer uses the credit
+  NqtcpConnection& server = *responder_->conn_;
+  const uint32_t window = server.receive_window();
+  const ::std::string small = pattern(32 * 1024, 3);
+  initiator_->write(id, small, false);
+  clock_.run();
+  ASSERT_EQ(window - small.size(), server.receive_window());
+
+  // The peer may still use the window that was advertised before the shrink
+  initiator_->write(id, data, true);
+  clock_.run();
+  ASSERT_EQ(data + small + data, responder_->rx_[id]);
+  ASSERT_EQ(1u, responder_->eof_.count(id));
+  ASSERT_GE(config.receive_window_ + limit, server.receive_window());
+}
+
+TEST_F(NqtcpTest, RackTest) {
+  NqtcpConfig config;
+  connect(config);
+  NqtcpConnection& client = *initiator_->conn_;
+
+  // Get a RTT sample (The ACK of a single packet is delayed)
+  uint32_t id;
+  ASSERT_EQ(kErrorOk, client.open_stream(id));
+  const ::std::string hello = pattern(100, 6);
+  initiator_->write(id, hello, false);
+  clock_.run();
+  ASSERT_EQ(2 * delay_ + config.max_ack_delay_, client.srtt());
+
+  // Lose the first of 2 packets.  Only 1 later packet is acknowledged, so the
+  // loss is detected by the reordering window expiring (1/4 of the minimum
+  // RTT after the ACK), and the retransmission arrives well before the RTO.
+  bool dropped = false;
+  initiator_->drop_ = [&](const packet::Packet& pkt) {
+    if (dropped || pkt.stream_offset() != hello.size())
+      return false;
+    return dropped = true;
+  };
+  const Clock::time_point start = clock_.now();
+  const ::std::string data = pattern(2 * config.max_payload_, 7);
+  initiator_->write(id, data, false);
+  clock_.run_until(start + 4 * delay_);
+  ASSERT_EQ(hello + data, responder_->rx_[id]);
+
+  clock_.run();
+  ASSERT_EQ(1u, client.stats().lost_packets_);
+  ASSERT_EQ(config.max_payload_, client.stats().tx_retransmitted_bytes_);
+  ASSERT_EQ(0u, client.stats().spurious_losses_);
+  ASSERT_EQ(0u, client.stats().tlp_probes_);
+  ASSERT_EQ(0u, client.stats().rto_expirations_);
+}
+
+TEST_F(NqtcpTest, ReorderingTest) {
+  NqtcpConfig config;
+  connect(config);
+  NqtcpConnection& client = *initiator_->conn_;
+
+  uint32_t id;
+  ASSERT_EQ(kErrorOk, client.open_stream(id));
+
+  // Delay the first of every pair of packets by most of a one way delay, so
+  // that it arrives after the second one, but within a RTT of it
+  const size_t pair = 2 * config.max_payload_;
+  initiator_->jitter_ = [&](const packet::Packet& pkt) {
+    if (!pkt.has_stream_id() || pkt.stream_offset() % pair != 0)
+      return Clock::duration::zero();
+    return delay_ * 4 / 5;
+  };
+
+  // The first time, the reordering window is too small, and the delayed
+  // packet is declared lost
+  ::std::string data = pattern(pair, 8);
+  initiator_->write(id, data, false);
+  clock_.run();
+  ASSERT_EQ(data, responder_->rx_[id]);
+  ASSERT_EQ(1u, client.stats().lost_packets_);
+  ASSERT_EQ(1u, client.stats().spurious_losses_);
+  ASSERT_LT(client.min_rtt() / 4, client.reo_wnd());
+
+  // The grown reordering window accommodates it from then on
+  for (int i = 0; i < 5; i++) {
+    const ::std::string more = pattern(pair, 9 + i);
+    initiator_->write(id, more, false);
+    data += more;
+    clock_.run();
+  }
+  ASSERT_EQ(data, responder_->rx_[id]);
+  ASSERT_EQ(1u, client.stats().lost_packets_);
+  ASSERT_EQ(1u, client.stats().spurious_losses_);
+  ASSERT_EQ(0u, client.stats().rto_expirations_);
+}
+
+TEST_F(NqtcpTest, TailLossProbeTest) {
+  NqtcpConfig config;
+  connect(config);
+  NqtcpConnection& client = *initiator_->conn_;
+
+  // Get a RTT sample
+  uint32_t id;
+  ASSERT_EQ(kErrorOk, client.open_stream(id));
+  const ::std::string hello = pattern(100, 6);
+  initiator_->write(id, hello, false);
+  clock_.run();
+  ASSERT_EQ(2 * client.srtt() + config.max_ack_delay_, client.pto());
+
+  // Lose the last of 3 packets.  Nothing after it is acknowledged, so the
+  // probe (sent 2 RTTs plus the maximum ACK delay after the tail, with the
+  // RTT only getting smaller from the ACK of the first 2 packets)
+  // retransmits it, instead of waiting for the RTO.
+  const uint64_t tail = hello.size() + 2 * config.max_payload_;
+  bool dropped = false;
+  initiator_->drop_ = [&](const packet::Packet& pkt) {
+    if (dropped || pkt.stream_offset() != tail)
+      return false;
+    return dropped = true;
+  };
+  const Clock::time_point start = clock_.now();
+  const Clock::duration pto = client.pto();
+  const ::std::string data = pattern(3 * config.max_payload_, 7);
+  initiator_->write(id, data, false);
+  clock_.run_until(start + 2 * delay_);
+  ASSERT_NE(hello + data, responder_->rx_[id]);
+  ASSERT_GT(pto, client.pto());
+  clock_.run_until(start + client.pto() + delay_ +
+                   ::std::chrono::milliseconds(1));
+  ASSERT_EQ(hello + data, responder_->rx_[id]);
+  ASSERT_LT(client.pto() + delay_, client.rto());
+
+  // The ACK of the probe reveals the loss of the original
+  clock_.run();
+  ASSERT_EQ(1u, client.stats().tlp_probes_);
+  ASSERT_EQ(1u, client.stats().lost_packets_);
+  ASSERT_EQ(config.max_payload_, client.stats().tx_retransmitted_bytes_);
+  ASSERT_EQ(0u, client.stats().rto_expirations_);
+  ASSERT_EQ(0u, client.nr_inflight());
+}
+
+TEST_F(NqtcpTest, AckTest) {
+  NqtcpConfig config;
+  connect(config);
+  NqtcpConnection& client = *initiator_->conn_;
+  NqtcpConnection& server = *responder_->conn_;
+
+  uint32_t id;
+  ASSERT_EQ(kErrorOk, client.open_stream(id));
+
+  // A lone packet is acknowledged max_ack_delay_ after it arrives
+  Clock::time_point start = clock_.now();
+  initiator_->write(id, pattern(100, 11), false);
+  const Clock::time_point acked = start + 2 * delay_ + config.max_ack_delay_;
+  clock_.run_until(acked - ::std::chrono::milliseconds(1));
+  ASSERT_EQ(1u, client.nr_inflight());
+  clock_.run_until(acked);
+  ASSERT_EQ(0u, client.nr_inflight());
+  ASSERT_EQ(1u, server.stats().tx_acks_);
+  ASSERT_EQ(1u, server.stats().tx_delayed_acks_);
+  clock_.run();
+
+  // A reply carries the ACK
+  start = clock_.now();
+  uint64_t nr_acks = server.stats().tx_acks_;
+  initiator_->write(id, pattern(100, 12), false);
+  clock_.run_until(start + delay_);
+  responder_->write(id, pattern(100, 13), false);
+  clock_.run_until(start + 2 * delay_);
+  ASSERT_EQ(0u, client.nr_inflight());
+  ASSERT_EQ(nr_acks, server.stats().tx_acks_);
+  clock_.run();
+
+  // Bulk data is acknowledged every other packet
+  nr_acks = server.stats().tx_acks_;
+  const uint64_t nr_packets = client.stats().tx_packets_;
+  initiator_->write(id, pattern(512 * 1024, 14), false);
+  clock_.run();
+  ASSERT_GE((client.stats().tx_packets_ - nr_packets) / 2 + 1,
+            server.stats().tx_acks_ - nr_acks);
+  ASSERT_EQ(0u, client.stats().lost_packets_);
+  ASSERT_EQ(0u, client.stats().tlp_probes_);
+}
+
+TEST_F(NqtcpTest, HolBlockingTest) {
+  NqtcpConfig config;
+  connect(config);
+  NqtcpConnection& client = *initiator_->conn_;
+
+  uint32_t bulk, interactive;
+  ASSERT_EQ(kErrorOk, client.open_stream(bulk));
+  ASSERT_EQ(kErrorOk, client.open_stream(interactive));
+
+  // Lose the first bulk packet
+  bool dropped = false;
+  initiator_->drop_ = [&](const packet::Packet& pkt) {
+    if (dropped || pkt.stream_id() != bulk)
+      return false;
+    return dropped = true;
+  };
+
+  // The message is delivered despite the hole in the bulk stream
+  const Clock::time_point start = clock_.now();
+  const ::std::string data = pattern(32 * 1024, 4);
+  initiator_->write(bulk, data, false);
+  const ::std::string msg = pattern(100, 5);
+  initiator_->write(interactive, msg, false);
+  clock_.run_until(start + delay_);
+  ASSERT_EQ(msg, responder_->rx_[interactive]);
+  ASSERT_EQ(0u, responder_->rx_.count(bulk));
+
+  // The out of order bulk data is charged until the hole is filled
+  NqtcpConnection& server = *responder_->conn_;
+  ASSERT_LT(config.receive_window_, server.receive_window());
+  ASSERT_GT(config.receive_window_ + data.size(), server.receive_window());
+
+  clock_.run();
+  ASSERT_EQ(data, responder_->rx_[bulk]);
+  ASSERT_EQ(1u, client.stats().lost_packets_);
+  ASSERT_EQ(config.receive_window_, server.receive_window());
+}
+
+TEST_F(NqtcpTest, SchedulerTest) {
+  NqtcpConfig config;
+  config.send_buffer_size_ = 256 * 1024;
+  config.max_inflight_ = 16;
+  connect(config);
+  NqtcpConnection& client = *initiator_->conn_;
+
+  uint32_t bulk, interactive;
+  ASSERT_EQ(kErrorOk, client.open_stream(bulk));
+  ASSERT_EQ(kErrorOk, client.open_stream(interactive));
+
+  // Saturate the connection with bulk data, then send a small message
+  const Clock::time_point start = clock_.now();
+  initiator_->write(bulk, pattern(config.send_buffer_size_, 4), false);
+  ASSERT_EQ(config.max_inflight_, client.nr_inflight());
+  const ::std::string msg = pattern(100, 5);
+  initiator_->write(interactive, msg, false);
+
+  // The message goes out with the first free slot, ahead of the backlogged
+  // bulk data
+  clock_.run_until(start + 3 * delay_);
+  ASSERT_EQ(msg, responder_->rx_[interactive]);
+  ASSERT_GT(config.send_buffer_size_ / 4, responder_->rx_[bulk].size());
+
+  clock_.run();
+  ASSERT_EQ(config.send_buffer_size_, responder_->rx_[bulk].size());
+}
+
+TEST_F(NqtcpTest, WeightTest) {
+  NqtcpConfig config;
+  config.max_inflight_ = 8;
+  connect(config);
+  NqtcpConnection& client = *initiator_->conn_;
+
+  uint32_t low, high;
+  ASSERT_EQ(kErrorOk, client.open_stream(low, 16));
+  ASSERT_EQ(kErrorOk, client.open_stream(high, 48));
+  ASSERT_EQ(kErrorInval, client.open_stream(high, 0));
+  ASSERT_EQ(kErrorInval, client.set_weight(high, NqtcpConnection::kMaxWeight + 1));
+
+  // Once both are backlogged, the link is shared 1:3
+  const Clock::time_point start = clock_.now();
+  initiator_->write(low, pattern(2 * 1024 * 1024, 6), false);
+  initiator_->write(high, pattern(2 * 1024 * 1024, 7), false);
+  clock_.run_until(start + 5 * delay_);
+  size_t low_before = responder_->rx_[low].size();
+  size_t high_before = responder_->rx_[high].size();
+  clock_.run_until(start + 25 * delay_);
+  double ratio = static_cast<double>(responder_->rx_[high].size() -
+                                     high_before) /
+      (responder_->rx_[low].size() - low_before);
+  ASSERT_LT(2.7, ratio);
+  ASSERT_GT(3.3, ratio);
+
+  // Reweighting takes effect immediately
+  ASSERT_EQ(kErrorOk, client.set_weight(high, 16));
+  clock_.run_until(start + 30 * delay_);
+  low_before = responder_->rx_[low].size();
+  high_before = responder_->rx_[high].size();
+  clock_.run_until(start + 50 * delay_);
+  ratio = static_cast<double>(responder_->rx_[high].size() - high_before) /
+      (responder_->rx_[low].size() - low_before);
+  ASSERT_LT(0.8, ratio);
+  ASSERT_GT(1.2, ratio);
+}
+
+TEST_F(NqtcpTest, ErrorTest) {
+  NqtcpConfig config;
+  config.max_streams_ = 2;
+  connect(config);
+  NqtcpConnection& client = *initiator_->conn_;
+  NqtcpConnection& server = *responder_->conn_;
+
+  uint32_t id;
+  size_t written, read;
+  uint8_t buf[16];
+  ASSERT_EQ(kErrorNoStream, client.send(1, "x", 1, written));
+  ASSERT_EQ(kErrorNoStream, client.recv(1, buf, sizeof(buf), read));
+  ASSERT_EQ(kErrorOk, client.open_stream(id));
+  ASSERT_EQ(kErrorInval, client.send(id, nullptr, 1, written));
+  ASSERT_EQ(kErrorAgain, client.recv(id, buf, sizeof(buf), read));
+  ASSERT_EQ(kErrorOk, client.shutdown(id));
+  ASSERT_EQ(kErrorStreamShutdown, client.send(id, "x", 1, written));
+  ASSERT_EQ(kErrorOk, client.open_stream(id));
+  ASSERT_EQ(kErrorTooManyStreams, client.open_stream(id));
+
+  // Garbage, and packets for other connections
+  ASSERT_EQ(kErrorBadPacketFormat, server.on_packet(buf, 0xff));
+  packet::Packet pkt;
+  pkt.set_connection_id(0x12345678);
+  ::std::string raw;
+  pkt.SerializeToString(&raw);
+  ASSERT_EQ(kErrorBadPacketFormat, server.on_packet(raw.data(), raw.size()));
+
+  // Sending beyond the window resets the connection
+  pkt.set_connection_id(client.connection_id());
+  pkt.set_sequence_number(0);
+  pkt.set_stream_id(2);
+  pkt.set_stream_offset(config.recv_buffer_size_);
+  pkt.set_payload("x");
+  pkt.SerializeToString(&raw);
+  ASSERT_EQ(kErrorFlowControl, client.on_packet(raw.data(), raw.size()));
+  ASSERT_TRUE(client.is_reset());
+  ASSERT_EQ(1, initiator_->nr_resets_);
+  ASSERT_EQ(kErrorConnAborted, client.open_stream(id));
+  ASSERT_EQ(kErrorConnAborted, client.on_packet(raw.data(), raw.size()));
+
+  // The RST makes it to the peer
+  clock_.run();
+  ASSERT_TRUE(server.is_reset());
+  ASSERT_EQ(1, responder_->nr_resets_);
+}
+
+TEST_F(NqtcpTest, ResetTest) {
+  connect();
+  NqtcpConnection& client = *initiator_->conn_;
+  NqtcpConnection& server = *responder_->conn_;
+
+  uint32_t id;
+  ASSERT_EQ(kErrorOk, client.open_stream(id));
+  initiator_->write(id, "hello", false);
+  clock_.run();
+  ASSERT_EQ("hello", responder_->rx_[id]);
+
+  client.reset();
+  ASSERT_TRUE(client.is_reset());
+  ASSERT_EQ(0, initiator_->nr_resets_);
+  clock_.run();
+  ASSERT_TRUE(server.is_reset());
+  ASSERT_EQ(1, responder_->nr_resets_);
+  size_t written;
+  ASSERT_EQ(kErrorConnAborted, server.send(id, "x", 1, written));
+}
+
+} // namespace nqtcp
+} // namespace schwanenlied
@@ -0,0 +1,250 @@
+/**
+ * @file    packet_trace.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Packet trace capture file writer/reader (IMPLEMENTATION)
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "schwanenlied/packet_trace.h"
+
+namespace schwanenlied {
+
+static_assert(sizeof(PacketTrace::FileHeader) == 24,
+              "PacketTrace::FileHeader has padding");
+static_assert(sizeof(PacketTrace::Record) == 24,
+              "PacketTrace::Record has padding");
+static_assert(sizeof(PacketTrace::FileHeader) % PacketTrace::kAlignment == 0,
+              "PacketTrace::FileHeader breaks Record alignment");
+static_assert(sizeof(PacketTrace::Record) % PacketTrace::kAlignment == 0,
+              "PacketTrace::Record breaks packet alignment");
+
+const uint8_t PacketTrace::kDirRx;
+const uint8_t PacketTrace::kDirTx;
+const size_t PacketTrace::kAlignment;
+const size_t PacketTrace::kDefaultBufferSize;
+const size_t PacketTrace::kMinBufferSize;
+const char PacketTrace::kFileMagic[8] = {
+  'S', 'L', 'P', 'T', 'R', 'C', '0', '1'
+};
+
+PacketTrace::PacketTrace(const int fd,
+                         const uint64_t max_bytes,
+                         const size_t buffer_size) :
+    fd_(fd),
+    max_bytes_(max_bytes),
+    buffer_size_(buffer_size),
+    buf_(new uint64_t[(buffer_size + sizeof(uint64_t) - 1) /
+                      sizeof(uint64_t)]),
+    used_(sizeof(FileHeader)),
+    written_(0),
+    recorded_(0),
+    dropped_(0),
+    failed_(false) {
+  SL_ASSERT(fd >= 0);
+  SL_ASSERT(buffer_size >= kMinBufferSize);
+  SL_ASSERT(max_bytes == 0 || max_bytes >= sizeof(FileHeader));
+
+  FileHeader* header = reinterpret_cast<FileHeader*>(buf_.get());
+  ::std::memcpy(header->magic_, kFileMagic, sizeof(header->magic_));
+  header->header_size_ = sizeof(FileHeader);
+  header->record_size_ = sizeof(Record);
+  header->realtime_ = ::std::chrono::duration_cast<
+      ::std::chrono::nanoseconds>(
+          ::std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+PacketTrace::~PacketTrace() {
+  flush();
+}
+
+void PacketTrace::record(const uint8_t direction,
+                         const Clock::time_point& when,
+                         const IPAddress& addr,
+                         const void* buf,
+                         const size_t len) {
+  const size_t sz = entry_size(len);
+  if (failed_ || len > UINT32_MAX || sz > buffer_size_ ||
+      (max_bytes_ > 0 && size() + sz > max_bytes_)) {
+    dropped_++;
+    return;
+  }
+  if (used_ + sz > buffer_size_ && flush() != kErrorOk) {
+    dropped_++;
+    return;
+  }
+
+  uint8_t* p = reinterpret_cast<uint8_t*>(buf_.get()) + used_;
+  Record* r = reinterpret_cast<Record*>(p);
+  r->timestamp_ = ::std::chrono::duration_cast< ::std::chrono::nanoseconds>(
+      when.time_since_epoch()).count();
+  r->addr_hash_ = addr.hash();
+  r->length_ = static_cast<uint32_t>(len);
+  r->direction_ = direction;
+  r->family_ = addr.sockaddr()->sa_family == AF_INET6 ? 6 : 4;
+  r->reserved_ = 0;
+  ::std::memcpy(p + sizeof(Record), buf, len);
+  ::std::memset(p + sizeof(Record) + len, 0, sz - sizeof(Record) - len);
+
+  used_ += sz;
+  recorded_++;
+}
+
+int PacketTrace::flush() {
+  if (failed_)
+    return kErrorConnAborted;
+
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(buf_.get());
+  size_t off = 0;
+  while (off < used_) {
+    const ssize_t ret = ::write(fd_, p + off, used_ - off);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      failed_ = true;
+      return kErrorConnAborted;
+    }
+    off += static_cast<size_t>(ret);
+  }
+
+  written_ += used_;
+  used_ = 0;
+  return kErrorOk;
+}
+
+PacketTraceReader::PacketTraceReader() :
+    buf_(nullptr),
+    len_(0),
+    offset_(0),
+    map_(nullptr),
+    truncated_(false) {
+  ::std::memset(&header_, 0, sizeof(header_));
+}
+
+PacketTraceReader::~PacketTraceReader() {
+  close();
+}
+
+int PacketTraceReader::open(const char* path) {
+  close();
+
+  const int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return kErrorBadFD;
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size < 0) {
+    ::close(fd);
+    return kErrorBadFD;
+  }
+  const size_t len = static_cast<size_t>(st.st_size);
+  if (len < sizeof(PacketTrace::FileHeader)) {
+    ::close(fd);
+    return kErrorInval;
+  }
+
+  void* map = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED)
+    return kErrorBadFD;
+
+  const int ret = open(map, len);
+  if (ret != kErrorOk) {
+    ::munmap(map, len);
+    return ret;
+  }
+  map_ = map;
+
+  return kErrorOk;
+}
+
+int PacketTraceReader::open(const void* buf,
+                            const size_t len) {
+  close();
+
+  if (buf == nullptr || len < sizeof(PacketTrace::FileHeader))
+    return kErrorInval;
+  SL_ASSERT(reinterpret_cast<uintptr_t>(buf) % PacketTrace::kAlignment == 0);
+
+  ::std::memcpy(&header_, buf, sizeof(header_));
+  if (::std::memcmp(header_.magic_, PacketTrace::kFileMagic,
+                    sizeof(header_.magic_)) != 0)
+    return kErrorInval;
+  if (header_.header_size_ != sizeof(PacketTrace::FileHeader) ||
+      header_.record_size_ != sizeof(PacketTrace::Record))
+    return kErrorInval;
+
+  buf_ = static_cast<const uint8_t*>(buf);
+  len_ = len;
+  rewind();
+
+  return kErrorOk;
+}
+
+void PacketTraceReader::close() {
+  if (map_ != nullptr)
+    ::munmap(map_, len_);
+  ::std::memset(&header_, 0, sizeof(header_));
+  buf_ = nullptr;
+  len_ = 0;
+  offset_ = 0;
+  map_ = nullptr;
+  truncated_ = false;
+}
+
+bool PacketTraceReader::next(const PacketTrace::Record*& record,
+                             const uint8_t*& packet) {
+  if (buf_ == nullptr || offset_ >= len_)
+    return false;
+
+  const size_t left = len_ - offset_;
+  const PacketTrace::Record* r =
+      reinterpret_cast<const PacketTrace::Record*>(buf_ + offset_);
+  if (left < sizeof(PacketTrace::Record) ||
+      left < PacketTrace::entry_size(r->length_)) {
+    truncated_ = true;
+    return false;
+  }
+
+  record = r;
+  packet = buf_ + offset_ + sizeof(PacketTrace::Record);
+  offset_ += PacketTrace::entry_size(r->length_);
+  return true;
+}
+
+} // namespace schwanenlied
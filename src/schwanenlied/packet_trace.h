@@ -0,0 +1,257 @@
+/**
+ * @file    packet_trace.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Packet trace capture file writer/reader
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_PACKET_TRACE_H__
+#define SCHWANENLIED_PACKET_TRACE_H__
+
+#include <memory>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/clock.h"
+#include "schwanenlied/ip_address.h"
+
+namespace schwanenlied {
+
+/**
+ * A packet trace capture file writer
+ *
+ * A trace is a FileHeader followed by a sequence of variable length entries,
+ * each a Record followed by the datagram (as seen on the wire), padded to
+ * kAlignment bytes.  Everything is in host byte order, and every Record is
+ * naturally aligned, so a trace can be mmap()ed and walked in place
+ * (PacketTraceReader).
+ *
+ * Peers are identified by IPAddress::hash() (which is keyed per-process), so
+ * traces do not contain addresses, but the packets from a given peer can still
+ * be told apart.
+ *
+ * Entries are accumulated in a buffer that is written out when full, so the
+ * cost of capturing a packet is usually a memcpy(), but the occasional write()
+ * happens in the context of whatever recorded the packet.  Once max_bytes is
+ * reached, or if a write fails, further packets are counted as dropped.
+ *
+ * @warning This is not thread safe.
+ */
+class PacketTrace {
+ public:
+  /** @{ */
+  /** Record::direction_ - Received packet */
+  static const uint8_t kDirRx = 0;
+  /** Record::direction_ - Transmitted packet */
+  static const uint8_t kDirTx = 1;
+  /** @} */
+
+  /** The alignment of each entry */
+  static const size_t kAlignment = 8;
+  /** The default size of the write buffer */
+  static const size_t kDefaultBufferSize = 1024 * 1024;
+  /** The smallest write buffer that can hold any datagram */
+  static const size_t kMinBufferSize = 65536 + 64;
+
+  /** The header at the start of a trace */
+  struct FileHeader {
+    uint8_t magic_[8];      /**< kFileMagic */
+    uint32_t header_size_;  /**< sizeof(FileHeader) */
+    uint32_t record_size_;  /**< sizeof(Record) */
+    uint64_t realtime_;     /**< UNIX time in ns at creation */
+  };
+
+  /** A captured packet (The packet follows) */
+  struct Record {
+    uint64_t timestamp_;    /**< Clock::time_point in ns since the epoch */
+    uint64_t addr_hash_;    /**< IPAddress::hash() of the peer */
+    uint32_t length_;       /**< The length of the packet */
+    uint8_t direction_;     /**< kDirRx/kDirTx */
+    uint8_t family_;        /**< The peer's address family (4/6) */
+    uint16_t reserved_;     /**< Reserved (0) */
+  };
+
+  /** The magic at the start of a FileHeader */
+  static const char kFileMagic[8];
+
+  /** Return the size of the entry for a packet of length len */
+  static size_t entry_size(const size_t len) {
+    return sizeof(Record) + ((len + kAlignment - 1) & ~(kAlignment - 1));
+  }
+
+  /**
+   * Construct a PacketTrace
+   *
+   * The FileHeader is buffered immediately, and is written out along with the
+   * first batch of packets.
+   *
+   * @param[in] fd          The file descriptor to write the trace to (Not
+   *                        owned)
+   * @param[in] max_bytes   The maximum size of the trace (0 = unlimited)
+   * @param[in] buffer_size The size of the write buffer (At least
+   *                        kMinBufferSize)
+   */
+  PacketTrace(const int fd,
+              const uint64_t max_bytes = 0,
+              const size_t buffer_size = kDefaultBufferSize);
+
+  /** Flushes the buffered entries */
+  ~PacketTrace();
+
+  /** @{ */
+  /**
+   * Capture a packet
+   *
+   * @param[in] direction kDirRx/kDirTx
+   * @param[in] when      The time the packet was received/sent
+   * @param[in] addr      The peer's address
+   * @param[in] buf       The packet
+   * @param[in] len       The length of the packet
+   */
+  void record(const uint8_t direction,
+              const Clock::time_point& when,
+              const IPAddress& addr,
+              const void* buf,
+              const size_t len);
+
+  /**
+   * Write out the buffered entries
+   *
+   * @returns kErrorOk          - Success
+   * @returns kErrorConnAborted - The write failed (Capture is stopped)
+   */
+  int flush();
+  /** @} */
+
+  /** @{ */
+  /** Return the number of packets captured */
+  uint64_t recorded() const { return recorded_; }
+  /** Return the number of packets not captured due to size/errors */
+  uint64_t dropped() const { return dropped_; }
+  /** Return the size of the trace, including buffered entries */
+  uint64_t size() const { return written_ + used_; }
+  /** @} */
+
+ private:
+  PacketTrace() = delete;
+  PacketTrace(const PacketTrace&) = delete;
+  void operator=(const PacketTrace&) = delete;
+
+  const int fd_;                  /**< The trace file descriptor */
+  const uint64_t max_bytes_;      /**< The maximum trace size (0 = inf) */
+  const size_t buffer_size_;      /**< The size of buf_ */
+  ::std::unique_ptr<uint64_t[]> buf_; /**< The write buffer (Aligned) */
+  size_t used_;                   /**< The number of bytes in buf_ */
+  uint64_t written_;              /**< The number of bytes written */
+  uint64_t recorded_;             /**< The number of packets captured */
+  uint64_t dropped_;              /**< The number of packets dropped */
+  bool failed_;                   /**< A write failed */
+};
+
+/**
+ * A packet trace capture file reader
+ *
+ * The trace is mmap()ed (or read from a caller provided buffer), and next()
+ * returns pointers into the mapping, so walking even a very large trace does
+ * not copy anything.  A trace that ends with a partial entry (Eg: the writer
+ * was killed) is read up to the last complete entry.
+ */
+class PacketTraceReader {
+ public:
+  PacketTraceReader();
+
+  ~PacketTraceReader();
+
+  /** @{ */
+  /**
+   * Map a trace file
+   *
+   * @param[in] path  The path to the trace
+   *
+   * @returns kErrorOk    - Success
+   * @returns kErrorBadFD - The file could not be opened or mapped
+   * @returns kErrorInval - The file is not a trace
+   */
+  int open(const char* path);
+
+  /**
+   * Use a trace that is already in memory
+   *
+   * @param[in] buf The trace (Must be kAlignment aligned, and outlive the
+   *                PacketTraceReader)
+   * @param[in] len The length of the trace
+   *
+   * @returns kErrorOk    - Success
+   * @returns kErrorInval - The buffer is not a trace
+   */
+  int open(const void* buf,
+           const size_t len);
+
+  /** Release the trace */
+  void close();
+  /** @} */
+
+  /** @{ */
+  /** Get the FileHeader */
+  const PacketTrace::FileHeader& header() const { return header_; }
+
+  /**
+   * Get the next captured packet
+   *
+   * @param[out] record The Record
+   * @param[out] packet The packet
+   *
+   * @returns true - A packet was returned
+   * @returns false - There are no more packets
+   */
+  bool next(const PacketTrace::Record*& record,
+            const uint8_t*& packet);
+
+  /** Start over from the first packet */
+  void rewind() { offset_ = sizeof(PacketTrace::FileHeader); }
+
+  /** Return if the trace ends with a partial entry (Valid after next()) */
+  bool truncated() const { return truncated_; }
+  /** @} */
+
+ private:
+  PacketTraceReader(const PacketTraceReader&) = delete;
+  void operator=(const PacketTraceReader&) = delete;
+
+  PacketTrace::FileHeader header_;  /**< The FileHeader */
+  const uint8_t* buf_;            /**< The trace */
+  size_t len_;                    /**< The length of the trace */
+  size_t offset_;                 /**< The offset of the next entry */
+  void* map_;                     /**< The mapping (if mmap()ed) */
+  bool truncated_;                /**< The trace ends with a partial entry */
+};
+
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_PACKET_TRACE_H__
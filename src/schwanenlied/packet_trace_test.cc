@@ -0,0 +1,204 @@
+/*
+ * packet_trace_test.cc: Packet trace capture tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <cstdlib>
+#include <cstring>
+#include <array>
+#include <string>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "schwanenlied/packet_trace.h"
+#include "schwanenlied/crypto/siphash.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+
+class PacketTraceTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    key_.fill(0x23);
+    ::std::memset(&v4addr_, 0, sizeof(v4addr_));
+    v4addr_.sin_family = AF_INET;
+    v4addr_.sin_port = htons(6969);
+    inet_pton(AF_INET, "192.0.2.1", &v4addr_.sin_addr);
+    ::std::memset(&v6addr_, 0, sizeof(v6addr_));
+    v6addr_.sin6_family = AF_INET6;
+    v6addr_.sin6_port = htons(2323);
+    inet_pton(AF_INET6, "2001:db8::1", &v6addr_.sin6_addr);
+
+    ::std::strcpy(path_, "/tmp/packet_trace_XXXXXX");
+    fd_ = ::mkstemp(path_);
+    ASSERT_LE(0, fd_);
+  };
+  virtual void TearDown() {
+    ::close(fd_);
+    ::unlink(path_);
+  };
+
+  /** Read the entire trace file */
+  ::std::string contents() const {
+    ::std::string out;
+    char buf[4096];
+    ssize_t len;
+    ::lseek(fd_, 0, SEEK_SET);
+    while ((len = ::read(fd_, buf, sizeof(buf))) > 0)
+      out.append(buf, static_cast<size_t>(len));
+    return out;
+  }
+
+  ::std::array<uint8_t, crypto::SipHash::kKeyLength> key_;
+  struct sockaddr_in v4addr_;
+  struct sockaddr_in6 v6addr_;
+  char path_[32];
+  int fd_;
+};
+
+TEST_F(PacketTraceTest, RoundTrip) {
+  crypto::SipHash hash(key_.data(), key_.size());
+  IPAddress v4(hash, reinterpret_cast<struct sockaddr*>(&v4addr_),
+               sizeof(v4addr_), true);
+  IPAddress v6(hash, reinterpret_cast<struct sockaddr*>(&v6addr_),
+               sizeof(v6addr_), true);
+  const Clock::time_point t0(::std::chrono::nanoseconds(1000));
+  const Clock::time_point t1(::std::chrono::nanoseconds(2500));
+  const uint8_t pkt0[] = { 1, 2, 3 };
+  uint8_t pkt1[1200];
+  for (size_t i = 0; i < sizeof(pkt1); i++)
+    pkt1[i] = static_cast<uint8_t>(i);
+
+  {
+    PacketTrace trace(fd_);
+    ASSERT_EQ(sizeof(PacketTrace::FileHeader), trace.size());
+    trace.record(PacketTrace::kDirRx, t0, v4, pkt0, sizeof(pkt0));
+    trace.record(PacketTrace::kDirTx, t1, v6, pkt1, sizeof(pkt1));
+    ASSERT_EQ(2u, trace.recorded());
+    ASSERT_EQ(0u, trace.dropped());
+    ASSERT_EQ(sizeof(PacketTrace::FileHeader) +
+              PacketTrace::entry_size(sizeof(pkt0)) +
+              PacketTrace::entry_size(sizeof(pkt1)), trace.size());
+  }
+
+  // Everything is aligned
+  ASSERT_EQ(32u, PacketTrace::entry_size(sizeof(pkt0)));
+  ASSERT_EQ(24u + 1200u, PacketTrace::entry_size(sizeof(pkt1)));
+
+  PacketTraceReader reader;
+  ASSERT_EQ(kErrorOk, reader.open(path_));
+  ASSERT_EQ(0, ::std::memcmp(PacketTrace::kFileMagic,
+                             reader.header().magic_, 8));
+  ASSERT_LT(0u, reader.header().realtime_);
+
+  const PacketTrace::Record* r;
+  const uint8_t* pkt;
+  ASSERT_TRUE(reader.next(r, pkt));
+  ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(r) % PacketTrace::kAlignment);
+  ASSERT_EQ(1000u, r->timestamp_);
+  ASSERT_EQ(v4.hash(), r->addr_hash_);
+  ASSERT_EQ(PacketTrace::kDirRx, r->direction_);
+  ASSERT_EQ(4, r->family_);
+  ASSERT_EQ(sizeof(pkt0), r->length_);
+  ASSERT_EQ(0, ::std::memcmp(pkt0, pkt, sizeof(pkt0)));
+
+  ASSERT_TRUE(reader.next(r, pkt));
+  ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(r) % PacketTrace::kAlignment);
+  ASSERT_EQ(2500u, r->timestamp_);
+  ASSERT_EQ(v6.hash(), r->addr_hash_);
+  ASSERT_EQ(PacketTrace::kDirTx, r->direction_);
+  ASSERT_EQ(6, r->family_);
+  ASSERT_EQ(sizeof(pkt1), r->length_);
+  ASSERT_EQ(0, ::std::memcmp(pkt1, pkt, sizeof(pkt1)));
+
+  ASSERT_FALSE(reader.next(r, pkt));
+  ASSERT_FALSE(reader.truncated());
+
+  // Rewinding starts over
+  reader.rewind();
+  ASSERT_TRUE(reader.next(r, pkt));
+  ASSERT_EQ(1000u, r->timestamp_);
+}
+
+TEST_F(PacketTraceTest, Limits) {
+  crypto::SipHash hash(key_.data(), key_.size());
+  IPAddress v4(hash, reinterpret_cast<struct sockaddr*>(&v4addr_),
+               sizeof(v4addr_), true);
+  const Clock::time_point t(::std::chrono::seconds(1));
+  const ::std::string pkt(1400, 'x');
+  const size_t entry = PacketTrace::entry_size(pkt.size());
+
+  // The buffer is flushed when full
+  {
+    PacketTrace trace(fd_, 0, PacketTrace::kMinBufferSize);
+    for (int i = 0; i < 100; i++)
+      trace.record(PacketTrace::kDirRx, t, v4, pkt.data(), pkt.size());
+    ASSERT_EQ(100u, trace.recorded());
+    ASSERT_LT(0u, contents().size());
+    ASSERT_EQ(kErrorOk, trace.flush());
+    ASSERT_EQ(sizeof(PacketTrace::FileHeader) + 100 * entry,
+              contents().size());
+  }
+
+  // Packets past max_bytes are dropped
+  ASSERT_EQ(0, ::ftruncate(fd_, 0));
+  ::lseek(fd_, 0, SEEK_SET);
+  {
+    PacketTrace trace(fd_, sizeof(PacketTrace::FileHeader) + 3 * entry);
+    for (int i = 0; i < 5; i++)
+      trace.record(PacketTrace::kDirRx, t, v4, pkt.data(), pkt.size());
+    ASSERT_EQ(3u, trace.recorded());
+    ASSERT_EQ(2u, trace.dropped());
+  }
+
+  // A partial trailing entry is ignored
+  ::std::string buf = contents();
+  ASSERT_EQ(sizeof(PacketTrace::FileHeader) + 3 * entry, buf.size());
+  buf.resize(buf.size() - 8);
+  ::std::unique_ptr<uint64_t[]> aligned(new uint64_t[buf.size() / 8 + 1]);
+  ::std::memcpy(aligned.get(), buf.data(), buf.size());
+
+  PacketTraceReader reader;
+  ASSERT_EQ(kErrorOk, reader.open(aligned.get(), buf.size()));
+  const PacketTrace::Record* r;
+  const uint8_t* p;
+  int n = 0;
+  while (reader.next(r, p))
+    n++;
+  ASSERT_EQ(2, n);
+  ASSERT_TRUE(reader.truncated());
+
+  // Not a trace
+  reinterpret_cast<uint8_t*>(aligned.get())[0] = 'X';
+  ASSERT_EQ(kErrorInval, reader.open(aligned.get(), buf.size()));
+  ASSERT_EQ(kErrorInval, reader.open(aligned.get(), 8));
+  ASSERT_EQ(kErrorBadFD, reader.open("/nonexistent/trace"));
+}
+
+} // namespace schwanenlied
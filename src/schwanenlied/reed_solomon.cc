@@ -0,0 +1,337 @@
+/**
+ * @file   reed_solomon.cc
+ * @author Yawning Angel (yawning at schwanenlied dot me)
+ * @brief  Systematic Reed-Solomon erasure code over GF(2^8)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SL_RS_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#include "schwanenlied/reed_solomon.h"
+
+namespace schwanenlied {
+
+const size_t ReedSolomon::kMaxDataShards;
+const size_t ReedSolomon::kMaxParityShards;
+
+namespace {
+
+/** GF(2^8) log/antilog tables (x^8 + x^4 + x^3 + x^2 + 1) */
+struct GFTables {
+  GFTables() {
+    unsigned x = 1;
+    for (int i = 0; i < 255; i++) {
+      exp_[i] = static_cast<uint8_t>(x);
+      log_[x] = static_cast<uint8_t>(i);
+      x <<= 1;
+      if (x & 0x100)
+        x ^= 0x11d;
+    }
+    for (int i = 255; i < 512; i++)
+      exp_[i] = exp_[i - 255];
+    log_[0] = 0;
+  }
+
+  uint8_t exp_[512];
+  uint8_t log_[256];
+};
+
+const GFTables& gf() {
+  static const GFTables tables;
+  return tables;
+}
+
+inline uint8_t gf_mul(const uint8_t a,
+                      const uint8_t b) {
+  if (a == 0 || b == 0)
+    return 0;
+  const GFTables& t = gf();
+  return t.exp_[t.log_[a] + t.log_[b]];
+}
+
+inline uint8_t gf_inv(const uint8_t a) {
+  SL_ASSERT(a != 0);
+  const GFTables& t = gf();
+  return t.exp_[255 - t.log_[a]];
+}
+
+/*
+ * c * s = c * (s & 0x0f) ^ c * (s & 0xf0), so multiplying by a constant is two
+ * 16 entry table lookups, which is what pshufb does 16/32 bytes at a time.
+ */
+typedef void (*MulAddFn)(uint8_t* dst, const uint8_t* src, const uint8_t* lo,
+                         const uint8_t* hi, const size_t len);
+
+void mul_add_scalar(uint8_t* dst,
+                    const uint8_t* src,
+                    const uint8_t* lo,
+                    const uint8_t* hi,
+                    const size_t len) {
+  for (size_t i = 0; i < len; i++)
+    dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+}
+
+#ifdef SL_RS_HAVE_X86
+__attribute__((target("ssse3")))
+void mul_add_ssse3(uint8_t* dst,
+                   const uint8_t* src,
+                   const uint8_t* lo,
+                   const uint8_t* hi,
+                   const size_t len) {
+  const __m128i tbl_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo));
+  const __m128i tbl_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi));
+  const __m128i mask = _mm_set1_epi8(0x0f);
+
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    const __m128i p = _mm_xor_si128(
+        _mm_shuffle_epi8(tbl_lo, _mm_and_si128(s, mask)),
+        _mm_shuffle_epi8(tbl_hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+    __m128i* d = reinterpret_cast<__m128i*>(dst + i);
+    _mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(d), p));
+  }
+  mul_add_scalar(dst + i, src + i, lo, hi, len - i);
+}
+
+__attribute__((target("avx2")))
+void mul_add_avx2(uint8_t* dst,
+                  const uint8_t* src,
+                  const uint8_t* lo,
+                  const uint8_t* hi,
+                  const size_t len) {
+  const __m256i tbl_lo = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo)));
+  const __m256i tbl_hi = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi)));
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    const __m256i p = _mm256_xor_si256(
+        _mm256_shuffle_epi8(tbl_lo, _mm256_and_si256(s, mask)),
+        _mm256_shuffle_epi8(tbl_hi, _mm256_and_si256(_mm256_srli_epi64(s, 4),
+                                                     mask)));
+    __m256i* d = reinterpret_cast<__m256i*>(dst + i);
+    _mm256_storeu_si256(d, _mm256_xor_si256(_mm256_loadu_si256(d), p));
+  }
+  mul_add_ssse3(dst + i, src + i, lo, hi, len - i);
+}
+#endif
+
+bool impl_supported(const ReedSolomon::Impl impl) {
+  switch (impl) {
+  case ReedSolomon::Impl::kScalar:
+    return true;
+#ifdef SL_RS_HAVE_X86
+  case ReedSolomon::Impl::kSSSE3:
+    return __builtin_cpu_supports("ssse3");
+  case ReedSolomon::Impl::kAVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+MulAddFn impl_fn(const ReedSolomon::Impl impl) {
+  switch (impl) {
+#ifdef SL_RS_HAVE_X86
+  case ReedSolomon::Impl::kSSSE3:
+    return mul_add_ssse3;
+  case ReedSolomon::Impl::kAVX2:
+    return mul_add_avx2;
+#endif
+  default:
+    return mul_add_scalar;
+  }
+}
+
+ReedSolomon::Impl& current_impl() {
+  static ReedSolomon::Impl impl =
+      impl_supported(ReedSolomon::Impl::kAVX2) ? ReedSolomon::Impl::kAVX2 :
+      impl_supported(ReedSolomon::Impl::kSSSE3) ? ReedSolomon::Impl::kSSSE3 :
+      ReedSolomon::Impl::kScalar;
+  return impl;
+}
+
+} // namespace
+
+const uint8_t ReedSolomon::coefficient(const size_t parity_idx,
+                                       const size_t data_idx) {
+  SL_ASSERT(parity_idx < kMaxParityShards);
+  SL_ASSERT(data_idx < kMaxDataShards);
+
+  /*
+   * Cauchy matrix element 1 / (x_i + y_j), with x_i = kMaxDataShards + i and
+   * y_j = j, with column j scaled by (x_0 + y_j) so that row 0 is all 1s.
+   */
+  const uint8_t x_0 = static_cast<uint8_t>(kMaxDataShards);
+  const uint8_t x_i = static_cast<uint8_t>(kMaxDataShards + parity_idx);
+  const uint8_t y_j = static_cast<uint8_t>(data_idx);
+  return gf_mul(x_0 ^ y_j, gf_inv(x_i ^ y_j));
+}
+
+void ReedSolomon::mul_add(uint8_t* dst,
+                          const uint8_t* src,
+                          const uint8_t c,
+                          const size_t len) {
+  if (c == 0 || len == 0)
+    return;
+  if (c == 1) {
+    for (size_t i = 0; i < len; i++)
+      dst[i] ^= src[i];
+    return;
+  }
+
+  uint8_t lo[16];
+  uint8_t hi[16];
+  for (int i = 0; i < 16; i++) {
+    lo[i] = gf_mul(c, static_cast<uint8_t>(i));
+    hi[i] = gf_mul(c, static_cast<uint8_t>(i << 4));
+  }
+  impl_fn(current_impl())(dst, src, lo, hi, len);
+}
+
+void ReedSolomon::encode(uint8_t* const* parity,
+                         const size_t m,
+                         const size_t data_idx,
+                         const uint8_t* data,
+                         const size_t len) {
+  SL_ASSERT(m <= kMaxParityShards);
+
+  for (size_t i = 0; i < m; i++)
+    mul_add(parity[i], data, coefficient(i, data_idx), len);
+}
+
+bool ReedSolomon::reconstruct(uint8_t* const* data,
+                              const bool* present,
+                              const size_t k,
+                              const uint8_t* const* parity,
+                              const size_t m,
+                              const size_t len) {
+  SL_ASSERT(k <= kMaxDataShards);
+  SL_ASSERT(m <= kMaxParityShards);
+
+  // Figure out what is missing, and which parity shards to use
+  ::std::vector<size_t> missing;
+  for (size_t j = 0; j < k; j++) {
+    if (!present[j])
+      missing.push_back(j);
+  }
+  const size_t e = missing.size();
+  if (e == 0)
+    return true;
+  ::std::vector<size_t> rows;
+  for (size_t i = 0; i < m && rows.size() < e; i++) {
+    if (parity[i] != nullptr)
+      rows.push_back(i);
+  }
+  if (rows.size() < e)
+    return false;
+
+  // Remove the contribution of the data shards that are present
+  ::std::unique_ptr<uint8_t[]> syndromes(new uint8_t[e * len]);
+  for (size_t r = 0; r < e; r++) {
+    uint8_t* s = syndromes.get() + r * len;
+    ::std::memcpy(s, parity[rows[r]], len);
+    for (size_t j = 0; j < k; j++) {
+      if (present[j])
+        mul_add(s, data[j], coefficient(rows[r], j), len);
+    }
+  }
+
+  // Invert the e x e submatrix that maps the missing shards to the syndromes
+  ::std::vector<uint8_t> a(e * e);
+  ::std::vector<uint8_t> inv(e * e, 0);
+  for (size_t r = 0; r < e; r++) {
+    for (size_t c = 0; c < e; c++)
+      a[r * e + c] = coefficient(rows[r], missing[c]);
+    inv[r * e + r] = 1;
+  }
+  for (size_t c = 0; c < e; c++) {
+    size_t pivot = c;
+    while (pivot < e && a[pivot * e + c] == 0)
+      pivot++;
+    if (pivot == e)
+      return false;  // Can't happen, every square submatrix is invertible
+    if (pivot != c) {
+      for (size_t i = 0; i < e; i++) {
+        ::std::swap(a[pivot * e + i], a[c * e + i]);
+        ::std::swap(inv[pivot * e + i], inv[c * e + i]);
+      }
+    }
+    const uint8_t scale = gf_inv(a[c * e + c]);
+    for (size_t i = 0; i < e; i++) {
+      a[c * e + i] = gf_mul(a[c * e + i], scale);
+      inv[c * e + i] = gf_mul(inv[c * e + i], scale);
+    }
+    for (size_t r = 0; r < e; r++) {
+      const uint8_t f = a[r * e + c];
+      if (r == c || f == 0)
+        continue;
+      for (size_t i = 0; i < e; i++) {
+        a[r * e + i] ^= gf_mul(f, a[c * e + i]);
+        inv[r * e + i] ^= gf_mul(f, inv[c * e + i]);
+      }
+    }
+  }
+
+  // Rebuild the missing shards
+  for (size_t c = 0; c < e; c++) {
+    uint8_t* dst = data[missing[c]];
+    ::std::memset(dst, 0, len);
+    for (size_t r = 0; r < e; r++)
+      mul_add(dst, syndromes.get() + r * len, inv[c * e + r], len);
+  }
+
+  return true;
+}
+
+const ReedSolomon::Impl ReedSolomon::impl() {
+  return current_impl();
+}
+
+bool ReedSolomon::set_impl(const Impl impl) {
+  if (!impl_supported(impl))
+    return false;
+  current_impl() = impl;
+  return true;
+}
+
+} // namespace schwanenlied
@@ -0,0 +1,160 @@
+/**
+ * @file   reed_solomon.h
+ * @author Yawning Angel (yawning at schwanenlied dot me)
+ * @brief  Systematic Reed-Solomon erasure code over GF(2^8)
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_REED_SOLOMON_H__
+#define SCHWANENLIED_REED_SOLOMON_H__
+
+#include "schwanenlied/common.h"
+
+namespace schwanenlied {
+
+/**
+ * Systematic Reed-Solomon erasure code over GF(2^8)
+ *
+ * The k data shards are sent as is, and each of the m parity shards is a
+ * linear combination of the data shards.  Any k of the k + m shards are
+ * sufficient to reconstruct the data.  The encoding matrix is a Cauchy matrix
+ * with each column scaled so that the first parity shard is the XOR of the
+ * data shards, so m = 1 degenerates to simple XOR parity.
+ *
+ * The coefficients do not depend on k, so a block can be encoded
+ * incrementally (one data shard at a time) and closed early with fewer than
+ * the planned number of data shards.
+ *
+ * The GF(2^8) multiply-accumulate that does all the heavy lifting uses the
+ * split nibble table lookup technique, with SSSE3/AVX2 (pshufb) versions that
+ * are selected at runtime on x86 CPUs that support them.
+ */
+class ReedSolomon {
+ public:
+  /** The maximum number of data shards in a block */
+  static const size_t kMaxDataShards = 128;
+  /** The maximum number of parity shards in a block */
+  static const size_t kMaxParityShards = 128;
+
+  /** The GF(2^8) multiply-accumulate implementations */
+  enum class Impl {
+    kScalar,  /**< Portable C++ */
+    kSSSE3,   /**< x86 SSSE3 (16 bytes at a time) */
+    kAVX2     /**< x86 AVX2 (32 bytes at a time) */
+  };
+
+  /** @{ */
+  /**
+   * Get the encoding coefficient of a data shard for a parity shard
+   *
+   * @param[in] parity_idx  The parity shard index (< kMaxParityShards)
+   * @param[in] data_idx    The data shard index (< kMaxDataShards)
+   *
+   * @returns The GF(2^8) coefficient (1 for every data shard if parity_idx is 0)
+   */
+  static const uint8_t coefficient(const size_t parity_idx,
+                                   const size_t data_idx);
+
+  /**
+   * Multiply a buffer by a constant and add (XOR) it to another buffer
+   *
+   * @param[in,out] dst The buffer to add to
+   * @param[in] src     The buffer to multiply
+   * @param[in] c       The constant to multiply by
+   * @param[in] len     The length of the buffers in bytes
+   */
+  static void mul_add(uint8_t* dst,
+                      const uint8_t* src,
+                      const uint8_t c,
+                      const size_t len);
+
+  /**
+   * Add a data shard to a set of parity shards
+   *
+   * The parity shards must be zero filled before the first data shard is
+   * added.  Data shards that are shorter than the parity shards are treated as
+   * if they were zero padded.
+   *
+   * @param[in,out] parity  The m parity shards
+   * @param[in] m           The number of parity shards
+   * @param[in] data_idx    The index of the data shard
+   * @param[in] data        The data shard
+   * @param[in] len         The length of the data shard in bytes
+   */
+  static void encode(uint8_t* const* parity,
+                     const size_t m,
+                     const size_t data_idx,
+                     const uint8_t* data,
+                     const size_t len);
+
+  /**
+   * Reconstruct missing data shards
+   *
+   * @param[in,out] data  The k data shards (Missing shards are overwritten)
+   * @param[in] present   Which of the data shards are present
+   * @param[in] k         The number of data shards
+   * @param[in] parity    The m parity shards (nullptr if missing)
+   * @param[in] m         The number of parity shards
+   * @param[in] len       The length of each shard in bytes
+   *
+   * @returns true  - All of the missing data shards were reconstructed
+   * @returns false - Not enough parity shards are present
+   */
+  static bool reconstruct(uint8_t* const* data,
+                          const bool* present,
+                          const size_t k,
+                          const uint8_t* const* parity,
+                          const size_t m,
+                          const size_t len);
+  /** @} */
+
+  /** @{ */
+  /** Get the multiply-accumulate implementation in use */
+  static const Impl impl();
+
+  /**
+   * Set the multiply-accumulate implementation (Mostly for testing)
+   *
+   * @param[in] impl  The implementation to use
+   *
+   * @returns true  - The implementation is now in use
+   * @returns false - The CPU does not support the implementation
+   */
+  static bool set_impl(const Impl impl);
+  /** @} */
+
+ private:
+  ReedSolomon() = delete;
+  ReedSolomon(const ReedSolomon&) = delete;
+  void operator=(const ReedSolomon&) = delete;
+};
+
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_REED_SOLOMON_H__
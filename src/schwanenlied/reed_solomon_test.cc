@@ -0,0 +1,158 @@
+/*
+ * reed_solomon_test.cc: Reed-Solomon erasure code tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "schwanenlied/reed_solomon.h"
+#include "schwanenlied/crypto/random.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+
+class ReedSolomonTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {};
+  virtual void TearDown() {};
+};
+
+TEST_F(ReedSolomonTest, MulAddTest) {
+  crypto::Random rng;
+  const size_t len = 1000 + 7;  // Exercise the SIMD tails
+  ::std::vector<uint8_t> src(len);
+  ::std::vector<uint8_t> dst(len);
+  ::std::vector<uint8_t> expected(len);
+  rng.get_bytes(&src[0], len);
+  rng.get_bytes(&dst[0], len);
+
+  const ReedSolomon::Impl best = ReedSolomon::impl();
+  const ReedSolomon::Impl impls[] = {
+    ReedSolomon::Impl::kSSSE3,
+    ReedSolomon::Impl::kAVX2
+  };
+  for (unsigned c = 0; c < 256; c += 17) {
+    ASSERT_TRUE(ReedSolomon::set_impl(ReedSolomon::Impl::kScalar));
+    expected = dst;
+    ReedSolomon::mul_add(&expected[0], &src[0], c, len);
+
+    // Every implementation supported by the CPU must agree with the scalar one
+    for (auto impl : impls) {
+      if (!ReedSolomon::set_impl(impl))
+        continue;
+      ::std::vector<uint8_t> tmp(dst);
+      ReedSolomon::mul_add(&tmp[0], &src[0], c, len);
+      ASSERT_EQ(expected, tmp);
+    }
+  }
+  ASSERT_TRUE(ReedSolomon::set_impl(best));
+
+  // Multiplying by 0 is a no-op, and by 1 is XOR
+  expected = dst;
+  ReedSolomon::mul_add(&dst[0], &src[0], 0, len);
+  ASSERT_EQ(expected, dst);
+  ReedSolomon::mul_add(&dst[0], &src[0], 1, len);
+  for (size_t i = 0; i < len; i++)
+    ASSERT_EQ(expected[i] ^ src[i], dst[i]);
+}
+
+TEST_F(ReedSolomonTest, ReconstructTest) {
+  crypto::Random rng;
+  const size_t k = 10;
+  const size_t m = 4;
+  const size_t len = 1200;
+
+  // Build the data shards, and encode them one at a time
+  ::std::vector<::std::vector<uint8_t>> data(k, ::std::vector<uint8_t>(len));
+  ::std::vector<::std::vector<uint8_t>> parity(m,
+                                               ::std::vector<uint8_t>(len, 0));
+  ::std::vector<uint8_t*> parity_ptrs;
+  for (auto& p : parity)
+    parity_ptrs.push_back(&p[0]);
+  for (size_t j = 0; j < k; j++) {
+    rng.get_bytes(&data[j][0], len);
+    ReedSolomon::encode(&parity_ptrs[0], m, j, &data[j][0], len);
+  }
+
+  // The first parity shard is plain XOR
+  for (size_t i = 0; i < len; i++) {
+    uint8_t x = 0;
+    for (size_t j = 0; j < k; j++)
+      x ^= data[j][i];
+    ASSERT_EQ(x, parity[0][i]);
+  }
+
+  // Lose up to m shards in various combinations, and reconstruct
+  for (size_t lost = 1; lost <= m; lost++) {
+    for (int iter = 0; iter < 16; iter++) {
+      ::std::vector<::std::vector<uint8_t>> rx(data);
+      bool present[k];
+      ::std::vector<const uint8_t*> rx_parity;
+      for (auto& p : parity)
+        rx_parity.push_back(&p[0]);
+      for (size_t j = 0; j < k; j++)
+        present[j] = true;
+
+      // Lose lost shards, some data and possibly some parity
+      size_t nr_lost = 0;
+      while (nr_lost < lost) {
+        const size_t idx = rng.get_uint32_range(k + m);
+        if (idx < k && present[idx]) {
+          present[idx] = false;
+          ::std::memset(&rx[idx][0], 0xa5, len);
+          nr_lost++;
+        } else if (idx >= k && rx_parity[idx - k] != nullptr) {
+          rx_parity[idx - k] = nullptr;
+          nr_lost++;
+        }
+      }
+
+      ::std::vector<uint8_t*> rx_ptrs;
+      for (auto& d : rx)
+        rx_ptrs.push_back(&d[0]);
+      ASSERT_TRUE(ReedSolomon::reconstruct(&rx_ptrs[0], present, k,
+                                           &rx_parity[0], m, len));
+      ASSERT_EQ(data, rx);
+    }
+  }
+
+  // Losing more than m shards is unrecoverable
+  bool present[k];
+  for (size_t j = 0; j < k; j++)
+    present[j] = j > m;
+  ::std::vector<uint8_t*> data_ptrs;
+  for (auto& d : data)
+    data_ptrs.push_back(&d[0]);
+  ::std::vector<const uint8_t*> rx_parity(parity_ptrs.begin(),
+                                          parity_ptrs.end());
+  ASSERT_FALSE(ReedSolomon::reconstruct(&data_ptrs[0], present, k,
+                                        &rx_parity[0], m, len));
+}
+
+} // namespace schwanenlied
@@ -0,0 +1,126 @@
+/**
+ * @file   seqlock.h
+ * @author Yawning Angel (yawning at schwanenlied dot me)
+ * @brief  A single writer Sequence Lock
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_SEQLOCK_H__
+#define SCHWANENLIED_SEQLOCK_H__
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+#include "schwanenlied/common.h"
+
+namespace schwanenlied {
+
+/**
+ * A single writer, multiple reader Sequence Lock
+ *
+ * This allows a value that is periodically updated by one thread (Eg: the
+ * event loop) to be read consistently by any number of other threads (Eg: a
+ * monitoring thread), without the writer ever blocking.  Readers retry if a
+ * store() happened while they were copying the value out.
+ *
+ * The value is stored as relaxed atomic words so that concurrent access is
+ * well defined, so T must be trivially copyable.
+ *
+ * @warning store() must only ever be called from one thread at a time.
+ */
+template <class T>
+class SeqLock {
+ public:
+  static_assert(::std::is_trivially_copyable<T>::value,
+                "SeqLock requires a trivially copyable type");
+
+  SeqLock() :
+      seq_(0) {
+    for (auto& w : words_)
+      w.store(0, ::std::memory_order_relaxed);
+  }
+
+  /**
+   * Publish a new value (Writer)
+   *
+   * @param[in] value The value to publish
+   */
+  void store(const T& value) {
+    uint64_t buf[kNrWords] = { 0 };
+    ::std::memcpy(buf, &value, sizeof(T));
+
+    const uint32_t seq = seq_.load(::std::memory_order_relaxed);
+    seq_.store(seq + 1, ::std::memory_order_relaxed);
+    ::std::atomic_thread_fence(::std::memory_order_release);
+    for (size_t i = 0; i < kNrWords; i++)
+      words_[i].store(buf[i], ::std::memory_order_relaxed);
+    seq_.store(seq + 2, ::std::memory_order_release);
+  }
+
+  /**
+   * Read a consistent copy of the most recently published value (Reader)
+   *
+   * @param[out] value Where to store the value
+   */
+  void load(T& value) const {
+    uint64_t buf[kNrWords];
+    uint32_t seq0, seq1;
+
+    do {
+      seq0 = seq_.load(::std::memory_order_acquire);
+      for (size_t i = 0; i < kNrWords; i++)
+        buf[i] = words_[i].load(::std::memory_order_relaxed);
+      ::std::atomic_thread_fence(::std::memory_order_acquire);
+      seq1 = seq_.load(::std::memory_order_relaxed);
+    } while ((seq0 & 1) || seq0 != seq1);
+
+    ::std::memcpy(&value, buf, sizeof(T));
+  }
+
+  /** Return the number of times store() has been called */
+  uint32_t generation() const {
+    return seq_.load(::std::memory_order_acquire) >> 1;
+  }
+
+ private:
+  SeqLock(const SeqLock&) = delete;
+  void operator=(const SeqLock&) = delete;
+
+  /** The number of 64 bit words needed to hold a T */
+  static const size_t kNrWords = (sizeof(T) + sizeof(uint64_t) - 1) /
+      sizeof(uint64_t);
+
+  ::std::atomic<uint32_t> seq_;             /**< The sequence counter */
+  ::std::atomic<uint64_t> words_[kNrWords]; /**< The value storage */
+};
+
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_SEQLOCK_H__
@@ -0,0 +1,83 @@
+/*
+ * seqlock_test.cc: Sequence Lock tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <thread>
+
+#include "schwanenlied/seqlock.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+
+class SeqLockTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {};
+  virtual void TearDown() {};
+};
+
+TEST_F(SeqLockTest, Consistency) {
+  struct Value {
+    uint64_t a_;
+    uint64_t b_;
+    uint32_t c_;
+  };
+
+  SeqLock<Value> lock;
+  Value v;
+  lock.load(v);
+  ASSERT_EQ(0u, v.a_);
+  ASSERT_EQ(0u, lock.generation());
+
+  // Every published value has a_ == b_ == c_, so a torn read is detectable
+  const uint64_t kIterations = 200000;
+  ::std::atomic<bool> done(false);
+  ::std::thread writer([&lock, &done, kIterations]() {
+    for (uint64_t i = 1; i <= kIterations; i++) {
+      Value w = { i, i, static_cast<uint32_t>(i) };
+      lock.store(w);
+    }
+    done.store(true);
+  });
+
+  uint64_t last = 0;
+  while (!done.load()) {
+    Value r;
+    lock.load(r);
+    ASSERT_EQ(r.a_, r.b_);
+    ASSERT_EQ(static_cast<uint32_t>(r.a_), r.c_);
+    ASSERT_GE(r.a_, last);
+    last = r.a_;
+  }
+  writer.join();
+
+  lock.load(v);
+  ASSERT_EQ(kIterations, v.a_);
+  ASSERT_EQ(kIterations, lock.generation());
+}
+
+} // namespace schwanenlied
@@ -0,0 +1,139 @@
+/**
+ * @file    sim_clock.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Virtual time Clock for discrete event simulation (IMPLEMENTATION)
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "schwanenlied/sim_clock.h"
+#include "schwanenlied/timer.h"
+
+namespace schwanenlied {
+
+SimClock::SimClock(const time_point& start) :
+    now_(start),
+    next_seq_(0),
+    events_run_(0) {
+  // Empty!
+}
+
+SimClock::~SimClock() {
+  /*
+   * Timers are expected to be destroyed before the SimClock, but there may be
+   * other events that reference objects that are gone, so just drop them.
+   */
+  events_.clear();
+}
+
+SimClock::EventId SimClock::schedule(const duration& delay,
+                                     const ::std::function<void()> fn) {
+  SL_ASSERT(fn);
+  SL_ASSERT(delay.count() >= 0);
+
+  const EventId id(now_ + delay, next_seq_++);
+  events_.insert(::std::make_pair(id, fn));
+  return id;
+}
+
+bool SimClock::cancel(const EventId& id) {
+  return events_.erase(id) != 0;
+}
+
+bool SimClock::step() {
+  if (events_.empty())
+    return false;
+
+  // Remove the event before running it, as it may schedule/cancel others
+  auto it = events_.begin();
+  now_ = it->first.first;
+  ::std::function<void()> fn;
+  fn.swap(it->second);
+  events_.erase(it);
+
+  events_run_++;
+  fn();
+  return true;
+}
+
+size_t SimClock::run_until(const time_point& deadline) {
+  size_t nr_run = 0;
+  while (!events_.empty() && events_.begin()->first.first <= deadline) {
+    step();
+    nr_run++;
+  }
+
+  return nr_run;
+}
+
+size_t SimClock::run() {
+  size_t nr_run = 0;
+  while (step())
+    nr_run++;
+
+  return nr_run;
+}
+
+void* SimClock::timer_create(Timer& timer) {
+  SimTimer* t = new SimTimer{timer, false, EventId()};
+  return t;
+}
+
+void SimClock::timer_destroy(void* handle) {
+  timer_stop(handle);
+  delete reinterpret_cast<SimTimer*>(handle);
+}
+
+bool SimClock::timer_start(void* handle,
+                           const ::std::chrono::milliseconds& delta_t) {
+  SimTimer* t = reinterpret_cast<SimTimer*>(handle);
+  SL_ASSERT(!t->active_);
+
+  t->event_ = schedule(delta_t, [t]() {
+    t->active_ = false;
+    t->timer_.fire();
+  });
+  t->active_ = true;
+
+  return true;
+}
+
+void SimClock::timer_stop(void* handle) {
+  SimTimer* t = reinterpret_cast<SimTimer*>(handle);
+  if (t->active_) {
+    cancel(t->event_);
+    t->active_ = false;
+  }
+}
+
+bool SimClock::timer_is_active(const void* handle) const {
+  return reinterpret_cast<const SimTimer*>(handle)->active_;
+}
+
+} // namespace schwanenlied
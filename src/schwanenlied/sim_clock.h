@@ -0,0 +1,158 @@
+/**
+ * @file    sim_clock.h
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   Virtual time Clock for discrete event simulation
+ */
+
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SCHWANENLIED_SIM_CLOCK_H__
+#define SCHWANENLIED_SIM_CLOCK_H__
+
+#include <functional>
+#include <map>
+#include <utility>
+
+#include "schwanenlied/clock.h"
+
+namespace schwanenlied {
+
+/**
+ * A virtual time Clock and discrete event scheduler
+ *
+ * Time only advances when run() (or step()) executes the next scheduled event,
+ * at which point now() jumps to the event's time.  Events scheduled for the
+ * same time run in the order that they were scheduled, so a simulation that
+ * only takes randomness from a seeded PRNG is entirely reproducible.
+ *
+ * Timers created with a SimClock are scheduled as events.
+ *
+ * @warning This is not thread safe.
+ */
+class SimClock : public Clock {
+ public:
+  /** A handle to a scheduled event (for cancel()) */
+  typedef ::std::pair<time_point, uint64_t> EventId;
+
+  /**
+   * Construct a SimClock
+   *
+   * @param[in] start The initial virtual time
+   */
+  explicit SimClock(const time_point& start = time_point());
+
+  ~SimClock();
+
+  time_point now() const override { return now_; }
+
+  /** @{ */
+  /**
+   * Schedule a callback
+   *
+   * @param[in] delay The virtual time from now() at which to run fn
+   * @param[in] fn    The callback
+   *
+   * @returns The EventId of the scheduled event
+   */
+  EventId schedule(const duration& delay,
+                   const ::std::function<void()> fn);
+
+  /**
+   * Cancel a scheduled event
+   *
+   * @param[in] id  The EventId returned from schedule()
+   *
+   * @returns true - The event was cancelled
+   * @returns false - The event already ran (or was cancelled)
+   */
+  bool cancel(const EventId& id);
+
+  /**
+   * Run the next scheduled event
+   *
+   * @returns true - A event was run
+   * @returns false - There are no scheduled events
+   */
+  bool step();
+
+  /**
+   * Run events until there are none left, or the next event is after deadline
+   *
+   * On return now() is the time of the last event that was run.
+   *
+   * @param[in] deadline  The virtual time to stop at
+   *
+   * @returns The number of events that were run
+   */
+  size_t run_until(const time_point& deadline);
+
+  /**
+   * Run events until there are none left
+   *
+   * @returns The number of events that were run
+   */
+  size_t run();
+  /** @} */
+
+  /** @{ */
+  /** Return the number of scheduled events */
+  size_t pending() const { return events_.size(); }
+  /** Return the total number of events run */
+  uint64_t events_run() const { return events_run_; }
+  /** @} */
+
+ protected:
+  void* timer_create(Timer& timer) override;
+  void timer_destroy(void* handle) override;
+  bool timer_start(void* handle,
+                   const ::std::chrono::milliseconds& delta_t) override;
+  void timer_stop(void* handle) override;
+  bool timer_is_active(const void* handle) const override;
+
+ private:
+  SimClock(const SimClock&) = delete;
+  void operator=(const SimClock&) = delete;
+
+  /** The backend state of a Timer */
+  struct SimTimer {
+    Timer& timer_;    /**< The Timer */
+    bool active_;     /**< Is the timer scheduled? */
+    EventId event_;   /**< The scheduled event, if active_ */
+  };
+
+  /** The scheduled events, ordered by time and then scheduling order */
+  ::std::map<EventId, ::std::function<void()>> events_;
+  time_point now_;      /**< The current virtual time */
+  uint64_t next_seq_;   /**< The sequence number of the next event */
+  uint64_t events_run_; /**< The total number of events run */
+};
+
+} // namespace schwanenlied
+
+#endif // SCHWANENLIED_SIM_CLOCK_H__
@@ -0,0 +1,106 @@
+/*
+ * sim_clock_test.cc: Virtual time Clock tests
+ *
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <vector>
+
+#include "schwanenlied/sim_clock.h"
+#include "schwanenlied/timer.h"
+#include "gtest/gtest.h"
+
+namespace schwanenlied {
+
+class SimClockTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {};
+  virtual void TearDown() {};
+};
+
+TEST_F(SimClockTest, Events) {
+  SimClock clock;
+  const Clock::time_point start = clock.now();
+  ::std::vector<int> order;
+
+  // Events run in time order, and ties in scheduling order
+  const ::std::chrono::milliseconds ms(1);
+  clock.schedule(20 * ms, [&]() { order.push_back(3); });
+  clock.schedule(10 * ms, [&]() { order.push_back(1); });
+  clock.schedule(10 * ms, [&]() { order.push_back(2); });
+  auto id = clock.schedule(::std::chrono::milliseconds(15),
+                           [&]() { order.push_back(-1); });
+  ASSERT_EQ(4u, clock.pending());
+  ASSERT_TRUE(clock.cancel(id));
+  ASSERT_FALSE(clock.cancel(id));
+
+  // Events can schedule more events
+  clock.schedule(::std::chrono::milliseconds(30), [&]() {
+    order.push_back(4);
+    clock.schedule(5 * ms, [&]() { order.push_back(5); });
+  });
+
+  ASSERT_EQ(2u, clock.run_until(start + ::std::chrono::milliseconds(10)));
+  ASSERT_EQ(start + ::std::chrono::milliseconds(10), clock.now());
+  ASSERT_EQ(3u, clock.run());
+  ASSERT_EQ(start + ::std::chrono::milliseconds(35), clock.now());
+  ASSERT_EQ((::std::vector<int>{1, 2, 3, 4, 5}), order);
+  ASSERT_EQ(5u, clock.events_run());
+  ASSERT_FALSE(clock.step());
+}
+
+TEST_F(SimClockTest, Timer) {
+  SimClock clock;
+  const Clock::time_point start = clock.now();
+  int fired = 0;
+  Clock::time_point fired_at;
+
+  Timer t([&]() {
+    fired++;
+    fired_at = clock.now();
+  }, clock);
+  ASSERT_FALSE(t.is_active());
+
+  // Restarting replaces the pending expiry
+  ASSERT_TRUE(t.start(::std::chrono::milliseconds(100)));
+  ASSERT_TRUE(t.start(::std::chrono::milliseconds(200)));
+  ASSERT_TRUE(t.is_active());
+  ASSERT_EQ(1u, clock.pending());
+  clock.run();
+  ASSERT_EQ(1, fired);
+  ASSERT_EQ(start + ::std::chrono::milliseconds(200), fired_at);
+  ASSERT_FALSE(t.is_active());
+
+  // Stopped timers do not fire
+  ASSERT_TRUE(t.start(::std::chrono::milliseconds(100)));
+  t.stop();
+  ASSERT_FALSE(t.is_active());
+  ASSERT_EQ(0u, clock.run());
+  ASSERT_EQ(1, fired);
+}
+
+} // namespace schwanenlied
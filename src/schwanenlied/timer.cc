@@ -31,60 +31,43 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <cstdlib>
-
 #include "schwanenlied/timer.h"
 
 namespace schwanenlied {
 
 Timer::Timer(const ::std::function<void()> callback_fn) :
-    callback_fn_(callback_fn) {
+    Timer(callback_fn, Clock::system()) {
+  // Empty!
+}
+
+Timer::Timer(const ::std::function<void()> callback_fn,
+             Clock& clock) :
+    callback_fn_(callback_fn),
+    clock_(clock) {
   SL_ASSERT(callback_fn_);
 
-  timer_handle_ = reinterpret_cast<uv_timer_t*>(::std::calloc(1, sizeof(*timer_handle_)));
+  timer_handle_ = clock_.timer_create(*this);
   SL_ASSERT(timer_handle_ != nullptr);
-
-  uv_timer_init(uv_default_loop(), timer_handle_);
-  timer_handle_->data = this;
 }
 
 Timer::~Timer() {
-  uv_handle_t* t_handle = reinterpret_cast<uv_handle_t*>(timer_handle_);
-
-  // Stop the timer if it is pending
-  if (uv_is_active(t_handle))
-    uv_timer_stop(timer_handle_);
-
-  // Handle defered timer cleanup with a lambda
-  uv_close_cb close_cb = [](uv_handle_t* handle) {
-    free(handle);
-  };
-  uv_close(t_handle, close_cb);
-
+  clock_.timer_destroy(timer_handle_);
   timer_handle_ = nullptr;
 }
 
 const bool Timer::is_active() const {
-  return (0 != uv_is_active(reinterpret_cast<uv_handle_t*>(timer_handle_)));
+  return clock_.timer_is_active(timer_handle_);
 }
 
 bool Timer::start(const ::std::chrono::milliseconds& delta_t) {
   // Stop the existing timer, if running
   stop();
 
-  // Gratuitous use of yet another lambda to call the timer callback
-  uv_timer_cb timer_cb = [](uv_timer_t* handle, int status) {
-    // Does status ever hold anything important?
-    reinterpret_cast<Timer*>(handle->data)->fire();
-  };
-  int ret = uv_timer_start(timer_handle_, timer_cb, delta_t.count(), 0);
-
-  return (ret == 0);
+  return clock_.timer_start(timer_handle_, delta_t);
 }
 
 void Timer::stop() {
-  if (uv_is_active(reinterpret_cast<uv_handle_t*>(timer_handle_)))
-    uv_timer_stop(timer_handle_);
+  clock_.timer_stop(timer_handle_);
 }
 
 } // namespace schwanenlied
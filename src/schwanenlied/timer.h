@@ -37,21 +37,19 @@
 #include <chrono>
 #include <functional>
 
-#include <uv.h>
-
 #include "schwanenlied/common.h"
+#include "schwanenlied/clock.h"
 
 namespace schwanenlied {
 
 /**
  * Asynchronous callback based timer
  *
- * This provides a simple millisecond resolution timer based on
- * [libuv](https://github.com/joyent/libuv).  It is expected that the
+ * This provides a simple millisecond resolution timer, that is scheduled by a
+ * Clock.  With the default Clock::system() this is based on
+ * [libuv](https://github.com/joyent/libuv), and it is expected that the
  * application handles running the libuv default event loop, and nothing will
  * happen if the loop is not actually run.
- *
- * @todo Like crypto::Random this may be better off as an abstract base class
  */
 class Timer {
  public:
@@ -61,7 +59,16 @@ class Timer {
    * @param[in] callback_fn The function to call when the timer expires
    */
   Timer(const ::std::function<void()> callback_fn);
-  
+
+  /**
+   * Create a timer with a given callback function, scheduled by a Clock.
+   *
+   * @param[in] callback_fn The function to call when the timer expires
+   * @param[in] clock       The Clock that schedules the timer
+   */
+  Timer(const ::std::function<void()> callback_fn,
+        Clock& clock);
+
   ~Timer();
 
   /** @{ */
@@ -101,7 +108,8 @@ class Timer {
   void operator=(const Timer&) = delete;
 
   const ::std::function<void()> callback_fn_; /**< The timer callback */
-  uv_timer_t* timer_handle_; /**< The libuv timer handle */
+  Clock& clock_;        /**< The Clock that schedules the timer */
+  void* timer_handle_;  /**< The Clock specific timer handle */
 };
 
 } // namespace schwanenlied
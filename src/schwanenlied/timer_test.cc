@@ -49,6 +49,8 @@ TEST_F(TimerTest, SmokeTest) {
     uv_stop(uv_default_loop());          
   });
 
+  // Earlier tests may have left the loop's cached time stale
+  uv_update_time(uv_default_loop());
   ASSERT_TRUE(t.start(interval));
   ASSERT_TRUE(t.is_active());
 
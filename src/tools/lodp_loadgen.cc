@@ -0,0 +1,1301 @@
+/**
+ * @file    lodp_loadgen.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   LODP responder load generator
+ */
+
+
+/*
+ * Copyright (c) 2014, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * lodp_loadgen opens a large number of LodpSessions against a responder, each
+ * from it's own UDP socket (and thus source port) on loopback, and drives them
+ * at a configurable handshake rate, message size/rate, rekey cadence and
+ * session lifetime (churn).  At the end of the run handshake/rekey latency
+ * percentiles, throughput and error counters are reported.
+ *
+ * If the responder's public key is not specified, a responder LodpEndpoint is
+ * run in the same event loop, and it's statistics are included in the report.
+ * The local responder's traffic can be captured to a PacketTrace (--trace) for
+ * lodp_replay, with a fixed key (--responder-key) so the trace can be decrypted.
+ *
+ * Each client is a initiator LodpEndpoint with a single LodpSession, since
+ * that is what real clients look like to the responder's session table.
+ * Sources addresses are allocated from 127.0.1.1 upwards so that the number of
+ * clients is not limited by the size of the ephemeral port range.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/latency_histogram.h"
+#include "schwanenlied/timer.h"
+#include "schwanenlied/crypto/random.h"
+#include "schwanenlied/lodp/lodp_endpoint.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+namespace {
+
+const char kDefaultNodeId[] = "lodp_loadgen";
+
+/** lodp_loadgen scenario */
+struct LoadgenConfig {
+  LoadgenConfig() :
+      nr_clients_(1000),
+      clients_per_addr_(16384),
+      handshake_rate_(1000),
+      handshake_timeout_(500),
+      handshake_retries_(5),
+      message_size_(512),
+      message_rate_(1.0),
+      rekey_interval_(0),
+      lifetime_(0),
+      duration_(10),
+      report_interval_(1),
+      node_id_(kDefaultNodeId) {
+    ::std::memset(&dst_addr_, 0, sizeof(dst_addr_));
+    ::std::memset(&src_addr_, 0, sizeof(src_addr_));
+    dst_addr_.sin_family = AF_INET;
+    dst_addr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    dst_addr_.sin_port = htons(2323);
+    src_addr_.sin_family = AF_INET;
+    src_addr_.sin_addr.s_addr = htonl(0x7f000101);
+  }
+
+  /** @{ */
+  size_t nr_clients_;             /**< Concurrent clients */
+  size_t clients_per_addr_;       /**< Clients per source address */
+  struct sockaddr_in dst_addr_;   /**< The responder's address */
+  struct sockaddr_in src_addr_;   /**< The first source address */
+  /** @} */
+
+  /** @{ */
+  double handshake_rate_;         /**< Handshakes/sec (0 = unlimited) */
+  unsigned handshake_timeout_;    /**< Retransmission interval (ms) */
+  int handshake_retries_;         /**< Retransmissions before giving up */
+  /** @} */
+
+  /** @{ */
+  size_t message_size_;           /**< Message size (>= 8 bytes) */
+  double message_rate_;           /**< Messages/sec/client (0 = none) */
+  unsigned rekey_interval_;       /**< Seconds between rekeys (0 = never) */
+  unsigned lifetime_;             /**< Session lifetime (s, 0 = forever) */
+  /** @} */
+
+  /** @{ */
+  unsigned duration_;             /**< Length of the run (s) */
+  unsigned report_interval_;      /**< Progress report interval (s, 0 = off) */
+  /** @} */
+
+  /** @{ */
+  ::std::string public_key_;      /**< Responder public key (Empty = local) */
+  ::std::string private_key_;     /**< Local responder key (Empty = random) */
+  ::std::string node_id_;         /**< The responder's node ID */
+  ::std::string trace_path_;      /**< Local responder capture (Empty = off) */
+  /** @} */
+};
+
+/** lodp_loadgen results */
+struct LoadgenResults {
+  LoadgenResults() :
+      handshakes_started_(0),
+      handshakes_completed_(0),
+      handshake_retransmits_(0),
+      handshake_timeouts_(0),
+      handshake_failures_(0),
+      rekeys_started_(0),
+      rekeys_completed_(0),
+      rekey_retransmits_(0),
+      rekey_failures_(0),
+      sessions_churned_(0),
+      sessions_lost_(0),
+      messages_sent_(0),
+      bytes_sent_(0),
+      messages_received_(0),
+      bytes_received_(0),
+      socket_errors_(0),
+      tx_would_block_(0),
+      tx_errors_(0),
+      rx_packets_(0),
+      rx_errors_(0) {}
+
+  /** @{ */
+  uint64_t handshakes_started_;   /**< connect() + handshake() */
+  uint64_t handshakes_completed_; /**< on_connect() with kErrorOk */
+  uint64_t handshake_retransmits_; /**< handshake() retransmissions */
+  uint64_t handshake_timeouts_;   /**< Handshakes that ran out of retries */
+  uint64_t handshake_failures_;   /**< on_connect() with an error */
+  uint64_t rekeys_started_;       /**< rekey() initiated */
+  uint64_t rekeys_completed_;     /**< on_rekey() with kErrorOk */
+  uint64_t rekey_retransmits_;    /**< rekey() retransmissions */
+  uint64_t rekey_failures_;       /**< Rekeys that failed or timed out */
+  uint64_t sessions_churned_;     /**< Sessions closed due to lifetime_ */
+  uint64_t sessions_lost_;        /**< Sessions closed by the library */
+  /** @} */
+
+  /** @{ */
+  uint64_t messages_sent_;        /**< send_message() successes */
+  uint64_t bytes_sent_;           /**< Message bytes sent */
+  uint64_t messages_received_;    /**< Messages received (Local responder) */
+  uint64_t bytes_received_;       /**< Message bytes received */
+  /** @} */
+
+  /** @{ */
+  uint64_t socket_errors_;        /**< Failures to open a client socket */
+  uint64_t tx_would_block_;       /**< sendto() EAGAIN/ENOBUFS */
+  uint64_t tx_errors_;            /**< Other sendto() failures */
+  uint64_t rx_packets_;           /**< Datagrams received */
+  uint64_t rx_errors_;            /**< recvfrom() failures */
+  /** @} */
+
+  /** @{ */
+  ::std::map<int, uint64_t> send_errors_;     /**< send_message() errors */
+  ::std::map<int, uint64_t> packet_errors_;   /**< on_packet() errors */
+  ::std::map<int, uint64_t> session_errors_;  /**< Handshake/rekey errors */
+  /** @} */
+
+  /** @{ */
+  LatencyHistogram handshake_latency_;  /**< First handshake() to on_connect */
+  LatencyHistogram rekey_latency_;      /**< First rekey() to on_rekey */
+  LatencyHistogram message_latency_;    /**< One way (Local responder) */
+  /** @} */
+};
+
+uint64_t to_ns(const Clock::duration& d) {
+  return ::std::chrono::duration_cast< ::std::chrono::nanoseconds>(d).count();
+}
+
+double to_seconds(const Clock::duration& d) {
+  return to_ns(d) / 1e9;
+}
+
+/** Return now + interval seconds, or never if interval is 0 */
+Clock::time_point next_deadline(const Clock::time_point& now,
+                                const unsigned interval) {
+  if (interval == 0)
+    return Clock::time_point::max();
+  return now + ::std::chrono::seconds(interval);
+}
+
+::std::chrono::milliseconds to_timeout(const Clock::duration& d) {
+  // Round up so that deadlines have passed when the Timer fires
+  if (d.count() <= 0)
+    return ::std::chrono::milliseconds(0);
+  return ::std::chrono::duration_cast< ::std::chrono::milliseconds>(
+      d + ::std::chrono::milliseconds(1) - Clock::duration(1));
+}
+
+/**
+ * The load generator
+ *
+ * Clients move between the idle queue (waiting for the handshake pacer), the
+ * handshake, and the established/rekeying states.  All per-client actions
+ * (Handshake retransmission, messages, rekeying, churn) are driven off a
+ * single Timer per client, and teardown of a client's socket is always
+ * deferred to the Timer so that sockets are never closed while they are being
+ * read from.
+ */
+class LoadGenerator : private LodpCallbacks {
+ public:
+  LoadGenerator(crypto::Random& rng,
+                const LoadgenConfig& config);
+
+  ~LoadGenerator();
+
+  /**
+   * Bring up the responder (if local) and the clients
+   *
+   * @returns true - Success
+   * @returns false - Failure (An error message is printed)
+   */
+  bool init();
+
+  /** Run the scenario for config.duration_ seconds */
+  void run();
+
+  /** Print the results */
+  void report() const;
+
+ private:
+  LoadGenerator() = delete;
+  LoadGenerator(const LoadGenerator&) = delete;
+  void operator=(const LoadGenerator&) = delete;
+
+  /** A UDP socket */
+  struct Socket {
+    uv_poll_t poll_;            /**< The libuv poll handle */
+    LoadGenerator* gen_;        /**< The LoadGenerator */
+    LodpEndpoint* endpoint_;    /**< The LodpEndpoint that owns the socket */
+    int fd_;                    /**< The socket */
+    int events_;                /**< The uv_poll_event(s) being polled */
+  };
+
+  /** A client's state */
+  enum class State {
+    kIdle,                      /**< Waiting for the pacer */
+    kHandshaking,               /**< Handshaking */
+    kEstablished,               /**< Connected */
+    kRekeying,                  /**< Rekeying */
+  };
+
+  /** A simulated client */
+  struct Client {
+    Client(LoadGenerator& gen) :
+        index_(0),
+        state_(State::kIdle),
+        socket_(nullptr),
+        session_(nullptr),
+        timer_([this, &gen]() { gen.on_client_timer(*this); }),
+        attempts_(0) {}
+
+    size_t index_;                  /**< The index in clients_ */
+    State state_;                   /**< The client state */
+    Socket* socket_;                /**< The client socket (if open) */
+    ::std::unique_ptr<LodpEndpoint> endpoint_;  /**< The LodpEndpoint */
+    LodpSession* session_;          /**< The LodpSession (if any) */
+    Timer timer_;                   /**< The client Timer */
+    int attempts_;                  /**< handshake()/rekey() calls */
+    Clock::time_point start_time_;  /**< The first handshake()/rekey() */
+    Clock::time_point next_message_; /**< When to send the next message */
+    Clock::time_point next_rekey_;  /**< When to rekey next */
+    Clock::time_point close_time_;  /**< When to close (churn) */
+  };
+
+  /** @{ */
+  /** Open a UDP socket bound to addr, owned by endpoint */
+  Socket* open_socket(const struct sockaddr_in& addr,
+                      LodpEndpoint* endpoint);
+  /** Close a UDP socket */
+  void close_socket(Socket* s);
+  /** Change the events a Socket is polled for */
+  void poll_socket(Socket* s,
+                   const int events);
+  /** The uv_poll_cb */
+  static void on_poll(uv_poll_t* handle,
+                      int status,
+                      int events);
+  /** Drain a readable Socket */
+  void on_readable(Socket* s);
+  /** @} */
+
+  /** @{ */
+  /** Start handshakes at config_.handshake_rate_ */
+  void on_pacer_timer();
+  /** Print a progress report */
+  void on_report_timer();
+  /** Per-client Timer callback */
+  void on_client_timer(Client& c);
+  /** Start a client's handshake */
+  void connect(Client& c);
+  /** (Re)transmit a client's handshake */
+  void handshake(Client& c);
+  /** Start (or retransmit) a client's rekey */
+  void rekey(Client& c);
+  /** Send a client's next message */
+  void send_message(Client& c);
+  /** Schedule the client Timer for the next kEstablished action */
+  void schedule(Client& c);
+  /** Tear down a client's session and return it to the idle queue */
+  void recycle(Client& c);
+  /** Stop the run */
+  void stop();
+  /** @} */
+
+  // LodpCallbacks
+  /** @{ */
+  int sendto(LodpEndpoint& endpoint,
+             const void* buf,
+             const size_t buf_len,
+             const struct sockaddr* addr,
+             const socklen_t addr_len) override;
+  size_t pad_size(const LodpSession& session,
+                  const size_t available) override;
+  bool should_accept(const LodpEndpoint& endpoint,
+                     const struct sockaddr* addr,
+                     const socklen_t addr_len) override;
+  void on_accept(LodpEndpoint& endpoint,
+                 LodpSession* session,
+                 const struct sockaddr* addr,
+                 const socklen_t addr_len) override;
+  void on_connect(LodpSession& session,
+                  const int status) override;
+  void on_recv(LodpSession& session,
+               const void* buf,
+               const size_t buf_len) override;
+  void on_rekey_needed(LodpSession& session) override;
+  void on_rekey(LodpSession& session,
+                const int status) override;
+  void on_close(const LodpSession& session) override;
+  /** @} */
+
+  crypto::Random& rng_;           /**< The crypto::Random instance */
+  const LoadgenConfig config_;    /**< The scenario */
+  uv_loop_t* loop_;               /**< The event loop */
+  LoadgenResults results_;        /**< The results */
+  bool stopping_;                 /**< stop() was called */
+  ::std::string message_;         /**< The message buffer */
+  ::std::unique_ptr<uint8_t[]> rx_buf_; /**< The receive buffer */
+
+  /** @{ */
+  /** The responder's public key */
+  ::std::unique_ptr<crypto::Curve25519::PublicKey> responder_public_;
+  /** The local responder's private key (if any) */
+  ::std::unique_ptr<crypto::Curve25519::PrivateKey> responder_private_;
+  /** The local responder's PacketTrace (if any) */
+  ::std::unique_ptr<PacketTrace> trace_;
+  /** The local responder's PacketTrace file descriptor (if any) */
+  int trace_fd_;
+  /** The local responder (if any) */
+  ::std::unique_ptr<LodpEndpoint> responder_;
+  /** The local responder's socket (if any) */
+  Socket* responder_socket_;
+  /** The local responder's LodpSessions */
+  ::std::unordered_set<const LodpSession*> responder_sessions_;
+  /** @} */
+
+  /** @{ */
+  ::std::vector<::std::unique_ptr<Client>> clients_;  /**< The clients */
+  ::std::deque<Client*> idle_;    /**< Clients waiting to handshake */
+  size_t established_;            /**< Clients currently established */
+  size_t peak_established_;       /**< Peak value of established_ */
+  /** @} */
+
+  /** @{ */
+  Timer pacer_timer_;             /**< Handshake pacing Timer */
+  Timer report_timer_;            /**< Progress report Timer */
+  Timer stop_timer_;              /**< End of run Timer */
+  Clock::time_point pacer_time_;  /**< The last pacer run */
+  double pacer_tokens_;           /**< Handshakes that may be started */
+  Clock::time_point start_time_;  /**< The start of the run */
+  Clock::time_point stop_time_;   /**< The end of the run */
+  LoadgenResults last_report_;    /**< The results at the last report */
+  /** @} */
+};
+
+LoadGenerator::LoadGenerator(crypto::Random& rng,
+                             const LoadgenConfig& config) :
+    rng_(rng),
+    config_(config),
+    loop_(uv_default_loop()),
+    results_(),
+    stopping_(false),
+    message_(config.message_size_, '\0'),
+    rx_buf_(new uint8_t[65536]),
+    trace_fd_(-1),
+    responder_socket_(nullptr),
+    established_(0),
+    peak_established_(0),
+    pacer_timer_([this]() { on_pacer_timer(); }),
+    report_timer_([this]() { on_report_timer(); }),
+    stop_timer_([this]() { stop(); }),
+    pacer_tokens_(0.0) {
+  SL_ASSERT(config_.nr_clients_ > 0);
+  SL_ASSERT(config_.clients_per_addr_ > 0);
+  SL_ASSERT(config_.message_size_ >= sizeof(uint64_t));
+  SL_ASSERT(config_.message_size_ <= LodpSession::kMaxMessageLength);
+}
+
+LoadGenerator::~LoadGenerator() {
+  // Sessions were closed by stop(), so only the sockets need to be torn down
+  for (auto& c : clients_) {
+    c->timer_.stop();
+    if (c->session_ != nullptr)
+      c->session_->close(false);
+    if (c->socket_ != nullptr)
+      close_socket(c->socket_);
+  }
+
+  ::std::vector<LodpSession*> sessions;
+  for (auto session : responder_sessions_)
+    sessions.push_back(const_cast<LodpSession*>(session));
+  for (auto session : sessions)
+    session->close(false);
+  if (responder_socket_ != nullptr)
+    close_socket(responder_socket_);
+
+  // Run the loop once to process the uv_close() callbacks
+  uv_run(loop_, UV_RUN_NOWAIT);
+
+  if (trace_) {
+    responder_->set_packet_trace(nullptr);
+    trace_.reset();
+    ::close(trace_fd_);
+  }
+}
+
+bool LoadGenerator::init() {
+  const uint8_t* node_id =
+      reinterpret_cast<const uint8_t*>(config_.node_id_.data());
+  const size_t node_id_len = config_.node_id_.size();
+
+  if (config_.public_key_.empty()) {
+    // Bring up a local responder
+    if (config_.private_key_.empty()) {
+      responder_private_.reset(new crypto::Curve25519::PrivateKey(rng_));
+    } else {
+      responder_private_.reset(new crypto::Curve25519::PrivateKey(
+          reinterpret_cast<const uint8_t*>(config_.private_key_.data()),
+          config_.private_key_.size()));
+    }
+    responder_public_.reset(
+        new crypto::Curve25519::PublicKey(*responder_private_));
+    responder_.reset(new LodpEndpoint(rng_, *this, nullptr, false,
+                                      *responder_private_, node_id,
+                                      node_id_len));
+    responder_socket_ = open_socket(config_.dst_addr_, responder_.get());
+    if (responder_socket_ == nullptr) {
+      ::std::fprintf(stderr, "Failed to bind the responder: %s\n",
+                     ::std::strerror(errno));
+      return false;
+    }
+
+    if (!config_.trace_path_.empty()) {
+      trace_fd_ = ::open(config_.trace_path_.c_str(),
+                         O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (trace_fd_ < 0) {
+        ::std::fprintf(stderr, "Failed to open the trace: %s\n",
+                       ::std::strerror(errno));
+        return false;
+      }
+      trace_.reset(new PacketTrace(trace_fd_));
+      responder_->set_packet_trace(trace_.get());
+    }
+  } else {
+    responder_public_.reset(new crypto::Curve25519::PublicKey(
+        reinterpret_cast<const uint8_t*>(config_.public_key_.data()),
+        config_.public_key_.size()));
+  }
+
+  // Each client needs a file descriptor
+  struct rlimit rl;
+  if (::getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+    rl.rlim_cur = rl.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur != RLIM_INFINITY &&
+        rl.rlim_cur < config_.nr_clients_ + 64) {
+      ::std::fprintf(stderr, "RLIMIT_NOFILE (%lu) is too low for %zu "
+                     "clients\n", static_cast<unsigned long>(rl.rlim_cur),
+                     config_.nr_clients_);
+      return false;
+    }
+  }
+
+  clients_.reserve(config_.nr_clients_);
+  for (size_t i = 0; i < config_.nr_clients_; i++) {
+    Client* c = new Client(*this);
+    clients_.push_back(::std::unique_ptr<Client>(c));
+    c->index_ = i;
+    c->endpoint_.reset(new LodpEndpoint(rng_, *this, c, false));
+    idle_.push_back(c);
+  }
+
+  return true;
+}
+
+void LoadGenerator::run() {
+  start_time_ = Clock::system().now();
+  pacer_time_ = start_time_;
+  stop_time_ = start_time_;
+
+  pacer_timer_.start(::std::chrono::milliseconds(0));
+  stop_timer_.start(::std::chrono::seconds(config_.duration_));
+  if (config_.report_interval_ > 0)
+    report_timer_.start(::std::chrono::seconds(config_.report_interval_));
+
+  uv_run(loop_, UV_RUN_DEFAULT);
+}
+
+void LoadGenerator::report() const {
+  const double elapsed = to_seconds(stop_time_ - start_time_);
+  const LoadgenResults& r = results_;
+
+  auto print_latency = [](const char* name, const LatencyHistogram& h) {
+    if (h.count() == 0)
+      return;
+    ::std::printf("  %-12s min %.3f p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f "
+                  "max %.3f (ms)\n", name, h.min() / 1e6,
+                  h.value_at_percentile(50.0) / 1e6,
+                  h.value_at_percentile(90.0) / 1e6,
+                  h.value_at_percentile(99.0) / 1e6,
+                  h.value_at_percentile(99.9) / 1e6, h.max() / 1e6);
+  };
+  auto print_errors = [](const char* name,
+                         const ::std::map<int, uint64_t>& errors) {
+    for (auto& e : errors) {
+      const char* s = lodp_error_name(e.first);
+      if (s != nullptr)
+        ::std::printf("  %-12s %-18s %lu\n", name, s,
+                      static_cast<unsigned long>(e.second));
+      else
+        ::std::printf("  %-12s %-18d %lu\n", name, e.first,
+                      static_cast<unsigned long>(e.second));
+    }
+  };
+
+  ::std::printf("Run: %.3f s, %zu clients\n", elapsed, clients_.size());
+  ::std::printf("Sessions:\n");
+  ::std::printf("  established %zu (peak %zu)\n", established_,
+                peak_established_);
+  ::std::printf("  handshakes  started %lu completed %lu (%.1f/s) "
+                "retransmits %lu\n",
+                static_cast<unsigned long>(r.handshakes_started_),
+                static_cast<unsigned long>(r.handshakes_completed_),
+                elapsed > 0 ? r.handshakes_completed_ / elapsed : 0.0,
+                static_cast<unsigned long>(r.handshake_retransmits_));
+  ::std::printf("  rekeys      started %lu completed %lu retransmits %lu\n",
+                static_cast<unsigned long>(r.rekeys_started_),
+                static_cast<unsigned long>(r.rekeys_completed_),
+                static_cast<unsigned long>(r.rekey_retransmits_));
+  ::std::printf("  churned %lu lost %lu\n",
+                static_cast<unsigned long>(r.sessions_churned_),
+                static_cast<unsigned long>(r.sessions_lost_));
+
+  ::std::printf("Latency:\n");
+  print_latency("handshake", r.handshake_latency_);
+  print_latency("rekey", r.rekey_latency_);
+  print_latency("one way", r.message_latency_);
+
+  ::std::printf("Throughput:\n");
+  ::std::printf("  sent     %lu msgs %lu bytes (%.1f msgs/s, %.3f Mbit/s)\n",
+                static_cast<unsigned long>(r.messages_sent_),
+                static_cast<unsigned long>(r.bytes_sent_),
+                elapsed > 0 ? r.messages_sent_ / elapsed : 0.0,
+                elapsed > 0 ? r.bytes_sent_ * 8 / elapsed / 1e6 : 0.0);
+  if (responder_) {
+    ::std::printf("  received %lu msgs %lu bytes (%.1f msgs/s, %.3f "
+                  "Mbit/s)\n",
+                  static_cast<unsigned long>(r.messages_received_),
+                  static_cast<unsigned long>(r.bytes_received_),
+                  elapsed > 0 ? r.messages_received_ / elapsed : 0.0,
+                  elapsed > 0 ? r.bytes_received_ * 8 / elapsed / 1e6 : 0.0);
+  }
+
+  ::std::printf("Errors:\n");
+  ::std::printf("  handshake timeouts %lu failures %lu, rekey failures %lu\n",
+                static_cast<unsigned long>(r.handshake_timeouts_),
+                static_cast<unsigned long>(r.handshake_failures_),
+                static_cast<unsigned long>(r.rekey_failures_));
+  ::std::printf("  socket open %lu tx would block %lu tx %lu rx %lu "
+                "(of %lu packets)\n",
+                static_cast<unsigned long>(r.socket_errors_),
+                static_cast<unsigned long>(r.tx_would_block_),
+                static_cast<unsigned long>(r.tx_errors_),
+                static_cast<unsigned long>(r.rx_errors_),
+                static_cast<unsigned long>(r.rx_packets_));
+  print_errors("session", r.session_errors_);
+  print_errors("send", r.send_errors_);
+  print_errors("packet", r.packet_errors_);
+
+  if (trace_) {
+    ::std::printf("Trace: %lu packets %lu bytes (%lu dropped)\n",
+                  static_cast<unsigned long>(trace_->recorded()),
+                  static_cast<unsigned long>(trace_->size()),
+                  static_cast<unsigned long>(trace_->dropped()));
+  }
+
+  if (responder_) {
+    const LodpEndpoint::Stats& s = responder_->stats();
+    ::std::printf("Responder:\n");
+    ::std::printf("  sessions accepted %lu closed %lu\n",
+                  static_cast<unsigned long>(s.sessions_accepted_),
+                  static_cast<unsigned long>(s.sessions_closed_));
+    ::std::printf("  rx init replays %lu invalid cookies %lu cookie replays "
+                  "%lu handshake failed %lu decrypt failed %lu\n",
+                  static_cast<unsigned long>(s.rx_init_replays_),
+                  static_cast<unsigned long>(s.rx_invalid_cookie_),
+                  static_cast<unsigned long>(s.rx_cookie_replays_),
+                  static_cast<unsigned long>(s.rx_handshake_failed_),
+                  static_cast<unsigned long>(s.rx_decrypt_failed_));
+  }
+}
+
+LoadGenerator::Socket* LoadGenerator::open_socket(
+    const struct sockaddr_in& addr,
+    LodpEndpoint* endpoint) {
+  const int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+    return nullptr;
+
+  const int flags = ::fcntl(fd, F_GETFL);
+  if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+      ::bind(fd, reinterpret_cast<const struct sockaddr*>(&addr),
+             sizeof(addr)) < 0) {
+    const int err = errno;
+    ::close(fd);
+    errno = err;
+    return nullptr;
+  }
+
+  Socket* s = new Socket;
+  s->gen_ = this;
+  s->endpoint_ = endpoint;
+  s->fd_ = fd;
+  s->events_ = 0;
+  uv_poll_init(loop_, &s->poll_, fd);
+  s->poll_.data = s;
+  poll_socket(s, UV_READABLE);
+
+  return s;
+}
+
+void LoadGenerator::close_socket(Socket* s) {
+  uv_poll_stop(&s->poll_);
+  ::close(s->fd_);
+  uv_close(reinterpret_cast<uv_handle_t*>(&s->poll_), [](uv_handle_t* h) {
+    delete static_cast<Socket*>(h->data);
+  });
+}
+
+void LoadGenerator::poll_socket(Socket* s,
+                                const int events) {
+  if (s->events_ == events)
+    return;
+
+  s->events_ = events;
+  uv_poll_start(&s->poll_, events, on_poll);
+}
+
+void LoadGenerator::on_poll(uv_poll_t* handle,
+                            int status,
+                            int events) {
+  Socket* s = static_cast<Socket*>(handle->data);
+  if (status < 0) {
+    s->gen_->results_.rx_errors_++;
+    return;
+  }
+
+  if (events & UV_WRITABLE) {
+    s->gen_->poll_socket(s, UV_READABLE);
+    s->endpoint_->on_writable();
+  }
+  if (events & UV_READABLE)
+    s->gen_->on_readable(s);
+}
+
+void LoadGenerator::on_readable(Socket* s) {
+  // Bound the amount of work done per socket per loop iteration
+  for (int i = 0; i < 64; i++) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    const ssize_t len = ::recvfrom(s->fd_, rx_buf_.get(), 65536, 0,
+                                   reinterpret_cast<struct sockaddr*>(&addr),
+                                   &addr_len);
+    if (len < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        results_.rx_errors_++;
+      return;
+    }
+
+    results_.rx_packets_++;
+    const int ret = s->endpoint_->on_packet(
+        rx_buf_.get(), static_cast<size_t>(len),
+        reinterpret_cast<const struct sockaddr*>(&addr), addr_len);
+    if (ret != kErrorOk)
+      results_.packet_errors_[ret]++;
+  }
+}
+
+void LoadGenerator::on_pacer_timer() {
+  if (stopping_)
+    return;
+
+  const Clock::time_point now = Clock::system().now();
+  if (config_.handshake_rate_ > 0) {
+    // Allow bursts of up to 10 ms worth of handshakes
+    pacer_tokens_ += to_seconds(now - pacer_time_) * config_.handshake_rate_;
+    pacer_tokens_ = ::std::min(pacer_tokens_,
+                               ::std::max(1.0, config_.handshake_rate_ / 100));
+  } else {
+    pacer_tokens_ = static_cast<double>(idle_.size());
+  }
+  pacer_time_ = now;
+
+  while (!idle_.empty() && pacer_tokens_ >= 1.0) {
+    Client* c = idle_.front();
+    idle_.pop_front();
+    pacer_tokens_ -= 1.0;
+    connect(*c);
+  }
+
+  if (!idle_.empty())
+    pacer_timer_.start(::std::chrono::milliseconds(1));
+}
+
+void LoadGenerator::on_report_timer() {
+  const double interval = config_.report_interval_;
+  const LoadgenResults& r = results_;
+  const LoadgenResults& l = last_report_;
+  ::std::printf("[%6.1f s] established %zu, %.1f handshakes/s, %.1f msgs/s, "
+                "%.3f Mbit/s\n",
+                to_seconds(Clock::system().now() - start_time_), established_,
+                (r.handshakes_completed_ - l.handshakes_completed_) / interval,
+                (r.messages_sent_ - l.messages_sent_) / interval,
+                (r.bytes_sent_ - l.bytes_sent_) * 8 / interval / 1e6);
+  ::std::fflush(stdout);
+
+  last_report_.handshakes_completed_ = r.handshakes_completed_;
+  last_report_.messages_sent_ = r.messages_sent_;
+  last_report_.bytes_sent_ = r.bytes_sent_;
+  report_timer_.start(::std::chrono::seconds(config_.report_interval_));
+}
+
+void LoadGenerator::on_client_timer(Client& c) {
+  if (stopping_)
+    return;
+
+  switch (c.state_) {
+  case State::kIdle:
+    // Deferred teardown from recycle()
+    if (c.session_ != nullptr)
+      c.session_->close(false);
+    if (c.socket_ != nullptr) {
+      close_socket(c.socket_);
+      c.socket_ = nullptr;
+    }
+    idle_.push_back(&c);
+    if (!pacer_timer_.is_active())
+      pacer_timer_.start(::std::chrono::milliseconds(0));
+    break;
+  case State::kHandshaking:
+    handshake(c);
+    break;
+  case State::kRekeying:
+    rekey(c);
+    break;
+  case State::kEstablished: {
+    const Clock::time_point now = Clock::system().now();
+    if (now >= c.close_time_) {
+      results_.sessions_churned_++;
+      established_--;
+      c.state_ = State::kIdle;
+      c.session_->close();
+      recycle(c);
+      return;
+    }
+    if (now >= c.next_message_)
+      send_message(c);
+    if (c.state_ == State::kEstablished && now >= c.next_rekey_) {
+      c.attempts_ = 0;
+      c.start_time_ = now;
+      results_.rekeys_started_++;
+      rekey(c);
+      return;
+    }
+    if (c.state_ == State::kEstablished)
+      schedule(c);
+    break;
+  }
+  }
+}
+
+void LoadGenerator::connect(Client& c) {
+  SL_ASSERT(c.state_ == State::kIdle);
+  SL_ASSERT(c.session_ == nullptr);
+
+  // Every connection attempt gets a fresh source port
+  if (c.socket_ == nullptr) {
+    struct sockaddr_in addr = config_.src_addr_;
+    addr.sin_addr.s_addr = htonl(ntohl(addr.sin_addr.s_addr) +
+        static_cast<uint32_t>(c.index_ / config_.clients_per_addr_));
+    c.socket_ = open_socket(addr, c.endpoint_.get());
+    if (c.socket_ == nullptr) {
+      results_.socket_errors_++;
+      recycle(c);
+      return;
+    }
+  }
+
+  const struct sockaddr* addr =
+      reinterpret_cast<const struct sockaddr*>(&config_.dst_addr_);
+  const int ret = c.endpoint_->connect(&c, *responder_public_,
+      reinterpret_cast<const uint8_t*>(config_.node_id_.data()),
+      config_.node_id_.size(), addr, sizeof(config_.dst_addr_), c.session_);
+  if (ret != kErrorOk) {
+    results_.session_errors_[ret]++;
+    recycle(c);
+    return;
+  }
+
+  results_.handshakes_started_++;
+  c.state_ = State::kHandshaking;
+  c.attempts_ = 0;
+  c.start_time_ = Clock::system().now();
+  handshake(c);
+}
+
+void LoadGenerator::handshake(Client& c) {
+  if (c.attempts_ > config_.handshake_retries_) {
+    results_.handshake_timeouts_++;
+    c.state_ = State::kIdle;
+    recycle(c);
+    return;
+  }
+
+  if (c.attempts_++ > 0)
+    results_.handshake_retransmits_++;
+  c.timer_.start(::std::chrono::milliseconds(config_.handshake_timeout_));
+  const int ret = c.session_->handshake();
+  if (ret != kErrorOk && ret != kErrorAgain)
+    results_.session_errors_[ret]++;
+}
+
+void LoadGenerator::rekey(Client& c) {
+  if (c.attempts_ > config_.handshake_retries_) {
+    results_.rekey_failures_++;
+    established_--;
+    c.state_ = State::kIdle;
+    recycle(c);
+    return;
+  }
+
+  if (c.attempts_++ > 0)
+    results_.rekey_retransmits_++;
+  c.state_ = State::kRekeying;
+  c.timer_.start(::std::chrono::milliseconds(config_.handshake_timeout_));
+  const int ret = c.session_->rekey();
+  if (ret != kErrorOk && ret != kErrorAgain)
+    results_.session_errors_[ret]++;
+}
+
+void LoadGenerator::send_message(Client& c) {
+  const Clock::duration interval = ::std::chrono::duration_cast<
+      Clock::duration>(::std::chrono::duration<double>(
+          1.0 / config_.message_rate_));
+
+  // Timestamp the message so a local responder can measure the latency
+  const uint64_t ts = to_ns(Clock::system().now().time_since_epoch());
+  ::std::memcpy(&message_[0], &ts, sizeof(ts));
+  const int ret = c.session_->send_message(message_.data(), message_.size());
+  if (ret == kErrorOk) {
+    results_.messages_sent_++;
+    results_.bytes_sent_ += message_.size();
+  } else {
+    results_.send_errors_[ret]++;
+  }
+
+  // Don't try to catch up if the event loop fell behind
+  c.next_message_ += interval;
+  const Clock::time_point now = Clock::system().now();
+  if (c.next_message_ < now)
+    c.next_message_ = now;
+}
+
+void LoadGenerator::schedule(Client& c) {
+  const Clock::time_point next = ::std::min(c.next_message_,
+      ::std::min(c.next_rekey_, c.close_time_));
+  if (next == Clock::time_point::max())
+    return;
+
+  c.timer_.start(to_timeout(next - Clock::system().now()));
+}
+
+void LoadGenerator::recycle(Client& c) {
+  // The actual teardown happens from the Timer
+  c.state_ = State::kIdle;
+  c.timer_.start(::std::chrono::milliseconds(0));
+}
+
+void LoadGenerator::stop() {
+  stop_time_ = Clock::system().now();
+  stopping_ = true;
+  pacer_timer_.stop();
+  report_timer_.stop();
+
+  // Politely close every session, so a remote responder's table drains
+  for (auto& c : clients_) {
+    c->timer_.stop();
+    if (c->session_ != nullptr)
+      c->session_->close();
+  }
+
+  uv_stop(loop_);
+}
+
+int LoadGenerator::sendto(LodpEndpoint& endpoint,
+                          const void* buf,
+                          const size_t buf_len,
+                          const struct sockaddr* addr,
+                          const socklen_t addr_len) {
+  Client* c = static_cast<Client*>(endpoint.context());
+  Socket* s = (c != nullptr) ? c->socket_ : responder_socket_;
+  if (s == nullptr)
+    return kErrorBadFD;
+
+  const ssize_t ret = ::sendto(s->fd_, buf, buf_len, 0, addr, addr_len);
+  if (ret < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+      results_.tx_would_block_++;
+      poll_socket(s, UV_READABLE | UV_WRITABLE);
+      return kErrorAgain;
+    }
+    results_.tx_errors_++;
+    return -errno;
+  }
+
+  return kErrorOk;
+}
+
+size_t LoadGenerator::pad_size(const LodpSession& session,
+                               const size_t available) {
+  // Padding only adds noise to the throughput numbers
+  return 0;
+}
+
+bool LoadGenerator::should_accept(const LodpEndpoint& endpoint,
+                                  const struct sockaddr* addr,
+                                  const socklen_t addr_len) {
+  return true;
+}
+
+void LoadGenerator::on_accept(LodpEndpoint& endpoint,
+                              LodpSession* session,
+                              const struct sockaddr* addr,
+                              const socklen_t addr_len) {
+  responder_sessions_.insert(session);
+}
+
+void LoadGenerator::on_connect(LodpSession& session,
+                               const int status) {
+  Client* c = static_cast<Client*>(session.context());
+  SL_ASSERT(c != nullptr);
+  if (c->state_ != State::kHandshaking)
+    return;
+
+  if (status != kErrorOk) {
+    results_.handshake_failures_++;
+    results_.session_errors_[status]++;
+    recycle(*c);
+    return;
+  }
+
+  const Clock::time_point now = Clock::system().now();
+  results_.handshakes_completed_++;
+  results_.handshake_latency_.record(to_ns(now - c->start_time_));
+  peak_established_ = ::std::max(peak_established_, ++established_);
+
+  // Spread the messages from each client across the message interval
+  c->state_ = State::kEstablished;
+  c->next_message_ = Clock::time_point::max();
+  if (config_.message_rate_ > 0) {
+    c->next_message_ = now + ::std::chrono::duration_cast<Clock::duration>(
+        ::std::chrono::duration<double>((c->index_ % 1024) / 1024.0 /
+                                        config_.message_rate_));
+  }
+  c->next_rekey_ = next_deadline(now, config_.rekey_interval_);
+  c->close_time_ = next_deadline(now, config_.lifetime_);
+  c->timer_.stop();
+  schedule(*c);
+}
+
+void LoadGenerator::on_recv(LodpSession& session,
+                            const void* buf,
+                            const size_t buf_len) {
+  // Only the local responder's sessions have a NULL context
+  if (session.context() != nullptr || buf_len < sizeof(uint64_t))
+    return;
+
+  uint64_t ts;
+  ::std::memcpy(&ts, buf, sizeof(ts));
+  results_.message_latency_.record(
+      to_ns(Clock::system().now().time_since_epoch()) - ts);
+  results_.messages_received_++;
+  results_.bytes_received_ += buf_len;
+}
+
+void LoadGenerator::on_rekey_needed(LodpSession& session) {
+  Client* c = static_cast<Client*>(session.context());
+  if (c == nullptr || c->state_ != State::kEstablished)
+    return;
+
+  // Can't rekey from within the callback, so pull the Timer in
+  c->next_rekey_ = Clock::system().now();
+  c->timer_.start(::std::chrono::milliseconds(0));
+}
+
+void LoadGenerator::on_rekey(LodpSession& session,
+                             const int status) {
+  Client* c = static_cast<Client*>(session.context());
+  if (c == nullptr || c->state_ != State::kRekeying)
+    return;
+
+  if (status != kErrorOk) {
+    results_.rekey_failures_++;
+    results_.session_errors_[status]++;
+    established_--;
+    recycle(*c);
+    return;
+  }
+
+  const Clock::time_point now = Clock::system().now();
+  results_.rekeys_completed_++;
+  results_.rekey_latency_.record(to_ns(now - c->start_time_));
+  c->state_ = State::kEstablished;
+  c->next_rekey_ = next_deadline(now, config_.rekey_interval_);
+  c->timer_.stop();
+  schedule(*c);
+}
+
+void LoadGenerator::on_close(const LodpSession& session) {
+  Client* c = static_cast<Client*>(session.context());
+  if (c == nullptr) {
+    responder_sessions_.erase(&session);
+    return;
+  }
+
+  c->session_ = nullptr;
+  if (c->state_ == State::kIdle || stopping_)
+    return;
+
+  // The library tore down the session out from under us
+  results_.sessions_lost_++;
+  if (c->state_ == State::kEstablished || c->state_ == State::kRekeying)
+    established_--;
+  recycle(*c);
+}
+
+bool parse_addr(const char* str,
+                struct sockaddr_in& addr,
+                const bool need_port) {
+  ::std::string host(str);
+  const size_t colon = host.rfind(':');
+  if (colon != ::std::string::npos) {
+    char* end;
+    const unsigned long port = ::std::strtoul(host.c_str() + colon + 1, &end,
+                                              10);
+    if (*end != '\0' || port == 0 || port > 65535)
+      return false;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    host.resize(colon);
+  } else if (need_port) {
+    return false;
+  }
+
+  return ::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) == 1;
+}
+
+bool parse_key(const char* str,
+               ::std::string& key) {
+  const size_t len = ::std::strlen(str);
+  if (len != crypto::Curve25519::PublicKey::kKeyLength * 2)
+    return false;
+
+  key.clear();
+  for (size_t i = 0; i < len; i += 2) {
+    char hex[3] = { str[i], str[i + 1], '\0' };
+    char* end;
+    const unsigned long b = ::std::strtoul(hex, &end, 16);
+    if (*end != '\0')
+      return false;
+    key.push_back(static_cast<char>(b));
+  }
+
+  return true;
+}
+
+void usage(const char* argv0) {
+  ::std::fprintf(stderr,
+      "Usage: %s [OPTIONS]\n"
+      "\n"
+      "Responder:\n"
+      "  -d, --dst ADDR:PORT         Responder address (127.0.0.1:2323)\n"
+      "  -k, --key HEX               Responder public key (Default: run a\n"
+      "                              responder in process)\n"
+      "  -n, --node-id STRING        Responder node ID (%s)\n"
+      "      --responder-key HEX     Local responder private key (Random)\n"
+      "      --trace FILE            Capture the local responder's packets\n"
+      "\n"
+      "Clients:\n"
+      "  -c, --clients N             Concurrent clients (1000)\n"
+      "  -s, --src ADDR              First source address (127.0.1.1)\n"
+      "      --clients-per-addr N    Clients per source address (16384)\n"
+      "  -r, --handshake-rate N      Handshakes/sec, 0 = unlimited (1000)\n"
+      "      --handshake-timeout MS  Retransmission interval (500)\n"
+      "      --handshake-retries N   Retransmissions (5)\n"
+      "  -m, --message-size N        Message size in bytes (512)\n"
+      "  -R, --message-rate N        Messages/sec/client, 0 = none (1)\n"
+      "      --rekey-interval S      Seconds between rekeys, 0 = never (0)\n"
+      "      --lifetime S            Session lifetime, 0 = forever (0)\n"
+      "\n"
+      "Run:\n"
+      "  -t, --duration S            Length of the run (10)\n"
+      "      --report-interval S     Progress reports, 0 = off (1)\n",
+      argv0, kDefaultNodeId);
+}
+
+} // namespace
+
+} // namespace lodp
+} // namespace schwanenlied
+
+int main(int argc, char* argv[]) {
+  using namespace ::schwanenlied::lodp;
+
+  enum {
+    kOptClientsPerAddr = 256,
+    kOptHandshakeTimeout,
+    kOptHandshakeRetries,
+    kOptRekeyInterval,
+    kOptLifetime,
+    kOptReportInterval,
+    kOptResponderKey,
+    kOptTrace,
+  };
+  static const struct option options[] = {
+    { "dst", required_argument, nullptr, 'd' },
+    { "key", required_argument, nullptr, 'k' },
+    { "node-id", required_argument, nullptr, 'n' },
+    { "responder-key", required_argument, nullptr, kOptResponderKey },
+    { "trace", required_argument, nullptr, kOptTrace },
+    { "clients", required_argument, nullptr, 'c' },
+    { "src", required_argument, nullptr, 's' },
+    { "clients-per-addr", required_argument, nullptr, kOptClientsPerAddr },
+    { "handshake-rate", required_argument, nullptr, 'r' },
+    { "handshake-timeout", required_argument, nullptr, kOptHandshakeTimeout },
+    { "handshake-retries", required_argument, nullptr, kOptHandshakeRetries },
+    { "message-size", required_argument, nullptr, 'm' },
+    { "message-rate", required_argument, nullptr, 'R' },
+    { "rekey-interval", required_argument, nullptr, kOptRekeyInterval },
+    { "lifetime", required_argument, nullptr, kOptLifetime },
+    { "duration", required_argument, nullptr, 't' },
+    { "report-interval", required_argument, nullptr, kOptReportInterval },
+    { "help", no_argument, nullptr, 'h' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  LoadgenConfig config;
+  bool valid = true;
+  int opt;
+  while ((opt = ::getopt_long(argc, argv, "d:k:n:c:s:r:m:R:t:h", options,
+                              nullptr)) != -1) {
+    switch (opt) {
+    case 'd':
+      valid = parse_addr(optarg, config.dst_addr_, true);
+      break;
+    case 'k':
+      valid = parse_key(optarg, config.public_key_);
+      break;
+    case 'n':
+      config.node_id_ = optarg;
+      valid = !config.node_id_.empty();
+      break;
+    case kOptResponderKey:
+      valid = parse_key(optarg, config.private_key_);
+      break;
+    case kOptTrace:
+      config.trace_path_ = optarg;
+      valid = !config.trace_path_.empty();
+      break;
+    case 'c':
+      config.nr_clients_ = ::std::strtoul(optarg, nullptr, 10);
+      valid = config.nr_clients_ > 0;
+      break;
+    case 's':
+      valid = parse_addr(optarg, config.src_addr_, false);
+      break;
+    case kOptClientsPerAddr:
+      config.clients_per_addr_ = ::std::strtoul(optarg, nullptr, 10);
+      valid = config.clients_per_addr_ > 0;
+      break;
+    case 'r':
+      config.handshake_rate_ = ::std::strtod(optarg, nullptr);
+      valid = config.handshake_rate_ >= 0;
+      break;
+    case kOptHandshakeTimeout:
+      config.handshake_timeout_ = ::std::strtoul(optarg, nullptr, 10);
+      valid = config.handshake_timeout_ > 0;
+      break;
+    case kOptHandshakeRetries:
+      config.handshake_retries_ = ::std::atoi(optarg);
+      valid = config.handshake_retries_ >= 0;
+      break;
+    case 'm':
+      config.message_size_ = ::std::strtoul(optarg, nullptr, 10);
+      valid = config.message_size_ >= sizeof(uint64_t) &&
+          config.message_size_ <= LodpSession::kMaxMessageLength;
+      break;
+    case 'R':
+      config.message_rate_ = ::std::strtod(optarg, nullptr);
+      valid = config.message_rate_ >= 0;
+      break;
+    case kOptRekeyInterval:
+      config.rekey_interval_ = ::std::strtoul(optarg, nullptr, 10);
+      break;
+    case kOptLifetime:
+      config.lifetime_ = ::std::strtoul(optarg, nullptr, 10);
+      break;
+    case 't':
+      config.duration_ = ::std::strtoul(optarg, nullptr, 10);
+      valid = config.duration_ > 0;
+      break;
+    case kOptReportInterval:
+      config.report_interval_ = ::std::strtoul(optarg, nullptr, 10);
+      break;
+    default:
+      valid = false;
+    }
+    if (!valid) {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc || (!config.public_key_.empty() &&
+                         (!config.private_key_.empty() ||
+                          !config.trace_path_.empty()))) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  ::schwanenlied::crypto::Random rng;
+  LoadGenerator gen(rng, config);
+  if (!gen.init())
+    return 1;
+  gen.run();
+  gen.report();
+
+  return 0;
+}
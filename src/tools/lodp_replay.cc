@@ -0,0 +1,530 @@
+/**
+ * @file    lodp_replay.cc
+ * @author  Yawning Angel (yawning at schwanenlied dot me)
+ * @brief   LODP packet trace replay tool
+ */
+
+/*
+ * Copyright (c) 2013, Yawning Angel <yawning at schwanenlied dot me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * lodp_replay feeds the received packets from a PacketTrace into a fresh
+ * responder LodpEndpoint's on_packet(), either as fast as possible or at the
+ * pacing they were captured at, and reports the packet rate, the on_packet()
+ * latency distribution, a breakdown of the return codes and the responder's
+ * statistics.  Transmitted packets are discarded (and counted).
+ *
+ * Given the responder's private key and node ID, the stateless paths replay
+ * exactly: garbage and DATA for unknown sessions fail the intro decryption, and
+ * INIT packets are decrypted and answered with a INIT ACK.  HANDSHAKE packets
+ * will fail cookie validation (the cookie key is random), and DATA packets for
+ * sessions that were established when the trace was captured take the trial
+ * decryption failure path, since session keys are derived from ephemeral keys
+ * that are not in the trace.
+ *
+ * Each peer in the trace is assigned a synthetic address of the same family,
+ * and each loop uses a fresh LodpEndpoint so the INIT replay filter does not
+ * turn the second pass into a replay benchmark.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <sys/socket.h>
+
+#include "schwanenlied/common.h"
+#include "schwanenlied/latency_histogram.h"
+#include "schwanenlied/packet_trace.h"
+#include "schwanenlied/crypto/random.h"
+#include "schwanenlied/lodp/lodp_endpoint.h"
+
+namespace schwanenlied {
+namespace lodp {
+
+namespace {
+
+const char kDefaultNodeId[] = "lodp_loadgen";
+
+/** lodp_replay options */
+struct ReplayConfig {
+  ReplayConfig() :
+      loops_(1),
+      paced_(false),
+      node_id_(kDefaultNodeId) {}
+
+  unsigned loops_;                /**< Passes over the trace */
+  bool paced_;                    /**< Replay at the captured pacing */
+  ::std::string private_key_;     /**< Responder private key (Empty = random) */
+  ::std::string node_id_;         /**< The responder's node ID */
+  ::std::string path_;            /**< The trace */
+};
+
+/** A synthetic peer address */
+struct Peer {
+  struct sockaddr_storage addr_;  /**< The address */
+  socklen_t addr_len_;            /**< The length of addr_ */
+};
+
+typedef ::std::chrono::steady_clock SteadyClock;
+
+uint64_t to_ns(const SteadyClock::duration& d) {
+  return ::std::chrono::duration_cast< ::std::chrono::nanoseconds>(d).count();
+}
+
+/** The trace replayer */
+class Replayer : private LodpCallbacks {
+ public:
+  Replayer(crypto::Random& rng,
+           const ReplayConfig& config,
+           PacketTraceReader& reader);
+
+  /** Assign addresses, and load the responder's private key */
+  bool init();
+
+  /** Replay the trace config_.loops_ times */
+  void run();
+
+  /** Print the results */
+  void report() const;
+
+ private:
+  Replayer() = delete;
+  Replayer(const Replayer&) = delete;
+  void operator=(const Replayer&) = delete;
+
+  /** Replay the trace once into endpoint */
+  void replay(LodpEndpoint& endpoint);
+
+  // LodpCallbacks
+  /** @{ */
+  int sendto(LodpEndpoint& endpoint,
+             const void* buf,
+             const size_t buf_len,
+             const struct sockaddr* addr,
+             const socklen_t addr_len) override;
+  size_t pad_size(const LodpSession& session,
+                  const size_t available) override;
+  bool should_accept(const LodpEndpoint& endpoint,
+                     const struct sockaddr* addr,
+                     const socklen_t addr_len) override;
+  void on_accept(LodpEndpoint& endpoint,
+                 LodpSession* session,
+                 const struct sockaddr* addr,
+                 const socklen_t addr_len) override;
+  void on_connect(LodpSession& session,
+                  const int status) override;
+  void on_recv(LodpSession& session,
+               const void* buf,
+               const size_t buf_len) override;
+  void on_rekey_needed(LodpSession& session) override;
+  void on_rekey(LodpSession& session,
+                const int status) override;
+  void on_close(const LodpSession& session) override;
+  /** @} */
+
+  crypto::Random& rng_;           /**< The crypto::Random instance */
+  const ReplayConfig config_;     /**< The options */
+  PacketTraceReader& reader_;     /**< The trace */
+  /** The responder's private key */
+  ::std::unique_ptr<crypto::Curve25519::PrivateKey> private_key_;
+
+  /** @{ */
+  ::std::unordered_map<uint64_t, Peer> peers_; /**< addr_hash_ to Peer */
+  uint64_t trace_rx_;             /**< Received packets in the trace */
+  uint64_t trace_tx_;             /**< Transmitted packets in the trace */
+  uint64_t trace_span_;           /**< First to last packet (ns) */
+  /** @} */
+
+  /** @{ */
+  uint64_t rx_packets_;           /**< Packets replayed */
+  uint64_t rx_bytes_;             /**< Bytes replayed */
+  uint64_t tx_packets_;           /**< Packets the responder sent */
+  uint64_t tx_bytes_;             /**< Bytes the responder sent */
+  uint64_t busy_ns_;              /**< Time spent in on_packet() */
+  uint64_t elapsed_ns_;           /**< Wall clock time of the run */
+  ::std::map<int, uint64_t> results_; /**< on_packet() return codes */
+  LatencyHistogram latency_;      /**< on_packet() latency (ns) */
+  LodpEndpoint::Stats stats_;     /**< The last loop's responder Stats */
+  /** The responder's LodpSessions */
+  ::std::unordered_set<LodpSession*> sessions_;
+  /** @} */
+};
+
+Replayer::Replayer(crypto::Random& rng,
+                   const ReplayConfig& config,
+                   PacketTraceReader& reader) :
+    rng_(rng),
+    config_(config),
+    reader_(reader),
+    trace_rx_(0),
+    trace_tx_(0),
+    trace_span_(0),
+    rx_packets_(0),
+    rx_bytes_(0),
+    tx_packets_(0),
+    tx_bytes_(0),
+    busy_ns_(0),
+    elapsed_ns_(0),
+    stats_() {
+  SL_ASSERT(config_.loops_ > 0);
+}
+
+bool Replayer::init() {
+  if (config_.private_key_.empty()) {
+    ::std::fprintf(stderr, "No responder key, every packet will fail to "
+                   "decrypt\n");
+    private_key_.reset(new crypto::Curve25519::PrivateKey(rng_));
+  } else {
+    private_key_.reset(new crypto::Curve25519::PrivateKey(
+        reinterpret_cast<const uint8_t*>(config_.private_key_.data()),
+        config_.private_key_.size()));
+  }
+
+  // Hand out 10.0.0.1 and fd00::1 upwards, in order of appearance
+  const PacketTrace::Record* record;
+  const uint8_t* pkt;
+  uint64_t first = 0, last = 0;
+  uint32_t nr_v4 = 0, nr_v6 = 0;
+  reader_.rewind();
+  while (reader_.next(record, pkt)) {
+    if (trace_rx_ + trace_tx_ == 0)
+      first = record->timestamp_;
+    last = record->timestamp_;
+    if (record->direction_ != PacketTrace::kDirRx) {
+      trace_tx_++;
+      continue;
+    }
+    trace_rx_++;
+    if (peers_.find(record->addr_hash_) != peers_.end())
+      continue;
+
+    Peer& peer = peers_[record->addr_hash_];
+    ::std::memset(&peer.addr_, 0, sizeof(peer.addr_));
+    if (record->family_ == 6) {
+      auto v6 = reinterpret_cast<struct sockaddr_in6*>(&peer.addr_);
+      const uint32_t n = htonl(++nr_v6);
+      v6->sin6_family = AF_INET6;
+      v6->sin6_port = htons(2323);
+      v6->sin6_addr.s6_addr[0] = 0xfd;
+      ::std::memcpy(&v6->sin6_addr.s6_addr[12], &n, sizeof(n));
+      peer.addr_len_ = sizeof(*v6);
+    } else {
+      auto v4 = reinterpret_cast<struct sockaddr_in*>(&peer.addr_);
+      v4->sin_family = AF_INET;
+      v4->sin_port = htons(2323);
+      v4->sin_addr.s_addr = htonl(0x0a000000 | (++nr_v4 & 0xffffff));
+      peer.addr_len_ = sizeof(*v4);
+    }
+  }
+  trace_span_ = last - first;
+
+  if (trace_rx_ == 0) {
+    ::std::fprintf(stderr, "The trace has no received packets\n");
+    return false;
+  }
+
+  return true;
+}
+
+void Replayer::run() {
+  const uint8_t* node_id =
+      reinterpret_cast<const uint8_t*>(config_.node_id_.data());
+  const size_t node_id_len = config_.node_id_.size();
+
+  const SteadyClock::time_point start = SteadyClock::now();
+  for (unsigned i = 0; i < config_.loops_; i++) {
+    LodpEndpoint endpoint(rng_, *this, nullptr, false, *private_key_, node_id,
+                          node_id_len);
+    replay(endpoint);
+
+    // Nothing in a trace should establish a session, but just in case
+    ::std::vector<LodpSession*> sessions(sessions_.begin(), sessions_.end());
+    for (auto session : sessions)
+      session->close(false);
+    stats_ = endpoint.stats();
+  }
+  elapsed_ns_ = to_ns(SteadyClock::now() - start);
+}
+
+void Replayer::replay(LodpEndpoint& endpoint) {
+  const PacketTrace::Record* record;
+  const uint8_t* pkt;
+  bool first = true;
+  uint64_t first_ts = 0;
+  SteadyClock::time_point start;
+
+  reader_.rewind();
+  while (reader_.next(record, pkt)) {
+    if (record->direction_ != PacketTrace::kDirRx)
+      continue;
+
+    if (first) {
+      first = false;
+      first_ts = record->timestamp_;
+      start = SteadyClock::now();
+    } else if (config_.paced_) {
+      ::std::this_thread::sleep_until(start + ::std::chrono::nanoseconds(
+          record->timestamp_ - first_ts));
+    }
+
+    const Peer& peer = peers_[record->addr_hash_];
+    const SteadyClock::time_point t0 = SteadyClock::now();
+    const int ret = endpoint.on_packet(pkt, record->length_,
+        reinterpret_cast<const struct sockaddr*>(&peer.addr_),
+        peer.addr_len_);
+    const uint64_t ns = to_ns(SteadyClock::now() - t0);
+
+    latency_.record(ns);
+    busy_ns_ += ns;
+    results_[ret]++;
+    rx_packets_++;
+    rx_bytes_ += record->length_;
+  }
+}
+
+void Replayer::report() const {
+  const double elapsed = elapsed_ns_ / 1e9;
+  const double busy = busy_ns_ / 1e9;
+
+  ::std::printf("Trace: %lu rx %lu tx packets over %.3f s, %zu peers%s\n",
+                static_cast<unsigned long>(trace_rx_),
+                static_cast<unsigned long>(trace_tx_), trace_span_ / 1e9,
+                peers_.size(), reader_.truncated() ? " (truncated)" : "");
+  ::std::printf("Replay: %u loop(s), %.3f s%s\n", config_.loops_, elapsed,
+                config_.paced_ ? " (paced)" : "");
+  ::std::printf("  rx %lu packets %lu bytes (%.1f pkts/s, %.3f Mbit/s in "
+                "on_packet)\n",
+                static_cast<unsigned long>(rx_packets_),
+                static_cast<unsigned long>(rx_bytes_),
+                busy > 0 ? rx_packets_ / busy : 0.0,
+                busy > 0 ? rx_bytes_ * 8 / busy / 1e6 : 0.0);
+  ::std::printf("  tx %lu packets %lu bytes (discarded)\n",
+                static_cast<unsigned long>(tx_packets_),
+                static_cast<unsigned long>(tx_bytes_));
+
+  const LatencyHistogram& h = latency_;
+  ::std::printf("Latency:\n");
+  ::std::printf("  %-12s min %.3f p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f "
+                "max %.3f (us)\n", "on_packet", h.min() / 1e3,
+                h.value_at_percentile(50.0) / 1e3,
+                h.value_at_percentile(90.0) / 1e3,
+                h.value_at_percentile(99.0) / 1e3,
+                h.value_at_percentile(99.9) / 1e3, h.max() / 1e3);
+
+  ::std::printf("Results:\n");
+  for (auto& r : results_) {
+    const char* s = lodp_error_name(r.first);
+    if (s != nullptr)
+      ::std::printf("  %-18s %lu\n", s, static_cast<unsigned long>(r.second));
+    else
+      ::std::printf("  %-18d %lu\n", r.first,
+                    static_cast<unsigned long>(r.second));
+  }
+
+  const LodpEndpoint::Stats& s = stats_;
+  ::std::printf("Responder (last loop):\n");
+  ::std::printf("  rx undersized %lu oversized %lu over mtu %lu decrypt "
+                "failed %lu invalid envelope %lu bad format %lu\n",
+                static_cast<unsigned long>(s.rx_undersized_),
+                static_cast<unsigned long>(s.rx_oversized_),
+                static_cast<unsigned long>(s.rx_over_mtu_),
+                static_cast<unsigned long>(s.rx_decrypt_failed_),
+                static_cast<unsigned long>(s.rx_invalid_envelope_),
+                static_cast<unsigned long>(s.rx_bad_packet_format_));
+  ::std::printf("  rx init replays %lu invalid cookies %lu cookie replays "
+                "%lu handshake failed %lu\n",
+                static_cast<unsigned long>(s.rx_init_replays_),
+                static_cast<unsigned long>(s.rx_invalid_cookie_),
+                static_cast<unsigned long>(s.rx_cookie_replays_),
+                static_cast<unsigned long>(s.rx_handshake_failed_));
+  ::std::printf("  sessions accepted %lu closed %lu\n",
+                static_cast<unsigned long>(s.sessions_accepted_),
+                static_cast<unsigned long>(s.sessions_closed_));
+}
+
+int Replayer::sendto(LodpEndpoint& endpoint,
+                     const void* buf,
+                     const size_t buf_len,
+                     const struct sockaddr* addr,
+                     const socklen_t addr_len) {
+  tx_packets_++;
+  tx_bytes_ += buf_len;
+  return kErrorOk;
+}
+
+size_t Replayer::pad_size(const LodpSession& session,
+                          const size_t available) {
+  return 0;
+}
+
+bool Replayer::should_accept(const LodpEndpoint& endpoint,
+                             const struct sockaddr* addr,
+                             const socklen_t addr_len) {
+  return true;
+}
+
+void Replayer::on_accept(LodpEndpoint& endpoint,
+                         LodpSession* session,
+                         const struct sockaddr* addr,
+                         const socklen_t addr_len) {
+  sessions_.insert(session);
+}
+
+void Replayer::on_connect(LodpSession& session,
+                          const int status) {
+  // Never the initiator
+}
+
+void Replayer::on_recv(LodpSession& session,
+                       const void* buf,
+                       const size_t buf_len) {
+  // Nothing to do
+}
+
+void Replayer::on_rekey_needed(LodpSession& session) {
+  // Never the initiator
+}
+
+void Replayer::on_rekey(LodpSession& session,
+                        const int status) {
+  // Never the initiator
+}
+
+void Replayer::on_close(const LodpSession& session) {
+  sessions_.erase(const_cast<LodpSession*>(&session));
+}
+
+bool parse_key(const char* str,
+               ::std::string& key) {
+  const size_t len = ::std::strlen(str);
+  if (len != crypto::Curve25519::PrivateKey::kKeyLength * 2)
+    return false;
+
+  key.clear();
+  for (size_t i = 0; i < len; i += 2) {
+    char hex[3] = { str[i], str[i + 1], '\0' };
+    char* end;
+    const unsigned long b = ::std::strtoul(hex, &end, 16);
+    if (*end != '\0')
+      return false;
+    key.push_back(static_cast<char>(b));
+  }
+
+  return true;
+}
+
+void usage(const char* argv0) {
+  ::std::fprintf(stderr,
+      "Usage: %s [OPTIONS] TRACE\n"
+      "\n"
+      "  -k, --key HEX               Responder private key (Random)\n"
+      "  -n, --node-id STRING        Responder node ID (%s)\n"
+      "  -l, --loops N               Passes over the trace (1)\n"
+      "  -p, --paced                 Replay at the captured pacing\n",
+      argv0, kDefaultNodeId);
+}
+
+} // namespace
+
+} // namespace lodp
+} // namespace schwanenlied
+
+int main(int argc, char* argv[]) {
+  using namespace ::schwanenlied;
+  using namespace ::schwanenlied::lodp;
+
+  static const struct option options[] = {
+    { "key", required_argument, nullptr, 'k' },
+    { "node-id", required_argument, nullptr, 'n' },
+    { "loops", required_argument, nullptr, 'l' },
+    { "paced", no_argument, nullptr, 'p' },
+    { "help", no_argument, nullptr, 'h' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  ReplayConfig config;
+  bool valid = true;
+  int opt;
+  while ((opt = ::getopt_long(argc, argv, "k:n:l:ph", options,
+                              nullptr)) != -1) {
+    switch (opt) {
+    case 'k':
+      valid = parse_key(optarg, config.private_key_);
+      break;
+    case 'n':
+      config.node_id_ = optarg;
+      valid = !config.node_id_.empty();
+      break;
+    case 'l':
+      config.loops_ = ::std::strtoul(optarg, nullptr, 10);
+      valid = config.loops_ > 0;
+      break;
+    case 'p':
+      config.paced_ = true;
+      break;
+    default:
+      valid = false;
+    }
+    if (!valid) {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  config.path_ = argv[optind];
+
+  PacketTraceReader reader;
+  const int ret = reader.open(config.path_.c_str());
+  if (ret != kErrorOk) {
+    ::std::fprintf(stderr, "Failed to open %s: %s\n", config.path_.c_str(),
+                   ret == kErrorInval ? "Not a trace" : "I/O error");
+    return 1;
+  }
+
+  crypto::Random rng;
+  Replayer replayer(rng, config, reader);
+  if (!replayer.init())
+    return 1;
+  replayer.run();
+  replayer.report();
+
+  return 0;
+}